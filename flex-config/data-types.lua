@@ -26,6 +26,11 @@ local highways = osm2pgsql.define_way_table('highways', {
     -- valid text representation for that type, see below.
     { column = 'nodes',    sql_type = 'int8[]' },
     { column = 'geom',     type = 'linestring' },
+
+    -- Type "row_hash" is filled by osm2pgsql with a hash of the content of
+    -- the row. When updating, rows whose content didn't change are then not
+    -- deleted and inserted again and the tiles they are in are not expired.
+    { column = 'hash',     type = 'row_hash' },
 })
 
 -- Helper function to remove some of the tags we usually are not interested in.
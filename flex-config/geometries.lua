@@ -31,6 +31,14 @@ tables.polygons = osm2pgsql.define_area_table('polygons', {
     -- projections are currently not supported.
     { column = 'area', type = 'area' },
 })
+-- Large tables can be split into partitions by adding the table options
+-- "partition_by = 'geom'" (and optionally "partitions = 16"). Each partition
+-- then contains the objects from a compact area and clustering and indexing
+-- is done for all partitions in parallel. For an extract set the option
+-- "partition_extent = { min_lon, min_lat, max_lon, max_lat }" to its bounding
+-- box, so that the data is spread evenly over the partitions. With
+-- "partition_by = 'type'" a table with ids of type 'any' is split by OSM
+-- object type instead.
 
 tables.boundaries = osm2pgsql.define_relation_table('boundaries', {
     { column = 'type', type = 'text' },
@@ -77,6 +77,12 @@ end
 -- Called for every node in the input. The `object` argument contains all the
 -- attributes of the node like `id`, `version`, etc. as well as all tags as a
 -- Lua table (`object.tags`).
+--
+-- Instead of process_node() you can define process_node_batch(objects) which
+-- is called with an array of up to 1000 nodes at a time. This saves some
+-- overhead for calling into Lua. In that function add_row() needs the object
+-- the row is for as additional parameter: `table:add_row(row, object)`. The
+-- same is available for ways and relations.
 function osm2pgsql.process_node(object)
     --  Uncomment next line to look at the object data:
     --  print(inspect(object))
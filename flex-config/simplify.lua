@@ -0,0 +1,67 @@
+-- This config example file is released into the Public Domain.
+
+-- This config shows how to create tables with simplified geometries for
+-- rendering at low zoom levels. Look at and understand "geometries.lua"
+-- first, before looking at this file.
+--
+-- Rendering at low zoom levels is much faster if the geometries have been
+-- simplified beforehand. Each table gets geometries simplified for one zoom
+-- level, here zoom level 6.
+
+local tables = {}
+
+tables.roads_z6 = osm2pgsql.define_way_table('roads_z6', {
+    { column = 'type', type = 'text' },
+    { column = 'geom', type = 'linestring' },
+})
+
+tables.water_z6 = osm2pgsql.define_area_table('water_z6', {
+    { column = 'name', type = 'text' },
+    { column = 'geom', type = 'geometry' },
+})
+
+-- Set "simplify" in a 'line' or 'area' geometry transformation to the
+-- tolerance in map units (meters in web mercator) used to simplify the
+-- geometry with the Douglas-Peucker algorithm. About the size of a pixel at
+-- the target zoom level is a good choice.
+local z6_tolerance = 2500
+
+local major_roads = {
+    motorway = true,
+    trunk = true,
+    primary = true,
+}
+
+function osm2pgsql.process_way(object)
+    local highway = object.tags.highway
+    if major_roads[highway] then
+        -- Lines that collapse into a single point after simplification
+        -- (like small closed ways) are not added to the table at all.
+        tables.roads_z6:add_row({
+            type = highway,
+            geom = { create = 'line', simplify = z6_tolerance }
+        })
+    end
+
+    if object.is_closed and object.tags.natural == 'water' then
+        -- Polygons that are too small to be visible after simplification
+        -- are not added to the table at all. Simplified polygons are not
+        -- checked for validity, rings can end up touching or crossing each
+        -- other. Use ST_MakeValid() when querying the table if you need
+        -- valid geometries.
+        tables.water_z6:add_row({
+            name = object.tags.name,
+            geom = { create = 'area', simplify = z6_tolerance }
+        })
+    end
+end
+
+function osm2pgsql.process_relation(object)
+    if object.tags.type == 'multipolygon' and object.tags.natural == 'water' then
+        tables.water_z6:add_row({
+            name = object.tags.name,
+            geom = { create = 'area', simplify = z6_tolerance }
+        })
+    end
+end
+
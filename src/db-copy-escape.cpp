@@ -0,0 +1,116 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "db-copy-escape.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool needs_escape(char c) noexcept
+{
+    return c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t';
+}
+
+/**
+ * Find the first character in [it, end) that needs escaping. Returns end
+ * if there is none. Most strings don't contain any such characters, so
+ * with SSE2 available 16 bytes are checked at a time.
+ */
+char const *find_special(char const *it, char const *end) noexcept
+{
+#ifdef __SSE2__
+    __m128i const quote = _mm_set1_epi8('"');
+    __m128i const backslash = _mm_set1_epi8('\\');
+    __m128i const newline = _mm_set1_epi8('\n');
+    __m128i const cr = _mm_set1_epi8('\r');
+    __m128i const tab = _mm_set1_epi8('\t');
+
+    while (end - it >= 16) {
+        __m128i const chunk =
+            _mm_loadu_si128(reinterpret_cast<__m128i const *>(it));
+        __m128i const match = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                         _mm_cmpeq_epi8(chunk, backslash)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, newline),
+                                      _mm_cmpeq_epi8(chunk, cr)),
+                         _mm_cmpeq_epi8(chunk, tab)));
+        if (_mm_movemask_epi8(match) != 0) {
+            // There is a match in this chunk, find it below.
+            break;
+        }
+        it += 16;
+    }
+#endif
+
+    while (it != end && !needs_escape(*it)) {
+        ++it;
+    }
+
+    return it;
+}
+
+template <typename FUNC>
+void append_escaped(std::string *buffer, char const *str, std::size_t length,
+                    FUNC &&replacement)
+{
+    char const *const end = str + length;
+
+    while (true) {
+        char const *const special = find_special(str, end);
+        buffer->append(str, special);
+        if (special == end) {
+            return;
+        }
+        buffer->append(replacement(*special));
+        str = special + 1;
+    }
+}
+
+} // anonymous namespace
+
+void copy_escape_column(std::string *buffer, char const *str,
+                        std::size_t length)
+{
+    append_escaped(buffer, str, length, [](char c) {
+        switch (c) {
+        case '"':
+            return "\\\"";
+        case '\\':
+            return "\\\\";
+        case '\n':
+            return "\\n";
+        case '\r':
+            return "\\r";
+        default: // '\t'
+            return "\\t";
+        }
+    });
+}
+
+void copy_escape_quoted(std::string *buffer, char const *str,
+                        std::size_t length)
+{
+    append_escaped(buffer, str, length, [](char c) {
+        switch (c) {
+        case '"':
+            return "\\\\\"";
+        case '\\':
+            return "\\\\\\\\";
+        case '\n':
+            return "\\n";
+        case '\r':
+            return "\\r";
+        default: // '\t'
+            return "\\t";
+        }
+    });
+}
@@ -0,0 +1,40 @@
+#ifndef OSM2PGSQL_DB_COPY_ESCAPE_HPP
+#define OSM2PGSQL_DB_COPY_ESCAPE_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains the functions for escaping strings for the COPY text format.
+ */
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Append a string to the buffer escaped for use as a column value in the
+ * COPY text format.
+ */
+void copy_escape_column(std::string *buffer, char const *str,
+                        std::size_t length);
+
+/**
+ * Append a string to the buffer escaped for use inside a double quoted
+ * array element or hstore key or value in the COPY text format. This
+ * needs an additional level of escaping for the backslash and the double
+ * quote.
+ */
+void copy_escape_quoted(std::string *buffer, char const *str,
+                        std::size_t length);
+
+#endif // OSM2PGSQL_DB_COPY_ESCAPE_HPP
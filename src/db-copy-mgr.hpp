@@ -11,9 +11,14 @@
  */
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <string>
 
+#include "db-copy-escape.hpp"
 #include "db-copy.hpp"
 #include "util.hpp"
 
@@ -38,11 +43,12 @@ public:
     {
         if (!m_current || !m_current->target->same_copy_target(*table)) {
             if (m_current) {
-                m_processor->add_buffer(std::move(m_current));
+                send_current_buffer();
             }
 
             m_current = std::make_unique<db_cmd_copy_delete_t<DELETER>>(table);
         }
+        m_line_start = m_current->buffer.size();
     }
 
     /**
@@ -63,9 +69,68 @@ public:
         assert(buf.back() == '\t');
         buf.back() = '\n';
 
+        if (m_row_hash_pos != no_row_hash) {
+            fill_row_hash();
+        }
+
         if (m_current->is_full()) {
-            m_processor->add_buffer(std::move(m_current));
+            send_current_buffer();
+        }
+    }
+
+    /**
+     * Add a column with a hash of the content of the current row. The
+     * hash is calculated over the whole row (with a placeholder for the
+     * hash itself) when the row is finished with finish_line(). After that
+     * it is available from row_hash().
+     */
+    void add_row_hash_column()
+    {
+        assert(m_current);
+        m_row_hash_pos = m_current->buffer.size();
+        m_current->buffer.append(row_hash_digits, '0');
+        m_current->buffer += '\t';
+    }
+
+    /// The hash of the last row finished that had a row hash column.
+    std::int64_t row_hash() const noexcept { return m_row_hash; }
+
+    /**
+     * A position in the data added to the copy manager. See mark() and
+     * rollback().
+     */
+    struct mark_t
+    {
+        std::size_t generation;
+        std::size_t buffer_size;
+        std::size_t num_deletables;
+    };
+
+    /**
+     * Remember the current position in the data. Call this only between
+     * rows and after new_line() was called.
+     */
+    mark_t mark() const noexcept
+    {
+        assert(m_current);
+        return {m_generation, m_current->buffer.size(),
+                m_current->num_deletables()};
+    }
+
+    /**
+     * Remove all rows and deletes added after the mark was taken. This
+     * is only possible if that data hasn't been sent to the copy thread yet.
+     *
+     * \returns true if the data was removed, false if that wasn't possible.
+     */
+    bool rollback(mark_t const &mark)
+    {
+        if (!m_current || mark.generation != m_generation) {
+            return false;
         }
+
+        m_current->truncate(mark.buffer_size, mark.num_deletables);
+        return true;
     }
 
     /**
@@ -128,7 +193,13 @@ public:
         m_current->buffer += ',';
     }
 
-    void add_array_elem(std::string const &s) { add_array_elem(s.c_str()); }
+    void add_array_elem(std::string const &s)
+    {
+        assert(m_current);
+        m_current->buffer += '"';
+        add_escaped_string(s);
+        m_current->buffer += "\",";
+    }
 
     void add_array_elem(char const *s)
     {
@@ -172,7 +243,11 @@ public:
 
     void add_hash_elem(std::string const &k, std::string const &v)
     {
-        add_hash_elem(k.c_str(), v.c_str());
+        m_current->buffer += '"';
+        add_escaped_string(k);
+        m_current->buffer += "\"=>\"";
+        add_escaped_string(v);
+        m_current->buffer += "\",";
     }
 
     /**
@@ -258,6 +333,17 @@ public:
         m_current->buffer += '\t';
     }
 
+    /**
+     * Add a bytea column with the given binary data. The data is written
+     * in the hex format for bytea values.
+     */
+    void add_bytea_column(std::string const &data)
+    {
+        // The backslash has to be escaped in the COPY format.
+        m_current->buffer += "\\\\x";
+        add_hex_geom(data);
+    }
+
     /**
      * Mark an OSM object for deletion in the current table.
      *
@@ -280,13 +366,52 @@ public:
     {
         // finish any ongoing copy operations
         if (m_current) {
-            m_processor->add_buffer(std::move(m_current));
+            send_current_buffer();
         }
 
         m_processor->sync_and_wait();
     }
 
 private:
+    /// Number of decimal digits needed for a positive 64 bit integer.
+    static constexpr std::size_t const row_hash_digits = 19;
+
+    static constexpr std::size_t const no_row_hash =
+        std::numeric_limits<std::size_t>::max();
+
+    void send_current_buffer()
+    {
+        m_processor->add_buffer(std::move(m_current));
+        ++m_generation;
+    }
+
+    /**
+     * Calculate the hash (64 bit FNV-1a) of the current row and write it
+     * into the placeholder added by add_row_hash_column().
+     */
+    void fill_row_hash()
+    {
+        auto &buf = m_current->buffer;
+        assert(m_row_hash_pos + row_hash_digits < buf.size());
+
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (std::size_t i = m_line_start; i < buf.size(); ++i) {
+            hash ^= static_cast<unsigned char>(buf[i]);
+            hash *= 1099511628211ULL;
+        }
+
+        // Only use 63 bits so that the hash fits into a PostgreSQL int8.
+        hash &= 0x7fffffffffffffffULL;
+        m_row_hash = static_cast<std::int64_t>(hash);
+
+        for (std::size_t i = row_hash_digits; i > 0; --i) {
+            buf[m_row_hash_pos + i - 1] = static_cast<char>('0' + hash % 10);
+            hash /= 10;
+        }
+
+        m_row_hash_pos = no_row_hash;
+    }
+
     template <typename T>
     void add_value(T value)
     {
@@ -299,62 +424,41 @@ private:
         m_current->buffer += tmp.c_str();
     }
 
-    void add_value(std::string const &s) { add_value(s.c_str()); }
+    void add_value(std::string const &s)
+    {
+        assert(m_current);
+        copy_escape_column(&m_current->buffer, s.data(), s.size());
+    }
 
     void add_value(char const *s)
     {
         assert(m_current);
-        for (char const *c = s; *c; ++c) {
-            switch (*c) {
-            case '"':
-                m_current->buffer += "\\\"";
-                break;
-            case '\\':
-                m_current->buffer += "\\\\";
-                break;
-            case '\n':
-                m_current->buffer += "\\n";
-                break;
-            case '\r':
-                m_current->buffer += "\\r";
-                break;
-            case '\t':
-                m_current->buffer += "\\t";
-                break;
-            default:
-                m_current->buffer += *c;
-                break;
-            }
-        }
+        copy_escape_column(&m_current->buffer, s, std::strlen(s));
+    }
+
+    void add_escaped_string(std::string const &s)
+    {
+        copy_escape_quoted(&m_current->buffer, s.data(), s.size());
     }
 
     void add_escaped_string(char const *s)
     {
-        for (char const *c = s; *c; ++c) {
-            switch (*c) {
-            case '"':
-                m_current->buffer += "\\\\\"";
-                break;
-            case '\\':
-                m_current->buffer += "\\\\\\\\";
-                break;
-            case '\n':
-                m_current->buffer += "\\n";
-                break;
-            case '\r':
-                m_current->buffer += "\\r";
-                break;
-            case '\t':
-                m_current->buffer += "\\t";
-                break;
-            default:
-                m_current->buffer += *c;
-                break;
-            }
-        }
+        copy_escape_quoted(&m_current->buffer, s, std::strlen(s));
     }
 
     std::shared_ptr<db_copy_thread_t> m_processor;
+
+    /// Position of the start of the current row in the buffer.
+    std::size_t m_line_start = 0;
+
+    /// Position of the row hash placeholder in the current row.
+    std::size_t m_row_hash_pos = no_row_hash;
+
+    std::int64_t m_row_hash = 0;
+
+    /// Incremented every time a buffer is sent to the copy thread.
+    std::size_t m_generation = 0;
+
     std::unique_ptr<db_cmd_copy_delete_t<DELETER>> m_current;
 };
 
@@ -7,11 +7,14 @@
  * For a full list of authors see the git log.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 
 #include "db-copy.hpp"
 #include "format.hpp"
 #include "logging.hpp"
+#include "metrics.hpp"
 #include "pgsql.hpp"
 
 void db_deleter_by_id_t::delete_rows(std::string const &table,
@@ -79,14 +82,58 @@ void db_deleter_by_type_and_id_t::delete_rows(std::string const &table,
     conn->exec(sql.data());
 }
 
+/// Memory used by the buffer of a command.
+static std::size_t command_memory(db_cmd_t const &cmd) noexcept
+{
+    if (cmd.type != db_cmd_t::Cmd_copy) {
+        return 0;
+    }
+    return static_cast<db_cmd_copy_t const &>(cmd).buffer.capacity();
+}
+
+/// Smallest size of a copy buffer used with a memory limit.
+static constexpr std::size_t const min_copy_buffer_size = 1024UL * 1024UL;
+
+std::size_t db_cmd_copy_t::buffer_size() noexcept
+{
+    // With a memory limit, each copy queue may use up to 1/32 of it. Make
+    // the buffers small enough that a full queue fits in there.
+    auto const limit = get_memory_tracker().limit();
+    if (limit == 0) {
+        return Max_buf_size;
+    }
+    return std::max(min_copy_buffer_size,
+                    std::min(std::size_t{Max_buf_size},
+                             limit / 32 / Max_buffers));
+}
+
 db_copy_thread_t::db_copy_thread_t(std::string const &conninfo)
 {
+    // With a memory limit, each copy queue may use up to 1/32 of it.
+    auto const limit = get_memory_tracker().limit();
+    if (limit > 0) {
+        m_shared.max_buffers = std::max(
+            std::size_t{1},
+            std::min(m_shared.max_buffers,
+                     limit / 32 / db_cmd_copy_t::buffer_size()));
+    }
+
+    static std::atomic<unsigned int> queue_count{0};
+    m_shared.queue_length = &get_metrics().gauge(
+        "osm2pgsql_copy_queue_length",
+        "Number of buffers waiting to be sent to the database.",
+        "queue=\"{}\""_format(queue_count++));
+
     // conninfo is captured by copy here, because we don't know wether the
     // reference will still be valid once we get around to running the thread
     m_worker = std::thread{thread_t{conninfo, m_shared}};
 }
 
-db_copy_thread_t::~db_copy_thread_t() { finish(); }
+db_copy_thread_t::~db_copy_thread_t()
+{
+    finish();
+    get_metrics().remove(m_shared.queue_length);
+}
 
 void db_copy_thread_t::add_buffer(std::unique_ptr<db_cmd_t> &&buffer)
 {
@@ -94,10 +141,14 @@ void db_copy_thread_t::add_buffer(std::unique_ptr<db_cmd_t> &&buffer)
 
     std::unique_lock<std::mutex> lock{m_shared.queue_mutex};
     m_shared.queue_full_cond.wait(lock, [&] {
-        return m_shared.worker_queue.size() < db_cmd_copy_t::Max_buffers;
+        return m_shared.worker_queue.size() < m_shared.max_buffers;
     });
 
+    m_shared.queued_bytes += command_memory(*buffer);
+    m_shared.memory.update(m_shared.queued_bytes);
+
     m_shared.worker_queue.push_back(std::move(buffer));
+    m_shared.queue_length->set(m_shared.worker_queue.size());
     m_shared.queue_cond.notify_one();
 }
 
@@ -143,6 +194,10 @@ void db_copy_thread_t::thread_t::operator()()
 
                 item = std::move(m_shared.worker_queue.front());
                 m_shared.worker_queue.pop_front();
+                m_shared.queue_length->set(m_shared.worker_queue.size());
+
+                m_shared.queued_bytes -= command_memory(*item);
+                m_shared.memory.update(m_shared.queued_bytes);
                 m_shared.queue_full_cond.notify_one();
             }
 
@@ -10,7 +10,9 @@
  * For a full list of authors see the git log.
  */
 
+#include <cassert>
 #include <condition_variable>
+#include <cstddef>
 #include <deque>
 #include <future>
 #include <memory>
@@ -20,9 +22,12 @@
 #include <utility>
 #include <vector>
 
+#include "memory-tracker.hpp"
 #include "osmtypes.hpp"
 #include "pgsql.hpp"
 
+class metric_t;
+
 /**
  * Table information necessary for building SQL queries.
  */
@@ -70,6 +75,14 @@ public:
 
     void add(osmid_t osm_id) { m_deletables.push_back(osm_id); }
 
+    std::size_t size() const noexcept { return m_deletables.size(); }
+
+    /// Remove all but the first num entries.
+    void truncate(std::size_t num)
+    {
+        m_deletables.erase(m_deletables.begin() + num, m_deletables.end());
+    }
+
     void delete_rows(std::string const &table, std::string const &column,
                      pg_conn_t *conn);
 
@@ -111,6 +124,14 @@ public:
         }
     }
 
+    std::size_t size() const noexcept { return m_deletables.size(); }
+
+    /// Remove all but the first num entries.
+    void truncate(std::size_t num)
+    {
+        m_deletables.erase(m_deletables.begin() + num, m_deletables.end());
+    }
+
     void delete_rows(std::string const &table, std::string const &column,
                      pg_conn_t *conn);
 
@@ -171,11 +192,21 @@ struct db_cmd_copy_t : public db_cmd_t
     virtual bool has_deletables() const noexcept = 0;
     virtual void delete_data(pg_conn_t *conn) = 0;
 
+    /**
+     * The size at which a buffer is considered full. This is Max_buf_size
+     * unless a memory limit is set, then smaller buffers are used so that
+     * the copy queues can still hold several of them.
+     */
+    std::size_t const max_buf_size;
+
     explicit db_cmd_copy_t(std::shared_ptr<db_target_descr_t> const &t)
-    : db_cmd_t(db_cmd_t::Cmd_copy), target(t)
+    : db_cmd_t(db_cmd_t::Cmd_copy), target(t), max_buf_size(buffer_size())
     {
-        buffer.reserve(Max_buf_size);
+        buffer.reserve(max_buf_size);
     }
+
+    /// Size of copy buffers with the current memory limit.
+    static std::size_t buffer_size() noexcept;
 };
 
 template <typename DELETER>
@@ -187,7 +218,7 @@ public:
     /// Return true if the buffer is filled up.
     bool is_full() const noexcept
     {
-        return (buffer.size() > Max_buf_size - 100) || m_deleter.is_full();
+        return (buffer.size() > max_buf_size - 100) || m_deleter.is_full();
     }
 
     bool has_deletables() const noexcept override
@@ -209,6 +240,19 @@ public:
         m_deleter.add(std::forward<ARGS>(args)...);
     }
 
+    std::size_t num_deletables() const noexcept { return m_deleter.size(); }
+
+    /**
+     * Remove everything added after the buffer had the specified size
+     * and the specified number of deletables.
+     */
+    void truncate(std::size_t buffer_size, std::size_t num_deletables)
+    {
+        assert(buffer_size <= buffer.size());
+        buffer.resize(buffer_size);
+        m_deleter.truncate(num_deletables);
+    }
+
 private:
     /// Deleter class for old items
     DELETER m_deleter;
@@ -269,6 +313,21 @@ private:
         std::condition_variable queue_cond;
         std::condition_variable queue_full_cond;
         std::deque<std::unique_ptr<db_cmd_t>> worker_queue;
+
+        /**
+         * Maximum length of the queue. This is db_cmd_copy_t::Max_buffers
+         * unless a memory limit is set.
+         */
+        std::size_t max_buffers = db_cmd_copy_t::Max_buffers;
+
+        /// Bytes used by the buffers in the queue.
+        std::size_t queued_bytes = 0;
+
+        /// Memory used by the queue (updated under the queue_mutex).
+        tracked_memory_t memory{"database copy queues"};
+
+        /// Metric for the length of the queue (updated under the queue_mutex).
+        metric_t *queue_length = nullptr;
     };
 
     // This is the class that actually instantiated and run in the thread.
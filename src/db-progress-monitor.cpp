@@ -0,0 +1,184 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "db-progress-monitor.hpp"
+#include "format.hpp"
+#include "logging.hpp"
+#include "pgsql.hpp"
+#include "util.hpp"
+
+#include <cstdlib>
+#include <exception>
+#include <utility>
+
+namespace {
+
+// Progress of CREATE INDEX and CLUSTER commands. For index builds the
+// progress is reported in blocks if available (while scanning the table)
+// and in tuples otherwise (while loading tuples into the index).
+constexpr char const *const progress_views_sql =
+    "SELECT pid, relid, command, phase,"
+    " CASE WHEN blocks_total > 0 THEN blocks_done ELSE tuples_done END"
+    " AS done,"
+    " CASE WHEN blocks_total > 0 THEN blocks_total ELSE tuples_total END"
+    " AS total,"
+    " CASE WHEN blocks_total > 0 THEN 'blocks' ELSE 'tuples' END AS unit"
+    " FROM pg_stat_progress_create_index"
+    " UNION ALL "
+    "SELECT pid, relid, command, phase, heap_blks_scanned, heap_blks_total,"
+    " 'blocks' FROM pg_stat_progress_cluster";
+
+std::string build_activity_sql(bool with_progress_views)
+{
+    std::string sql{
+        "SELECT a.pid, coalesce(a.wait_event_type, ''),"
+        " coalesce(a.wait_event, ''),"
+        " coalesce(extract(epoch FROM now() - a.query_start)::int8, 0),"
+        " left(regexp_replace(a.query, '\\s+', ' ', 'g'), 80),"};
+
+    if (with_progress_views) {
+        sql += " coalesce(c.relname, ''), p.command, p.phase, p.done,"
+               " p.total, p.unit"
+               " FROM pg_stat_activity a"
+               " LEFT JOIN ({}) p ON p.pid = a.pid"
+               " LEFT JOIN pg_class c ON c.oid = p.relid"_format(
+                   progress_views_sql);
+    } else {
+        sql += " '', NULL, NULL, NULL, NULL, NULL FROM pg_stat_activity a";
+    }
+
+    sql += " WHERE a.datname = current_database() AND a.state = 'active'"
+           " AND a.pid <> pg_backend_pid()"
+           " AND a.application_name = current_setting('application_name')"
+           " ORDER BY a.query_start";
+
+    return sql;
+}
+
+uint64_t to_uint(char const *str) noexcept
+{
+    return std::strtoull(str, nullptr, 10);
+}
+
+} // anonymous namespace
+
+double estimate_remaining_seconds(uint64_t start_done, uint64_t done,
+                                  uint64_t total,
+                                  std::chrono::duration<double> elapsed) noexcept
+{
+    if (done <= start_done || done > total || elapsed.count() <= 0.0) {
+        return -1.0;
+    }
+
+    double const rate =
+        static_cast<double>(done - start_done) / elapsed.count();
+    return static_cast<double>(total - done) / rate;
+}
+
+db_progress_monitor_t::db_progress_monitor_t(std::string conninfo,
+                                             std::chrono::seconds interval)
+: m_conninfo(std::move(conninfo)), m_interval(interval)
+{
+    m_thread = std::thread{[this]() { run(); }};
+}
+
+db_progress_monitor_t::~db_progress_monitor_t() noexcept
+{
+    {
+        std::lock_guard<std::mutex> const guard{m_mutex};
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+void db_progress_monitor_t::run()
+{
+    try {
+        pg_conn_t const conn{m_conninfo};
+
+        // The progress views are available from PostgreSQL 12.
+        auto const res = conn.query(
+            PGRES_TUPLES_OK, "SELECT current_setting('server_version_num')");
+        bool const with_progress_views =
+            res.num_tuples() == 1 && to_uint(res.get_value(0, 0)) >= 120000;
+
+        std::unique_lock<std::mutex> lock{m_mutex};
+        while (!m_cond.wait_for(lock, m_interval, [&]() { return m_stop; })) {
+            lock.unlock();
+            report(conn, with_progress_views);
+            lock.lock();
+        }
+    } catch (std::exception const &e) {
+        log_warn("Monitoring database progress failed: {}", e.what());
+    }
+}
+
+void db_progress_monitor_t::report(pg_conn_t const &conn,
+                                   bool with_progress_views)
+{
+    auto const res =
+        conn.query(PGRES_TUPLES_OK, build_activity_sql(with_progress_views));
+    auto const now = std::chrono::steady_clock::now();
+
+    std::map<std::string, phase_start_t> phases;
+    for (int i = 0; i < res.num_tuples(); ++i) {
+        auto const pid = res.get_value_as_string(i, 0);
+        std::string const wait_event_type = res.get_value(i, 1);
+        std::string const wait_event = res.get_value(i, 2);
+        auto const duration = to_uint(res.get_value(i, 3));
+
+        std::string lock_info;
+        if (wait_event_type == "Lock") {
+            lock_info = " Waiting for lock ({})!"_format(wait_event);
+        }
+
+        if (res.is_null(i, 6)) {
+            log_info("Database progress: Running for {}: {}{}",
+                     util::human_readable_duration(duration),
+                     res.get_value(i, 4), lock_info);
+            continue;
+        }
+
+        std::string const phase = res.get_value(i, 7);
+        auto const done = to_uint(res.get_value(i, 8));
+        auto const total = to_uint(res.get_value(i, 9));
+
+        auto it = m_phases.find(pid);
+        if (it == m_phases.end() || it->second.phase != phase) {
+            phases[pid] = phase_start_t{phase, done, now};
+        } else {
+            phases[pid] = it->second;
+        }
+        auto const &start = phases[pid];
+
+        std::string work;
+        if (total > 0) {
+            work = ", {:.1f}% of {} {} done"_format(
+                100.0 * static_cast<double>(done) /
+                    static_cast<double>(total),
+                total, res.get_value(i, 10));
+            auto const remaining = estimate_remaining_seconds(
+                start.done, done, total, now - start.time);
+            if (remaining >= 0.0) {
+                work += ", about {} left"_format(util::human_readable_duration(
+                    static_cast<uint64_t>(remaining)));
+            }
+        }
+
+        log_info("Database progress: {} on '{}' running for {}, phase '{}'{}."
+                 "{}",
+                 res.get_value(i, 6), res.get_value(i, 5),
+                 util::human_readable_duration(duration), phase, work,
+                 lock_info);
+    }
+
+    // Forget about commands that are finished.
+    m_phases = std::move(phases);
+}
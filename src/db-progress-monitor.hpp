@@ -0,0 +1,97 @@
+#ifndef OSM2PGSQL_DB_PROGRESS_MONITOR_HPP
+#define OSM2PGSQL_DB_PROGRESS_MONITOR_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains the class for reporting the progress of long-running database
+ * commands like index creation.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class pg_conn_t;
+
+/**
+ * Estimate the remaining time of a database command from its progress.
+ *
+ * \param start_done Units of work done when the command was first seen.
+ * \param done Units of work done now.
+ * \param total Total units of work.
+ * \param elapsed Time between the first and the current observation.
+ * \returns Estimated remaining time in seconds, negative if no estimate is
+ *          possible (yet).
+ */
+double estimate_remaining_seconds(uint64_t start_done, uint64_t done,
+                                  uint64_t total,
+                                  std::chrono::duration<double> elapsed) noexcept;
+
+/**
+ * Reports the progress of the database commands run by osm2pgsql while
+ * this object exists. A separate thread with its own database connection
+ * regularly polls pg_stat_progress_create_index and pg_stat_progress_cluster
+ * (PostgreSQL 12 and above) and pg_stat_activity and logs for each active
+ * command the table, phase, amount of work done, and an estimate of the
+ * remaining time. Commands waiting for a lock are logged as such.
+ *
+ * Problems with the monitoring connection are logged as warnings, they
+ * never stop the import.
+ */
+class db_progress_monitor_t
+{
+public:
+    db_progress_monitor_t(std::string conninfo, std::chrono::seconds interval);
+
+    db_progress_monitor_t(db_progress_monitor_t const &) = delete;
+    db_progress_monitor_t &operator=(db_progress_monitor_t const &) = delete;
+
+    db_progress_monitor_t(db_progress_monitor_t &&) = delete;
+    db_progress_monitor_t &operator=(db_progress_monitor_t &&) = delete;
+
+    ~db_progress_monitor_t() noexcept;
+
+private:
+    /// Work done by a command when its current phase was first seen.
+    struct phase_start_t
+    {
+        std::string phase;
+        uint64_t done = 0;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    void run();
+
+    void report(pg_conn_t const &conn, bool with_progress_views);
+
+    std::string m_conninfo;
+    std::chrono::seconds m_interval;
+
+    /// Start of the current phase by backend pid.
+    std::map<std::string, phase_start_t> m_phases;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+
+    std::thread m_thread;
+
+}; // class db_progress_monitor_t
+
+#endif // OSM2PGSQL_DB_PROGRESS_MONITOR_HPP
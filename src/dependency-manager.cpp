@@ -23,6 +23,8 @@ void full_dependency_manager_t::node_changed(osmid_t id)
     for (auto const rel_id : m_object_store->get_rels_by_node(id)) {
         m_rels_pending_tracker.set(rel_id);
     }
+
+    update_memory_usage();
 }
 
 void full_dependency_manager_t::way_changed(osmid_t id)
@@ -34,6 +36,14 @@ void full_dependency_manager_t::way_changed(osmid_t id)
     for (auto const rel_id : m_object_store->get_rels_by_way(id)) {
         m_rels_pending_tracker.set(rel_id);
     }
+
+    update_memory_usage();
+}
+
+void full_dependency_manager_t::update_memory_usage()
+{
+    m_memory.update(m_ways_pending_tracker.used_memory() +
+                    m_rels_pending_tracker.used_memory());
 }
 
 bool full_dependency_manager_t::has_pending() const noexcept
@@ -10,6 +10,7 @@
  * For a full list of authors see the git log.
  */
 
+#include "memory-tracker.hpp"
 #include "osmtypes.hpp"
 
 #include <osmium/index/id_set.hpp>
@@ -99,12 +100,16 @@ public:
 
     idlist_t get_pending_way_ids() override
     {
-        return get_ids(m_ways_pending_tracker);
+        auto ids = get_ids(m_ways_pending_tracker);
+        update_memory_usage();
+        return ids;
     }
 
     idlist_t get_pending_relation_ids() override
     {
-        return get_ids(m_rels_pending_tracker);
+        auto ids = get_ids(m_rels_pending_tracker);
+        update_memory_usage();
+        return ids;
     }
 
 private:
@@ -112,8 +117,13 @@ private:
 
     std::shared_ptr<middle_t> m_object_store;
 
+    void update_memory_usage();
+
     osmium::index::IdSetSmall<osmid_t> m_ways_pending_tracker;
     osmium::index::IdSetSmall<osmid_t> m_rels_pending_tracker;
+
+    /// Memory used by the pending trackers.
+    tracked_memory_t m_memory{"dependency manager"};
 };
 
 #endif // OSM2PGSQL_DEPENDENCY_MANAGER_HPP
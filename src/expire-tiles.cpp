@@ -15,11 +15,14 @@
  * http://subversion.nexusuk.org/projects/openpistemap/trunk/scripts/expire_tiles.py
  */
 
+#include <algorithm>
 #include <cerrno>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <tuple>
 
 #include "expire-tiles.hpp"
 #include "format.hpp"
@@ -61,10 +64,147 @@ void tile_output_t::output_dirty_tile(uint32_t x, uint32_t y, uint32_t zoom)
     fmt::print(outfile, "{}/{}/{}\n", zoom, x, y);
 }
 
-void expire_tiles::output_and_destroy(char const *filename, uint32_t minzoom)
+tile_output_binary_t::tile_output_binary_t(char const *filename,
+                                           uint32_t metatile_size)
+: m_filename(filename), m_metatile_size(metatile_size)
+{}
+
+tile_output_binary_t::~tile_output_binary_t()
+{
+    static constexpr char const magic[8] = {'O', '2', 'P', 'E',
+                                            'X', 'P', '0', '1'};
+
+    auto const runs = get_runs();
+
+    FILE *const outfile = std::fopen(m_filename.c_str(), "ab");
+    if (!outfile) {
+        log_warn("Failed to open expired tiles file ({}).  Tile expiry "
+                 "list will not be written!",
+                 std::strerror(errno));
+        return;
+    }
+
+    auto const num_runs = static_cast<uint32_t>(runs.size());
+    bool ok = std::fwrite(magic, sizeof(magic), 1, outfile) == 1 &&
+              std::fwrite(&m_metatile_size, sizeof(uint32_t), 1, outfile) ==
+                  1 &&
+              std::fwrite(&num_runs, sizeof(uint32_t), 1, outfile) == 1;
+
+    if (ok && !runs.empty()) {
+        ok = std::fwrite(runs.data(), sizeof(run_t), runs.size(), outfile) ==
+             runs.size();
+    }
+
+    if (std::fclose(outfile) != 0 || !ok) {
+        log_warn("Error writing expired tiles file '{}'.", m_filename);
+    }
+}
+
+void tile_output_binary_t::output_dirty_tile(uint32_t x, uint32_t y,
+                                             uint32_t zoom)
 {
-    tile_output_t output_writer(filename);
-    output_and_destroy<tile_output_t>(output_writer, minzoom);
+    m_tiles.push_back({zoom, x, y, 1});
+}
+
+std::vector<tile_output_binary_t::run_t> tile_output_binary_t::get_runs()
+{
+    std::sort(m_tiles.begin(), m_tiles.end(),
+              [](run_t const &a, run_t const &b) {
+                  return std::tie(a.zoom, a.y, a.x) <
+                         std::tie(b.zoom, b.y, b.x);
+              });
+
+    std::vector<run_t> runs;
+    for (auto const &tile : m_tiles) {
+        if (!runs.empty()) {
+            auto &run = runs.back();
+            if (run.zoom == tile.zoom && run.y == tile.y &&
+                run.x + run.count * m_metatile_size == tile.x) {
+                ++run.count;
+                continue;
+            }
+        }
+        runs.push_back(tile);
+    }
+
+    return runs;
+}
+
+void expire_tiles::output_and_destroy(options_t const &options)
+{
+    auto const *const filename = options.expire_tiles_filename.c_str();
+    auto const minzoom = options.expire_tiles_zoom_min;
+
+    if (options.expire_tiles_binary) {
+        tile_output_binary_t output_writer(
+            filename, options.expire_tiles_metatile_size);
+        output_and_destroy(output_writer, minzoom,
+                           options.expire_tiles_metatile_size,
+                           options.expire_tiles_collapse);
+    } else {
+        tile_output_t output_writer(filename);
+        output_and_destroy(output_writer, minzoom,
+                           options.expire_tiles_metatile_size,
+                           options.expire_tiles_collapse);
+    }
+}
+
+std::vector<std::vector<uint64_t>>
+expire_tiles::aggregate_and_destroy(uint32_t minzoom, uint32_t metatile_size,
+                                    bool collapse)
+{
+    assert(minzoom <= maxzoom);
+
+    std::vector<uint64_t> current(m_dirty_tiles.begin(), m_dirty_tiles.end());
+    m_dirty_tiles.clear();
+    std::sort(current.begin(), current.end());
+
+    std::vector<std::vector<uint64_t>> result(maxzoom + 1);
+
+    for (uint32_t zoom = maxzoom; zoom > minzoom; --zoom) {
+        std::vector<uint64_t> parents;
+
+        // Tiles with the same parent are next to each other in the sorted
+        // list. The four children of a tile differ only in the lowest two
+        // bits of the quadkey.
+        auto it = current.begin();
+        while (it != current.end()) {
+            uint64_t const parent = *it >> 2U;
+            auto const group_end =
+                std::find_if(it, current.end(), [parent](uint64_t quadkey) {
+                    return (quadkey >> 2U) != parent;
+                });
+
+            // With collapse a parent whose children are all expired stands
+            // for them, otherwise the children are written.
+            bool const full = collapse && (group_end - it == 4);
+            if (!full) {
+                result[zoom].insert(result[zoom].end(), it, group_end);
+            }
+            if (full || !collapse) {
+                parents.push_back(parent);
+            }
+            it = group_end;
+        }
+
+        current = std::move(parents);
+    }
+    result[minzoom] = std::move(current);
+
+    if (metatile_size > 1) {
+        // Clear the lower bits of x and y to get the top left tile of the
+        // metatile. Order is retained, so duplicates are neighbours.
+        uint64_t const mask =
+            ~(static_cast<uint64_t>(metatile_size) * metatile_size - 1U);
+        for (auto &tiles : result) {
+            for (auto &quadkey : tiles) {
+                quadkey &= mask;
+            }
+            tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+        }
+    }
+
+    return result;
 }
 
 expire_tiles::expire_tiles(uint32_t max, double bbox,
@@ -125,29 +265,26 @@ uint32_t expire_tiles::normalise_tile_x_coord(int x) const
     return static_cast<uint32_t>(x);
 }
 
-void expire_tiles::coords_to_tile(double lon, double lat, double *tilex,
-                                  double *tiley)
+osmium::geom::Coordinates
+expire_tiles::coords_to_tile(osmium::geom::Coordinates c)
 {
-    auto const c =
-        projection->target_to_tile(osmium::geom::Coordinates{lon, lat});
+    auto const t = projection->target_to_tile(c);
 
-    *tilex = map_width * (0.5 + c.x / EARTH_CIRCUMFERENCE);
-    *tiley = map_width * (0.5 - c.y / EARTH_CIRCUMFERENCE);
+    return osmium::geom::Coordinates{
+        map_width * (0.5 + t.x / EARTH_CIRCUMFERENCE),
+        map_width * (0.5 - t.y / EARTH_CIRCUMFERENCE)};
 }
 
 /*
  * Expire tiles that a line crosses
  */
-void expire_tiles::from_line(double lon_a, double lat_a, double lon_b,
-                             double lat_b)
+void expire_tiles::from_tile_line(osmium::geom::Coordinates a,
+                                  osmium::geom::Coordinates b)
 {
-    double tile_x_a = NAN;
-    double tile_y_a = NAN;
-    double tile_x_b = NAN;
-    double tile_y_b = NAN;
-
-    coords_to_tile(lon_a, lat_a, &tile_x_a, &tile_y_a);
-    coords_to_tile(lon_b, lat_b, &tile_x_b, &tile_y_b);
+    double tile_x_a = a.x;
+    double tile_y_a = a.y;
+    double tile_x_b = b.x;
+    double tile_y_b = b.y;
 
     if (tile_x_a > tile_x_b) {
         /* We always want the line to go from left to right - swap the ends if it doesn't */
@@ -237,14 +374,18 @@ int expire_tiles::from_bbox(double min_lon, double min_lat, double max_lon,
     }
 
     /* Convert the box's Mercator coordinates into tile coordinates */
-    double tmp_x = NAN;
-    double tmp_y = NAN;
-    coords_to_tile(min_lon, max_lat, &tmp_x, &tmp_y);
-    int min_tile_x = tmp_x - TILE_EXPIRY_LEEWAY;
-    int min_tile_y = tmp_y - TILE_EXPIRY_LEEWAY;
-    coords_to_tile(max_lon, min_lat, &tmp_x, &tmp_y);
-    int max_tile_x = tmp_x + TILE_EXPIRY_LEEWAY;
-    int max_tile_y = tmp_y + TILE_EXPIRY_LEEWAY;
+    from_tile_bbox(coords_to_tile(osmium::geom::Coordinates{min_lon, max_lat}),
+                   coords_to_tile(osmium::geom::Coordinates{max_lon, min_lat}));
+    return 0;
+}
+
+void expire_tiles::from_tile_bbox(osmium::geom::Coordinates min,
+                                  osmium::geom::Coordinates max)
+{
+    int min_tile_x = min.x - TILE_EXPIRY_LEEWAY;
+    int min_tile_y = min.y - TILE_EXPIRY_LEEWAY;
+    int max_tile_x = max.x + TILE_EXPIRY_LEEWAY;
+    int max_tile_y = max.y + TILE_EXPIRY_LEEWAY;
     if (min_tile_x < 0) {
         min_tile_x = 0;
     }
@@ -264,7 +405,36 @@ int expire_tiles::from_bbox(double min_lon, double min_lat, double max_lon,
             expire_tile(norm_x, static_cast<uint32_t>(iterator_y));
         }
     }
-    return 0;
+}
+
+void expire_tiles::from_point(osmium::geom::Coordinates c)
+{
+    if (maxzoom == 0) {
+        return;
+    }
+
+    auto const t = coords_to_tile(c);
+    from_tile_bbox(t, t);
+}
+
+void expire_tiles::from_line(geom::linestring_t const &line)
+{
+    if (maxzoom == 0 || line.empty()) {
+        return;
+    }
+
+    if (line.size() == 1) {
+        from_point(line[0]);
+        return;
+    }
+
+    // Each point is converted to tile coordinates only once.
+    auto prev = coords_to_tile(line[0]);
+    for (std::size_t i = 1; i < line.size(); ++i) {
+        auto const cur = coords_to_tile(line[i]);
+        from_tile_line(prev, cur);
+        prev = cur;
+    }
 }
 
 void expire_tiles::from_wkb(std::string const &wkb, osmid_t osm_id)
@@ -308,8 +478,7 @@ void expire_tiles::from_wkb(std::string const &wkb, osmid_t osm_id)
 
 void expire_tiles::from_wkb_point(ewkb::parser_t *wkb)
 {
-    auto const c = wkb->read_point();
-    from_bbox(c.x, c.y, c.x, c.y);
+    from_point(wkb->read_point());
 }
 
 void expire_tiles::from_wkb_line(ewkb::parser_t *wkb)
@@ -323,10 +492,10 @@ void expire_tiles::from_wkb_line(ewkb::parser_t *wkb)
     if (sz == 1) {
         from_wkb_point(wkb);
     } else {
-        auto prev = wkb->read_point();
+        auto prev = coords_to_tile(wkb->read_point());
         for (size_t i = 1; i < sz; ++i) {
-            auto const cur = wkb->read_point();
-            from_line(prev.x, prev.y, cur.x, cur.y);
+            auto const cur = coords_to_tile(wkb->read_point());
+            from_tile_line(prev, cur);
             prev = cur;
         }
     }
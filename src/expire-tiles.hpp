@@ -12,11 +12,14 @@
 
 #include <memory>
 #include <unordered_set>
+#include <vector>
 
+#include "geom.hpp"
 #include "logging.hpp"
 #include "osmtypes.hpp"
 #include "pgsql.hpp"
 
+class options_t;
 class reprojection;
 class table_t;
 class tile;
@@ -56,6 +59,50 @@ public:
     void output_dirty_tile(uint32_t x, uint32_t y, uint32_t zoom);
 };
 
+/**
+ * Output of the tile expiry list to a file in a compact binary format.
+ * Tiles are collected, sorted by zoom, y, and x and written as runs of
+ * neighbouring tiles in a row when this object is destroyed.
+ *
+ * The file consists of one or more blocks (one per run of osm2pgsql).
+ * Each block starts with the 8 byte magic "O2PEXP01", followed by the
+ * metatile size and the number of runs as 32 bit integers. Each run has
+ * four 32 bit integers: zoom, x, y of the first tile, and the number of
+ * tiles in the run. The x index of consecutive tiles in a run differs by
+ * the metatile size. All numbers are in native byte order.
+ */
+class tile_output_binary_t
+{
+public:
+    tile_output_binary_t(char const *filename, uint32_t metatile_size);
+
+    tile_output_binary_t(tile_output_binary_t const &) = delete;
+    tile_output_binary_t &operator=(tile_output_binary_t const &) = delete;
+
+    tile_output_binary_t(tile_output_binary_t &&) = delete;
+    tile_output_binary_t &operator=(tile_output_binary_t &&) = delete;
+
+    ~tile_output_binary_t();
+
+    void output_dirty_tile(uint32_t x, uint32_t y, uint32_t zoom);
+
+    struct run_t
+    {
+        uint32_t zoom;
+        uint32_t x;
+        uint32_t y;
+        uint32_t count;
+    };
+
+    /// Sort the tiles output so far and return them as runs.
+    std::vector<run_t> get_runs();
+
+private:
+    std::string m_filename;
+    std::vector<run_t> m_tiles;
+    uint32_t m_metatile_size;
+};
+
 struct expire_tiles
 {
     expire_tiles(uint32_t maxzoom, double maxbbox,
@@ -67,6 +114,18 @@ struct expire_tiles
                   double max_lat);
     void from_wkb(std::string const &wkb, osmid_t osm_id);
 
+    /**
+     * Expire tiles for a point in target coordinates.
+     */
+    void from_point(osmium::geom::Coordinates c);
+
+    /**
+     * Expire tiles along a line in target coordinates. This is used with
+     * the coordinates from the geometry builder, so the WKB doesn't have
+     * to be parsed again.
+     */
+    void from_line(geom::linestring_t const &line);
+
     /**
      * Expire tiles based on an osm id.
      *
@@ -80,15 +139,10 @@ struct expire_tiles
     int from_result(pg_result_t const &result, osmid_t osm_id);
 
     /**
-     * Write the list of expired tiles to a file.
-     *
-     * You will probably use tile_output_t as template argument for production code
-     * and another class which does not write to a file for unit tests.
-     *
-     * \param filename name of the file
-     * \param minzoom minimum zoom level
+     * Write the list of expired tiles to the file set in the options using
+     * the format, metatile size and minimum zoom level set there.
      */
-    void output_and_destroy(char const *filename, uint32_t minzoom);
+    void output_and_destroy(options_t const &options);
 
     /**
      * Output expired tiles on all requested zoom levels.
@@ -135,6 +189,46 @@ struct expire_tiles
         log_info("Wrote {} entries to expired tiles list", count);
     }
 
+    /**
+     * Output expired tiles on all requested zoom levels aggregated to
+     * metatiles. Each metatile is written once per zoom level using the
+     * x and y index of its top left tile.
+     *
+     * If collapse is set, only the coarsest tiles are written for which
+     * all tiles on the maximum zoom level below them have been expired.
+     * A tile in the output then stands for itself and all tiles below it
+     * down to the maximum zoom level. Its parent tiles down to the minimum
+     * zoom level are expired, too.
+     *
+     * \tparam TILE_WRITER see above
+     *
+     * \param minzoom minimum zoom level
+     * \param metatile_size size of metatiles (power of 2)
+     * \param collapse only write coarsest completely expired tiles
+     */
+    template <class TILE_WRITER>
+    void output_and_destroy(TILE_WRITER &output_writer, uint32_t minzoom,
+                            uint32_t metatile_size, bool collapse)
+    {
+        if (metatile_size <= 1 && !collapse) {
+            output_and_destroy(output_writer, minzoom);
+            return;
+        }
+
+        auto const tiles =
+            aggregate_and_destroy(minzoom, metatile_size, collapse);
+
+        std::size_t count = 0;
+        for (uint32_t zoom = minzoom; zoom <= maxzoom; ++zoom) {
+            for (auto const quadkey : tiles[zoom]) {
+                xy_coord_t const xy = quadkey_to_xy(quadkey, zoom);
+                output_writer.output_dirty_tile(xy.x, xy.y, zoom);
+                ++count;
+            }
+        }
+        log_info("Wrote {} entries to expired tiles list", count);
+    }
+
     /**
     * merge the list of expired tiles in the other object into this
     * object, destroying the list in the other object.
@@ -165,11 +259,19 @@ struct expire_tiles
     static xy_coord_t quadkey_to_xy(uint64_t quadkey, uint32_t zoom);
 
 private:
+    /**
+     * Get the quadkeys of the expired tiles for all zoom levels from minzoom
+     * to maxzoom aggregated to metatiles. The result is indexed by zoom
+     * level, the quadkeys for each zoom level are sorted and unique.
+     */
+    std::vector<std::vector<uint64_t>>
+    aggregate_and_destroy(uint32_t minzoom, uint32_t metatile_size,
+                          bool collapse);
 
     /**
      * Converts from target coordinates to tile coordinates.
      */
-    void coords_to_tile(double lon, double lat, double *tilex, double *tiley);
+    osmium::geom::Coordinates coords_to_tile(osmium::geom::Coordinates c);
 
     /**
      * Expire a single tile.
@@ -179,7 +281,14 @@ private:
      */
     void expire_tile(uint32_t x, uint32_t y);
     uint32_t normalise_tile_x_coord(int x) const;
-    void from_line(double lon_a, double lat_a, double lon_b, double lat_b);
+
+    /// Expire tiles that a line (in tile coordinates) crosses.
+    void from_tile_line(osmium::geom::Coordinates a,
+                        osmium::geom::Coordinates b);
+
+    /// Expire tiles within a bounding box (in tile coordinates).
+    void from_tile_bbox(osmium::geom::Coordinates min,
+                        osmium::geom::Coordinates max);
 
     void from_wkb_point(ewkb::parser_t *wkb);
     void from_wkb_line(ewkb::parser_t *wkb);
@@ -23,7 +23,7 @@ struct column_type_lookup
     table_column_type type;
 };
 
-static std::array<column_type_lookup, 25> const column_types = {
+static std::array<column_type_lookup, 27> const column_types = {
     {{"text", table_column_type::text},
      {"boolean", table_column_type::boolean},
      {"bool", table_column_type::boolean},
@@ -47,6 +47,8 @@ static std::array<column_type_lookup, 25> const column_types = {
      {"multilinestring", table_column_type::multilinestring},
      {"multipolygon", table_column_type::multipolygon},
      {"area", table_column_type::area},
+     {"row_hash", table_column_type::row_hash},
+     {"partition_key", table_column_type::partition_key},
      {"id_type", table_column_type::id_type},
      {"id_num", table_column_type::id_num}}};
 
@@ -113,6 +115,17 @@ void flex_table_column_t::set_projection(char const *projection)
     }
 }
 
+void flex_table_column_t::init_area_projection(int geom_srid)
+{
+    assert(m_type == table_column_type::area);
+
+    if (m_srid == geom_srid) {
+        m_area_projection.reset();
+    } else {
+        m_area_projection = reprojection::create_projection(geom_srid);
+    }
+}
+
 std::string flex_table_column_t::sql_type_name() const
 {
     if (!m_sql_type.empty()) {
@@ -156,6 +169,10 @@ std::string flex_table_column_t::sql_type_name() const
         return "Geometry(MULTIPOLYGON, {})"_format(m_srid);
     case table_column_type::area:
         return "real";
+    case table_column_type::row_hash:
+        return "int8";
+    case table_column_type::partition_key:
+        return "int2";
     case table_column_type::id_type:
         return "char(1)";
     case table_column_type::id_num:
@@ -10,8 +10,11 @@
  * For a full list of authors see the git log.
  */
 
+#include "reprojection.hpp"
+
 #include <cassert>
 #include <cstdint>
+#include <memory>
 #include <string>
 
 enum class table_column_type : uint8_t
@@ -42,6 +45,10 @@ enum class table_column_type : uint8_t
 
     area,
 
+    row_hash,
+
+    partition_key,
+
     id_type,
     id_num
 };
@@ -114,6 +121,24 @@ public:
 
     int srid() const noexcept { return m_srid; }
 
+    /**
+     * For area columns only: Set up the projection needed to calculate the
+     * area of geometries with the specified SRID (the SRID of the geometry
+     * column of the table). This is done once when the table is defined so
+     * that it doesn't have to happen for every row.
+     */
+    void init_area_projection(int geom_srid);
+
+    /**
+     * For area columns only: The projection used to calculate the area or
+     * nullptr if the area can be calculated directly from the coordinates
+     * of the geometry because it is in the same projection as this column.
+     */
+    reprojection const *area_projection() const noexcept
+    {
+        return m_area_projection.get();
+    }
+
 private:
     /// The name of the database table column.
     std::string m_name;
@@ -140,6 +165,12 @@ private:
      */
     int m_srid = 3857;
 
+    /**
+     * For area columns only: Projection used for area calculation if the
+     * SRID of this column is different from the SRID of the geometry column.
+     */
+    std::shared_ptr<reprojection> m_area_projection;
+
     /// NOT NULL constraint
     bool m_not_null = false;
 
@@ -12,9 +12,18 @@
 #include "logging.hpp"
 #include "pgsql-helper.hpp"
 #include "util.hpp"
+#include "wkb.hpp"
 
+#include <osmium/geom/mercator_projection.hpp>
+
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
 #include <string>
+#include <utility>
 
 char const *type_to_char(osmium::item_type type) noexcept
 {
@@ -63,6 +72,143 @@ std::string flex_table_t::full_tmp_name() const
     return qualified_name(schema(), name() + "_tmp");
 }
 
+std::string flex_table_t::partition_name(std::size_t n) const
+{
+    return "{}_p{}"_format(name(), n);
+}
+
+std::string flex_table_t::full_partition_name(std::size_t n) const
+{
+    return qualified_name(schema(), partition_name(n));
+}
+
+std::string flex_table_t::full_partition_tmp_name(std::size_t n) const
+{
+    return qualified_name(schema(), partition_name(n) + "_tmp");
+}
+
+std::string flex_table_t::partition_value(std::size_t n) const
+{
+    assert(n < m_num_partitions);
+
+    if (m_partitioning == partition_type::type) {
+        static constexpr std::array<osmium::item_type, 3> const types = {
+            osmium::item_type::node, osmium::item_type::way,
+            osmium::item_type::relation};
+        return "'{}'"_format(type_to_char(types[n]));
+    }
+
+    return fmt::to_string(n);
+}
+
+/// Get the first point of a (multi)point, (multi)linestring or (multi)polygon.
+static bool first_point(ewkb::parser_t *parser,
+                        osmium::geom::Coordinates *point)
+{
+    switch (parser->read_header()) {
+    case ewkb::wkb_point:
+        *point = parser->read_point();
+        return true;
+    case ewkb::wkb_line:
+        if (parser->read_length() == 0) {
+            return false;
+        }
+        *point = parser->read_point();
+        return true;
+    case ewkb::wkb_polygon:
+        if (parser->read_length() == 0 || parser->read_length() == 0) {
+            return false;
+        }
+        *point = parser->read_point();
+        return true;
+    case ewkb::wkb_multi_point:
+    case ewkb::wkb_multi_line:
+    case ewkb::wkb_multi_polygon:
+    case ewkb::wkb_collection:
+        if (parser->read_length() == 0) {
+            return false;
+        }
+        return first_point(parser, point);
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/**
+ * Position of cell (x, y) along the Hilbert curve through a grid of
+ * size x size cells (size must be a power of 2).
+ */
+static uint64_t hilbert_index(uint32_t size, uint32_t x, uint32_t y) noexcept
+{
+    uint64_t d = 0;
+    for (uint32_t s = size / 2; s > 0; s /= 2) {
+        uint32_t const rx = (x & s) > 0 ? 1 : 0;
+        uint32_t const ry = (y & s) > 0 ? 1 : 0;
+        d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+        // rotate quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = size - 1 - x;
+                y = size - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+void flex_table_t::set_partition_extent(osmium::Box const &box)
+{
+    auto const clamp_lat = [](double lat) {
+        return std::max(-osmium::geom::MERCATOR_MAX_LAT,
+                        std::min(osmium::geom::MERCATOR_MAX_LAT, lat));
+    };
+
+    m_partition_min = osmium::geom::lonlat_to_mercator(osmium::geom::Coordinates{
+        box.bottom_left().lon(), clamp_lat(box.bottom_left().lat())});
+    m_partition_max = osmium::geom::lonlat_to_mercator(osmium::geom::Coordinates{
+        box.top_right().lon(), clamp_lat(box.top_right().lat())});
+}
+
+std::size_t flex_table_t::geom_partition(std::string const &wkb,
+                                         reprojection const &proj) const
+{
+    assert(m_partitioning == partition_type::geom);
+
+    osmium::geom::Coordinates point;
+    ewkb::parser_t parser{wkb};
+    if (!first_point(&parser, &point)) {
+        return 0;
+    }
+
+    // Grid of zoom level 10 tiles (for the default world extent). This is
+    // fine enough that the ranges of the Hilbert curve for the partitions
+    // all have about the same size.
+    constexpr uint32_t const size = 1U << 10U;
+
+    auto const tile = proj.target_to_tile(point);
+    auto const to_cell = [&](double c, double min, double max) {
+        double const f = (c - min) / (max - min);
+        if (f <= 0.0) {
+            return 0U;
+        }
+        if (f >= 1.0) {
+            return size - 1;
+        }
+        return static_cast<uint32_t>(f * size);
+    };
+
+    uint64_t const cells = static_cast<uint64_t>(size) * size;
+    return static_cast<std::size_t>(
+        hilbert_index(size, to_cell(tile.x, m_partition_min.x,
+                                    m_partition_max.x),
+                      to_cell(tile.y, m_partition_min.y, m_partition_max.y)) *
+        m_num_partitions / cells);
+}
+
 flex_table_column_t &flex_table_t::add_column(std::string const &name,
                                               std::string const &type,
                                               std::string const &sql_type)
@@ -81,9 +227,35 @@ flex_table_column_t &flex_table_t::add_column(std::string const &name,
         column.set_not_null();
     }
 
+    if (column.type() == table_column_type::partition_key) {
+        m_partition_column = m_columns.size() - 1;
+    }
+
+    if (column.type() == table_column_type::row_hash) {
+        if (has_row_hash_column()) {
+            throw std::runtime_error{
+                "Only one row_hash column allowed in table '{}'."_format(
+                    m_name)};
+        }
+        m_row_hash_column = m_columns.size() - 1;
+    }
+
     return column;
 }
 
+void flex_table_t::init_area_projections()
+{
+    if (!has_geom_column()) {
+        return;
+    }
+
+    for (auto &column : m_columns) {
+        if (column.type() == table_column_type::area) {
+            column.init_area_projection(srid());
+        }
+    }
+}
+
 std::string flex_table_t::build_sql_prepare_get_wkb() const
 {
     if (has_multicolumn_id_index()) {
@@ -98,6 +270,26 @@ std::string flex_table_t::build_sql_prepare_get_wkb() const
                geom_column().name(), full_name(), id_column_names());
 }
 
+std::string flex_table_t::build_sql_prepare_get_row_hashes() const
+{
+    // The geometry is also needed for expiring tiles.
+    std::string const columns =
+        has_geom_column() ? "\"{}\", \"{}\""_format(geom_column().name(),
+                                                  row_hash_column().name())
+                          : "\"{}\""_format(row_hash_column().name());
+
+    if (has_multicolumn_id_index()) {
+        return "PREPARE get_row_hashes(char(1), bigint) AS"
+               " SELECT {} FROM {} WHERE \"{}\" = $1 AND \"{}\" = $2"_format(
+                   columns, full_name(), m_columns[0].name(),
+                   m_columns[1].name());
+    }
+
+    return "PREPARE get_row_hashes(bigint) AS"
+           " SELECT {} FROM {} WHERE \"{}\" = $1"_format(
+               columns, full_name(), id_column_names());
+}
+
 std::string
 flex_table_t::build_sql_create_table(table_type ttype,
                                      std::string const &table_name) const
@@ -114,6 +306,32 @@ flex_table_t::build_sql_create_table(table_type ttype,
     assert(sql.back() == ',');
     sql.back() = ')';
 
+    if (ttype == table_type::partitioned) {
+        // The tablespace is set on the partitions.
+        sql += " PARTITION BY LIST (\"{}\")"_format(partition_column().name());
+        return sql;
+    }
+
+    if (ttype == table_type::interim) {
+        sql += " WITH (autovacuum_enabled = off)";
+    }
+
+    sql += tablespace_clause(m_data_tablespace);
+
+    return sql;
+}
+
+std::string flex_table_t::build_sql_create_partition(std::size_t n,
+                                                     table_type ttype) const
+{
+    assert(ttype != table_type::partitioned);
+
+    std::string sql =
+        "CREATE {} TABLE IF NOT EXISTS {} PARTITION OF {}"
+        " FOR VALUES IN ({})"_format(
+            ttype == table_type::interim ? "UNLOGGED" : "",
+            full_partition_name(n), full_name(), partition_value(n));
+
     if (ttype == table_type::interim) {
         sql += " WITH (autovacuum_enabled = off)";
     }
@@ -123,6 +341,12 @@ flex_table_t::build_sql_create_table(table_type ttype,
     return sql;
 }
 
+std::string flex_table_t::build_sql_attach_partition(std::size_t n) const
+{
+    return "ALTER TABLE {} ATTACH PARTITION {} FOR VALUES IN ({})"_format(
+        full_name(), full_partition_name(n), partition_value(n));
+}
+
 std::string flex_table_t::build_sql_column_list() const
 {
     assert(!m_columns.empty());
@@ -142,9 +366,15 @@ std::string flex_table_t::build_sql_column_list() const
 }
 
 std::string flex_table_t::build_sql_create_id_index() const
+{
+    return build_sql_create_id_index(full_name());
+}
+
+std::string
+flex_table_t::build_sql_create_id_index(std::string const &table_name) const
 {
     return "CREATE INDEX ON {} USING BTREE ({}) {}"_format(
-        full_name(), id_column_names(), tablespace_clause(index_tablespace()));
+        table_name, id_column_names(), tablespace_clause(index_tablespace()));
 }
 
 void table_connection_t::connect(std::string const &conninfo)
@@ -169,16 +399,35 @@ void table_connection_t::start(bool append)
     // These _tmp tables can be left behind if we run out of disk space.
     m_db_connection->exec(
         "DROP TABLE IF EXISTS {}"_format(table().full_tmp_name()));
+    for (std::size_t n = 0; n < table().num_partitions(); ++n) {
+        m_db_connection->exec(
+            "DROP TABLE IF EXISTS {}"_format(table().full_partition_tmp_name(n)));
+    }
     m_db_connection->exec("RESET client_min_messages");
 
-    if (!append) {
+    auto const ttype = table().has_geom_column()
+                           ? flex_table_t::table_type::interim
+                           : flex_table_t::table_type::permanent;
+    bool const needs_isvalid =
+        table().has_geom_column() && table().geom_column().needs_isvalid();
+
+    if (!append && table().is_partitioned()) {
         m_db_connection->exec(table().build_sql_create_table(
-            table().has_geom_column() ? flex_table_t::table_type::interim
-                                      : flex_table_t::table_type::permanent,
-            table().full_name()));
+            flex_table_t::table_type::partitioned, table().full_name()));
+
+        for (std::size_t n = 0; n < table().num_partitions(); ++n) {
+            m_db_connection->exec(table().build_sql_create_partition(n, ttype));
+            if (needs_isvalid) {
+                create_geom_check_trigger(
+                    m_db_connection.get(), table().schema(),
+                    table().partition_name(n), table().geom_column().name());
+            }
+        }
+    } else if (!append) {
+        m_db_connection->exec(
+            table().build_sql_create_table(ttype, table().full_name()));
 
-        if (table().has_geom_column() &&
-            table().geom_column().needs_isvalid()) {
+        if (needs_isvalid) {
             create_geom_check_trigger(m_db_connection.get(), table().schema(),
                                       table().name(),
                                       table().geom_column().name());
@@ -199,6 +448,31 @@ void table_connection_t::stop(bool updateable, bool append)
         return;
     }
 
+    if (table().is_partitioned()) {
+        // Clustering and indexing is done for each partition separately
+        // in stop_partition(). Indexes created on the parent table after
+        // that will only attach the indexes on the partitions.
+        for (auto &task : m_partition_tasks) {
+            task.wait();
+        }
+        m_partition_tasks.clear();
+
+        if (table().has_geom_column()) {
+            create_geom_index(m_db_connection.get(), table().full_name(),
+                              updateable);
+        }
+
+        if (updateable && table().has_id_column()) {
+            create_id_index();
+        }
+
+        log_info("Analyzing table '{}'...", table().name());
+        analyze_table(*m_db_connection, table().schema(), table().name());
+
+        teardown();
+        return;
+    }
+
     if (table().cluster_by_geom()) {
         if (table().geom_column().needs_isvalid()) {
             drop_geom_check_trigger(m_db_connection.get(), table().schema(),
@@ -214,32 +488,10 @@ void table_connection_t::stop(bool updateable, bool append)
         m_db_connection->exec(table().build_sql_create_table(
             flex_table_t::table_type::permanent, table().full_tmp_name()));
 
-        std::string sql = "INSERT INTO {} SELECT * FROM {}"_format(
-            table().full_tmp_name(), table().full_name());
-
-        auto const postgis_version = get_postgis_version(*m_db_connection);
-
-        sql += " ORDER BY ";
-        if (postgis_version.major == 2 && postgis_version.minor < 4) {
-            log_debug("Using GeoHash for clustering table '{}'",
-                      table().name());
-            if (table().geom_column().srid() == 4326) {
-                sql += "ST_GeoHash({},10)"_format(table().geom_column().name());
-            } else {
-                sql +=
-                    "ST_GeoHash(ST_Transform(ST_Envelope({}),4326),10)"_format(
-                        table().geom_column().name());
-            }
-            sql += " COLLATE \"C\"";
-        } else {
-            log_debug("Using native order for clustering table '{}'",
-                      table().name());
-            // Since Postgis 2.4 the order function for geometries gives
-            // useful results.
-            sql += table().geom_column().name();
-        }
-
-        m_db_connection->exec(sql);
+        m_db_connection->exec(
+            "INSERT INTO {} SELECT * FROM {}{}"_format(
+                table().full_tmp_name(), table().full_name(),
+                build_sql_cluster_order(*m_db_connection)));
 
         m_db_connection->exec("DROP TABLE {}"_format(table().full_name()));
         m_db_connection->exec("ALTER TABLE {} RENAME TO \"{}\""_format(
@@ -255,13 +507,8 @@ void table_connection_t::stop(bool updateable, bool append)
 
     if (table().has_geom_column()) {
         log_info("Creating geometry index on table '{}'...", table().name());
-
-        // Use fillfactor 100 for un-updateable imports
-        m_db_connection->exec(
-            "CREATE INDEX ON {} USING GIST (\"{}\") {} {}"_format(
-                table().full_name(), table().geom_column().name(),
-                (updateable ? "" : "WITH (fillfactor = 100)"),
-                tablespace_clause(table().index_tablespace())));
+        create_geom_index(m_db_connection.get(), table().full_name(),
+                          updateable);
     }
 
     if (updateable && table().has_id_column()) {
@@ -274,12 +521,116 @@ void table_connection_t::stop(bool updateable, bool append)
     teardown();
 }
 
+void table_connection_t::stop_partition(std::size_t n, bool updateable,
+                                        std::string const &conninfo)
+{
+    pg_conn_t db_connection{conninfo};
+    db_connection.exec("SET synchronous_commit = off");
+
+    auto const name = table().partition_name(n);
+
+    if (table().cluster_by_geom()) {
+        if (table().geom_column().needs_isvalid()) {
+            drop_geom_check_trigger(&db_connection, table().schema(), name);
+        }
+
+        log_info("Clustering partition '{}' of table '{}' by geometry...",
+                 name, table().name());
+
+        // Notices about invalid geometries are expected and can be ignored
+        // because they say nothing about the validity of the geometry in OSM.
+        db_connection.exec("SET client_min_messages = WARNING");
+
+        auto const tmp_name = table().full_partition_tmp_name(n);
+        db_connection.exec(table().build_sql_create_table(
+            flex_table_t::table_type::permanent, tmp_name));
+
+        db_connection.exec("INSERT INTO {} SELECT * FROM {}{}"_format(
+            tmp_name, table().full_partition_name(n),
+            build_sql_cluster_order(db_connection)));
+
+        // With this constraint attaching the partition doesn't need to
+        // scan the table.
+        db_connection.exec("ALTER TABLE {} ADD CHECK (\"{}\" = {})"_format(
+            tmp_name, table().partition_column().name(),
+            table().partition_value(n)));
+
+        db_connection.exec("ALTER TABLE {} DETACH PARTITION {}"_format(
+            table().full_name(), table().full_partition_name(n)));
+        db_connection.exec(
+            "DROP TABLE {}"_format(table().full_partition_name(n)));
+        db_connection.exec(
+            "ALTER TABLE {} RENAME TO \"{}\""_format(tmp_name, name));
+        db_connection.exec(table().build_sql_attach_partition(n));
+
+        if (updateable && table().geom_column().needs_isvalid()) {
+            create_geom_check_trigger(&db_connection, table().schema(), name,
+                                      table().geom_column().name());
+        }
+    }
+
+    if (table().has_geom_column()) {
+        log_info("Creating geometry index on partition '{}'...", name);
+        create_geom_index(&db_connection, table().full_partition_name(n),
+                          updateable);
+    }
+
+    if (updateable && table().has_id_column()) {
+        log_info("Creating id index on partition '{}'...", name);
+        db_connection.exec(
+            table().build_sql_create_id_index(table().full_partition_name(n)));
+    }
+
+    log_info("Analyzing partition '{}'...", name);
+    analyze_table(db_connection, table().schema(), name);
+}
+
+std::string
+table_connection_t::build_sql_cluster_order(pg_conn_t const &db_connection) const
+{
+    auto const postgis_version = get_postgis_version(db_connection);
+
+    std::string sql{" ORDER BY "};
+    if (postgis_version.major == 2 && postgis_version.minor < 4) {
+        log_debug("Using GeoHash for clustering table '{}'", table().name());
+        if (table().geom_column().srid() == 4326) {
+            sql += "ST_GeoHash({},10)"_format(table().geom_column().name());
+        } else {
+            sql += "ST_GeoHash(ST_Transform(ST_Envelope({}),4326),10)"_format(
+                table().geom_column().name());
+        }
+        sql += " COLLATE \"C\"";
+    } else {
+        log_debug("Using native order for clustering table '{}'",
+                  table().name());
+        // Since Postgis 2.4 the order function for geometries gives
+        // useful results.
+        sql += table().geom_column().name();
+    }
+
+    return sql;
+}
+
+void table_connection_t::create_geom_index(pg_conn_t *db_connection,
+                                           std::string const &table_name,
+                                           bool updateable) const
+{
+    // Use fillfactor 100 for un-updateable imports
+    db_connection->exec("CREATE INDEX ON {} USING GIST (\"{}\") {} {}"_format(
+        table_name, table().geom_column().name(),
+        (updateable ? "" : "WITH (fillfactor = 100)"),
+        tablespace_clause(table().index_tablespace())));
+}
+
 void table_connection_t::prepare()
 {
     assert(m_db_connection);
     if (table().has_id_column() && table().has_geom_column()) {
         m_db_connection->exec(table().build_sql_prepare_get_wkb());
     }
+    if (table().has_id_column() && table().has_row_hash_column()) {
+        m_db_connection->exec(table().build_sql_prepare_get_row_hashes());
+    }
 }
 
 void table_connection_t::create_id_index()
@@ -314,6 +665,75 @@ void table_connection_t::delete_rows_with(osmium::item_type type, osmid_t id)
         type = osmium::item_type::undefined;
     }
     m_copy_mgr.delete_object(type_to_char(type)[0], id);
+
+    if (table().has_row_hash_column()) {
+        m_changed_ids.insert(id);
+    }
+}
+
+pg_result_t table_connection_t::get_row_hashes(osmium::item_type type,
+                                               osmid_t id) const
+{
+    assert(table().has_row_hash_column());
+    assert(m_db_connection);
+    std::string const id_str = fmt::to_string(id);
+    if (table().has_multicolumn_id_index()) {
+        return m_db_connection->exec_prepared(
+            "get_row_hashes", type_to_char(type), id_str.c_str());
+    }
+    return m_db_connection->exec_prepared("get_row_hashes", id_str);
+}
+
+void table_connection_t::begin_replace(osmium::item_type type, osmid_t id,
+                                       pg_result_t &&old_rows)
+{
+    assert(!m_replacing);
+
+    m_copy_mgr.new_line(m_target);
+    m_replace_mark = m_copy_mgr.mark();
+    delete_rows_with(type, id);
+
+    m_replacing = true;
+    m_last_replaced_id = id;
+    m_old_rows = std::move(old_rows);
+    m_new_hashes.clear();
+    m_new_wkbs.clear();
+}
+
+void table_connection_t::finish_replace(expire_tiles *expire)
+{
+    assert(m_replacing);
+    assert(expire);
+    m_replacing = false;
+
+    // The hash is in the last column of the result.
+    int const hash_column = m_old_rows.num_fields() - 1;
+    std::vector<std::int64_t> old_hashes;
+    old_hashes.reserve(static_cast<std::size_t>(m_old_rows.num_tuples()));
+    for (int i = 0; i < m_old_rows.num_tuples(); ++i) {
+        old_hashes.push_back(
+            m_old_rows.is_null(i, hash_column)
+                ? -1
+                : std::strtoll(m_old_rows.get_value(i, hash_column), nullptr,
+                               10));
+    }
+
+    std::sort(old_hashes.begin(), old_hashes.end());
+    std::sort(m_new_hashes.begin(), m_new_hashes.end());
+
+    if (old_hashes == m_new_hashes && m_copy_mgr.rollback(m_replace_mark)) {
+        m_old_rows = pg_result_t{nullptr};
+        return;
+    }
+
+    if (expire->enabled() && table().has_geom_column()) {
+        expire->from_result(m_old_rows, m_last_replaced_id);
+        for (auto const &wkb : m_new_wkbs) {
+            expire->from_wkb(wkb, m_last_replaced_id);
+        }
+    }
+
+    m_old_rows = pg_result_t{nullptr};
 }
 
 void table_connection_t::task_wait()
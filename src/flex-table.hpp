@@ -11,17 +11,22 @@
  */
 
 #include "db-copy-mgr.hpp"
+#include "expire-tiles.hpp"
 #include "flex-table-column.hpp"
 #include "osmium-builder.hpp"
 #include "pgsql.hpp"
 #include "thread-pool.hpp"
 
+#include <osmium/geom/coordinates.hpp>
+#include <osmium/osm/box.hpp>
 #include <osmium/osm/item_type.hpp>
 
 #include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -39,7 +44,15 @@ public:
      */
     enum class table_type {
         interim,
-        permanent
+        permanent,
+        partitioned ///< Parent table of a partitioned table
+    };
+
+    /// How the table is split into partitions.
+    enum class partition_type {
+        none, ///< Not partitioned
+        type, ///< One partition per OSM object type
+        geom ///< Partitions by location of the geometry
     };
 
     explicit flex_table_t(std::string name) : m_name(std::move(name)) {}
@@ -80,6 +93,59 @@ public:
         m_index_tablespace = tablespace;
     }
 
+    partition_type partitioning() const noexcept { return m_partitioning; }
+
+    bool is_partitioned() const noexcept
+    {
+        return m_partitioning != partition_type::none;
+    }
+
+    std::size_t num_partitions() const noexcept { return m_num_partitions; }
+
+    void set_partitioning(partition_type type,
+                          std::size_t num_partitions) noexcept
+    {
+        m_partitioning = type;
+        m_num_partitions = num_partitions;
+    }
+
+    /// The column the table is partitioned by.
+    flex_table_column_t const &partition_column() const noexcept
+    {
+        assert(is_partitioned());
+        if (m_partitioning == partition_type::type) {
+            return m_columns[0];
+        }
+        assert(m_partition_column < m_columns.size());
+        return m_columns[m_partition_column];
+    }
+
+    /// Name of the nth partition (without schema).
+    std::string partition_name(std::size_t n) const;
+
+    /// The value of the partition column for rows in the nth partition.
+    std::string partition_value(std::size_t n) const;
+
+    /**
+     * Set the area (in WGS84 coordinates) covered by the grid used for
+     * partitioning by geometry. Defaults to the whole world. Geometries
+     * outside this area go into the partitions for its edges.
+     */
+    void set_partition_extent(osmium::Box const &box);
+
+    /**
+     * The partition a geometry belongs in (for tables partitioned by
+     * geometry). The partition extent is split into a grid of tiles of a
+     * fixed zoom level and the Hilbert curve through this grid is split into
+     * num_partitions() ranges of the same length, so each partition contains
+     * a compact area.
+     *
+     * \param wkb The geometry in the projection of the table.
+     * \param proj The projection of the table.
+     */
+    std::size_t geom_partition(std::string const &wkb,
+                               reprojection const &proj) const;
+
     osmium::item_type id_type() const noexcept { return m_id_type; }
 
     void set_id_type(osmium::item_type type) noexcept { m_id_type = type; }
@@ -95,6 +161,12 @@ public:
 
     std::size_t num_columns() const noexcept { return m_columns.size(); }
 
+    flex_table_column_t const &column(std::size_t n) const noexcept
+    {
+        assert(n < m_columns.size());
+        return m_columns[n];
+    }
+
     std::vector<flex_table_column_t>::const_iterator begin() const noexcept
     {
         return m_columns.begin();
@@ -117,6 +189,17 @@ public:
         return m_columns[m_geom_column];
     }
 
+    bool has_row_hash_column() const noexcept
+    {
+        return m_row_hash_column != std::numeric_limits<std::size_t>::max();
+    }
+
+    flex_table_column_t const &row_hash_column() const noexcept
+    {
+        assert(has_row_hash_column());
+        return m_columns[m_row_hash_column];
+    }
+
     int srid() const noexcept
     {
         return has_geom_column() ? geom_column().srid() : 4326;
@@ -124,13 +207,22 @@ public:
 
     std::string build_sql_prepare_get_wkb() const;
 
+    std::string build_sql_prepare_get_row_hashes() const;
+
     std::string build_sql_create_table(table_type ttype,
                                        std::string const &table_name) const;
 
+    std::string build_sql_create_partition(std::size_t n,
+                                           table_type ttype) const;
+
+    std::string build_sql_attach_partition(std::size_t n) const;
+
     std::string build_sql_column_list() const;
 
     std::string build_sql_create_id_index() const;
 
+    std::string build_sql_create_id_index(std::string const &table_name) const;
+
     /// Does this table take objects of the specified type?
     bool matches_type(osmium::item_type type) const noexcept
     {
@@ -186,10 +278,18 @@ public:
                                     std::string const &type,
                                     std::string const &sql_type);
 
+    /**
+     * Set up the projections for all area columns. Must be called after all
+     * columns have been added.
+     */
+    void init_area_projections();
+
     bool has_multicolumn_id_index() const noexcept;
     std::string id_column_names() const;
     std::string full_name() const;
     std::string full_tmp_name() const;
+    std::string full_partition_name(std::size_t n) const;
+    std::string full_partition_tmp_name(std::size_t n) const;
 
 private:
     /// The name of the table
@@ -216,12 +316,28 @@ private:
     /// Index of the geometry column in m_columns. Default means no geometry.
     std::size_t m_geom_column = std::numeric_limits<std::size_t>::max();
 
+    /// Index of the row hash column in m_columns. Default means no hashes.
+    std::size_t m_row_hash_column = std::numeric_limits<std::size_t>::max();
+
     /**
      * Type of Id stored in this table (node, way, relation, area, or
      * undefined for any type).
      */
     osmium::item_type m_id_type = osmium::item_type::undefined;
 
+    /// Index of the partition key column (for tables partitioned by geom).
+    std::size_t m_partition_column = std::numeric_limits<std::size_t>::max();
+
+    partition_type m_partitioning = partition_type::none;
+
+    std::size_t m_num_partitions = 0;
+
+    /// Area covered by the partition grid (in web mercator coordinates).
+    osmium::geom::Coordinates m_partition_min{-20037508.342789244,
+                                              -20037508.342789244};
+    osmium::geom::Coordinates m_partition_max{20037508.342789244,
+                                              20037508.342789244};
+
     /// Cluster the table by geometry.
     bool m_cluster_by_geom = true;
 
@@ -247,6 +363,21 @@ public:
 
     void stop(bool updateable, bool append);
 
+    /**
+     * Cluster, index, and analyze partition n of a partitioned table. This
+     * is run in parallel for all partitions using separate database
+     * connections. The stop() function then waits for all partitions
+     * before creating the indexes on the parent table.
+     */
+    void stop_partition(std::size_t n, bool updateable,
+                        std::string const &conninfo);
+
+    void partition_task_add(std::future<std::chrono::milliseconds> &&future)
+    {
+        m_partition_tasks.emplace_back();
+        m_partition_tasks.back().set(std::move(future));
+    }
+
     flex_table_t const &table() const noexcept { return *m_table; }
 
     void teardown() { m_db_connection.reset(); }
@@ -257,7 +388,11 @@ public:
 
     pg_result_t get_geom_by_id(osmium::item_type type, osmid_t id) const;
 
-    void sync() { m_copy_mgr.sync(); }
+    void sync()
+    {
+        m_copy_mgr.sync();
+        m_changed_ids.clear();
+    }
 
     void new_line() { m_copy_mgr.new_line(m_target); }
 
@@ -268,6 +403,52 @@ public:
 
     void delete_rows_with(osmium::item_type type, osmid_t id);
 
+    /**
+     * Get the geometries (if any) and row hashes of all rows of the
+     * specified object.
+     */
+    pg_result_t get_row_hashes(osmium::item_type type, osmid_t id) const;
+
+    /**
+     * Can the rows of the specified object be replaced using the row hashes?
+     * This is not possible if the rows were already changed since the last
+     * sync, because the database doesn't reflect those changes yet.
+     */
+    bool can_replace(osmid_t id) const
+    {
+        return m_changed_ids.count(id) == 0;
+    }
+
+    /**
+     * Delete the rows of the specified object remembering the hashes of the
+     * old rows (from get_row_hashes()). The new rows are then added as usual
+     * and finish_replace() must be called after that.
+     */
+    void begin_replace(osmium::item_type type, osmid_t id,
+                       pg_result_t &&old_rows);
+
+    bool replacing() const noexcept { return m_replacing; }
+
+    /**
+     * Remember the hash and geometry (if any) of a row added while
+     * replacing.
+     */
+    void add_replacement_row(std::int64_t hash, std::string const &wkb)
+    {
+        m_new_hashes.push_back(hash);
+        if (!wkb.empty()) {
+            m_new_wkbs.push_back(wkb);
+        }
+    }
+
+    /**
+     * Finish replacing the rows of an object. If the new rows are the same
+     * as the old ones, the delete and the new rows are removed from the
+     * copy buffer if that is still possible, so the database is not touched
+     * at all. Otherwise the tiles of the old and new geometries are expired.
+     */
+    void finish_replace(expire_tiles *expire);
+
     geom::osmium_builder_t *get_builder() { return &m_builder; }
 
     void task_set(std::future<std::chrono::milliseconds> &&future)
@@ -278,6 +459,13 @@ public:
     void task_wait();
 
 private:
+    /// The ORDER BY clause for clustering the table by geometry.
+    std::string build_sql_cluster_order(pg_conn_t const &db_connection) const;
+
+    void create_geom_index(pg_conn_t *db_connection,
+                           std::string const &table_name,
+                           bool updateable) const;
+
     geom::osmium_builder_t m_builder;
 
     flex_table_t *m_table;
@@ -295,9 +483,36 @@ private:
 
     task_result_t m_task_result;
 
+    /// Results of the stop_partition() tasks.
+    std::vector<task_result_t> m_partition_tasks;
+
     /// Has the Id index already been created?
     bool m_id_index_created = false;
 
+    /// Are we currently replacing the rows of an object?
+    bool m_replacing = false;
+
+    /// Id of the object currently (or last) replaced.
+    osmid_t m_last_replaced_id = 0;
+
+    /**
+     * Ids of all objects whose rows were deleted since the last sync in
+     * tables with a row hash column.
+     */
+    std::unordered_set<osmid_t> m_changed_ids;
+
+    /// Geometries and hashes of the rows being replaced.
+    pg_result_t m_old_rows{nullptr};
+
+    /// Position in the copy buffer before the delete of the old rows.
+    db_copy_mgr_t<db_deleter_by_type_and_id_t>::mark_t m_replace_mark{};
+
+    /// Hashes of the rows added while replacing.
+    std::vector<std::int64_t> m_new_hashes;
+
+    /// Geometries of the rows added while replacing.
+    std::vector<std::string> m_new_wkbs;
+
 }; // class table_connection_t
 
 char const *type_to_char(osmium::item_type type) noexcept;
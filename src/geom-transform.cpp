@@ -8,12 +8,54 @@
  */
 
 #include "geom-transform.hpp"
+#include "geom.hpp"
 #include "logging.hpp"
 
 #include <osmium/osm.hpp>
 
 #include <cstring>
 #include <stdexcept>
+#include <utility>
+
+static double get_simplify_param(lua_State *lua_state)
+{
+    if (lua_type(lua_state, -1) != LUA_TNUMBER) {
+        throw std::runtime_error{
+            "The 'simplify' field in a geometry transformation "
+            "description must be a number."};
+    }
+
+    double const tolerance = lua_tonumber(lua_state, -1);
+    if (tolerance < 0.0) {
+        throw std::runtime_error{
+            "The 'simplify' field in a geometry transformation "
+            "description must not be negative."};
+    }
+
+    return tolerance;
+}
+
+/**
+ * Simplify all geometries with the specified tolerance (in map units).
+ * Geometries collapsing completely are removed.
+ */
+static geom::osmium_builder_t::wkbs_t
+simplify_wkbs(geom::osmium_builder_t::wkbs_t &&wkbs, double tolerance)
+{
+    if (tolerance <= 0.0) {
+        return std::move(wkbs);
+    }
+
+    geom::osmium_builder_t::wkbs_t result;
+    for (auto const &wkb : wkbs) {
+        auto simplified = geom::simplify_wkb(wkb, tolerance);
+        if (!simplified.empty()) {
+            result.push_back(std::move(simplified));
+        }
+    }
+
+    return result;
+}
 
 bool geom_transform_point_t::is_compatible_with(
     table_column_type geom_type) const noexcept
@@ -34,6 +76,11 @@ geom_transform_point_t::run(geom::osmium_builder_t *builder,
 
 bool geom_transform_line_t::set_param(char const *name, lua_State *lua_state)
 {
+    if (std::strcmp(name, "simplify") == 0) {
+        m_simplify = get_simplify_param(lua_state);
+        return true;
+    }
+
     if (std::strcmp(name, "split_at") != 0) {
         return false;
     }
@@ -64,7 +111,8 @@ geom_transform_line_t::run(geom::osmium_builder_t *builder,
     assert(builder);
     assert(way);
 
-    return builder->get_wkb_line(way->nodes(), m_split_at);
+    return simplify_wkbs(builder->get_wkb_line(way->nodes(), m_split_at),
+                         m_simplify);
 }
 
 geom::osmium_builder_t::wkbs_t
@@ -75,7 +123,8 @@ geom_transform_line_t::run(geom::osmium_builder_t *builder,
 {
     assert(builder);
 
-    return builder->get_wkb_multiline(buffer, m_split_at);
+    return simplify_wkbs(builder->get_wkb_multiline(buffer, m_split_at),
+                         m_simplify);
 }
 
 bool geom_transform_area_t::set_param(char const *name, lua_State *lua_state)
@@ -86,6 +135,11 @@ bool geom_transform_area_t::set_param(char const *name, lua_State *lua_state)
             " removed. See docs on how to use 'split_at' instead."};
     }
 
+    if (std::strcmp(name, "simplify") == 0) {
+        m_simplify = get_simplify_param(lua_state);
+        return true;
+    }
+
     if (std::strcmp(name, "split_at") != 0) {
         return false;
     }
@@ -137,7 +191,7 @@ geom_transform_area_t::run(geom::osmium_builder_t *builder,
         builder->wrap_in_multipolygon(&result);
     }
 
-    return result;
+    return simplify_wkbs(std::move(result), m_simplify);
 }
 
 geom::osmium_builder_t::wkbs_t
@@ -150,7 +204,9 @@ geom_transform_area_t::run(geom::osmium_builder_t *builder,
 
     bool const wrap_multi = target_geom_type == table_column_type::multipolygon;
 
-    return builder->get_wkb_multipolygon(relation, buffer, m_multi, wrap_multi);
+    return simplify_wkbs(
+        builder->get_wkb_multipolygon(relation, buffer, m_multi, wrap_multi),
+        m_simplify);
 }
 
 std::unique_ptr<geom_transform_t> create_geom_transform(char const *type)
@@ -96,6 +96,7 @@ public:
 
 private:
     double m_split_at = 0.0;
+    double m_simplify = 0.0;
 
 }; // class geom_transform_line_t
 
@@ -117,6 +118,7 @@ public:
         osmium::memory::Buffer const &buffer) const override;
 
 private:
+    double m_simplify = 0.0;
     bool m_multi = true;
 
 }; // class geom_transform_area_t
@@ -10,11 +10,13 @@
 #include "geom.hpp"
 
 #include "osmtypes.hpp"
+#include "wkb.hpp"
 
 #include <osmium/osm/way.hpp>
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iterator>
 #include <tuple>
 
@@ -291,5 +293,196 @@ void make_multiline(osmium::memory::Buffer const &ways, double split_at,
     }
 }
 
-} // namespace geom
+/// Distance of point p from the line segment a-b.
+static double segment_distance(osmium::geom::Coordinates p,
+                               osmium::geom::Coordinates a,
+                               osmium::geom::Coordinates b) noexcept
+{
+    double const dx = b.x - a.x;
+    double const dy = b.y - a.y;
+    double const len2 = dx * dx + dy * dy;
+
+    if (len2 == 0.0) {
+        return distance(p, a);
+    }
+
+    double const frac =
+        std::max(0.0, std::min(1.0, ((p.x - a.x) * dx + (p.y - a.y) * dy) /
+                                        len2));
+
+    return distance(
+        p, osmium::geom::Coordinates{a.x + frac * dx, a.y + frac * dy});
+}
+
+linestring_t simplify(linestring_t const &line, double tolerance)
+{
+    if (line.size() <= 2) {
+        return line;
+    }
+
+    std::vector<bool> keep(line.size(), false);
+    keep.front() = true;
+    keep.back() = true;
+
+    // Use an explicit stack instead of recursion, long coastlines would
+    // otherwise need a deep call stack.
+    std::vector<std::pair<std::size_t, std::size_t>> stack;
+    stack.emplace_back(0, line.size() - 1);
+
+    while (!stack.empty()) {
+        auto const first = stack.back().first;
+        auto const last = stack.back().second;
+        stack.pop_back();
+
+        double max_dist = 0.0;
+        std::size_t max_index = first;
+        for (std::size_t i = first + 1; i < last; ++i) {
+            double const dist = segment_distance(line[i], line[first],
+                                                 line[last]);
+            if (dist > max_dist) {
+                max_dist = dist;
+                max_index = i;
+            }
+        }
+
+        if (max_dist > tolerance) {
+            keep[max_index] = true;
+            stack.emplace_back(first, max_index);
+            stack.emplace_back(max_index, last);
+        }
+    }
+
+    linestring_t result;
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        if (keep[i]) {
+            result.add_point(line[i]);
+        }
+    }
+
+    return result;
+}
+
+static linestring_t read_points(ewkb::parser_t *parser)
+{
+    linestring_t line;
+
+    auto const num_points = parser->read_length();
+    for (uint32_t i = 0; i < num_points; ++i) {
+        line.add_point(parser->read_point());
+    }
+
+    return line;
+}
+
+static void write_points(ewkb::writer_t *writer, linestring_t const &line)
+{
+    for (auto const &coord : line) {
+        writer->add_location(coord);
+    }
+}
 
+static std::string simplify_line_wkb(ewkb::parser_t *parser, uint32_t srid,
+                                     double tolerance)
+{
+    auto const line = simplify(read_points(parser), tolerance);
+    if (line.size() < 2 || (line.size() == 2 && line[0] == line[1])) {
+        return {};
+    }
+
+    ewkb::writer_t writer{static_cast<int>(srid)};
+    writer.linestring_start();
+    write_points(&writer, line);
+    return writer.linestring_finish(line.size());
+}
+
+static std::string simplify_polygon_wkb(ewkb::parser_t *parser,
+                                        uint32_t srid, double tolerance)
+{
+    auto const num_rings = parser->read_length();
+    assert(num_rings > 0);
+
+    auto const outer = simplify(read_points(parser), tolerance);
+    if (outer.size() < 4) {
+        // Skip over the inner rings.
+        for (uint32_t i = 1; i < num_rings; ++i) {
+            parser->skip_points(parser->read_length());
+        }
+        return {};
+    }
+
+    ewkb::writer_t writer{static_cast<int>(srid)};
+    writer.polygon_start();
+    writer.polygon_ring_start();
+    write_points(&writer, outer);
+    writer.polygon_ring_finish(outer.size());
+
+    std::size_t rings_written = 1;
+    for (uint32_t i = 1; i < num_rings; ++i) {
+        auto const inner = simplify(read_points(parser), tolerance);
+        if (inner.size() >= 4) {
+            writer.polygon_ring_start();
+            write_points(&writer, inner);
+            writer.polygon_ring_finish(inner.size());
+            ++rings_written;
+        }
+    }
+
+    return writer.polygon_finish(rings_written);
+}
+
+std::string simplify_wkb(std::string const &wkb, double tolerance)
+{
+    // The SRID follows the byte order marker and the geometry type.
+    uint32_t srid = 4326;
+    std::size_t const srid_offset = sizeof(uint8_t) + sizeof(uint32_t);
+    if (wkb.size() >= srid_offset + sizeof(uint32_t)) {
+        std::memcpy(&srid, wkb.data() + srid_offset, sizeof(uint32_t));
+    }
+
+    ewkb::parser_t parser{wkb};
+    auto const type = parser.read_header();
+
+    switch (type) {
+    case ewkb::wkb_line:
+        return simplify_line_wkb(&parser, srid, tolerance);
+    case ewkb::wkb_polygon:
+        return simplify_polygon_wkb(&parser, srid, tolerance);
+    case ewkb::wkb_multi_line:
+    case ewkb::wkb_multi_polygon: {
+        std::vector<std::string> parts;
+        auto const num_parts = parser.read_length();
+        for (uint32_t i = 0; i < num_parts; ++i) {
+            parser.read_header();
+            auto part = (type == ewkb::wkb_multi_line)
+                            ? simplify_line_wkb(&parser, srid, tolerance)
+                            : simplify_polygon_wkb(&parser, srid, tolerance);
+            if (!part.empty()) {
+                parts.push_back(std::move(part));
+            }
+        }
+
+        if (parts.empty()) {
+            return {};
+        }
+
+        ewkb::writer_t writer{static_cast<int>(srid)};
+        if (type == ewkb::wkb_multi_line) {
+            writer.multilinestring_start();
+        } else {
+            writer.multipolygon_start();
+        }
+        for (auto const &part : parts) {
+            writer.add_sub_geometry(part);
+        }
+        return type == ewkb::wkb_multi_line
+                   ? writer.multilinestring_finish(parts.size())
+                   : writer.multipolygon_finish(parts.size());
+    }
+    default:
+        break;
+    }
+
+    return wkb;
+}
+
+} // namespace geom
@@ -26,6 +26,7 @@
 #include <cassert>
 #include <initializer_list>
 #include <ostream>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -176,6 +177,29 @@ void add_nodes_to_linestring(geom::linestring_t &linestring,
 void make_multiline(osmium::memory::Buffer const &ways, double split_at,
                     reprojection const &proj, std::vector<linestring_t> *out);
 
+/**
+ * Simplify a linestring using the Douglas-Peucker algorithm. All points
+ * closer than tolerance to the simplified line are removed. The first and
+ * last points are always kept.
+ *
+ * \param line The input line string.
+ * \param tolerance The maximum distance (in map units) between the original
+ *                  and the simplified line.
+ */
+linestring_t simplify(linestring_t const &line, double tolerance);
+
+/**
+ * Simplify all linestrings and polygon rings in an EWKB geometry (as
+ * created by ewkb::writer_t) using the simplify() function. Inner rings
+ * collapsing to less than four points are removed, polygons whose outer
+ * ring collapses are removed completely. Points are returned unchanged.
+ *
+ * The result is not guaranteed to be a valid geometry.
+ *
+ * \returns The simplified geometry or an empty string if nothing is left.
+ */
+std::string simplify_wkb(std::string const &wkb, double tolerance);
+
 } // namespace geom
 
 #endif // OSM2PGSQL_GEOM_HPP
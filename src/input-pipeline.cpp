@@ -0,0 +1,141 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "input-pipeline.hpp"
+
+#include <exception>
+#include <initializer_list>
+#include <utility>
+
+input_pipeline_t::input_pipeline_t(stage_func_type middle_func,
+                                   stage_func_type output_func)
+: m_middle_func(std::move(middle_func)), m_output_func(std::move(output_func))
+{}
+
+input_pipeline_t::~input_pipeline_t() noexcept
+{
+    try {
+        flush();
+    } catch (...) {
+        // Exceptions from the stages have already been reported to the
+        // caller of add() or flush() unless we are cleaning up after some
+        // other error, in which case we don't want to hide that one.
+    }
+}
+
+void input_pipeline_t::start()
+{
+    m_failed = false;
+    m_middle_stage =
+        std::async(std::launch::async, &input_pipeline_t::run_stage, this,
+                   &m_middle_queue, &m_output_queue, std::cref(m_middle_func));
+    m_output_stage =
+        std::async(std::launch::async, &input_pipeline_t::run_stage, this,
+                   &m_output_queue, nullptr, std::cref(m_output_func));
+    m_running = true;
+}
+
+void input_pipeline_t::send_buffer()
+{
+    if (m_buffer && m_buffer.committed() > 0) {
+        m_middle_queue.push(std::move(m_buffer));
+    }
+    m_buffer = osmium::memory::Buffer{};
+}
+
+void input_pipeline_t::add(osmium::OSMObject const &object)
+{
+    if (!m_running) {
+        start();
+    }
+
+    if (!m_buffer) {
+        m_buffer = osmium::memory::Buffer{
+            buffer_size, osmium::memory::Buffer::auto_grow::yes};
+    }
+
+    m_buffer.add_item(object);
+    m_buffer.commit();
+
+    if (m_buffer.committed() >= buffer_size) {
+        send_buffer();
+        // Stop reading as soon as possible if a stage failed. This will
+        // throw the exception from the stage.
+        if (m_failed) {
+            flush();
+        }
+    }
+}
+
+void input_pipeline_t::flush()
+{
+    if (!m_running) {
+        return;
+    }
+
+    send_buffer();
+
+    // An invalid buffer tells the stages that there is no more data.
+    m_middle_queue.push(osmium::memory::Buffer{});
+    m_running = false;
+
+    std::exception_ptr error;
+    for (auto *stage : {&m_middle_stage, &m_output_stage}) {
+        try {
+            stage->get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void input_pipeline_t::run_stage(queue_type *in, queue_type *out,
+                                 stage_func_type const &func)
+{
+    std::exception_ptr error;
+
+    osmium::memory::Buffer buffer;
+    while (true) {
+        in->wait_and_pop(buffer);
+        if (!buffer) {
+            break;
+        }
+
+        // After an error the rest of the data is read and dropped, so
+        // that the thread feeding this stage doesn't block.
+        if (!error) {
+            try {
+                for (auto &object : buffer.select<osmium::OSMObject>()) {
+                    func(object);
+                }
+            } catch (...) {
+                error = std::current_exception();
+                m_failed = true;
+            }
+        }
+
+        if (out && !error) {
+            out->push(std::move(buffer));
+        }
+    }
+
+    if (out) {
+        out->push(osmium::memory::Buffer{});
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef OSM2PGSQL_INPUT_PIPELINE_HPP
+#define OSM2PGSQL_INPUT_PIPELINE_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains the class input_pipeline_t.
+ */
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/thread/queue.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <future>
+
+/**
+ * A pipeline with two stages running in their own threads. OSM objects
+ * added to the pipeline are copied into buffers which are handed from the
+ * first stage (the middle) to the second stage (the output) through bounded
+ * queues. Each object goes through the first stage before it goes through
+ * the second, and objects are processed by each stage in the order they
+ * were added. The stages run concurrently with each other and with the
+ * thread adding the objects.
+ *
+ * Ownership of the buffers is handed along with the buffers, after the last
+ * stage is done with a buffer, it is freed.
+ */
+class input_pipeline_t
+{
+public:
+    using stage_func_type = std::function<void(osmium::OSMObject &)>;
+
+    input_pipeline_t(stage_func_type middle_func, stage_func_type output_func);
+
+    input_pipeline_t(input_pipeline_t const &) = delete;
+    input_pipeline_t &operator=(input_pipeline_t const &) = delete;
+
+    input_pipeline_t(input_pipeline_t &&) = delete;
+    input_pipeline_t &operator=(input_pipeline_t &&) = delete;
+
+    ~input_pipeline_t() noexcept;
+
+    /**
+     * Add a copy of an OSM object to the pipeline. Starts the stage threads
+     * if they are not running.
+     *
+     * \throws Any exception thrown by one of the stages.
+     */
+    void add(osmium::OSMObject const &object);
+
+    /**
+     * Wait until all objects added so far have been processed by all stages
+     * and stop the stage threads.
+     *
+     * \throws Any exception thrown by one of the stages.
+     */
+    void flush();
+
+private:
+    using queue_type = osmium::thread::Queue<osmium::memory::Buffer>;
+
+    /// Size of the buffers handed from stage to stage.
+    static constexpr std::size_t const buffer_size = 1024UL * 1024UL;
+
+    /// Maximum number of buffers waiting in each queue.
+    static constexpr std::size_t const max_queue_size = 8;
+
+    void start();
+    void send_buffer();
+
+    void run_stage(queue_type *in, queue_type *out,
+                   stage_func_type const &func);
+
+    stage_func_type m_middle_func;
+    stage_func_type m_output_func;
+
+    queue_type m_middle_queue{max_queue_size, "middle"};
+    queue_type m_output_queue{max_queue_size, "output"};
+
+    /// The buffer currently being filled by add().
+    osmium::memory::Buffer m_buffer{};
+
+    std::future<void> m_middle_stage;
+    std::future<void> m_output_stage;
+
+    /// Set if one of the stages has failed.
+    std::atomic<bool> m_failed{false};
+
+    bool m_running = false;
+
+}; // class input_pipeline_t
+
+#endif // OSM2PGSQL_INPUT_PIPELINE_HPP
@@ -18,6 +18,7 @@
 #include "format.hpp"
 #include "input.hpp"
 #include "logging.hpp"
+#include "memory-tracker.hpp"
 #include "osmdata.hpp"
 #include "progress-display.hpp"
 
@@ -243,6 +244,11 @@ public:
         }
 
         osmium::apply_item(object, *m_osmdata, *m_progress);
+
+        if (++m_objects_since_check == memory_check_interval) {
+            m_objects_since_check = 0;
+            get_memory_tracker().check();
+        }
     }
 
     void eof()
@@ -263,8 +269,12 @@ public:
     }
 
 private:
+    /// Check memory use against the limit after this many objects.
+    static constexpr std::size_t const memory_check_interval = 100000;
+
     osmdata_t *m_osmdata;
     progress_display_t *m_progress;
+    std::size_t m_objects_since_check = 0;
     osmium::item_type m_last_type = osmium::item_type::node;
     bool m_append;
 }; // class input_context_t
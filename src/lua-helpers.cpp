@@ -0,0 +1,472 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "lua-helpers.hpp"
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+#include <array>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_set>
+
+namespace {
+
+constexpr char const *const tag_matcher_name = "osm2pgsql.tag_matcher";
+
+/// Same as %s in Lua patterns in the C locale.
+bool is_space(char c) noexcept
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+           c == '\r';
+}
+
+/// Same as %a in Lua patterns in the C locale.
+bool is_alpha(char c) noexcept
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+bool is_string(lua_State *lua_state, int index) noexcept
+{
+    return lua_type(lua_state, index) == LUA_TSTRING;
+}
+
+bool is_plain_table(lua_State *lua_state, int index) noexcept
+{
+    if (lua_type(lua_state, index) != LUA_TTABLE) {
+        return false;
+    }
+    if (lua_getmetatable(lua_state, index)) {
+        lua_pop(lua_state, 1);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Call the Lua implementation of a function stored as upvalue with all
+ * arguments and return all its results.
+ */
+int call_lua_impl(lua_State *lua_state, int upvalue)
+{
+    int const nargs = lua_gettop(lua_state);
+    lua_pushvalue(lua_state, lua_upvalueindex(upvalue));
+    lua_insert(lua_state, 1);
+    lua_call(lua_state, nargs, LUA_MULTRET);
+    return lua_gettop(lua_state);
+}
+
+std::pair<char const *, char const *> trim(char const *begin,
+                                           char const *end) noexcept
+{
+    while (begin != end && is_space(*begin)) {
+        ++begin;
+    }
+    while (end != begin && is_space(*(end - 1))) {
+        --end;
+    }
+    return {begin, end};
+}
+
+int has_prefix(lua_State *lua_state)
+{
+    if (lua_isnoneornil(lua_state, 1)) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+    if (!is_string(lua_state, 1) || !is_string(lua_state, 2)) {
+        return call_lua_impl(lua_state, 1);
+    }
+
+    std::size_t len = 0;
+    std::size_t prefix_len = 0;
+    char const *const str = lua_tolstring(lua_state, 1, &len);
+    char const *const prefix = lua_tolstring(lua_state, 2, &prefix_len);
+
+    lua_pushboolean(lua_state, prefix_len <= len &&
+                                   std::memcmp(str, prefix, prefix_len) == 0);
+    return 1;
+}
+
+int has_suffix(lua_State *lua_state)
+{
+    if (lua_isnoneornil(lua_state, 1)) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+    if (!is_string(lua_state, 1) || !is_string(lua_state, 2)) {
+        return call_lua_impl(lua_state, 1);
+    }
+
+    std::size_t len = 0;
+    std::size_t suffix_len = 0;
+    char const *const str = lua_tolstring(lua_state, 1, &len);
+    char const *const suffix = lua_tolstring(lua_state, 2, &suffix_len);
+
+    lua_pushboolean(lua_state,
+                    suffix_len <= len &&
+                        std::memcmp(str + len - suffix_len, suffix,
+                                    suffix_len) == 0);
+    return 1;
+}
+
+int trim_func(lua_State *lua_state)
+{
+    if (lua_isnoneornil(lua_state, 1)) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+    if (!is_string(lua_state, 1)) {
+        return call_lua_impl(lua_state, 1);
+    }
+
+    std::size_t len = 0;
+    char const *const str = lua_tolstring(lua_state, 1, &len);
+    auto const range = trim(str, str + len);
+    lua_pushlstring(lua_state, range.first,
+                    static_cast<std::size_t>(range.second - range.first));
+    return 1;
+}
+
+// Same as matching the pattern "^(-?[0-9.]+) ?(%a*)$" in Lua.
+int split_unit(lua_State *lua_state)
+{
+    int const nargs = lua_gettop(lua_state);
+    if (lua_isnoneornil(lua_state, 1)) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+    if (!is_string(lua_state, 1)) {
+        return call_lua_impl(lua_state, 1);
+    }
+
+    std::size_t len = 0;
+    char const *const str = lua_tolstring(lua_state, 1, &len);
+    char const *const end = str + len;
+
+    char const *it = str;
+    if (it != end && *it == '-') {
+        ++it;
+    }
+    char const *const digits = it;
+    while (it != end && ((*it >= '0' && *it <= '9') || *it == '.')) {
+        ++it;
+    }
+    if (it == digits) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+    std::string const value{str, it};
+
+    if (it != end && *it == ' ') {
+        ++it;
+    }
+    char const *const unit = it;
+    while (it != end && is_alpha(*it)) {
+        ++it;
+    }
+    if (it != end) {
+        lua_pushnil(lua_state);
+        return 1;
+    }
+
+    // Same as tonumber(value)
+#if LUA_VERSION_NUM >= 503
+    if (lua_stringtonumber(lua_state, value.c_str()) == 0) {
+        lua_pushnil(lua_state);
+    }
+#else
+    lua_pushlstring(lua_state, value.data(), value.size());
+    if (lua_isnumber(lua_state, -1)) {
+        lua_Number const number = lua_tonumber(lua_state, -1);
+        lua_pop(lua_state, 1);
+        lua_pushnumber(lua_state, number);
+    } else {
+        lua_pop(lua_state, 1);
+        lua_pushnil(lua_state);
+    }
+#endif
+
+    if (unit == end) {
+        if (nargs >= 2) {
+            lua_pushvalue(lua_state, 2); // default unit
+        } else {
+            lua_pushnil(lua_state);
+        }
+    } else {
+        lua_pushlstring(lua_state, unit, static_cast<std::size_t>(end - unit));
+    }
+
+    return 2;
+}
+
+// Same as splitting with the pattern "([^" .. separator .. "]+)" in Lua and
+// trimming the parts.
+int split_string(lua_State *lua_state)
+{
+    if (lua_isnoneornil(lua_state, 1)) {
+        lua_newtable(lua_state);
+        return 1;
+    }
+
+    char const *separator = ";";
+    std::size_t separator_len = 1;
+    if (!lua_isnoneornil(lua_state, 2)) {
+        if (!is_string(lua_state, 2)) {
+            return call_lua_impl(lua_state, 1);
+        }
+        separator = lua_tolstring(lua_state, 2, &separator_len);
+    }
+
+    // Separators with special meaning in a pattern character class are
+    // left to Lua.
+    if (!is_string(lua_state, 1) || separator_len == 0 ||
+        std::strpbrk(separator, "%-]") != nullptr ||
+        std::strlen(separator) != separator_len) {
+        return call_lua_impl(lua_state, 1);
+    }
+
+    std::array<bool, 256> is_separator{};
+    for (std::size_t i = 0; i < separator_len; ++i) {
+        is_separator[static_cast<unsigned char>(separator[i])] = true;
+    }
+    auto const is_sep = [&](char c) {
+        return is_separator[static_cast<unsigned char>(c)];
+    };
+
+    std::size_t len = 0;
+    char const *it = lua_tolstring(lua_state, 1, &len);
+    char const *const end = it + len;
+
+    lua_newtable(lua_state);
+    int n = 0;
+    while (it != end) {
+        while (it != end && is_sep(*it)) {
+            ++it;
+        }
+        char const *const begin = it;
+        while (it != end && !is_sep(*it)) {
+            ++it;
+        }
+        if (it != begin) {
+            auto const range = trim(begin, it);
+            lua_pushlstring(
+                lua_state, range.first,
+                static_cast<std::size_t>(range.second - range.first));
+            lua_rawseti(lua_state, -2, ++n);
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * The function returned by make_check_values_func(). Upvalues are the table
+ * with the valid values and the default value.
+ */
+int check_value(lua_State *lua_state)
+{
+    lua_settop(lua_state, 1);
+    lua_rawget(lua_state, lua_upvalueindex(1));
+    if (lua_isnil(lua_state, -1)) {
+        lua_pushvalue(lua_state, lua_upvalueindex(2));
+    }
+    return 1;
+}
+
+int make_check_values_func(lua_State *lua_state)
+{
+    if (!is_plain_table(lua_state, 1)) {
+        return call_lua_impl(lua_state, 1);
+    }
+
+    lua_settop(lua_state, 2);
+
+    lua_newtable(lua_state);
+    for (int i = 1;; ++i) {
+        lua_rawgeti(lua_state, 1, i);
+        if (lua_isnil(lua_state, -1)) {
+            lua_pop(lua_state, 1);
+            break;
+        }
+        lua_pushvalue(lua_state, -1);
+        lua_settable(lua_state, 3);
+    }
+
+    lua_pushvalue(lua_state, 2);
+    lua_pushcclosure(lua_state, check_value, 2);
+    return 1;
+}
+
+/// Compiled matcher for the keys given to make_clean_tags_func().
+struct tag_matcher_t
+{
+    std::unordered_set<std::string> keys;
+    string_trie_t prefixes;
+    string_trie_t suffixes;
+
+    bool matches(std::string const &key) const noexcept
+    {
+        return keys.count(key) > 0 ||
+               prefixes.matches_prefix_of(key.cbegin(), key.cend()) ||
+               suffixes.matches_prefix_of(key.crbegin(), key.crend());
+    }
+};
+
+int tag_matcher_gc(lua_State *lua_state)
+{
+    static_cast<tag_matcher_t *>(lua_touserdata(lua_state, 1))
+        ->~tag_matcher_t();
+    return 0;
+}
+
+/**
+ * The function returned by make_clean_tags_func(). Upvalues are the
+ * tag_matcher_t userdata and the function created by the Lua
+ * implementation.
+ */
+int clean_tags(lua_State *lua_state)
+{
+    if (!is_plain_table(lua_state, 1)) {
+        return call_lua_impl(lua_state, 2);
+    }
+    lua_settop(lua_state, 1);
+
+    auto const *matcher = static_cast<tag_matcher_t const *>(
+        lua_touserdata(lua_state, lua_upvalueindex(1)));
+    bool const with_patterns =
+        !matcher->prefixes.empty() || !matcher->suffixes.empty();
+
+    std::vector<std::string> to_delete;
+    std::string key;
+    bool remaining = false;
+
+    lua_pushnil(lua_state);
+    while (lua_next(lua_state, 1) != 0) {
+        lua_pop(lua_state, 1); // value
+        if (!is_string(lua_state, -1)) {
+            if (with_patterns) {
+                // The Lua implementation fails on these, let it do that.
+                lua_settop(lua_state, 1);
+                return call_lua_impl(lua_state, 2);
+            }
+            remaining = true;
+            continue;
+        }
+        std::size_t len = 0;
+        char const *const str = lua_tolstring(lua_state, -1, &len);
+        key.assign(str, len);
+        if (matcher->matches(key)) {
+            to_delete.push_back(key);
+        } else {
+            remaining = true;
+        }
+    }
+
+    for (auto const &k : to_delete) {
+        lua_pushlstring(lua_state, k.data(), k.size());
+        lua_pushnil(lua_state);
+        lua_rawset(lua_state, 1);
+    }
+
+    lua_pushboolean(lua_state, !remaining);
+    return 1;
+}
+
+int make_clean_tags_func(lua_State *lua_state)
+{
+    if (!is_plain_table(lua_state, 1)) {
+        return call_lua_impl(lua_state, 1);
+    }
+    lua_settop(lua_state, 1);
+
+    for (int i = 1;; ++i) {
+        lua_rawgeti(lua_state, 1, i);
+        int const type = lua_type(lua_state, -1);
+        lua_pop(lua_state, 1);
+        if (type == LUA_TNIL) {
+            break;
+        }
+        if (type != LUA_TSTRING) {
+            return call_lua_impl(lua_state, 1);
+        }
+    }
+
+    // The function created by the Lua implementation is used for unusual
+    // tag tables.
+    lua_pushvalue(lua_state, lua_upvalueindex(1));
+    lua_pushvalue(lua_state, 1);
+    lua_call(lua_state, 1, 1);
+
+    void *const memory = lua_newuserdata(lua_state, sizeof(tag_matcher_t));
+    auto *const matcher = new (memory) tag_matcher_t{};
+    luaL_getmetatable(lua_state, tag_matcher_name);
+    lua_setmetatable(lua_state, -2);
+
+    for (int i = 1;; ++i) {
+        lua_rawgeti(lua_state, 1, i);
+        if (lua_isnil(lua_state, -1)) {
+            lua_pop(lua_state, 1);
+            break;
+        }
+        std::size_t len = 0;
+        char const *const str = lua_tolstring(lua_state, -1, &len);
+        if (len > 0 && str[len - 1] == '*') {
+            matcher->prefixes.add(str, str + len - 1);
+        } else if (len > 0 && str[0] == '*') {
+            std::string const suffix{str + 1, len - 1};
+            matcher->suffixes.add(suffix.crbegin(), suffix.crend());
+        } else {
+            matcher->keys.emplace(str, len);
+        }
+        lua_pop(lua_state, 1);
+    }
+
+    // Upvalues: matcher, Lua function
+    lua_insert(lua_state, -2);
+    lua_pushcclosure(lua_state, clean_tags, 2);
+    return 1;
+}
+
+/**
+ * Replace the function "name" in the table on top of the stack by a native
+ * implementation which gets the Lua implementation as first upvalue.
+ */
+void replace_function(lua_State *lua_state, char const *name,
+                      lua_CFunction func)
+{
+    lua_getfield(lua_state, -1, name);
+    lua_pushcclosure(lua_state, func, 1);
+    lua_setfield(lua_state, -2, name);
+}
+
+} // anonymous namespace
+
+void add_native_lua_helpers(lua_State *lua_state)
+{
+    luaL_newmetatable(lua_state, tag_matcher_name);
+    lua_pushcfunction(lua_state, tag_matcher_gc);
+    lua_setfield(lua_state, -2, "__gc");
+    lua_pop(lua_state, 1);
+
+    replace_function(lua_state, "has_prefix", has_prefix);
+    replace_function(lua_state, "has_suffix", has_suffix);
+    replace_function(lua_state, "trim", trim_func);
+    replace_function(lua_state, "split_unit", split_unit);
+    replace_function(lua_state, "split_string", split_string);
+    replace_function(lua_state, "make_check_values_func",
+                     make_check_values_func);
+    replace_function(lua_state, "make_clean_tags_func", make_clean_tags_func);
+}
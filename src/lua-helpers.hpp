@@ -0,0 +1,116 @@
+#ifndef OSM2PGSQL_LUA_HELPERS_HPP
+#define OSM2PGSQL_LUA_HELPERS_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains native implementations of the helper functions from init.lua
+ * which are called for every object by typical flex configurations.
+ */
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+struct lua_State;
+
+/**
+ * Set of strings stored as a trie. It is used to check quickly whether any
+ * of the strings is a prefix of some other string. To check for suffixes,
+ * add the strings and match using reverse iterators.
+ */
+class string_trie_t
+{
+public:
+    template <typename It>
+    void add(It begin, It end)
+    {
+        std::uint32_t node = 0;
+        for (; begin != end; ++begin) {
+            node = child_or_create(node, *begin);
+        }
+        m_nodes[node].terminal = true;
+    }
+
+    /// Is any of the strings in the trie a prefix of [begin, end)?
+    template <typename It>
+    bool matches_prefix_of(It begin, It end) const noexcept
+    {
+        std::uint32_t node = 0;
+        while (!m_nodes[node].terminal) {
+            if (begin == end) {
+                return false;
+            }
+            node = child(node, *begin);
+            if (node == 0) {
+                return false;
+            }
+            ++begin;
+        }
+        return true;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_nodes.size() == 1 && !m_nodes[0].terminal;
+    }
+
+private:
+    struct node_t
+    {
+        std::vector<std::pair<char, std::uint32_t>> children;
+        bool terminal = false;
+    };
+
+    /// Get child node for character c, returns 0 if there is none.
+    std::uint32_t child(std::uint32_t node, char c) const noexcept
+    {
+        for (auto const &ch : m_nodes[node].children) {
+            if (ch.first == c) {
+                return ch.second;
+            }
+        }
+        return 0;
+    }
+
+    std::uint32_t child_or_create(std::uint32_t node, char c)
+    {
+        auto const existing = child(node, c);
+        if (existing != 0) {
+            return existing;
+        }
+        auto const id = static_cast<std::uint32_t>(m_nodes.size());
+        m_nodes.emplace_back();
+        m_nodes[node].children.emplace_back(c, id);
+        return id;
+    }
+
+    std::vector<node_t> m_nodes{1};
+
+}; // class string_trie_t
+
+/**
+ * Replace the helper functions has_prefix(), has_suffix(), trim(),
+ * split_unit(), split_string(), make_check_values_func(), and
+ * make_clean_tags_func() in the "osm2pgsql" table on top of the Lua stack
+ * by native implementations.
+ *
+ * The native functions keep the Lua implementations from init.lua and call
+ * them for unusual arguments (for instance numbers instead of strings or
+ * tables with metatables), so the behaviour, including error messages,
+ * stays exactly the same.
+ */
+void add_native_lua_helpers(lua_State *lua_state);
+
+#endif // OSM2PGSQL_LUA_HELPERS_HPP
@@ -0,0 +1,132 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "memory-tracker.hpp"
+#include "format.hpp"
+#include "logging.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+constexpr std::size_t const mbyte = 1024UL * 1024UL;
+
+/// Global memory tracker singleton
+memory_tracker_t the_memory_tracker{};
+
+} // anonymous namespace
+
+memory_tracker_t &get_memory_tracker() noexcept { return the_memory_tracker; }
+
+std::size_t process_resident_memory() noexcept
+{
+#ifdef __linux__
+    try {
+        // VmRSS would include pages of memory-mapped files like the
+        // flat node file, so RssAnon is used. The line looks like this:
+        // "RssAnon:     12345 kB"
+        std::ifstream status{"/proc/self/status"};
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 8, "RssAnon:") == 0) {
+                return static_cast<std::size_t>(
+                           std::strtoull(line.c_str() + 8, nullptr, 10)) *
+                       1024UL;
+            }
+        }
+    } catch (...) {
+    }
+#endif
+    return 0;
+}
+
+void memory_account_t::add(std::size_t bytes) noexcept
+{
+    auto const current =
+        m_current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    auto peak = m_peak.load(std::memory_order_relaxed);
+    while (current > peak &&
+           !m_peak.compare_exchange_weak(peak, current,
+                                         std::memory_order_relaxed)) {
+    }
+}
+
+memory_account_t &memory_tracker_t::account(std::string const &name)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto const it =
+        std::find_if(m_accounts.begin(), m_accounts.end(),
+                     [&](memory_account_t const &a) { return a.name() == name; });
+    if (it != m_accounts.end()) {
+        return *it;
+    }
+
+    m_accounts.emplace_back(name);
+    return m_accounts.back();
+}
+
+std::size_t memory_tracker_t::current() const
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    std::size_t sum = 0;
+    for (auto const &account : m_accounts) {
+        sum += account.current();
+    }
+    return sum;
+}
+
+std::string memory_tracker_t::usage_report() const
+{
+    std::string report;
+
+    std::lock_guard<std::mutex> const guard{m_mutex};
+    for (auto const &account : m_accounts) {
+        report += "\n  {}: {}MB (peak {}MB)"_format(
+            account.name(), account.current() / mbyte, account.peak() / mbyte);
+    }
+
+    return report;
+}
+
+void memory_tracker_t::check() const
+{
+    if (m_limit == 0) {
+        return;
+    }
+
+    auto const accounted = current();
+
+    // Anonymous resident memory of the whole process in bytes (0 if not
+    // available). Virtual memory is not used here, it can be much larger
+    // than the memory actually used, for instance because of memory-mapped
+    // files.
+    auto const process = process_resident_memory();
+
+    if (std::max(accounted, process) <= m_limit) {
+        return;
+    }
+
+    throw std::runtime_error{
+        "Memory limit of {}MB exceeded (process: {}MB, accounted: {}MB). "
+        "Memory use by subsystem:{}"_format(m_limit / mbyte, process / mbyte,
+                                            accounted / mbyte,
+                                            usage_report())};
+}
+
+void memory_tracker_t::log_usage() const
+{
+    log_debug("Memory use by subsystem:{}", usage_report());
+}
@@ -0,0 +1,177 @@
+#ifndef OSM2PGSQL_MEMORY_TRACKER_HPP
+#define OSM2PGSQL_MEMORY_TRACKER_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains the classes for central accounting of memory use.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+
+/**
+ * Memory use of one subsystem. Accounts are created by the memory tracker
+ * and live as long as the program. All functions are thread-safe.
+ */
+class memory_account_t
+{
+public:
+    explicit memory_account_t(std::string name) : m_name(std::move(name)) {}
+
+    std::string const &name() const noexcept { return m_name; }
+
+    void add(std::size_t bytes) noexcept;
+
+    void sub(std::size_t bytes) noexcept
+    {
+        m_current.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    /// The number of bytes currently used.
+    std::size_t current() const noexcept
+    {
+        return m_current.load(std::memory_order_relaxed);
+    }
+
+    /// The maximum number of bytes used so far.
+    std::size_t peak() const noexcept
+    {
+        return m_peak.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::string m_name;
+    std::atomic<std::size_t> m_current{0};
+    std::atomic<std::size_t> m_peak{0};
+
+}; // class memory_account_t
+
+/**
+ * Central accounting of the memory used by the different subsystems. It is
+ * intended as a singleton class, use get_memory_tracker() to access it.
+ *
+ * Subsystems report their memory use through tracked_memory_t objects. If
+ * a memory limit is set, check() can be called regularly to stop processing
+ * with a report of the memory use when the limit is exceeded.
+ */
+class memory_tracker_t
+{
+public:
+    /**
+     * Get the account with the specified name. It is created if it doesn't
+     * exist yet. The returned reference stays valid.
+     */
+    memory_account_t &account(std::string const &name);
+
+    /// Set the memory limit in bytes (0 for no limit).
+    void set_limit(std::size_t limit) noexcept { m_limit = limit; }
+
+    /// The memory limit in bytes (0 if there is no limit).
+    std::size_t limit() const noexcept { return m_limit; }
+
+    /// Sum of the memory currently used by all accounts.
+    std::size_t current() const;
+
+    /**
+     * Check memory use against the limit. Memory used is the larger of the
+     * sum of all accounts and the anonymous resident memory of the whole
+     * process as reported by the operating system (if available).
+     *
+     * \throws std::runtime_error with a report of the memory use if the
+     *         limit is exceeded.
+     */
+    void check() const;
+
+    /// Log the current and peak memory use of all accounts (debug level).
+    void log_usage() const;
+
+    /// Call func for each account (with the tracker locked).
+    template <typename FUNC>
+    void for_each_account(FUNC &&func) const
+    {
+        std::lock_guard<std::mutex> const guard{m_mutex};
+        for (auto const &account : m_accounts) {
+            std::forward<FUNC>(func)(account);
+        }
+    }
+
+private:
+    std::string usage_report() const;
+
+    mutable std::mutex m_mutex;
+
+    /// Accounts, a deque is used because references to it stay valid.
+    std::deque<memory_account_t> m_accounts;
+
+    std::size_t m_limit = 0;
+
+}; // class memory_tracker_t
+
+memory_tracker_t &get_memory_tracker() noexcept;
+
+/**
+ * Anonymous resident memory (RssAnon) of the process in bytes. This doesn't
+ * include pages of memory-mapped files like the flat node file. Returns 0 if
+ * this is not available on this system.
+ */
+std::size_t process_resident_memory() noexcept;
+
+/**
+ * Memory used by some data structure. The owner of this object calls
+ * update() whenever it knows how much memory the data structure uses,
+ * the difference to the last update is reported to the account. When
+ * this object is destroyed, the memory is subtracted from the account
+ * again.
+ *
+ * An object of this class must only be updated from one thread at a time.
+ */
+class tracked_memory_t
+{
+public:
+    explicit tracked_memory_t(std::string const &account_name)
+    : m_account(&get_memory_tracker().account(account_name))
+    {}
+
+    tracked_memory_t(tracked_memory_t const &) = delete;
+    tracked_memory_t &operator=(tracked_memory_t const &) = delete;
+
+    tracked_memory_t(tracked_memory_t &&) = delete;
+    tracked_memory_t &operator=(tracked_memory_t &&) = delete;
+
+    ~tracked_memory_t() noexcept { update(0); }
+
+    void update(std::size_t bytes) noexcept
+    {
+        if (bytes > m_bytes) {
+            m_account->add(bytes - m_bytes);
+        } else if (bytes < m_bytes) {
+            m_account->sub(m_bytes - bytes);
+        }
+        m_bytes = bytes;
+    }
+
+    std::size_t bytes() const noexcept { return m_bytes; }
+
+private:
+    memory_account_t *m_account;
+    std::size_t m_bytes = 0;
+
+}; // class tracked_memory_t
+
+#endif // OSM2PGSQL_MEMORY_TRACKER_HPP
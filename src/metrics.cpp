@@ -0,0 +1,291 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "metrics.hpp"
+#include "format.hpp"
+#include "logging.hpp"
+#include "memory-tracker.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace {
+
+/// Global metrics registry singleton
+metrics_t the_metrics{};
+
+void format_metric_header(fmt::memory_buffer *out, std::string const &name,
+                          std::string const &help, char const *type)
+{
+    fmt::format_to(std::back_inserter(*out), "# HELP {} {}\n# TYPE {} {}\n",
+                   name, help, name, type);
+}
+
+} // anonymous namespace
+
+metrics_t &get_metrics() noexcept { return the_metrics; }
+
+metric_t &metrics_t::get(std::string const &name, std::string const &help,
+                         std::string const &labels,
+                         metric_t::metric_type type, double scale)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto const it = std::find_if(
+        m_metrics.begin(), m_metrics.end(), [&](metric_t const &metric) {
+            return metric.name() == name && metric.labels() == labels;
+        });
+    if (it != m_metrics.end()) {
+        return *it;
+    }
+
+    m_help.emplace(name, help);
+    m_metrics.emplace_back(name, labels, type, scale);
+    return m_metrics.back();
+}
+
+metric_t &metrics_t::counter(std::string const &name, std::string const &help,
+                             std::string const &labels)
+{
+    return get(name, help, labels, metric_t::metric_type::counter, 1.0);
+}
+
+metric_t &metrics_t::gauge(std::string const &name, std::string const &help,
+                           std::string const &labels)
+{
+    return get(name, help, labels, metric_t::metric_type::gauge, 1.0);
+}
+
+metric_t &metrics_t::duration(std::string const &name,
+                              std::string const &help,
+                              std::string const &labels)
+{
+    return get(name, help, labels, metric_t::metric_type::counter, 1e-9);
+}
+
+void metrics_t::remove(metric_t const *metric)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+    m_metrics.remove_if([&](metric_t const &m) { return &m == metric; });
+}
+
+void metrics_t::set_phase(std::string phase)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+    m_phase = std::move(phase);
+}
+
+std::string metrics_t::format() const
+{
+    fmt::memory_buffer out;
+    auto const it = std::back_inserter(out);
+
+    format_metric_header(&out, "osm2pgsql_phase",
+                         "Current processing phase.", "gauge");
+    {
+        std::lock_guard<std::mutex> const guard{m_mutex};
+        fmt::format_to(it, "osm2pgsql_phase{{phase=\"{}\"}} 1\n", m_phase);
+    }
+
+    format_metric_header(&out, "osm2pgsql_run_duration_seconds",
+                         "Time since osm2pgsql was started.", "gauge");
+    fmt::format_to(it, "osm2pgsql_run_duration_seconds {:.3f}\n",
+                   std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - m_start)
+                       .count());
+
+    format_metric_header(&out, "osm2pgsql_memory_bytes",
+                         "Memory currently used by subsystem.", "gauge");
+    get_memory_tracker().for_each_account(
+        [&](memory_account_t const &account) {
+            fmt::format_to(it, "osm2pgsql_memory_bytes{{subsystem=\"{}\"}} {}\n",
+                           account.name(), account.current());
+        });
+
+    // Anonymous resident memory of the whole process (only available on
+    // Linux).
+    auto const rss = process_resident_memory();
+    if (rss > 0) {
+        format_metric_header(&out, "osm2pgsql_process_resident_memory_bytes",
+                             "Anonymous resident memory (RssAnon) used by "
+                             "the process.",
+                             "gauge");
+        fmt::format_to(it, "osm2pgsql_process_resident_memory_bytes {}\n",
+                       rss);
+    }
+
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    // Metrics with the same name must be grouped together.
+    for (auto const &help : m_help) {
+        bool first = true;
+        for (auto const &metric : m_metrics) {
+            if (metric.name() != help.first) {
+                continue;
+            }
+            if (first) {
+                format_metric_header(
+                    &out, help.first, help.second,
+                    metric.type() == metric_t::metric_type::counter
+                        ? "counter"
+                        : "gauge");
+                first = false;
+            }
+            fmt::format_to(it, "{}", metric.name());
+            if (!metric.labels().empty()) {
+                fmt::format_to(it, "{{{}}}", metric.labels());
+            }
+            fmt::format_to(it, " {}\n", metric.value());
+        }
+    }
+
+    return fmt::to_string(out);
+}
+
+#ifdef _WIN32
+
+metrics_server_t::metrics_server_t(unsigned int /*port*/)
+{
+    throw std::runtime_error{"The metrics server is not available on Windows."};
+}
+
+metrics_server_t::~metrics_server_t() noexcept = default;
+
+void metrics_server_t::run() const {}
+
+void metrics_server_t::handle_request(int /*fd*/) const {}
+
+#else
+
+metrics_server_t::metrics_server_t(unsigned int port)
+{
+    if (port == 0 || port > 65535) {
+        throw std::runtime_error{"Invalid port for metrics server: {}."_format(
+            port)};
+    }
+
+    m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (m_socket < 0) {
+        throw std::runtime_error{"Can not create socket for metrics server: "
+                                 "{}."_format(std::strerror(errno))};
+    }
+
+    int const one = 1;
+    ::setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (::bind(m_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) !=
+            0 ||
+        ::listen(m_socket, 8) != 0) {
+        auto const err = errno;
+        ::close(m_socket);
+        throw std::runtime_error{
+            "Can not start metrics server on port {}: {}."_format(
+                port, std::strerror(err))};
+    }
+
+    log_info("Serving metrics on http://localhost:{}/metrics", port);
+
+    m_thread = std::thread{[this]() { run(); }};
+}
+
+metrics_server_t::~metrics_server_t() noexcept
+{
+    m_stop = true;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    ::close(m_socket);
+}
+
+void metrics_server_t::run() const
+{
+    pollfd pfd{};
+    pfd.fd = m_socket;
+    pfd.events = POLLIN;
+
+    while (!m_stop) {
+        // Wake up regularly to check whether we should stop.
+        if (::poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+
+        int const fd = ::accept(m_socket, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+
+        try {
+            handle_request(fd);
+        } catch (std::exception const &e) {
+            log_warn("Metrics server: {}", e.what());
+        }
+        ::close(fd);
+    }
+}
+
+void metrics_server_t::handle_request(int fd) const
+{
+    // Do not let a slow client block the server.
+    timeval timeout{};
+    timeout.tv_sec = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line is interesting.
+    char buffer[1024];
+    auto const len = ::recv(fd, buffer, sizeof(buffer) - 1, 0);
+    if (len <= 0) {
+        return;
+    }
+    buffer[len] = '\0';
+
+    std::string response;
+    if (std::strncmp(buffer, "GET /metrics ", 13) == 0 ||
+        std::strncmp(buffer, "GET / ", 6) == 0) {
+        auto const body = get_metrics().format();
+        response = "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: {}\r\n\r\n{}"_format(body.size(), body);
+    } else {
+        response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    }
+
+    std::size_t sent = 0;
+    while (sent < response.size()) {
+        auto const n = ::send(fd, response.data() + sent,
+                              response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        sent += static_cast<std::size_t>(n);
+    }
+}
+
+#endif
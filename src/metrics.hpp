@@ -0,0 +1,206 @@
+#ifndef OSM2PGSQL_METRICS_HPP
+#define OSM2PGSQL_METRICS_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains the classes for collecting metrics and serving them over HTTP in
+ * the Prometheus text format.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+/**
+ * A single metric (one time series). Metrics are created by the metrics
+ * registry and stay valid until they are removed from it. Updating a metric
+ * is a relaxed atomic operation, so it can be done on hot paths from any
+ * thread.
+ */
+class metric_t
+{
+public:
+    enum class metric_type
+    {
+        counter,
+        gauge
+    };
+
+    metric_t(std::string name, std::string labels, metric_type type,
+             double scale)
+    : m_name(std::move(name)), m_labels(std::move(labels)), m_type(type),
+      m_scale(scale)
+    {}
+
+    std::string const &name() const noexcept { return m_name; }
+
+    std::string const &labels() const noexcept { return m_labels; }
+
+    metric_type type() const noexcept { return m_type; }
+
+    void add(uint64_t value = 1) noexcept
+    {
+        m_value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t value) noexcept
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    uint64_t raw_value() const noexcept
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+    /// The value in the unit of the metric (seconds for durations).
+    double value() const noexcept
+    {
+        return static_cast<double>(raw_value()) * m_scale;
+    }
+
+private:
+    std::string m_name;
+    std::string m_labels;
+    metric_type m_type;
+    double m_scale;
+    std::atomic<uint64_t> m_value{0};
+
+}; // class metric_t
+
+/**
+ * Central registry of all metrics. It is intended as a singleton class, use
+ * get_metrics() to access it.
+ *
+ * Metric names follow the Prometheus conventions. Labels are given as
+ * string in the Prometheus syntax without the braces, for instance
+ * 'type="node"'. Registering a metric that already exists returns the
+ * existing metric.
+ */
+class metrics_t
+{
+public:
+    /// Get a counter.
+    metric_t &counter(std::string const &name, std::string const &help,
+                      std::string const &labels = "");
+
+    /// Get a gauge.
+    metric_t &gauge(std::string const &name, std::string const &help,
+                    std::string const &labels = "");
+
+    /**
+     * Get a counter for durations. It is updated with nanoseconds (use
+     * metric_timer_t), but reported in seconds.
+     */
+    metric_t &duration(std::string const &name, std::string const &help,
+                       std::string const &labels = "");
+
+    /// Remove a metric from the registry. The metric is invalid afterwards.
+    void remove(metric_t const *metric);
+
+    /// Set the name of the current processing phase.
+    void set_phase(std::string phase);
+
+    /// Return all metrics in the Prometheus text format.
+    std::string format() const;
+
+private:
+    metric_t &get(std::string const &name, std::string const &help,
+                  std::string const &labels, metric_t::metric_type type,
+                  double scale);
+
+    mutable std::mutex m_mutex;
+
+    /// Metrics, a list is used because references to it stay valid.
+    std::list<metric_t> m_metrics;
+
+    /// Help text by metric name.
+    std::map<std::string, std::string> m_help;
+
+    std::string m_phase{"startup"};
+
+    std::chrono::steady_clock::time_point m_start =
+        std::chrono::steady_clock::now();
+
+}; // class metrics_t
+
+metrics_t &get_metrics() noexcept;
+
+/**
+ * Adds the time from construction to destruction of this object (in
+ * nanoseconds) to a duration metric.
+ */
+class metric_timer_t
+{
+public:
+    explicit metric_timer_t(metric_t *metric) noexcept
+    : m_metric(metric), m_start(std::chrono::steady_clock::now())
+    {}
+
+    metric_timer_t(metric_timer_t const &) = delete;
+    metric_timer_t &operator=(metric_timer_t const &) = delete;
+
+    metric_timer_t(metric_timer_t &&) = delete;
+    metric_timer_t &operator=(metric_timer_t &&) = delete;
+
+    ~metric_timer_t() noexcept
+    {
+        m_metric->add(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - m_start)
+                .count()));
+    }
+
+private:
+    metric_t *m_metric;
+    std::chrono::steady_clock::time_point m_start;
+
+}; // class metric_timer_t
+
+/**
+ * Minimal HTTP server answering requests for "/metrics" with the metrics
+ * in the Prometheus text format. It only listens on the loopback interface
+ * and runs in its own thread until the object is destroyed.
+ */
+class metrics_server_t
+{
+public:
+    explicit metrics_server_t(unsigned int port);
+
+    metrics_server_t(metrics_server_t const &) = delete;
+    metrics_server_t &operator=(metrics_server_t const &) = delete;
+
+    metrics_server_t(metrics_server_t &&) = delete;
+    metrics_server_t &operator=(metrics_server_t &&) = delete;
+
+    ~metrics_server_t() noexcept;
+
+private:
+    void run() const;
+    void handle_request(int fd) const;
+
+    int m_socket = -1;
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread;
+
+}; // class metrics_server_t
+
+#endif // OSM2PGSQL_METRICS_HPP
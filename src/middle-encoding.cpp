@@ -0,0 +1,168 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "middle-encoding.hpp"
+
+#include <osmium/osm/item_type.hpp>
+#include <osmium/util/delta.hpp>
+
+// Workaround: This must be included before buffer_string.hpp due to a missing
+// include in the upstream code. https://github.com/mapbox/protozero/pull/104
+#include <protozero/config.hpp>
+
+#include <protozero/buffer_string.hpp>
+#include <protozero/exception.hpp>
+#include <protozero/varint.hpp>
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+void add_string(std::string *data, char const *str)
+{
+    auto const length = std::strlen(str);
+    protozero::add_varint_to_buffer(data, length);
+    data->append(str, length);
+}
+
+/// Decode a string, sets begin to the first byte after it.
+std::pair<char const *, std::size_t> decode_string(char const **begin,
+                                                   char const *end)
+{
+    auto const length = protozero::decode_varint(begin, end);
+    if (length > static_cast<std::size_t>(end - *begin)) {
+        throw protozero::end_of_buffer_exception{};
+    }
+    char const *const str = *begin;
+    *begin += length;
+    return {str, length};
+}
+
+} // anonymous namespace
+
+void add_delta_encoded_way_node_list(std::string *data,
+                                     osmium::WayNodeList const &wnl)
+{
+    assert(data);
+
+    // Add number of nodes in list
+    protozero::add_varint_to_buffer(data, wnl.size());
+
+    // Add delta encoded node ids
+    osmium::DeltaEncode<osmid_t> delta;
+    for (auto const &nr : wnl) {
+        protozero::add_varint_to_buffer(
+            data, protozero::encode_zigzag64(delta.update(nr.ref())));
+    }
+}
+
+char const *
+decode_delta_encoded_way_node_list(char const *begin, char const *end,
+                                   osmium::builder::WayBuilder *builder)
+{
+    assert(builder);
+
+    auto count = protozero::decode_varint(&begin, end);
+
+    osmium::DeltaDecode<osmid_t> delta;
+    osmium::builder::WayNodeListBuilder wnl_builder{*builder};
+    while (count > 0) {
+        auto const val =
+            protozero::decode_zigzag64(protozero::decode_varint(&begin, end));
+        wnl_builder.add_node_ref(delta.update(val));
+        --count;
+    }
+
+    return begin;
+}
+
+bool delta_encoded_way_node_list_contains(char const *begin, char const *end,
+                                          osmid_t id)
+{
+    auto count = protozero::decode_varint(&begin, end);
+
+    osmium::DeltaDecode<osmid_t> delta;
+    while (count > 0) {
+        auto const val =
+            protozero::decode_zigzag64(protozero::decode_varint(&begin, end));
+        if (delta.update(val) == id) {
+            return true;
+        }
+        --count;
+    }
+
+    return false;
+}
+
+void add_encoded_member_list(std::string *data,
+                             osmium::RelationMemberList const &members)
+{
+    assert(data);
+
+    protozero::add_varint_to_buffer(data, members.size());
+
+    osmium::DeltaEncode<osmid_t> delta;
+    for (auto const &member : members) {
+        *data += osmium::item_type_to_char(member.type());
+        protozero::add_varint_to_buffer(
+            data, protozero::encode_zigzag64(delta.update(member.ref())));
+        add_string(data, member.role());
+    }
+}
+
+void decode_member_list(char const *begin, char const *end,
+                        osmium::builder::RelationBuilder *builder)
+{
+    assert(builder);
+
+    auto count = protozero::decode_varint(&begin, end);
+
+    osmium::DeltaDecode<osmid_t> delta;
+    osmium::builder::RelationMemberListBuilder rml_builder{*builder};
+    while (count > 0) {
+        if (begin == end) {
+            throw protozero::end_of_buffer_exception{};
+        }
+        auto const type = osmium::char_to_item_type(*begin++);
+        auto const ref = delta.update(
+            protozero::decode_zigzag64(protozero::decode_varint(&begin, end)));
+        auto const role = decode_string(&begin, end);
+        rml_builder.add_member(type, ref, role.first, role.second);
+        --count;
+    }
+}
+
+void add_encoded_tag(std::string *data, char const *key, char const *value)
+{
+    assert(data);
+    add_string(data, key);
+    add_string(data, value);
+}
+
+void add_encoded_tag_list(std::string *data, osmium::TagList const &tags)
+{
+    for (auto const &tag : tags) {
+        add_encoded_tag(data, tag.key(), tag.value());
+    }
+}
+
+void decode_tag_list(char const *begin, char const *end,
+                     osmium::builder::Builder *builder)
+{
+    assert(builder);
+
+    osmium::builder::TagListBuilder tl_builder{*builder};
+    while (begin != end) {
+        auto const key = decode_string(&begin, end);
+        auto const value = decode_string(&begin, end);
+        tl_builder.add_tag(key.first, key.second, value.first, value.second);
+    }
+}
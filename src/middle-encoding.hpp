@@ -0,0 +1,87 @@
+#ifndef OSM2PGSQL_MIDDLE_ENCODING_HPP
+#define OSM2PGSQL_MIDDLE_ENCODING_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains functions for the compact binary encoding of way node lists,
+ * relation member lists, and tag lists used by the middles.
+ *
+ * Node lists and member lists start with the number of entries as varint.
+ * Ids are delta encoded and stored as zigzag varints. Strings (roles, tag
+ * keys and values) are stored with their length as varint followed by the
+ * bytes of the string. Tag lists have no count, they end where the data
+ * ends, so extra tags can simply be appended.
+ */
+
+#include "osmtypes.hpp"
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/tag.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <string>
+
+/// Append delta encoded node list to data.
+void add_delta_encoded_way_node_list(std::string *data,
+                                     osmium::WayNodeList const &wnl);
+
+/**
+ * Decode a node list encoded with add_delta_encoded_way_node_list() and
+ * add it to the way being built.
+ *
+ * \returns Pointer to the first byte after the encoded node list.
+ * \throws protozero::end_of_buffer_exception if the data is truncated.
+ */
+char const *
+decode_delta_encoded_way_node_list(char const *begin, char const *end,
+                                   osmium::builder::WayBuilder *builder);
+
+/**
+ * Does the node list encoded with add_delta_encoded_way_node_list() contain
+ * the specified node id?
+ */
+bool delta_encoded_way_node_list_contains(char const *begin, char const *end,
+                                          osmid_t id);
+
+/// Append encoded relation member list to data.
+void add_encoded_member_list(std::string *data,
+                             osmium::RelationMemberList const &members);
+
+/**
+ * Decode a member list encoded with add_encoded_member_list() and add it
+ * to the relation being built.
+ *
+ * \throws protozero::end_of_buffer_exception if the data is truncated.
+ */
+void decode_member_list(char const *begin, char const *end,
+                        osmium::builder::RelationBuilder *builder);
+
+/// Append one encoded tag to data.
+void add_encoded_tag(std::string *data, char const *key, char const *value);
+
+/// Append encoded tag list to data.
+void add_encoded_tag_list(std::string *data, osmium::TagList const &tags);
+
+/**
+ * Decode a tag list encoded with add_encoded_tag_list() and add it to the
+ * object being built.
+ *
+ * \throws protozero::end_of_buffer_exception if the data is truncated.
+ */
+void decode_tag_list(char const *begin, char const *end,
+                     osmium::builder::Builder *builder);
+
+#endif // OSM2PGSQL_MIDDLE_ENCODING_HPP
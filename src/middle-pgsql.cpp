@@ -18,11 +18,17 @@
 #include <stdexcept>
 #include <unordered_map>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <functional>
 #include <memory>
+#include <random>
 #include <utility>
+#include <vector>
 
 #include <osmium/builder/osm_object_builder.hpp>
 #include <osmium/memory/buffer.hpp>
@@ -30,8 +36,10 @@
 
 #include "format.hpp"
 #include "logging.hpp"
+#include "middle-encoding.hpp"
 #include "middle-pgsql.hpp"
 #include "node-locations.hpp"
+#include "node-location-cache.hpp"
 #include "node-persistent-cache.hpp"
 #include "options.hpp"
 #include "osmtypes.hpp"
@@ -56,6 +64,12 @@ static std::string build_sql(options_t const &options, char const *templ)
         fmt::arg("way_node_index_id_shift", options.way_node_index_id_shift));
 }
 
+static std::string middle_table_name(options_t const &options,
+                                     char const *suffix)
+{
+    return qualified_name(options.middle_dbschema, options.prefix + suffix);
+}
+
 middle_pgsql_t::table_desc::table_desc(options_t const &options,
                                        table_sql const &ts)
 : m_create_table(build_sql(options, ts.create_table)),
@@ -190,6 +204,16 @@ void pgsql_parse_members(char const *string, osmium::memory::Buffer *buffer,
     }
 }
 
+/// Get an int8 value from a result in binary format.
+osmid_t id_from_binary(char const *data) noexcept
+{
+    uint64_t value = 0;
+    for (std::size_t i = 0; i < sizeof(value); ++i) {
+        value = (value << 8U) | static_cast<unsigned char>(data[i]);
+    }
+    return static_cast<osmid_t>(value);
+}
+
 void pgsql_parse_nodes(char const *string, osmium::memory::Buffer *buffer,
                        osmium::builder::WayBuilder &builder)
 {
@@ -212,6 +236,20 @@ void middle_pgsql_t::buffer_store_tags(osmium::OSMObject const &obj, bool attrs)
 {
     if (obj.tags().empty() && !attrs) {
         m_db_copy.add_null_column();
+    } else if (m_compact) {
+        m_encode_buffer.clear();
+        add_encoded_tag_list(&m_encode_buffer, obj.tags());
+
+        if (attrs) {
+            taglist_t extra;
+            extra.add_attributes(obj);
+            for (auto const &it : extra) {
+                add_encoded_tag(&m_encode_buffer, it.key.c_str(),
+                                it.value.c_str());
+            }
+        }
+
+        m_db_copy.add_bytea_column(m_encode_buffer);
     } else {
         m_db_copy.new_array();
 
@@ -242,7 +280,7 @@ std::size_t middle_query_pgsql_t::get_way_node_locations_db(
     // get nodes where possible from cache,
     // at the same time build a list for querying missing nodes from DB
     for (auto &n : *nodes) {
-        auto const loc = m_cache->get(n.ref());
+        auto const loc = get_cached_location(n.ref());
         if (loc.valid()) {
             n.set_location(loc);
             ++count;
@@ -274,6 +312,12 @@ std::size_t middle_query_pgsql_t::get_way_node_locations_db(
         }
     }
 
+    if (m_update_cache) {
+        for (auto const &loc : locs) {
+            m_update_cache->set(loc.first, loc.second);
+        }
+    }
+
     return count;
 }
 
@@ -296,7 +340,7 @@ void middle_pgsql_t::way(osmium::Way const &way) {
         if (m_options->append) {
             way_delete(way.id());
         }
-        way_set(way);
+        way_set(way, m_options->extra_attributes);
     }
 }
 
@@ -307,7 +351,7 @@ void middle_pgsql_t::relation(osmium::Relation const &relation) {
         if (m_options->append) {
             relation_delete(relation.id());
         }
-        relation_set(relation);
+        relation_set(relation, m_options->extra_attributes);
     }
 }
 
@@ -315,6 +359,15 @@ void middle_pgsql_t::node_set(osmium::Node const &node)
 {
     m_cache->set(node.id(), node.location());
 
+    // Only report memory use from time to time, it doesn't change quickly.
+    if (++m_cache_inserts % (64 * 1024) == 0) {
+        m_cache_memory.update(m_cache->used_memory());
+    }
+
+    if (m_update_cache) {
+        m_update_cache->set(node.id(), node.location());
+    }
+
     if (!m_options->flat_node_file.empty()) {
         m_persistent_cache->set(node.id(), node.location());
     } else {
@@ -333,9 +386,12 @@ std::size_t middle_query_pgsql_t::get_way_node_locations_flatnodes(
     std::size_t count = 0;
 
     for (auto &n : *nodes) {
-        auto loc = m_cache->get(n.ref());
+        auto loc = get_cached_location(n.ref());
         if (!loc.valid() && n.ref() >= 0) {
             loc = m_persistent_cache->get(n.ref());
+            if (m_update_cache && loc.valid()) {
+                m_update_cache->set(n.ref(), loc);
+            }
         }
         n.set_location(loc);
         if (loc.valid()) {
@@ -346,6 +402,16 @@ std::size_t middle_query_pgsql_t::get_way_node_locations_flatnodes(
     return count;
 }
 
+osmium::Location middle_query_pgsql_t::get_cached_location(osmid_t id) const
+{
+    auto const loc = m_cache->get(id);
+    if (loc.valid() || !m_update_cache) {
+        return loc;
+    }
+
+    return m_update_cache->get(id);
+}
+
 size_t middle_query_pgsql_t::nodes_get_list(osmium::WayNodeList *nodes) const
 {
     return m_persistent_cache ? get_way_node_locations_flatnodes(nodes)
@@ -356,6 +422,10 @@ void middle_pgsql_t::node_delete(osmid_t osm_id)
 {
     assert(m_options->append);
 
+    if (m_update_cache) {
+        m_update_cache->remove(osm_id);
+    }
+
     if (!m_options->flat_node_file.empty()) {
         m_persistent_cache->set(osm_id, osmium::Location{});
     } else {
@@ -364,9 +434,69 @@ void middle_pgsql_t::node_delete(osmid_t osm_id)
     }
 }
 
+bool middle_pgsql_t::node_location_changed(osmium::Node const &node)
+{
+    if (!m_old_objects) {
+        return true;
+    }
+
+    m_old_objects_buffer.clear();
+    {
+        osmium::builder::WayNodeListBuilder builder{m_old_objects_buffer};
+        builder.add_node_ref(node.id());
+    }
+    m_old_objects_buffer.commit();
+
+    auto &nodes = m_old_objects_buffer.get<osmium::WayNodeList>(0);
+    m_old_objects->nodes_get_list(&nodes);
+
+    return nodes[0].location() != node.location();
+}
+
+bool middle_pgsql_t::way_nodes_changed(osmium::Way const &way)
+{
+    if (!m_old_objects) {
+        return true;
+    }
+
+    m_old_objects_buffer.clear();
+    if (!m_old_objects->way_get(way.id(), &m_old_objects_buffer)) {
+        return true;
+    }
+
+    auto const &old_nodes =
+        m_old_objects_buffer.get<osmium::Way>(0).nodes();
+    auto const &new_nodes = way.nodes();
+
+    return old_nodes.size() != new_nodes.size() ||
+           !std::equal(old_nodes.cbegin(), old_nodes.cend(),
+                       new_nodes.cbegin(),
+                       [](osmium::NodeRef const &a, osmium::NodeRef const &b) {
+                           return a.ref() == b.ref();
+                       });
+}
+
 idlist_t middle_pgsql_t::get_ways_by_node(osmid_t osm_id)
 {
-    return get_ids_from_db(&m_db_connection, "mark_ways_by_node", osm_id);
+    if (!m_compact) {
+        return get_ids_from_db(&m_db_connection, "mark_ways_by_node", osm_id);
+    }
+
+    // The index only finds ways with nodes in the same bucket, check
+    // the node lists for the actual node.
+    auto const res =
+        m_db_connection.exec_prepared_binary("mark_ways_by_node", osm_id);
+
+    idlist_t ids;
+    for (int i = 0; i < res.num_tuples(); ++i) {
+        char const *const nodes = res.get_value(i, 1);
+        if (delta_encoded_way_node_list_contains(
+                nodes, nodes + res.get_length(i, 1), osm_id)) {
+            ids.push_back(id_from_binary(res.get_value(i, 0)));
+        }
+    }
+
+    return ids;
 }
 
 idlist_t middle_pgsql_t::get_rels_by_node(osmid_t osm_id)
@@ -379,44 +509,117 @@ idlist_t middle_pgsql_t::get_rels_by_way(osmid_t osm_id)
     return get_ids_from_db(&m_db_connection, "mark_rels_by_way", osm_id);
 }
 
-void middle_pgsql_t::way_set(osmium::Way const &way)
+std::vector<std::size_t>
+middle_pgsql_t::get_relation_member_counts(idlist_t const &ids)
+{
+    std::unordered_map<osmid_t, std::size_t> counts;
+
+    // Query in chunks to keep the parameter size reasonable.
+    constexpr std::size_t const chunk_size = 10000;
+    for (std::size_t start = 0; start < ids.size(); start += chunk_size) {
+        util::string_id_list_t id_list;
+        auto const end = std::min(start + chunk_size, ids.size());
+        for (std::size_t i = start; i < end; ++i) {
+            id_list.add(ids[i]);
+        }
+
+        auto const res = m_db_connection.exec_prepared("get_rel_member_counts",
+                                                       id_list.get());
+        for (int i = 0; i < res.num_tuples(); ++i) {
+            counts.emplace(osmium::string_to_object_id(res.get_value(i, 0)),
+                           std::strtoull(res.get_value(i, 1), nullptr, 10));
+        }
+    }
+
+    std::vector<std::size_t> result;
+    result.reserve(ids.size());
+    for (auto const id : ids) {
+        auto const it = counts.find(id);
+        result.push_back(it == counts.end() ? 0 : it->second);
+    }
+
+    return result;
+}
+
+void middle_pgsql_t::way_set(osmium::Way const &way, bool attrs)
 {
     m_db_copy.new_line(m_tables.ways().copy_target());
 
     m_db_copy.add_column(way.id());
 
-    // nodes
-    m_db_copy.new_array();
-    for (auto const &n : way.nodes()) {
-        m_db_copy.add_array_elem(n.ref());
+    if (m_compact) {
+        m_encode_buffer.clear();
+        add_delta_encoded_way_node_list(&m_encode_buffer, way.nodes());
+        m_db_copy.add_bytea_column(m_encode_buffer);
+
+        // node buckets used for finding ways by node
+        std::vector<osmid_t> buckets;
+        buckets.reserve(way.nodes().size());
+        for (auto const &n : way.nodes()) {
+            buckets.push_back(n.ref() >> m_way_node_bucket_shift);
+        }
+        std::sort(buckets.begin(), buckets.end());
+        buckets.erase(std::unique(buckets.begin(), buckets.end()),
+                      buckets.end());
+
+        m_db_copy.new_array();
+        for (auto const bucket : buckets) {
+            m_db_copy.add_array_elem(bucket);
+        }
+        m_db_copy.finish_array();
+    } else {
+        // nodes
+        m_db_copy.new_array();
+        for (auto const &n : way.nodes()) {
+            m_db_copy.add_array_elem(n.ref());
+        }
+        m_db_copy.finish_array();
     }
-    m_db_copy.finish_array();
 
-    buffer_store_tags(way, m_options->extra_attributes);
+    buffer_store_tags(way, attrs);
 
     m_db_copy.finish_line();
 }
 
+void middle_query_pgsql_t::add_way_to_buffer(
+    pg_result_t const &res, int row, int col, osmid_t id,
+    osmium::memory::Buffer *buffer) const
+{
+    {
+        osmium::builder::WayBuilder builder{*buffer};
+        builder.set_id(id);
+
+        if (m_compact) {
+            char const *const nodes = res.get_value(row, col);
+            decode_delta_encoded_way_node_list(
+                nodes, nodes + res.get_length(row, col), &builder);
+            if (!res.is_null(row, col + 1)) {
+                char const *const tags = res.get_value(row, col + 1);
+                decode_tag_list(tags, tags + res.get_length(row, col + 1),
+                                &builder);
+            }
+        } else {
+            pgsql_parse_nodes(res.get_value(row, col), buffer, builder);
+            pgsql_parse_tags(res.get_value(row, col + 1), buffer, builder);
+        }
+    }
+
+    buffer->commit();
+}
+
 bool middle_query_pgsql_t::way_get(osmid_t id,
                                    osmium::memory::Buffer *buffer) const
 {
     assert(buffer);
 
-    auto const res = m_sql_conn.exec_prepared("get_way", id);
+    auto const res = m_compact ? m_sql_conn.exec_prepared_binary("get_way", id)
+                               : m_sql_conn.exec_prepared("get_way", id);
 
     if (res.num_tuples() != 1) {
         return false;
     }
 
-    {
-        osmium::builder::WayBuilder builder{*buffer};
-        builder.set_id(id);
-
-        pgsql_parse_nodes(res.get_value(0, 0), buffer, builder);
-        pgsql_parse_tags(res.get_value(0, 1), buffer, builder);
-    }
-
-    buffer->commit();
+    add_way_to_buffer(res, 0, 0, id, buffer);
 
     return true;
 }
@@ -447,8 +650,19 @@ middle_query_pgsql_t::rel_members_get(osmium::Relation const &rel,
         return 0;
     }
 
-    auto const res = m_sql_conn.exec_prepared("get_way_list", id_list.get());
-    idlist_t const wayidspg = get_ids_from_result(res);
+    auto const res =
+        m_compact ? m_sql_conn.exec_prepared_binary("get_way_list", id_list.get())
+                  : m_sql_conn.exec_prepared("get_way_list", id_list.get());
+
+    idlist_t wayidspg;
+    if (m_compact) {
+        wayidspg.reserve(static_cast<std::size_t>(res.num_tuples()));
+        for (int i = 0; i < res.num_tuples(); ++i) {
+            wayidspg.push_back(id_from_binary(res.get_value(i, 0)));
+        }
+    } else {
+        wayidspg = get_ids_from_result(res);
+    }
 
     // Match the list of ways coming from postgres in a different order
     //   back to the list of ways given by the caller */
@@ -459,15 +673,7 @@ middle_query_pgsql_t::rel_members_get(osmium::Relation const &rel,
         }
         for (int j = 0; j < res.num_tuples(); ++j) {
             if (m.ref() == wayidspg[static_cast<std::size_t>(j)]) {
-                {
-                    osmium::builder::WayBuilder builder{*buffer};
-                    builder.set_id(m.ref());
-
-                    pgsql_parse_nodes(res.get_value(j, 1), buffer, builder);
-                    pgsql_parse_tags(res.get_value(j, 2), buffer, builder);
-                }
-
-                buffer->commit();
+                add_way_to_buffer(res, j, 1, m.ref(), buffer);
                 ++outres;
                 break;
             }
@@ -484,7 +690,7 @@ void middle_pgsql_t::way_delete(osmid_t osm_id)
     m_db_copy.delete_object(osm_id);
 }
 
-void middle_pgsql_t::relation_set(osmium::Relation const &rel)
+void middle_pgsql_t::relation_set(osmium::Relation const &rel, bool attrs)
 {
     // Sort relation members by their type.
     idlist_t parts[3];
@@ -511,6 +717,10 @@ void middle_pgsql_t::relation_set(osmium::Relation const &rel)
     // members
     if (rel.members().empty()) {
         m_db_copy.add_null_column();
+    } else if (m_compact) {
+        m_encode_buffer.clear();
+        add_encoded_member_list(&m_encode_buffer, rel.members());
+        m_db_copy.add_bytea_column(m_encode_buffer);
     } else {
         m_db_copy.new_array();
         for (auto const &m : rel.members()) {
@@ -522,7 +732,7 @@ void middle_pgsql_t::relation_set(osmium::Relation const &rel)
     }
 
     // tags
-    buffer_store_tags(rel, m_options->extra_attributes);
+    buffer_store_tags(rel, attrs);
 
     m_db_copy.finish_line();
 }
@@ -532,7 +742,8 @@ bool middle_query_pgsql_t::relation_get(osmid_t id,
 {
     assert(buffer);
 
-    auto const res = m_sql_conn.exec_prepared("get_rel", id);
+    auto const res = m_compact ? m_sql_conn.exec_prepared_binary("get_rel", id)
+                               : m_sql_conn.exec_prepared("get_rel", id);
     // Fields are: members, tags, member_count */
     //
     if (res.num_tuples() != 1) {
@@ -543,8 +754,20 @@ bool middle_query_pgsql_t::relation_get(osmid_t id,
         osmium::builder::RelationBuilder builder{*buffer};
         builder.set_id(id);
 
-        pgsql_parse_members(res.get_value(0, 0), buffer, builder);
-        pgsql_parse_tags(res.get_value(0, 1), buffer, builder);
+        if (m_compact) {
+            if (!res.is_null(0, 0)) {
+                char const *const members = res.get_value(0, 0);
+                decode_member_list(members, members + res.get_length(0, 0),
+                                   &builder);
+            }
+            if (!res.is_null(0, 1)) {
+                char const *const tags = res.get_value(0, 1);
+                decode_tag_list(tags, tags + res.get_length(0, 1), &builder);
+            }
+        } else {
+            pgsql_parse_members(res.get_value(0, 0), buffer, builder);
+            pgsql_parse_tags(res.get_value(0, 1), buffer, builder);
+        }
     }
 
     buffer->commit();
@@ -562,6 +785,7 @@ void middle_pgsql_t::relation_delete(osmid_t osm_id)
 
 void middle_pgsql_t::after_nodes()
 {
+    m_cache_memory.update(m_cache->used_memory());
     m_db_copy.sync();
     if (m_options->flat_node_file.empty()) {
         auto const &table = m_tables.nodes();
@@ -571,6 +795,9 @@ void middle_pgsql_t::after_nodes()
 
 void middle_pgsql_t::after_ways()
 {
+    // Old versions of nodes and ways are not needed any more.
+    m_old_objects.reset();
+
     m_db_copy.sync();
     auto const &table = m_tables.ways();
     analyze_table(m_db_connection, table.schema(), table.name());
@@ -588,8 +815,10 @@ void middle_pgsql_t::after_relations()
 
 middle_query_pgsql_t::middle_query_pgsql_t(
     std::string const &conninfo, std::shared_ptr<node_locations_t> const &cache,
-    std::shared_ptr<node_persistent_cache> const &persistent_cache)
-: m_sql_conn(conninfo), m_cache(cache), m_persistent_cache(persistent_cache)
+    std::shared_ptr<node_persistent_cache> const &persistent_cache,
+    std::shared_ptr<node_location_cache_t> const &update_cache, bool compact)
+: m_sql_conn(conninfo), m_cache(cache), m_persistent_cache(persistent_cache),
+  m_update_cache(update_cache), m_compact(compact)
 {
     // Disable JIT and parallel workers as they are known to cause
     // problems when accessing the intarrays.
@@ -599,6 +828,10 @@ middle_query_pgsql_t::middle_query_pgsql_t(
 
 void middle_pgsql_t::start()
 {
+    if (m_migrate) {
+        migrate_to_compact();
+    }
+
     if (m_options->append) {
         // Disable JIT and parallel workers as they are known to cause
         // problems when accessing the intarrays.
@@ -611,6 +844,14 @@ void middle_pgsql_t::start()
                 m_db_connection.exec(table.m_prepare_fw_dep_lookups);
             }
         }
+
+        // Changed objects are compared with their old versions to find out
+        // whether dependent objects need updating. This uses its own
+        // connection, because it runs in a different thread than the
+        // dependency lookups.
+        if (m_options->with_forward_dependencies) {
+            m_old_objects = get_query_instance();
+        }
     } else {
         m_db_connection.exec("SET client_min_messages = WARNING");
         for (auto const &table : m_tables) {
@@ -623,9 +864,87 @@ void middle_pgsql_t::start()
     }
 }
 
+/**
+ * Get the state id of the update cache file matching the current state of
+ * the database. Returns 0 if there is none.
+ */
+static std::uint64_t get_update_cache_state_id(pg_conn_t *db_connection,
+                                               options_t const &options)
+{
+    auto const table = middle_table_name(options, "_update_cache_state");
+    auto const exists = db_connection->query(
+        PGRES_TUPLES_OK, "SELECT to_regclass('{}') IS NOT NULL"_format(table));
+    if (exists.num_tuples() == 0 || *exists.get_value(0, 0) != 't') {
+        return 0;
+    }
+
+    auto const res = db_connection->query(
+        PGRES_TUPLES_OK, "SELECT state_id FROM {}"_format(table));
+    if (res.num_tuples() != 1) {
+        return 0;
+    }
+    return static_cast<std::uint64_t>(
+        std::strtoll(res.get_value(0, 0), nullptr, 10));
+}
+
+/**
+ * Remove the update cache state id from the database. This is done before
+ * anything in the database is changed, so that after a failed update no
+ * update cache file will match the database.
+ */
+static void invalidate_update_cache_state_id(pg_conn_t *db_connection,
+                                             options_t const &options)
+{
+    db_connection->exec("DROP TABLE IF EXISTS {}"_format(
+        middle_table_name(options, "_update_cache_state")));
+}
+
+/// Store the state id of a newly written update cache file.
+static void set_update_cache_state_id(pg_conn_t *db_connection,
+                                      options_t const &options,
+                                      std::uint64_t state_id)
+{
+    auto const table = middle_table_name(options, "_update_cache_state");
+    db_connection->exec("BEGIN");
+    db_connection->exec("DROP TABLE IF EXISTS {}"_format(table));
+    db_connection->exec(
+        "CREATE TABLE {} (state_id int8 NOT NULL)"_format(table));
+    db_connection->exec("INSERT INTO {} (state_id) VALUES ({})"_format(
+        table, static_cast<std::int64_t>(state_id)));
+    db_connection->exec("COMMIT");
+}
+
+/// Create a new random (non-zero) state id for the update cache file.
+static std::uint64_t new_update_cache_state_id()
+{
+    std::random_device rd;
+    std::mt19937_64 generator{
+        (static_cast<std::uint64_t>(rd()) << 32U) ^ rd() ^
+        static_cast<std::uint64_t>(
+            std::chrono::system_clock::now().time_since_epoch().count())};
+    std::uint64_t state_id = 0;
+    while (state_id == 0) {
+        state_id = generator();
+    }
+    return state_id;
+}
+
 void middle_pgsql_t::stop()
 {
     m_cache.reset();
+    m_cache_memory.update(0);
+
+    if (m_update_cache) {
+        if (!m_options->update_cache_file.empty()) {
+            log_info("Saving {} node locations to update cache file '{}'.",
+                     m_update_cache->size(), m_options->update_cache_file);
+            auto const state_id = new_update_cache_state_id();
+            m_update_cache->save(m_options->update_cache_file, state_id);
+            set_update_cache_state_id(&m_db_connection, *m_options, state_id);
+        }
+        m_update_cache.reset();
+    }
+
     if (!m_options->flat_node_file.empty()) {
         m_persistent_cache.reset();
     }
@@ -678,6 +997,50 @@ static table_sql sql_for_nodes(bool create_table) noexcept
     return sql;
 }
 
+static table_sql sql_for_ways_compact() noexcept
+{
+    table_sql sql{};
+
+    sql.name = "{prefix}_ways";
+
+    // The nodes are delta encoded in a bytea column. To find ways by node
+    // the node ids shifted by the bucket shift are stored in an extra
+    // column. The shift is kept in the database, so it is known in
+    // append mode.
+    sql.create_table =
+        "CREATE {unlogged} TABLE {schema}\"{prefix}_ways\" ("
+        "  id int8 PRIMARY KEY {using_tablespace},"
+        "  nodes bytea NOT NULL,"
+        "  node_buckets int8[] NOT NULL,"
+        "  tags bytea"
+        ") {data_tablespace};\n"
+        "CREATE OR REPLACE FUNCTION"
+        "    {schema}\"{prefix}_way_node_bucket_shift\"()"
+        "  RETURNS int4 AS $$\n"
+        "  SELECT {way_node_index_id_shift}\n"
+        "$$ LANGUAGE SQL IMMUTABLE;\n";
+
+    sql.prepare_query = "PREPARE get_way(int8) AS"
+                        "  SELECT nodes, tags"
+                        "    FROM {schema}\"{prefix}_ways\" WHERE id = $1;\n"
+                        "PREPARE get_way_list(int8[]) AS"
+                        "  SELECT id, nodes, tags"
+                        "    FROM {schema}\"{prefix}_ways\""
+                        "      WHERE id = ANY($1::int8[]);\n";
+
+    sql.prepare_fw_dep_lookups =
+        "PREPARE mark_ways_by_node(int8) AS"
+        "  SELECT id, nodes FROM {schema}\"{prefix}_ways\""
+        "    WHERE node_buckets &&"
+        "      ARRAY[$1 >> {schema}\"{prefix}_way_node_bucket_shift\"()];\n";
+
+    sql.create_fw_dep_indexes =
+        "CREATE INDEX ON {schema}\"{prefix}_ways\" USING GIN (node_buckets)"
+        "  WITH (fastupdate = off) {index_tablespace};\n";
+
+    return sql;
+}
+
 static table_sql sql_for_ways(bool has_bucket_index,
                               uint8_t way_node_index_id_shift) noexcept
 {
@@ -734,20 +1097,33 @@ static table_sql sql_for_ways(bool has_bucket_index,
     return sql;
 }
 
-static table_sql sql_for_relations() noexcept
+static table_sql sql_for_relations(bool compact) noexcept
 {
     table_sql sql{};
 
     sql.name = "{prefix}_rels";
 
-    sql.create_table = "CREATE {unlogged} TABLE {schema}\"{prefix}_rels\" ("
-                       "  id int8 PRIMARY KEY {using_tablespace},"
-                       "  way_off int2,"
-                       "  rel_off int2,"
-                       "  parts int8[],"
-                       "  members text[],"
-                       "  tags text[]"
-                       ") {data_tablespace};\n";
+    if (compact) {
+        sql.create_table =
+            "CREATE {unlogged} TABLE {schema}\"{prefix}_rels\" ("
+            "  id int8 PRIMARY KEY {using_tablespace},"
+            "  way_off int2,"
+            "  rel_off int2,"
+            "  parts int8[],"
+            "  members bytea,"
+            "  tags bytea"
+            ") {data_tablespace};\n";
+    } else {
+        sql.create_table =
+            "CREATE {unlogged} TABLE {schema}\"{prefix}_rels\" ("
+            "  id int8 PRIMARY KEY {using_tablespace},"
+            "  way_off int2,"
+            "  rel_off int2,"
+            "  parts int8[],"
+            "  members text[],"
+            "  tags text[]"
+            ") {data_tablespace};\n";
+    }
 
     sql.prepare_query = "PREPARE get_rel(int8) AS"
                         "  SELECT members, tags"
@@ -761,7 +1137,10 @@ static table_sql sql_for_relations() noexcept
         "PREPARE mark_rels_by_way(int8) AS"
         "  SELECT id FROM {schema}\"{prefix}_rels\""
         "    WHERE parts && ARRAY[$1]"
-        "      AND parts[way_off+1:rel_off] && ARRAY[$1];\n";
+        "      AND parts[way_off+1:rel_off] && ARRAY[$1];\n"
+        "PREPARE get_rel_member_counts(int8[]) AS"
+        "  SELECT id, coalesce(cardinality(parts), 0)"
+        "    FROM {schema}\"{prefix}_rels\" WHERE id = ANY($1);\n";
 
     sql.create_fw_dep_indexes =
         "CREATE INDEX ON {schema}\"{prefix}_rels\" USING GIN (parts)"
@@ -770,6 +1149,131 @@ static table_sql sql_for_relations() noexcept
     return sql;
 }
 
+void middle_pgsql_t::migrate_to_compact()
+{
+    log_info("Migrating middle tables to compact format...");
+
+    // The tables in the compact format are built under temporary names
+    // next to the old tables and swapped in at the end in one transaction.
+    // If the migration is interrupted the old tables are still intact and
+    // the migration starts over on the next run.
+    options_t migrate_options = *m_options;
+    migrate_options.prefix += "_migrate";
+
+    table_desc new_ways{migrate_options, sql_for_ways_compact()};
+    table_desc new_rels{migrate_options, sql_for_relations(true)};
+
+    // Remove leftovers of an earlier migration that didn't finish.
+    m_db_connection.exec("SET client_min_messages = WARNING");
+    for (auto const *table : {&new_ways, &new_rels}) {
+        m_db_connection.exec("DROP TABLE IF EXISTS {}"_format(
+            qualified_name(table->schema(), table->name())));
+    }
+    m_db_connection.exec("RESET client_min_messages");
+
+    m_db_connection.exec(new_ways.m_create_table);
+    m_db_connection.exec(new_rels.m_create_table);
+
+    // way_set() and relation_set() write through the copy targets in
+    // m_tables, point them to the new tables while migrating.
+    std::swap(m_tables.ways(), new_ways);
+    std::swap(m_tables.relations(), new_rels);
+
+    // Read old tables with cursors in a transaction, objects are written
+    // to the new tables through the copy thread.
+    osmium::memory::Buffer buffer{4096, osmium::memory::Buffer::auto_grow::yes};
+
+    m_db_connection.exec("BEGIN");
+
+    m_db_connection.exec(
+        "DECLARE old_ways CURSOR FOR SELECT id, nodes, tags FROM {}"_format(
+            middle_table_name(*m_options, "_ways")));
+    for (;;) {
+        auto const res =
+            m_db_connection.query(PGRES_TUPLES_OK, "FETCH 10000 FROM old_ways");
+        if (res.num_tuples() == 0) {
+            break;
+        }
+        for (int i = 0; i < res.num_tuples(); ++i) {
+            buffer.clear();
+            {
+                osmium::builder::WayBuilder builder{buffer};
+                builder.set_id(osmium::string_to_object_id(res.get_value(i, 0)));
+                pgsql_parse_nodes(res.get_value(i, 1), &buffer, builder);
+                pgsql_parse_tags(res.get_value(i, 2), &buffer, builder);
+            }
+            buffer.commit();
+            // Attributes are already in the tags.
+            way_set(buffer.get<osmium::Way>(0), false);
+        }
+    }
+
+    m_db_connection.exec(
+        "DECLARE old_rels CURSOR FOR SELECT id, members, tags FROM {}"_format(
+            middle_table_name(*m_options, "_rels")));
+    for (;;) {
+        auto const res =
+            m_db_connection.query(PGRES_TUPLES_OK, "FETCH 10000 FROM old_rels");
+        if (res.num_tuples() == 0) {
+            break;
+        }
+        for (int i = 0; i < res.num_tuples(); ++i) {
+            buffer.clear();
+            {
+                osmium::builder::RelationBuilder builder{buffer};
+                builder.set_id(osmium::string_to_object_id(res.get_value(i, 0)));
+                pgsql_parse_members(res.get_value(i, 1), &buffer, builder);
+                pgsql_parse_tags(res.get_value(i, 2), &buffer, builder);
+            }
+            buffer.commit();
+            relation_set(buffer.get<osmium::Relation>(0), false);
+        }
+    }
+
+    m_db_connection.exec("COMMIT");
+    m_db_copy.sync();
+
+    std::swap(m_tables.ways(), new_ways);
+    std::swap(m_tables.relations(), new_rels);
+
+    for (auto const *table : {&new_ways, &new_rels}) {
+        if (!table->m_create_fw_dep_indexes.empty()) {
+            log_info("Building index on table '{}'", table->name());
+            m_db_connection.exec(table->m_create_fw_dep_indexes);
+        }
+    }
+
+    // Replace the old tables by the new ones.
+    m_db_connection.exec("BEGIN");
+    for (auto const type : {osmium::item_type::way, osmium::item_type::relation}) {
+        auto const &name = m_tables(type).name();
+        auto const &new_table =
+            type == osmium::item_type::way ? new_ways : new_rels;
+        auto const &schema = new_table.schema();
+
+        m_db_connection.exec(
+            "DROP TABLE {}"_format(qualified_name(schema, name)));
+        m_db_connection.exec("ALTER TABLE {} RENAME TO \"{}\""_format(
+            qualified_name(schema, new_table.name()), name));
+        m_db_connection.exec(
+            "ALTER INDEX IF EXISTS {} RENAME TO \"{}_pkey\""_format(
+                qualified_name(schema, new_table.name() + "_pkey"), name));
+    }
+    m_db_connection.exec("DROP FUNCTION IF EXISTS {}(int8[])"_format(
+        middle_table_name(*m_options, "_index_bucket")));
+    m_db_connection.exec("DROP FUNCTION IF EXISTS {}()"_format(
+        middle_table_name(*m_options, "_way_node_bucket_shift")));
+    m_db_connection.exec("ALTER FUNCTION {}() RENAME TO \"{}\""_format(
+        middle_table_name(migrate_options, "_way_node_bucket_shift"),
+        m_options->prefix + "_way_node_bucket_shift"));
+    m_db_connection.exec("COMMIT");
+
+    for (auto const type : {osmium::item_type::way, osmium::item_type::relation}) {
+        auto const &table = m_tables(type);
+        analyze_table(m_db_connection, table.schema(), table.name());
+    }
+}
+
 static bool check_bucket_index(pg_conn_t *db_connection,
                                std::string const &prefix)
 {
@@ -780,6 +1284,27 @@ static bool check_bucket_index(pg_conn_t *db_connection,
     return res.num_tuples() > 0;
 }
 
+static bool check_compact_middle(pg_conn_t *db_connection,
+                                 options_t const &options)
+{
+    auto const res = db_connection->query(
+        PGRES_TUPLES_OK,
+        "SELECT atttypid = 'bytea'::regtype FROM pg_attribute"
+        "  WHERE attrelid = to_regclass('{}') AND attname = 'nodes';"_format(
+            middle_table_name(options, "_ways")));
+    return res.num_tuples() > 0 && *res.get_value(0, 0) == 't';
+}
+
+static uint8_t get_way_node_bucket_shift(pg_conn_t *db_connection,
+                                         options_t const &options)
+{
+    auto const res = db_connection->query(
+        PGRES_TUPLES_OK,
+        "SELECT {}()"_format(
+            middle_table_name(options, "_way_node_bucket_shift")));
+    return static_cast<uint8_t>(std::strtoul(res.get_value(0, 0), nullptr, 10));
+}
+
 middle_pgsql_t::middle_pgsql_t(std::shared_ptr<thread_pool_t> thread_pool,
                                options_t const *options)
 : middle_t(std::move(thread_pool)), m_options(options),
@@ -795,7 +1320,44 @@ middle_pgsql_t::middle_pgsql_t(std::shared_ptr<thread_pool_t> thread_pool,
             options->flat_node_file, options->droptemp);
     }
 
-    log_debug("Mid: pgsql, cache={}", options->cache);
+    if (options->append && options->update_cache > 0) {
+        m_update_cache = std::make_shared<node_location_cache_t>(
+            static_cast<std::size_t>(options->update_cache) * 1024UL * 1024UL);
+        if (!options->update_cache_file.empty()) {
+            auto const state_id =
+                get_update_cache_state_id(&m_db_connection, *options);
+            if (state_id != 0 &&
+                m_update_cache->load(options->update_cache_file, state_id)) {
+                log_info(
+                    "Loaded {} node locations from update cache file '{}'.",
+                    m_update_cache->size(), options->update_cache_file);
+            }
+            std::remove(options->update_cache_file.c_str());
+        }
+    }
+
+    // Every run changes the database, so an update cache file written
+    // earlier doesn't match it any more, whether this run uses the update
+    // cache or not.
+    invalidate_update_cache_state_id(&m_db_connection, *options);
+
+    log_debug("Mid: pgsql, cache={}, update cache={}", options->cache,
+              m_update_cache ? options->update_cache : 0);
+
+    m_compact = options->middle_compact;
+    m_way_node_bucket_shift = options->way_node_index_id_shift;
+
+    if (options->append) {
+        if (check_compact_middle(&m_db_connection, *options)) {
+            m_compact = true;
+            m_way_node_bucket_shift =
+                get_way_node_bucket_shift(&m_db_connection, *options);
+        } else if (m_compact) {
+            m_migrate = true;
+        }
+    }
+
+    log_debug("Mid: format={}", m_compact ? "compact" : "array");
 
     bool const has_bucket_index =
         check_bucket_index(&m_db_connection, options->prefix);
@@ -808,9 +1370,11 @@ middle_pgsql_t::middle_pgsql_t(std::shared_ptr<thread_pool_t> thread_pool,
     m_tables.nodes() =
         table_desc{*options, sql_for_nodes(options->flat_node_file.empty())};
     m_tables.ways() =
-        table_desc{*options, sql_for_ways(has_bucket_index,
-                                          options->way_node_index_id_shift)};
-    m_tables.relations() = table_desc{*options, sql_for_relations()};
+        m_compact ? table_desc{*options, sql_for_ways_compact()}
+                  : table_desc{*options,
+                               sql_for_ways(has_bucket_index,
+                                            options->way_node_index_id_shift)};
+    m_tables.relations() = table_desc{*options, sql_for_relations(m_compact)};
 }
 
 std::shared_ptr<middle_query_t>
@@ -819,7 +1383,8 @@ middle_pgsql_t::get_query_instance()
     // NOTE: this is thread safe for use in pending async processing only because
     // during that process they are only read from
     auto mid = std::make_unique<middle_query_pgsql_t>(
-        m_options->database_options.conninfo(), m_cache, m_persistent_cache);
+        m_options->database_options.conninfo(), m_cache, m_persistent_cache,
+        m_update_cache, m_compact);
 
     // We use a connection per table to enable the use of COPY
     for (auto &table : m_tables) {
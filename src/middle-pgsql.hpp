@@ -21,11 +21,14 @@
 #include <memory>
 
 #include <osmium/index/nwr_array.hpp>
+#include <osmium/memory/buffer.hpp>
 
 #include "db-copy-mgr.hpp"
+#include "memory-tracker.hpp"
 #include "middle.hpp"
 #include "pgsql.hpp"
 
+class node_location_cache_t;
 class node_locations_t;
 class node_persistent_cache;
 class options_t;
@@ -36,7 +39,9 @@ public:
     middle_query_pgsql_t(
         std::string const &conninfo,
         std::shared_ptr<node_locations_t> const &cache,
-        std::shared_ptr<node_persistent_cache> const &persistent_cache);
+        std::shared_ptr<node_persistent_cache> const &persistent_cache,
+        std::shared_ptr<node_location_cache_t> const &update_cache,
+        bool compact);
 
     size_t nodes_get_list(osmium::WayNodeList *nodes) const override;
 
@@ -55,9 +60,26 @@ private:
     std::size_t get_way_node_locations_flatnodes(osmium::WayNodeList *nodes) const;
     std::size_t get_way_node_locations_db(osmium::WayNodeList *nodes) const;
 
+    /**
+     * Get location of a node from the in-memory caches. Returns an invalid
+     * location if the node is in neither cache.
+     */
+    osmium::Location get_cached_location(osmid_t id) const;
+
+    /**
+     * Add way with the node list and tags from the specified columns of the
+     * result row to the buffer.
+     */
+    void add_way_to_buffer(pg_result_t const &res, int row, int col,
+                           osmid_t id, osmium::memory::Buffer *buffer) const;
+
     pg_conn_t m_sql_conn;
     std::shared_ptr<node_locations_t> m_cache;
     std::shared_ptr<node_persistent_cache> m_persistent_cache;
+    std::shared_ptr<node_location_cache_t> m_update_cache;
+
+    /// Are the middle tables in the compact format?
+    bool m_compact;
 };
 
 struct table_sql {
@@ -86,10 +108,16 @@ struct middle_pgsql_t : public middle_t
     void after_ways() override;
     void after_relations() override;
 
+    bool node_location_changed(osmium::Node const &node) override;
+    bool way_nodes_changed(osmium::Way const &way) override;
+
     idlist_t get_ways_by_node(osmid_t osm_id) override;
     idlist_t get_rels_by_node(osmid_t osm_id) override;
     idlist_t get_rels_by_way(osmid_t osm_id) override;
 
+    std::vector<std::size_t>
+    get_relation_member_counts(idlist_t const &ids) override;
+
     class table_desc
     {
     public:
@@ -137,14 +165,21 @@ private:
     void node_set(osmium::Node const &node);
     void node_delete(osmid_t id);
 
-    void way_set(osmium::Way const &way);
+    void way_set(osmium::Way const &way, bool attrs);
     void way_delete(osmid_t id);
 
-    void relation_set(osmium::Relation const &rel);
+    void relation_set(osmium::Relation const &rel, bool attrs);
     void relation_delete(osmid_t id);
 
     void buffer_store_tags(osmium::OSMObject const &obj, bool attrs);
 
+    /**
+     * Convert the ways and relations tables from the array format to the
+     * compact format. Used in append mode when the compact format was
+     * requested but the existing tables are in the array format.
+     */
+    void migrate_to_compact();
+
     osmium::nwr_array<table_desc> m_tables;
 
     options_t const *m_options;
@@ -152,11 +187,45 @@ private:
     std::shared_ptr<node_locations_t> m_cache;
     std::shared_ptr<node_persistent_cache> m_persistent_cache;
 
+    /**
+     * Cache for locations of nodes touched by updates. Only used in append
+     * mode if enabled with --update-cache (nullptr otherwise).
+     */
+    std::shared_ptr<node_location_cache_t> m_update_cache;
+
+    /// Memory used by the node cache (m_cache).
+    tracked_memory_t m_cache_memory{"middle node cache"};
+
+    /// Number of nodes added to the node cache, used to update m_cache_memory.
+    std::size_t m_cache_inserts = 0;
+
     pg_conn_t m_db_connection;
 
     // middle keeps its own thread for writing to the database.
     std::shared_ptr<db_copy_thread_t> m_copy_thread;
     db_copy_mgr_t<db_deleter_by_id_t> m_db_copy;
+
+    /// Are the ways and relations tables in the compact format?
+    bool m_compact = false;
+
+    /// Do the tables need to be migrated to the compact format in start()?
+    bool m_migrate = false;
+
+    /// Shift used for the node buckets of ways in the compact format.
+    uint8_t m_way_node_bucket_shift = 0;
+
+    /// Buffer for encoding data in the compact format.
+    std::string m_encode_buffer;
+
+    /**
+     * Used in append mode to look up the old versions of changed objects
+     * before they are overwritten (nullptr if not needed).
+     */
+    std::shared_ptr<middle_query_t> m_old_objects;
+
+    /// Buffer for objects read through m_old_objects.
+    osmium::memory::Buffer m_old_objects_buffer{
+        1024, osmium::memory::Buffer::auto_grow::yes};
 };
 
 #endif // OSM2PGSQL_MIDDLE_PGSQL_HPP
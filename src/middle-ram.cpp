@@ -8,18 +8,11 @@
  */
 
 #include "logging.hpp"
+#include "middle-encoding.hpp"
 #include "middle-ram.hpp"
 #include "options.hpp"
 
 #include <osmium/builder/osm_object_builder.hpp>
-#include <osmium/util/delta.hpp>
-
-// Workaround: This must be included before buffer_string.hpp due to a missing
-// include in the upstream code. https://github.com/mapbox/protozero/pull/104
-#include <protozero/config.hpp>
-
-#include <protozero/buffer_string.hpp>
-#include <protozero/varint.hpp>
 
 #include <cassert>
 #include <memory>
@@ -106,6 +99,27 @@ void middle_ram_t::stop()
     for (auto &index : m_object_index) {
         index.clear();
     }
+
+    m_memory.update(0);
+}
+
+void middle_ram_t::update_memory_usage()
+{
+    // Computing the memory use isn't free, so don't do it for every object.
+    if (++m_objects_since_update < 64 * 1024) {
+        return;
+    }
+    m_objects_since_update = 0;
+
+    std::size_t index_mem = 0;
+    for (auto const &index : m_object_index) {
+        index_mem += index.used_memory();
+    }
+
+    m_memory.update(m_node_locations.used_memory() +
+                    m_way_nodes_data.capacity() +
+                    m_way_nodes_index.used_memory() +
+                    m_object_buffer.capacity() + index_mem);
 }
 
 void middle_ram_t::store_object(osmium::OSMObject const &object)
@@ -130,22 +144,6 @@ bool middle_ram_t::get_object(osmium::item_type type, osmid_t id,
     return true;
 }
 
-static void add_delta_encoded_way_node_list(std::string *data,
-                                            osmium::WayNodeList const &wnl)
-{
-    assert(data);
-
-    // Add number of nodes in list
-    protozero::add_varint_to_buffer(data, wnl.size());
-
-    // Add delta encoded node ids
-    osmium::DeltaEncode<osmid_t> delta;
-    for (auto const &nr : wnl) {
-        protozero::add_varint_to_buffer(
-            data, protozero::encode_zigzag64(delta.update(nr.ref())));
-    }
-}
-
 void middle_ram_t::node(osmium::Node const &node)
 {
     assert(node.visible());
@@ -158,6 +156,8 @@ void middle_ram_t::node(osmium::Node const &node)
         (!node.tags().empty() || m_store_options.untagged_nodes)) {
         store_object(node);
     }
+
+    update_memory_usage();
 }
 
 void middle_ram_t::way(osmium::Way const &way)
@@ -173,6 +173,8 @@ void middle_ram_t::way(osmium::Way const &way)
     if (m_store_options.ways) {
         store_object(way);
     }
+
+    update_memory_usage();
 }
 
 void middle_ram_t::relation(osmium::Relation const &relation)
@@ -182,6 +184,8 @@ void middle_ram_t::relation(osmium::Relation const &relation)
     if (m_store_options.relations) {
         store_object(relation);
     }
+
+    update_memory_usage();
 }
 
 std::size_t middle_ram_t::nodes_get_list(osmium::WayNodeList *nodes) const
@@ -212,27 +216,6 @@ bool middle_ram_t::way_get(osmid_t id, osmium::memory::Buffer *buffer) const
     return false;
 }
 
-static void
-get_delta_encoded_way_nodes_list(std::string const &data, std::size_t offset,
-                                 osmium::builder::WayBuilder *builder)
-{
-    assert(builder);
-
-    char const *begin = data.data() + offset;
-    char const *const end = data.data() + data.size();
-
-    auto count = protozero::decode_varint(&begin, end);
-
-    osmium::DeltaDecode<osmid_t> delta;
-    osmium::builder::WayNodeListBuilder wnl_builder{*builder};
-    while (count > 0) {
-        auto const val =
-            protozero::decode_zigzag64(protozero::decode_varint(&begin, end));
-        wnl_builder.add_node_ref(delta.update(val));
-        --count;
-    }
-}
-
 std::size_t
 middle_ram_t::rel_members_get(osmium::Relation const &rel,
                               osmium::memory::Buffer *buffer,
@@ -275,8 +258,10 @@ middle_ram_t::rel_members_get(osmium::Relation const &rel,
                 if (offset != ordered_index_t::not_found_value()) {
                     osmium::builder::WayBuilder builder{*buffer};
                     builder.set_id(member.ref());
-                    get_delta_encoded_way_nodes_list(m_way_nodes_data, offset,
-                                                     &builder);
+                    decode_delta_encoded_way_node_list(
+                        m_way_nodes_data.data() + offset,
+                        m_way_nodes_data.data() + m_way_nodes_data.size(),
+                        &builder);
                 }
                 buffer->commit();
                 ++count;
@@ -10,6 +10,7 @@
  * For a full list of authors see the git log.
  */
 
+#include "memory-tracker.hpp"
 #include "middle.hpp"
 #include "node-locations.hpp"
 #include "osmtypes.hpp"
@@ -93,6 +94,9 @@ private:
 
     void store_object(osmium::OSMObject const &object);
 
+    /// Report memory use to the memory tracker from time to time.
+    void update_memory_usage();
+
     bool get_object(osmium::item_type type, osmid_t id,
                     osmium::memory::Buffer *buffer) const;
 
@@ -114,6 +118,12 @@ private:
 
     /// Options for this middle.
     middle_ram_options m_store_options;
+
+    /// Memory used by all the stores above.
+    tracked_memory_t m_memory{"middle (ram)"};
+
+    /// Number of objects added since memory use was last reported.
+    std::size_t m_objects_since_update = 0;
 }; // class middle_ram_t
 
 #endif // OSM2PGSQL_MIDDLE_RAM_HPP
@@ -13,7 +13,9 @@
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm/entity_bits.hpp>
 
+#include <cstddef>
 #include <memory>
+#include <vector>
 
 #include "osmtypes.hpp"
 #include "thread-pool.hpp"
@@ -113,10 +115,45 @@ public:
     /// Called after all relations from the input file(s) have been processed.
     virtual void after_relations() {}
 
+    /**
+     * Has the location of this node changed compared to the version
+     * currently stored in the middle? This is called in append mode before
+     * the new version is stored. Returns true if the old version is not
+     * known.
+     */
+    virtual bool node_location_changed(osmium::Node const & /*node*/)
+    {
+        return true;
+    }
+
+    /**
+     * Has the node list of this way changed compared to the version
+     * currently stored in the middle? This is called in append mode before
+     * the new version is stored. Returns true if the old version is not
+     * known.
+     */
+    virtual bool way_nodes_changed(osmium::Way const & /*way*/)
+    {
+        return true;
+    }
+
     virtual idlist_t get_ways_by_node(osmid_t) { return {}; }
     virtual idlist_t get_rels_by_node(osmid_t) { return {}; }
     virtual idlist_t get_rels_by_way(osmid_t) { return {}; }
 
+    /**
+     * Get the number of members of the specified relations. This is used
+     * as an estimate for the cost of processing the relations.
+     *
+     * \returns One entry for each id (0 for relations not found) or an
+     *          empty vector if this middle can't provide the information.
+     */
+    virtual std::vector<std::size_t>
+    get_relation_member_counts(idlist_t const & /*ids*/)
+    {
+        return {};
+    }
+
     virtual std::shared_ptr<middle_query_t> get_query_instance() = 0;
 
     virtual void set_requirements(output_requirements const &) {}
@@ -0,0 +1,242 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "node-location-cache.hpp"
+#include "format.hpp"
+#include "logging.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+/// Magic string at the start of the cache file.
+constexpr char const file_magic[8] = {'O', '2', 'P', 'N', 'L', 'C', '0', '2'};
+
+/// On-disk format of one entry in the cache file.
+struct file_entry_t
+{
+    std::int64_t id;
+    std::int32_t x;
+    std::int32_t y;
+};
+
+} // anonymous namespace
+
+node_location_cache_t::node_location_cache_t(std::size_t max_size)
+: m_capacity(max_size / bytes_per_entry)
+{
+    m_slots.reserve(m_capacity);
+    m_index.reserve(m_capacity);
+    m_memory.update(m_capacity * bytes_per_entry);
+}
+
+void node_location_cache_t::add(osmid_t id, osmium::Location location)
+{
+    if (m_capacity == 0) {
+        return;
+    }
+
+    auto const it = m_index.find(id);
+    if (it != m_index.end()) {
+        auto &slot = m_slots[it->second];
+        slot.location = location;
+        slot.referenced = true;
+        return;
+    }
+
+    if (m_slots.size() < m_capacity) {
+        m_index.emplace(id, m_slots.size());
+        m_slots.push_back({id, location, true});
+        return;
+    }
+
+    // Cache is full: Advance the hand until we find an entry that has not
+    // been referenced since the hand last came by and replace that one.
+    while (m_slots[m_hand].referenced) {
+        m_slots[m_hand].referenced = false;
+        if (++m_hand == m_slots.size()) {
+            m_hand = 0;
+        }
+    }
+
+    auto &slot = m_slots[m_hand];
+    m_index.erase(slot.id);
+    m_index.emplace(id, m_hand);
+    slot = {id, location, true};
+
+    if (++m_hand == m_slots.size()) {
+        m_hand = 0;
+    }
+}
+
+void node_location_cache_t::remove_slot(std::size_t n)
+{
+    m_index.erase(m_slots[n].id);
+
+    // Move last entry into the free slot to keep the slots dense.
+    if (n != m_slots.size() - 1) {
+        m_slots[n] = m_slots.back();
+        m_index[m_slots[n].id] = n;
+    }
+    m_slots.pop_back();
+
+    if (m_hand >= m_slots.size()) {
+        m_hand = 0;
+    }
+}
+
+void node_location_cache_t::set(osmid_t id, osmium::Location location)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    if (location.valid()) {
+        add(id, location);
+        return;
+    }
+
+    auto const it = m_index.find(id);
+    if (it != m_index.end()) {
+        remove_slot(it->second);
+    }
+}
+
+osmium::Location node_location_cache_t::get(osmid_t id)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto const it = m_index.find(id);
+    if (it == m_index.end()) {
+        return osmium::Location{};
+    }
+
+    auto &slot = m_slots[it->second];
+    slot.referenced = true;
+    return slot.location;
+}
+
+void node_location_cache_t::remove(osmid_t id)
+{
+    set(id, osmium::Location{});
+}
+
+std::size_t node_location_cache_t::size() const
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+    return m_slots.size();
+}
+
+bool node_location_cache_t::load(std::string const &filename,
+                                 std::uint64_t state_id)
+{
+    FILE *const file = std::fopen(filename.c_str(), "rb");
+    if (!file) {
+        if (errno == ENOENT) {
+            return false;
+        }
+        throw std::runtime_error{
+            "Unable to open node location cache file '{}': {}"_format(
+                filename, std::strerror(errno))};
+    }
+
+    char magic[sizeof(file_magic)];
+    if (std::fread(magic, sizeof(magic), 1, file) != 1 ||
+        std::memcmp(magic, file_magic, sizeof(magic)) != 0) {
+        std::fclose(file);
+        throw std::runtime_error{
+            "File '{}' is not a node location cache file."_format(filename)};
+    }
+
+    std::uint64_t file_state_id = 0;
+    if (std::fread(&file_state_id, sizeof(file_state_id), 1, file) != 1 ||
+        file_state_id != state_id) {
+        std::fclose(file);
+        log_warn("Node location cache file '{}' doesn't match the state of "
+                 "the database. Not using it.",
+                 filename);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    file_entry_t entry{};
+    while (std::fread(&entry, sizeof(entry), 1, file) == 1) {
+        add(entry.id, osmium::Location{entry.x, entry.y});
+    }
+
+    bool const failed = std::ferror(file) != 0;
+    std::fclose(file);
+
+    if (failed) {
+        throw std::runtime_error{
+            "Error reading node location cache file '{}'."_format(filename)};
+    }
+
+    // Entries have been added in the order they were saved in, start
+    // evicting at the beginning.
+    m_hand = 0;
+
+    return true;
+}
+
+void node_location_cache_t::save(std::string const &filename,
+                                 std::uint64_t state_id) const
+{
+    std::string const tmp_filename = filename + ".tmp";
+
+    FILE *const file = std::fopen(tmp_filename.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error{
+            "Unable to open node location cache file '{}': {}"_format(
+                tmp_filename, std::strerror(errno))};
+    }
+
+    bool ok = std::fwrite(file_magic, sizeof(file_magic), 1, file) == 1 &&
+              std::fwrite(&state_id, sizeof(state_id), 1, file) == 1;
+
+    {
+        std::lock_guard<std::mutex> const guard{m_mutex};
+
+        // Write entries starting at the hand position, so that the entries
+        // that would be evicted next are at the beginning of the file and
+        // are evicted first after loading.
+        for (std::size_t i = 0; ok && i < m_slots.size(); ++i) {
+            auto const &slot = m_slots[(m_hand + i) % m_slots.size()];
+            file_entry_t const entry{slot.id, slot.location.x(),
+                                     slot.location.y()};
+            ok = std::fwrite(&entry, sizeof(entry), 1, file) == 1;
+        }
+    }
+
+    if (std::fclose(file) != 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error{
+            "Error writing node location cache file '{}'."_format(
+                tmp_filename)};
+    }
+
+#ifdef _WIN32
+    // On Windows rename() doesn't replace existing files.
+    std::remove(filename.c_str());
+#endif
+
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error{
+            "Unable to rename node location cache file '{}' to '{}': {}"_format(
+                tmp_filename, filename, std::strerror(errno))};
+    }
+}
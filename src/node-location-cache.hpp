@@ -0,0 +1,122 @@
+#ifndef OSM2PGSQL_NODE_LOCATION_CACHE_HPP
+#define OSM2PGSQL_NODE_LOCATION_CACHE_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "memory-tracker.hpp"
+#include "osmtypes.hpp"
+
+#include <osmium/osm/location.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A cache for node locations with a fixed maximum size. Unlike the
+ * node_locations_t class, ids can be added in any order. When the cache
+ * is full, entries are evicted using the CLOCK algorithm, so locations
+ * that have been used recently stay in the cache.
+ *
+ * This is used in append mode to keep the locations of nodes touched by
+ * updates in memory. The content can be saved to a file and loaded again
+ * when the next update is run. The file contains a state id, which must
+ * match the state id stored in the database, so that a file can never be
+ * used with a different database or after a failed update.
+ *
+ * All functions are thread-safe.
+ */
+class node_location_cache_t
+{
+public:
+    /**
+     * Create a cache using up to about max_size bytes of memory.
+     */
+    explicit node_location_cache_t(std::size_t max_size);
+
+    /**
+     * Store a node location. Storing an invalid location removes the node
+     * from the cache.
+     */
+    void set(osmid_t id, osmium::Location location);
+
+    /**
+     * Retrieve a node location. If the location is not in the cache, an
+     * invalid Location will be returned.
+     */
+    osmium::Location get(osmid_t id);
+
+    /// Remove a node from the cache.
+    void remove(osmid_t id);
+
+    /// The number of locations stored.
+    std::size_t size() const;
+
+    /// The maximum number of locations that can be stored.
+    std::size_t capacity() const noexcept { return m_capacity; }
+
+    /**
+     * Load cache content from a file written by save(). Locations are
+     * added to what is already in the cache.
+     *
+     * \param filename Name of the file.
+     * \param state_id Only load the file if it was saved with this state id.
+     * \returns false if the file doesn't exist or has a different state id.
+     * \throws std::runtime_error if the file can't be read.
+     */
+    bool load(std::string const &filename, std::uint64_t state_id);
+
+    /**
+     * Save the cache content to a file. The content is written to a
+     * temporary file first which is then renamed, so the file is never
+     * left half-written.
+     *
+     * \param filename Name of the file.
+     * \param state_id State id stored in the file.
+     * \throws std::runtime_error if the file can't be written.
+     */
+    void save(std::string const &filename, std::uint64_t state_id) const;
+
+private:
+    struct slot_t
+    {
+        osmid_t id;
+        osmium::Location location;
+        bool referenced;
+    };
+
+    void add(osmid_t id, osmium::Location location);
+    void remove_slot(std::size_t n);
+
+    /// Approximate number of bytes used per entry (slot and hash map entry).
+    static constexpr std::size_t const bytes_per_entry = 64;
+
+    std::size_t m_capacity;
+
+    /// The cache entries.
+    std::vector<slot_t> m_slots;
+
+    /// Maps node ids to the index of their entry in m_slots.
+    std::unordered_map<osmid_t, std::size_t> m_index;
+
+    /// The "clock hand": Position of the next candidate for eviction.
+    std::size_t m_hand = 0;
+
+    /// Memory reserved for the cache.
+    tracked_memory_t m_memory{"middle update cache"};
+
+    mutable std::mutex m_mutex;
+
+}; // class node_location_cache_t
+
+#endif // OSM2PGSQL_NODE_LOCATION_CACHE_HPP
@@ -11,6 +11,7 @@
 #include "format.hpp"
 #include "logging.hpp"
 #include "options.hpp"
+#include "pgsql-loopback.hpp"
 #include "reprojection.hpp"
 #include "util.hpp"
 #include "version.hpp"
@@ -47,19 +48,28 @@ namespace {
 char const *const short_options =
     "ab:cd:KhlmMp:suvU:WH:P:i:IE:C:S:e:o:O:xkjGz:r:VF:";
 
+/// Smallest value allowed for --memory-limit (in MB).
+constexpr int const min_memory_limit = 256;
+
 struct option const long_options[] = {
     {"append", no_argument, nullptr, 'a'},
     {"bbox", required_argument, nullptr, 'b'},
     {"cache", required_argument, nullptr, 'C'},
     {"cache-strategy", required_argument, nullptr, 204},
     {"create", no_argument, nullptr, 'c'},
+    {"copy-threads", required_argument, nullptr, 218},
     {"database", required_argument, nullptr, 'd'},
+    {"disable-input-pipeline", no_argument, nullptr, 230},
     {"disable-parallel-indexing", no_argument, nullptr, 'I'},
     {"drop", no_argument, nullptr, 206},
     {"expire-bbox-size", required_argument, nullptr, 214},
+    {"expire-collapse", no_argument, nullptr, 225},
+    {"expire-format", required_argument, nullptr, 224},
+    {"expire-metatile-size", required_argument, nullptr, 223},
     {"expire-output", required_argument, nullptr, 'o'},
     {"expire-tiles", required_argument, nullptr, 'e'},
     {"extra-attributes", no_argument, nullptr, 'x'},
+    {"extra-output", required_argument, nullptr, 222},
     {"flat-nodes", required_argument, nullptr, 'F'},
     {"help", no_argument, nullptr, 'h'},
     {"host", required_argument, nullptr, 'H'},
@@ -75,7 +85,11 @@ struct option const long_options[] = {
     {"log-progress", required_argument, nullptr, 401},
     {"log-sql", no_argument, nullptr, 402},
     {"log-sql-data", no_argument, nullptr, 403},
+    {"loopback-database", no_argument, nullptr, 227},
+    {"memory-limit", required_argument, nullptr, 221},
     {"merc", no_argument, nullptr, 'm'},
+    {"metrics-port", required_argument, nullptr, 228},
+    {"middle-format", required_argument, nullptr, 226},
     {"middle-schema", required_argument, nullptr, 215},
     {"middle-way-node-index-id-shift", required_argument, nullptr, 300},
     {"multi-geometry", no_argument, nullptr, 'G'},
@@ -94,7 +108,10 @@ struct option const long_options[] = {
     {"tablespace-main-index", required_argument, nullptr, 203},
     {"tablespace-slim-data", required_argument, nullptr, 200},
     {"tablespace-slim-index", required_argument, nullptr, 201},
+    {"tag-transform-cache", required_argument, nullptr, 229},
     {"tag-transform-script", required_argument, nullptr, 212},
+    {"update-cache", required_argument, nullptr, 219},
+    {"update-cache-file", required_argument, nullptr, 220},
     {"username", required_argument, nullptr, 'U'},
     {"verbose", no_argument, nullptr, 'v'},
     {"version", no_argument, nullptr, 'V'},
@@ -133,16 +150,27 @@ Common options:\n\
                     filtering and normalisation (pgsql output only).\n",
                stdout);
 #endif
+    std::fputs("\
+       --tag-transform-cache=NUM  Cache tag transform results for up to NUM\n\
+                    distinct tag sets (pgsql output only, default: 0 = off).\n",
+               stdout);
     std::fputs("\
     -s|--slim       Store temporary data in the database. This switch is\n\
                     required if you want to update with --append later.\n\
         --drop      Only with --slim: drop temporary tables after import\n\
                     (no updates are possible).\n\
     -C|--cache=SIZE  Use up to SIZE MB for caching nodes (default: 800).\n\
+       --memory-limit=SIZE  Stop with an error if more than SIZE MB of\n\
+                    memory is used. Caches are reduced to fit (default: 0\n\
+                    = no limit).\n\
     -F|--flat-nodes=FILE  Specifies the file to use to persistently store node\n\
                     information in slim mode instead of in PostgreSQL.\n\
                     This is a single large file (> 50GB). Only recommended\n\
                     for full planet imports. Default is disabled.\n\
+       --update-cache=SIZE  Only with --append: Use up to SIZE MB for caching\n\
+                    locations of nodes used by updates (default: 0 = off).\n\
+       --update-cache-file=FILE  Load update cache from FILE and save it\n\
+                    back after the update. Default is disabled.\n\
 \n\
 Database options:\n\
     -d|--database=DB  The name of the PostgreSQL database to connect to or\n\
@@ -150,7 +178,10 @@ Database options:\n\
     -U|--username=NAME  PostgreSQL user name.\n\
     -W|--password   Force password prompt.\n\
     -H|--host=HOST  Database server host name or socket location.\n\
-    -P|--port=PORT  Database server port.\n",
+    -P|--port=PORT  Database server port.\n\
+       --loopback-database  Do not connect to a database, use an in-process\n\
+                    stand-in which discards the data. For profiling\n\
+                    imports only, not with --append.\n",
                stdout);
 
     if (verbose) {
@@ -165,6 +196,8 @@ Logging options:\n\
        --log-sql    Enable logging of SQL commands for debugging.\n\
        --log-sql-data  Enable logging of all data added to the database.\n\
     -v|--verbose    Same as '--log-level=debug'.\n\
+       --metrics-port=PORT  Serve metrics in Prometheus format on\n\
+                    http://localhost:PORT/metrics while running.\n\
 \n\
 Input options:\n\
     -r|--input-reader=FORMAT  Input format ('xml', 'pbf', 'o5m', or\n\
@@ -184,6 +217,9 @@ Middle options:\n\
        --cache-strategy=STRATEGY  Deprecated. Not used any more.\n\
     -x|--extra-attributes  Include attributes (user name, user id, changeset\n\
                     id, timestamp and version) for each object in the database.\n\
+       --middle-format=FORMAT  Format of the middle tables: 'array'\n\
+                    (default) or 'compact'. In append mode the format of the\n\
+                    existing tables is used, 'compact' migrates them.\n\
        --middle-schema=SCHEMA  Schema to use for middle tables (default: none).\n\
        --middle-way-node-index-id-shift=SHIFT  Set ID shift for bucket index.\n\
 \n\
@@ -223,13 +259,27 @@ Expiry options:\n\
     -o|--expire-output=FILENAME  Output filename for expired tiles list.\n\
        --expire-bbox-size=SIZE  Max size for a polygon to expire the whole\n\
                     polygon, not just the boundary.\n\
+       --expire-metatile-size=SIZE  Aggregate expired tiles to metatiles of\n\
+                    SIZE x SIZE tiles (power of 2, default: 1).\n\
+       --expire-format=FORMAT  Format of the expired tiles list: 'text'\n\
+                    (default) or 'binary'.\n\
+       --expire-collapse  Only write the coarsest tiles whose subtrees are\n\
+                    completely expired.\n\
 \n\
 Advanced options:\n\
     -I|--disable-parallel-indexing   Disable indexing all tables concurrently.\n\
+       --disable-input-pipeline  Store nodes and ways in the middle and\n\
+                   process them in the output in the input thread.\n\
        --number-processes=NUM  Specifies the number of parallel processes used\n\
                    for certain operations (default depends on number of CPUs).\n\
+       --copy-threads=NUM  Number of threads (and database connections)\n\
+                   used by the flex output to copy data into its tables\n\
+                   (default: 1).\n\
        --with-forward-dependencies=BOOL  Propagate changes from nodes to ways\n\
                    and node/way members to relations (Default: true).\n\
+       --extra-output=OUTPUT,STYLE,DATABASE  Also fill the database DATABASE\n\
+                   using output OUTPUT and style STYLE from the same input.\n\
+                   Can be given several times.\n\
 ",
                    stdout);
     } else {
@@ -250,6 +300,10 @@ static bool compare_prefix(std::string const &str,
 
 std::string database_options_t::conninfo() const
 {
+    if (loopback) {
+        return loopback_conninfo;
+    }
+
     if (compare_prefix(db, "postgresql://") ||
         compare_prefix(db, "postgres://")) {
         return db;
@@ -320,24 +374,51 @@ static osmium::Box parse_bbox(char const *bbox)
     return osmium::Box{minx, miny, maxx, maxy};
 }
 
-static unsigned int number_of_threads(char const *arg)
+static unsigned int number_of_threads(char const *arg,
+                                      char const *option = "--number-processes")
 {
     int num = atoi(arg);
     if (num < 1) {
-        log_warn("--number-processes must be at least 1. Using 1.");
+        log_warn("{} must be at least 1. Using 1.", option);
         num = 1;
     } else if (num > 32) {
         // The threads will open up database connections which will
         // run out at some point. It depends on the number of tables
         // how many connections there are. The number 32 is way beyond
         // anything that will make sense here.
-        log_warn("--number-processes too large. Set to 32.");
+        log_warn("{} too large. Set to 32.", option);
         num = 32;
     }
 
     return static_cast<unsigned int>(num);
 }
 
+static extra_output_t parse_extra_output(char const *arg)
+{
+    // The database comes last, because conninfo strings can contain commas.
+    std::string const str{arg};
+    auto const first = str.find(',');
+    auto const second =
+        first == std::string::npos ? first : str.find(',', first + 1);
+    if (second == std::string::npos) {
+        throw std::runtime_error{
+            "Argument for --extra-output must be of the form "
+            "OUTPUT,STYLE,DATABASE."};
+    }
+
+    extra_output_t extra;
+    extra.output_backend = str.substr(0, first);
+    extra.style = str.substr(first + 1, second - first - 1);
+    extra.db = str.substr(second + 1);
+
+    if (extra.output_backend.empty() || extra.db.empty()) {
+        throw std::runtime_error{
+            "Output and database must be set for --extra-output."};
+    }
+
+    return extra;
+}
+
 options_t::options_t(int argc, char *argv[]) : options_t()
 {
     // If there are no command line arguments at all, show help.
@@ -573,6 +654,70 @@ options_t::options_t(int argc, char *argv[]) : options_t()
                         optarg)};
             }
             break;
+        case 218:
+            num_copy_threads = number_of_threads(optarg, "--copy-threads");
+            break;
+        case 219:
+            update_cache = atoi(optarg);
+            break;
+        case 220:
+            update_cache_file = optarg;
+            break;
+        case 221:
+            memory_limit = atoi(optarg);
+            break;
+        case 222:
+            extra_outputs.push_back(parse_extra_output(optarg));
+            break;
+        case 223:
+            expire_tiles_metatile_size =
+                static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 224:
+            if (std::strcmp(optarg, "text") == 0) {
+                expire_tiles_binary = false;
+            } else if (std::strcmp(optarg, "binary") == 0) {
+                expire_tiles_binary = true;
+            } else {
+                throw std::runtime_error{
+                    "Unknown value for --expire-format: '{}'. Use 'text' or "
+                    "'binary'."_format(optarg)};
+            }
+            break;
+        case 225:
+            expire_tiles_collapse = true;
+            break;
+        case 226:
+            if (std::strcmp(optarg, "array") == 0) {
+                middle_compact = false;
+            } else if (std::strcmp(optarg, "compact") == 0) {
+                middle_compact = true;
+            } else {
+                throw std::runtime_error{
+                    "Unknown value for --middle-format: '{}'. Use 'array' or "
+                    "'compact'."_format(optarg)};
+            }
+            break;
+        case 227:
+            database_options.loopback = true;
+            break;
+        case 228:
+            metrics_port = static_cast<unsigned int>(atoi(optarg));
+            if (metrics_port == 0 || metrics_port > 65535) {
+                throw std::runtime_error{
+                    "--metrics-port must be between 1 and 65535."};
+            }
+            break;
+        case 229:
+            if (atoi(optarg) < 0) {
+                throw std::runtime_error{
+                    "--tag-transform-cache must not be negative."};
+            }
+            tag_transform_cache = static_cast<std::size_t>(atoi(optarg));
+            break;
+        case 230:
+            input_pipeline = false;
+            break;
         case 300:
             way_node_index_id_shift = atoi(optarg);
             break;
@@ -656,6 +801,13 @@ void options_t::check_options()
         throw std::runtime_error{"--append can only be used with slim mode!"};
     }
 
+    // The loopback database starts out empty in every run, so an update
+    // would not find any of the existing data it depends on.
+    if (append && database_options.loopback) {
+        throw std::runtime_error{"--append can not be used with "
+                                 "--loopback-database."};
+    }
+
     if (droptemp && !slim) {
         throw std::runtime_error{"--drop only makes sense with --slim."};
     }
@@ -694,6 +846,47 @@ void options_t::check_options()
         log_warn("Ignoring --flat-nodes/-F setting in non-slim mode");
     }
 
+    if (update_cache < 0) {
+        update_cache = 0;
+        log_warn("Update cache cannot be negative. Using 0 instead.");
+    }
+
+    if (!append && update_cache > 0) {
+        log_warn("Ignoring --update-cache setting in non-append mode.");
+        update_cache = 0;
+    }
+
+    if (update_cache == 0 && !update_cache_file.empty()) {
+        log_warn("Ignoring --update-cache-file setting, because update cache "
+                 "is disabled.");
+        update_cache_file.clear();
+    }
+
+    if (memory_limit < 0) {
+        memory_limit = 0;
+        log_warn("Memory limit cannot be negative. Using 0 (no limit).");
+    }
+
+    if (memory_limit > 0) {
+        if (memory_limit < min_memory_limit) {
+            throw std::runtime_error{
+                "Memory limit must be at least {}MB."_format(min_memory_limit)};
+        }
+
+        // The caches are the largest tunable memory users, make sure they
+        // leave room for everything else.
+        if (cache > memory_limit / 2) {
+            cache = memory_limit / 2;
+            log_warn("Reducing cache to {}MB to fit into memory limit.",
+                     cache);
+        }
+        if (update_cache > memory_limit / 4) {
+            update_cache = memory_limit / 4;
+            log_warn("Reducing update cache to {}MB to fit into memory limit.",
+                     update_cache);
+        }
+    }
+
     // zoom level 31 is the technical limit because we use 32-bit integers for the x and y index of a tile ID
     if (expire_tiles_zoom_min > 31) {
         expire_tiles_zoom_min = 31;
@@ -707,6 +900,23 @@ void options_t::check_options()
                  "large and has been set to 31.");
     }
 
+    if (expire_tiles_metatile_size == 0 ||
+        (expire_tiles_metatile_size & (expire_tiles_metatile_size - 1)) != 0 ||
+        expire_tiles_metatile_size > 256) {
+        throw std::runtime_error{"Metatile size for tile expiry must be a "
+                                 "power of 2 between 1 and 256."};
+    }
+
+    for (auto const &extra : extra_outputs) {
+        if ((extra.output_backend == "flex" ||
+             extra.output_backend == "gazetteer") &&
+            extra.style.empty()) {
+            throw std::runtime_error{
+                "You need to set a style file for the extra {} output."_format(
+                    extra.output_backend)};
+        }
+    }
+
     if (output_backend == "flex" || output_backend == "gazetteer") {
         if (style == DEFAULT_STYLE) {
             throw std::runtime_error{
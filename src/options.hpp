@@ -12,6 +12,7 @@
 
 #include <osmium/osm/box.hpp>
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -41,6 +42,9 @@ struct database_options_t
     std::string password;
     std::string port;
 
+    /// Use the in-process loopback database instead of PostgreSQL.
+    bool loopback = false;
+
     std::string conninfo() const;
 };
 
@@ -67,6 +71,27 @@ struct output_requirements
      * is needed.
      */
     bool full_relations = false;
+
+    /**
+     * Relation processing uses the tags of member ways. If false, changes
+     * of way tags don't affect parent relations.
+     */
+    bool way_tags_in_relations = false;
+};
+
+/**
+ * An additional output writing into its own database (see --extra-output).
+ */
+struct extra_output_t
+{
+    /// Output type ("pgsql", "flex", ...)
+    std::string output_backend;
+
+    /// Style file for this output (empty for default style)
+    std::string style;
+
+    /// Database name or conninfo string (as for --database)
+    std::string db;
 };
 
 /**
@@ -129,6 +154,15 @@ public:
     /// File name to output expired tiles list to
     std::string expire_tiles_filename{"dirty_tiles"};
 
+    /// Aggregate expired tiles to metatiles of this size (power of 2)
+    uint32_t expire_tiles_metatile_size = 1;
+
+    /// Write expired tiles list in binary format instead of text
+    bool expire_tiles_binary = false;
+
+    /// Only write the coarsest tiles fully covered by expired tiles
+    bool expire_tiles_collapse = false;
+
     /// add an additional hstore column with objects key/value pairs, and what type of hstore column
     hstore_column hstore_mode = hstore_column::none;
 
@@ -143,6 +177,19 @@ public:
     bool keep_coastlines = false;
     bool parallel_indexing = true;
     unsigned int num_procs;
+
+    /**
+     * Store nodes and ways in the middle and process them in the output in
+     * separate threads (if num_procs > 1).
+     */
+    bool input_pipeline = true;
+
+    /**
+     * Number of threads (and database connections) used by the flex output
+     * to copy data into its tables.
+     */
+    unsigned int num_copy_threads = 1;
+
     bool droptemp = false; ///< drop slim mode temp tables after act
 
     /**
@@ -159,13 +206,34 @@ public:
     /// Name of the flat node file used. Empty if flat node file is not enabled.
     std::string flat_node_file{};
 
+    /**
+     * Memory (in MB) for the cache of node locations touched by updates.
+     * Only used in append mode, 0 disables the cache.
+     */
+    int update_cache = 0;
+
+    /// File the update cache is loaded from and saved to (empty: not saved).
+    std::string update_cache_file{};
+
+    /// Memory limit for the whole program in MB (0 for no limit).
+    int memory_limit = 0;
+
+    /// Port for the metrics server (0 = no metrics server).
+    unsigned int metrics_port = 0;
+
     std::string tag_transform_script;
 
+    /// Number of tag sets to cache tag transform results for (0 = off).
+    std::size_t tag_transform_cache = 0;
+
     bool create = false;
     bool pass_prompt = false;
 
     database_options_t database_options;
     std::string output_backend{"pgsql"};
+
+    /// Additional outputs filled from the same input and middle.
+    std::vector<extra_output_t> extra_outputs;
     std::string input_format; ///< input file format (default: autodetect)
     osmium::Box bbox;
     bool extra_attributes = false;
@@ -180,6 +248,12 @@ public:
      */
     uint8_t way_node_index_id_shift = 0;
 
+    /**
+     * Store node lists, members, and tags in the middle tables in a compact
+     * binary encoding instead of as PostgreSQL arrays.
+     */
+    bool middle_compact = false;
+
 private:
 
     bool m_print_help = false;
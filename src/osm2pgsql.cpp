@@ -11,10 +11,13 @@
 #include "dependency-manager.hpp"
 #include "input.hpp"
 #include "logging.hpp"
+#include "memory-tracker.hpp"
+#include "metrics.hpp"
 #include "middle.hpp"
 #include "options.hpp"
 #include "osmdata.hpp"
 #include "output.hpp"
+#include "pgsql-loopback.hpp"
 #include "util.hpp"
 #include "version.hpp"
 
@@ -26,6 +29,9 @@
 
 static void run(options_t const &options)
 {
+    get_memory_tracker().set_limit(static_cast<std::size_t>(options.memory_limit) *
+                                   1024UL * 1024UL);
+
     auto const files = prepare_input_files(
         options.input_files, options.input_format, options.append);
 
@@ -50,6 +56,8 @@ static void run(options_t const &options)
 
     osmdata.start();
 
+    get_metrics().set_phase("processing");
+
     // Processing: In this phase the input file(s) are read and parsed,
     // populating some of the tables.
     process_files(files, &osmdata, options.append,
@@ -58,6 +66,8 @@ static void run(options_t const &options)
     // Process pending ways and relations. Cluster database tables and
     // create indexes.
     osmdata.stop();
+
+    get_memory_tracker().log_usage();
 }
 
 int main(int argc, char *argv[])
@@ -72,10 +82,27 @@ int main(int argc, char *argv[])
 
         util::timer_t timer_overall;
 
-        check_db(options);
+        std::unique_ptr<metrics_server_t> metrics_server;
+        if (options.metrics_port > 0) {
+            metrics_server =
+                std::make_unique<metrics_server_t>(options.metrics_port);
+        }
+
+        if (options.database_options.loopback) {
+            log_info("Using loopback database. No data will be written!");
+        } else {
+            get_metrics().set_phase("checking database");
+            check_db(options);
+        }
 
         run(options);
 
+        get_metrics().set_phase("done");
+
+        if (options.database_options.loopback) {
+            get_loopback_db().log_stats();
+        }
+
         // Output overall memory usage. This only works on Linux.
         osmium::MemoryUsage mem;
         if (mem.peak() != 0) {
@@ -8,24 +8,46 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <functional>
 #include <future>
 #include <memory>
-#include <mutex>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "db-copy.hpp"
+#include "db-progress-monitor.hpp"
 #include "format.hpp"
+#include "input-pipeline.hpp"
 #include "logging.hpp"
+#include "memory-tracker.hpp"
+#include "metrics.hpp"
 #include "middle.hpp"
 #include "options.hpp"
 #include "osmdata.hpp"
 #include "output.hpp"
 #include "util.hpp"
 
+namespace {
+
+/**
+ * Relations with at least this many members are considered heavy, they
+ * are processed before all others.
+ */
+constexpr std::size_t const min_heavy_relation_members = 1000;
+
+metric_t &objects_metric(char const *type)
+{
+    return get_metrics().counter("osm2pgsql_objects_processed_total",
+                                 "Number of OSM objects read from the input.",
+                                 "type=\"{}\""_format(type));
+}
+
+} // anonymous namespace
+
 osmdata_t::osmdata_t(std::unique_ptr<dependency_manager_t> dependency_manager,
                      std::shared_ptr<middle_t> mid,
                      std::shared_ptr<output_t> output, options_t const &options)
@@ -34,28 +56,71 @@ osmdata_t::osmdata_t(std::unique_ptr<dependency_manager_t> dependency_manager,
   m_bbox(options.bbox), m_num_procs(options.num_procs),
   m_append(options.append), m_droptemp(options.droptemp),
   m_with_extra_attrs(options.extra_attributes),
-  m_with_forward_dependencies(options.with_forward_dependencies)
+  m_with_forward_dependencies(options.with_forward_dependencies),
+  m_check_parents(options.append && options.with_forward_dependencies),
+  m_way_tags_in_relations(m_output->get_requirements().way_tags_in_relations),
+  m_nodes_metric(&objects_metric("node")),
+  m_ways_metric(&objects_metric("way")),
+  m_relations_metric(&objects_metric("relation"))
 {
     assert(m_dependency_manager);
     assert(m_mid);
     assert(m_output);
+
+    if (options.input_pipeline && m_num_procs > 1) {
+        m_pipeline = std::make_unique<input_pipeline_t>(
+            [this](osmium::OSMObject &object) { middle_object(object); },
+            [this](osmium::OSMObject &object) { output_object(object); });
+    }
 }
 
-void osmdata_t::node(osmium::Node const &node)
+osmdata_t::~osmdata_t() noexcept = default;
+
+bool osmdata_t::node_wanted(osmium::Node const &node) const
 {
     if (node.visible()) {
         if (!node.location().valid()) {
             log_warn("Ignored node {} (version {}) with invalid location.",
                      node.id(), node.version());
-            return;
+            return false;
         }
         if (m_bbox.valid() && !m_bbox.contains(node.location())) {
-            return;
+            return false;
         }
     }
 
+    return true;
+}
+
+void osmdata_t::node(osmium::Node const &node)
+{
+    if (!node_wanted(node)) {
+        return;
+    }
+
+    m_nodes_metric->add();
+
+    if (m_pipeline) {
+        m_pipeline->add(node);
+        return;
+    }
+
+    node_middle(node);
+    node_output(node);
+}
+
+void osmdata_t::node_middle(osmium::Node const &node)
+{
+    // Parents only need updating if the node moved, not if only its tags
+    // changed. This has to be checked before the new version is stored.
+    if (m_check_parents && !node.deleted()) {
+        push_parents_changed(m_mid->node_location_changed(node));
+    }
     m_mid->node(node);
+}
 
+void osmdata_t::node_output(osmium::Node const &node)
+{
     if (node.deleted()) {
         node_delete(node.id());
     } else {
@@ -67,27 +132,108 @@ void osmdata_t::node(osmium::Node const &node)
     }
 }
 
-void osmdata_t::after_nodes() { m_mid->after_nodes(); }
+void osmdata_t::after_nodes()
+{
+    if (m_pipeline) {
+        m_pipeline->flush();
+    }
+    m_mid->after_nodes();
+}
 
 void osmdata_t::way(osmium::Way &way)
 {
+    m_ways_metric->add();
+
+    if (m_pipeline) {
+        m_pipeline->add(way);
+        return;
+    }
+
+    way_middle(way);
+    way_output(&way);
+}
+
+void osmdata_t::way_middle(osmium::Way const &way)
+{
+    // Parent relations only need updating if the node list changed, unless
+    // the output uses the tags of member ways.
+    if (m_check_parents && !way.deleted()) {
+        push_parents_changed(m_way_tags_in_relations ||
+                             m_mid->way_nodes_changed(way));
+    }
     m_mid->way(way);
+}
 
-    if (way.deleted()) {
-        way_delete(way.id());
+void osmdata_t::way_output(osmium::Way *way)
+{
+    if (way->deleted()) {
+        way_delete(way->id());
     } else {
         if (m_append) {
-            way_modify(&way);
+            way_modify(way);
         } else {
-            way_add(&way);
+            way_add(way);
         }
     }
 }
 
-void osmdata_t::after_ways() { m_mid->after_ways(); }
+void osmdata_t::after_ways()
+{
+    if (m_pipeline) {
+        m_pipeline->flush();
+    }
+    m_mid->after_ways();
+
+    if (m_check_parents) {
+        log_debug("Parents not updated for {} changed nodes that did not move"
+                  " and {} changed ways with unchanged node lists.",
+                  m_nodes_unmoved, m_ways_unchanged);
+    }
+}
+
+void osmdata_t::push_parents_changed(bool changed)
+{
+    std::lock_guard<std::mutex> const guard{m_parents_changed_mutex};
+    m_parents_changed.push_back(changed);
+}
+
+bool osmdata_t::pop_parents_changed()
+{
+    if (!m_check_parents) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> const guard{m_parents_changed_mutex};
+    assert(!m_parents_changed.empty());
+    bool const changed = m_parents_changed.front();
+    m_parents_changed.pop_front();
+    return changed;
+}
+
+void osmdata_t::middle_object(osmium::OSMObject &object)
+{
+    if (object.type() == osmium::item_type::node) {
+        node_middle(static_cast<osmium::Node const &>(object));
+    } else {
+        assert(object.type() == osmium::item_type::way);
+        way_middle(static_cast<osmium::Way const &>(object));
+    }
+}
+
+void osmdata_t::output_object(osmium::OSMObject &object)
+{
+    if (object.type() == osmium::item_type::node) {
+        node_output(static_cast<osmium::Node const &>(object));
+    } else {
+        assert(object.type() == osmium::item_type::way);
+        way_output(&static_cast<osmium::Way &>(object));
+    }
+}
 
 void osmdata_t::relation(osmium::Relation const &rel)
 {
+    m_relations_metric->add();
+
     if (m_append && !rel.deleted()) {
         m_output->select_relation_members(rel.id());
     }
@@ -131,16 +277,24 @@ void osmdata_t::relation_add(osmium::Relation const &rel) const
     }
 }
 
-void osmdata_t::node_modify(osmium::Node const &node) const
+void osmdata_t::node_modify(osmium::Node const &node)
 {
     m_output->node_modify(node);
-    m_dependency_manager->node_changed(node.id());
+    if (pop_parents_changed()) {
+        m_dependency_manager->node_changed(node.id());
+    } else {
+        ++m_nodes_unmoved;
+    }
 }
 
-void osmdata_t::way_modify(osmium::Way *way) const
+void osmdata_t::way_modify(osmium::Way *way)
 {
     m_output->way_modify(way);
-    m_dependency_manager->way_changed(way->id());
+    if (pop_parents_changed()) {
+        m_dependency_manager->way_changed(way->id());
+    } else {
+        ++m_ways_unchanged;
+    }
 }
 
 void osmdata_t::relation_modify(osmium::Relation const &rel) const
@@ -183,7 +337,7 @@ public:
                             std::shared_ptr<middle_t> const &mid,
                             std::shared_ptr<output_t> output,
                             std::size_t thread_count)
-    : m_output(std::move(output))
+    : m_mid(mid), m_output(std::move(output))
     {
         assert(mid);
         assert(m_output);
@@ -215,7 +369,8 @@ public:
      */
     void process_relations(idlist_t &&list)
     {
-        process_queue("relation", std::move(list), &output_t::pending_relation);
+        process_queue("relation", order_relations(std::move(list)),
+                      &output_t::pending_relation);
     }
 
     /**
@@ -226,7 +381,7 @@ public:
      */
     void process_relations_stage1c(idlist_t &&list)
     {
-        process_queue("relation", std::move(list),
+        process_queue("relation", order_relations(std::move(list)),
                       &output_t::pending_relation_stage1c);
     }
 
@@ -242,49 +397,185 @@ public:
     }
 
 private:
-    /// Get the next id from the queue.
-    static osmid_t pop_id(idlist_t *queue, std::mutex *mutex)
+    /**
+     * Move heavy relations (with many members) to the front of the list,
+     * the heaviest first. Otherwise a giant relation handed out at the end
+     * keeps one worker busy long after all others are done. The light
+     * relations keep their order, so that lookups in the middle stay
+     * local.
+     */
+    idlist_t order_relations(idlist_t &&list) const
     {
-        osmid_t id = 0;
+        auto const counts = m_mid->get_relation_member_counts(list);
+        if (counts.size() != list.size()) {
+            return std::move(list);
+        }
 
-        std::lock_guard<std::mutex> const lock{*mutex};
-        if (!queue->empty()) {
-            id = queue->back();
-            queue->pop_back();
+        std::vector<std::pair<std::size_t, osmid_t>> heavy;
+        idlist_t ordered;
+        ordered.reserve(list.size());
+        for (std::size_t i = 0; i < list.size(); ++i) {
+            if (counts[i] >= min_heavy_relation_members) {
+                heavy.emplace_back(counts[i], list[i]);
+            } else {
+                ordered.push_back(list[i]);
+            }
+        }
+
+        if (heavy.empty()) {
+            return ordered;
         }
 
-        return id;
+        log_debug("Processing {} heavy relations first.", heavy.size());
+
+        std::sort(heavy.begin(), heavy.end(),
+                  [](std::pair<std::size_t, osmid_t> const &a,
+                     std::pair<std::size_t, osmid_t> const &b) {
+                      return a.first > b.first;
+                  });
+
+        ordered.insert(ordered.begin(), heavy.size(), 0);
+        std::transform(heavy.begin(), heavy.end(), ordered.begin(),
+                       [](std::pair<std::size_t, osmid_t> const &p) {
+                           return p.second;
+                       });
+
+        return ordered;
+    }
+
+    /**
+     * The list of ids to work on shared between all worker threads. Workers
+     * claim chunks of consecutive ids by advancing an atomic cursor, so no
+     * locking is needed. Ids are handed out in the order they are in the
+     * list.
+     */
+    class id_queue_t
+    {
+    public:
+        id_queue_t(idlist_t &&list, std::size_t num_workers)
+        : m_list(std::move(list)), m_num_workers(num_workers)
+        {}
+
+        /**
+         * Claim a chunk of up to chunk_size ids. Towards the end of the
+         * list the chunks get smaller, so that all workers finish at about
+         * the same time. Returns an empty range if there are no ids left.
+         */
+        std::pair<osmid_t const *, osmid_t const *>
+        claim(std::size_t chunk_size) noexcept
+        {
+            auto const left = size_left();
+            chunk_size = std::max(
+                std::size_t{1},
+                std::min(chunk_size, left / (2 * m_num_workers)));
+
+            auto const pos = m_next.fetch_add(chunk_size);
+            if (pos >= m_list.size()) {
+                return {nullptr, nullptr};
+            }
+
+            auto const end = std::min(pos + chunk_size, m_list.size());
+            return {m_list.data() + pos, m_list.data() + end};
+        }
+
+        /// Number of ids not yet claimed by any worker.
+        std::size_t size_left() const noexcept
+        {
+            return m_list.size() -
+                   std::min(m_next.load(std::memory_order_relaxed),
+                            m_list.size());
+        }
+
+        /// Mark all ids as done, so that the workers finish early.
+        void clear() noexcept { m_next.store(m_list.size()); }
+
+    private:
+        idlist_t m_list;
+        std::size_t m_num_workers;
+        std::atomic<std::size_t> m_next{0};
+    };
+
+    /**
+     * Calculate the size of the next chunk a worker should claim from the
+     * time it took to process the last chunk. Workers aim for chunks that
+     * take a few milliseconds, so that cheap objects don't cause contention
+     * on the queue while expensive objects are still spread evenly over all
+     * workers.
+     */
+    static std::size_t next_chunk_size(std::size_t chunk_size,
+                                       std::chrono::nanoseconds elapsed)
+    {
+        constexpr std::chrono::nanoseconds const target_duration =
+            std::chrono::milliseconds{10};
+        constexpr std::size_t const max_chunk_size = 1024;
+
+        // Never grow more than by a factor of two at a time.
+        std::size_t new_size = chunk_size * 2;
+        if (elapsed.count() > 0) {
+            auto const per_object = elapsed.count() / chunk_size;
+            if (per_object > 0) {
+                new_size = std::min(
+                    new_size, static_cast<std::size_t>(
+                                  target_duration.count() / per_object));
+            }
+        }
+
+        return std::max(std::size_t{1}, std::min(new_size, max_chunk_size));
     }
 
     // Pointer to a member function of output_t taking an osm_id
     using output_member_fn_ptr = void (output_t::*)(osmid_t);
 
     /**
-     * Runs in the worker threads: As long as there are any, get ids from
-     * the queue and let the output process it by calling "func".
+     * Runs in the worker threads: As long as there are any, claim chunks of
+     * ids from the queue and let the output process them by calling "func".
      */
-    static void run(std::shared_ptr<output_t> const &output, idlist_t *queue,
-                    std::mutex *mutex, output_member_fn_ptr func)
+    static void run(std::shared_ptr<output_t> const &output, id_queue_t *queue,
+                    output_member_fn_ptr func, metric_t *processed)
     {
-        while (osmid_t const id = pop_id(queue, mutex)) {
-            (output.get()->*func)(id);
+        std::size_t chunk_size = 1;
+        while (true) {
+            auto const chunk = queue->claim(chunk_size);
+            if (chunk.first == chunk.second) {
+                break;
+            }
+
+            auto const start = std::chrono::steady_clock::now();
+            for (auto const *it = chunk.first; it != chunk.second; ++it) {
+                (output.get()->*func)(*it);
+            }
+            auto const count =
+                static_cast<std::size_t>(chunk.second - chunk.first);
+            processed->add(count);
+            chunk_size = next_chunk_size(
+                count, std::chrono::steady_clock::now() - start);
         }
         output->sync();
     }
 
-    /// Runs in a worker thread: Update progress display once per second.
-    static void print_stats(idlist_t *queue, std::mutex *mutex)
+    /**
+     * Runs in a worker thread: Update progress display, queue length
+     * metric, and check memory use once per second.
+     */
+    static void print_stats(id_queue_t *queue, metric_t *queue_length)
     {
         std::size_t queue_size = 0;
         do {
-            mutex->lock();
-            queue_size = queue->size();
-            mutex->unlock();
+            queue_size = queue->size_left();
+            queue_length->set(queue_size);
 
             if (get_logger().show_progress()) {
                 fmt::print(stderr, "\rLeft to process: {}...", queue_size);
             }
 
+            try {
+                get_memory_tracker().check();
+            } catch (...) {
+                // Stop the workers before reporting the error.
+                queue->clear();
+                throw;
+            }
+
             std::this_thread::sleep_for(std::chrono::seconds{1});
         } while (queue_size > 0);
     }
@@ -297,25 +588,42 @@ private:
         log_info("Going over {} pending {}s (using {} threads)"_format(
             ids_queued, type, m_clones.size()));
 
+        get_metrics().set_phase("pending {}s"_format(type));
+        auto const labels = "type=\"{}\""_format(type);
+        auto &processed = get_metrics().counter(
+            "osm2pgsql_pending_processed_total",
+            "Number of pending objects processed.", labels);
+        auto &queue_length = get_metrics().gauge(
+            "osm2pgsql_pending_queue_length",
+            "Number of pending objects left to process.", labels);
+
         util::timer_t timer;
+
+        // The queue must outlive the workers using it, so it is declared
+        // first.
+        id_queue_t queue{std::move(list), m_clones.size()};
         std::vector<std::future<void>> workers;
 
         for (auto const &clone : m_clones) {
             workers.push_back(std::async(std::launch::async, run,
-                                         std::cref(clone), &list, &m_mutex,
-                                         function));
+                                         std::cref(clone), &queue, function,
+                                         &processed));
         }
-        workers.push_back(
-            std::async(std::launch::async, print_stats, &list, &m_mutex));
+        workers.push_back(std::async(std::launch::async, print_stats, &queue,
+                                     &queue_length));
 
         for (auto &worker : workers) {
             try {
                 worker.get();
             } catch (...) {
-                // Drain the queue, so that the other workers finish early.
-                m_mutex.lock();
-                list.clear();
-                m_mutex.unlock();
+                // Drain the queue, so that the other workers finish early,
+                // and wait for them before passing on the exception.
+                queue.clear();
+                for (auto &other : workers) {
+                    if (other.valid()) {
+                        other.wait();
+                    }
+                }
                 throw;
             }
         }
@@ -335,11 +643,12 @@ private:
     /// Clones of output, one clone per thread.
     std::vector<std::shared_ptr<output_t>> m_clones;
 
+    /// The middle, used to estimate the cost of processing relations.
+    std::shared_ptr<middle_t> m_mid;
+
     /// The output.
     std::shared_ptr<output_t> m_output;
 
-    /// Mutex to make sure worker threads coordinate access to queue.
-    std::mutex m_mutex;
 };
 
 } // anonymous namespace
@@ -368,10 +677,20 @@ void osmdata_t::process_dependents() const
     }
 }
 
-void osmdata_t::reprocess_marked() const { m_output->reprocess_marked(); }
+void osmdata_t::reprocess_marked() const
+{
+    get_metrics().set_phase("reprocessing marked");
+    m_output->reprocess_marked();
+}
 
 void osmdata_t::postprocess_database() const
 {
+    get_metrics().set_phase("postprocessing");
+
+    // Clustering and index creation can take hours, report what the
+    // database is doing once per minute.
+    db_progress_monitor_t const monitor{m_conninfo, std::chrono::minutes{1}};
+
     if (m_droptemp) {
         // When dropping middle tables, make sure they are gone before
         // indexing starts.
@@ -395,6 +714,10 @@ void osmdata_t::postprocess_database() const
 
 void osmdata_t::stop() const
 {
+    if (m_pipeline) {
+        m_pipeline->flush();
+    }
+
     m_output->sync();
 
     if (m_append && m_with_forward_dependencies) {
@@ -18,7 +18,10 @@
  * It contains the osmdata_t class.
  */
 
+#include <cstddef>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include <osmium/fwd.hpp>
@@ -28,6 +31,8 @@
 #include "dependency-manager.hpp"
 #include "osmtypes.hpp"
 
+class input_pipeline_t;
+class metric_t;
 class middle_t;
 class options_t;
 class output_t;
@@ -44,6 +49,14 @@ public:
               std::shared_ptr<middle_t> mid, std::shared_ptr<output_t> output,
               options_t const &options);
 
+    osmdata_t(osmdata_t const &) = delete;
+    osmdata_t &operator=(osmdata_t const &) = delete;
+
+    osmdata_t(osmdata_t &&) = delete;
+    osmdata_t &operator=(osmdata_t &&) = delete;
+
+    ~osmdata_t() noexcept;
+
     void start() const;
 
     void node(osmium::Node const &node);
@@ -61,12 +74,35 @@ public:
     void stop() const;
 
 private:
+    /// Check whether a node should be imported, warns about invalid nodes.
+    bool node_wanted(osmium::Node const &node) const;
+
+    /// Store node/way in the middle.
+    void node_middle(osmium::Node const &node);
+    void way_middle(osmium::Way const &way);
+
+    /// Send node/way to the output after it has been stored in the middle.
+    void node_output(osmium::Node const &node);
+    void way_output(osmium::Way *way);
+
+    /**
+     * Remember whether the parents of the current changed node or way have
+     * to be updated (called from the middle stage) and get that information
+     * back (called from the output stage).
+     */
+    void push_parents_changed(bool changed);
+    bool pop_parents_changed();
+
+    /// Called from the pipeline stages.
+    void middle_object(osmium::OSMObject &object);
+    void output_object(osmium::OSMObject &object);
+
     void node_add(osmium::Node const &node) const;
     void way_add(osmium::Way *way) const;
     void relation_add(osmium::Relation const &rel) const;
 
-    void node_modify(osmium::Node const &node) const;
-    void way_modify(osmium::Way *way) const;
+    void node_modify(osmium::Node const &node);
+    void way_modify(osmium::Way *way);
     void relation_modify(osmium::Relation const &rel) const;
 
     void node_delete(osmid_t id) const;
@@ -104,6 +140,44 @@ private:
     bool m_droptemp;
     bool m_with_extra_attrs;
     bool m_with_forward_dependencies;
+
+    /**
+     * Do changed nodes and ways have to be compared with their old versions
+     * to find out whether their parents need updating? This is the case in
+     * append mode with forward dependencies.
+     */
+    bool m_check_parents;
+
+    /// Do relations use the tags of their member ways?
+    bool m_way_tags_in_relations;
+
+    /**
+     * For each changed node and way (in input order) whether the parents
+     * have to be updated. Filled by the middle stage, emptied by the output
+     * stage.
+     */
+    std::deque<bool> m_parents_changed;
+    std::mutex m_parents_changed_mutex;
+
+    /// Number of changed nodes and ways whose parents were not updated.
+    std::size_t m_nodes_unmoved = 0;
+    std::size_t m_ways_unchanged = 0;
+
+    /// Metrics for the number of objects read from the input.
+    metric_t *m_nodes_metric;
+    metric_t *m_ways_metric;
+    metric_t *m_relations_metric;
+
+    /**
+     * Pipeline used for nodes and ways when running with more than one
+     * thread (unless disabled with --disable-input-pipeline), so that storing objects in the middle and processing them in
+     * the output can happen concurrently. Relations are always processed
+     * synchronously, because the output reads members from the middle
+     * while the middle is being written to. This is declared last, so
+     * that the pipeline threads are stopped before anything else is
+     * destroyed.
+     */
+    std::unique_ptr<input_pipeline_t> m_pipeline;
 };
 
 #endif // OSM2PGSQL_OSMDATA_HPP
@@ -7,11 +7,14 @@
  * For a full list of authors see the git log.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <vector>
 
 #include <osmium/area/geom_assembler.hpp>
 
+#include "expire-tiles.hpp"
 #include "geom.hpp"
 #include "osmium-builder.hpp"
 
@@ -37,10 +40,39 @@ void osmium_builder_t::wrap_in_multipolygon(osmium_builder_t::wkb_t *geometry)
     *geometry = m_writer.multipolygon_finish(1);
 }
 
+void osmium_builder_t::bbox_t::extend(osmium::geom::Coordinates c) noexcept
+{
+    if (!valid) {
+        min = c;
+        max = c;
+        valid = true;
+        return;
+    }
+    min.x = std::min(min.x, c.x);
+    min.y = std::min(min.y, c.y);
+    max.x = std::max(max.x, c.x);
+    max.y = std::max(max.y, c.y);
+}
+
+void osmium_builder_t::expire_polygon(bbox_t const &bbox, wkb_t const &wkb,
+                                      osmid_t osm_id)
+{
+    assert(m_expire);
+    if (!bbox.valid || m_expire->from_bbox(bbox.min.x, bbox.min.y,
+                                           bbox.max.x, bbox.max.y)) {
+        // Bounding box too big, the perimeter has to be expired.
+        m_expire->from_wkb(wkb, osm_id);
+    }
+}
+
 osmium_builder_t::wkb_t
 osmium_builder_t::get_wkb_node(osmium::Location const &loc) const
 {
-    return m_writer.make_point(m_proj->reproject(loc));
+    auto const coords = m_proj->reproject(loc);
+    if (m_expire) {
+        m_expire->from_point(coords);
+    }
+    return m_writer.make_point(coords);
 }
 
 osmium_builder_t::wkbs_t
@@ -53,6 +85,9 @@ osmium_builder_t::get_wkb_line(osmium::WayNodeList const &nodes,
     wkbs_t ret;
 
     for (auto const &line : linestrings) {
+        if (m_expire) {
+            m_expire->from_line(line);
+        }
         m_writer.linestring_start();
         for (auto const &coord : line) {
             m_writer.add_location(coord);
@@ -63,9 +98,101 @@ osmium_builder_t::get_wkb_line(osmium::WayNodeList const &nodes,
     return ret;
 }
 
+bool osmium_builder_t::get_simple_polygon(osmium::Way const &way, wkb_t *wkb)
+{
+    m_ring.clear();
+    for (auto const &node_ref : way.nodes()) {
+        if (node_ref.location().valid() &&
+            (m_ring.empty() ||
+             m_ring.back().location() != node_ref.location())) {
+            m_ring.push_back(node_ref);
+        }
+    }
+
+    // A ring needs at least three different locations plus the closing one.
+    if (m_ring.size() < 4 ||
+        m_ring.front().location() != m_ring.back().location()) {
+        return false;
+    }
+
+    auto const num_locations = m_ring.size() - 1;
+
+    m_sorted_locations.clear();
+    for (std::size_t i = 0; i < num_locations; ++i) {
+        m_sorted_locations.push_back(m_ring[i].location());
+    }
+    std::sort(m_sorted_locations.begin(), m_sorted_locations.end());
+    if (std::adjacent_find(m_sorted_locations.cbegin(),
+                           m_sorted_locations.cend()) !=
+        m_sorted_locations.cend()) {
+        return false;
+    }
+
+    // Same check for intersections as in the area assembler.
+    m_segments.clear();
+    for (std::size_t i = 0; i < num_locations; ++i) {
+        m_segments.emplace_back(m_ring[i], m_ring[i + 1],
+                                osmium::area::detail::role_type::outer, &way);
+    }
+    std::sort(m_segments.begin(), m_segments.end());
+    for (auto it1 = m_segments.cbegin(); it1 != m_segments.cend() - 1; ++it1) {
+        for (auto it2 = it1 + 1; it2 != m_segments.cend(); ++it2) {
+            if (osmium::area::detail::outside_x_range(*it2, *it1)) {
+                break;
+            }
+            if (osmium::area::detail::y_range_overlap(*it1, *it2) &&
+                osmium::area::detail::calculate_intersection(*it1, *it2)) {
+                return false;
+            }
+        }
+    }
+
+    int64_t sum = 0;
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < num_locations; ++i) {
+        auto const &a = m_ring[i].location();
+        auto const &b = m_ring[i + 1].location();
+        sum += static_cast<int64_t>(a.x()) * b.y() -
+               static_cast<int64_t>(a.y()) * b.x();
+        if (a < m_ring[start].location()) {
+            start = i;
+        }
+    }
+
+    if (sum == 0) {
+        return false;
+    }
+
+    bbox_t bbox;
+    m_writer.polygon_start();
+    m_writer.polygon_ring_start();
+    for (std::size_t i = 0; i <= num_locations; ++i) {
+        auto const n = sum > 0 ? (start + i) % num_locations
+                               : (start + num_locations - i) % num_locations;
+        auto const coords = m_proj->reproject(m_ring[n].location());
+        if (m_expire) {
+            bbox.extend(coords);
+        }
+        m_writer.add_location(coords);
+    }
+    m_writer.polygon_ring_finish(num_locations + 1);
+    *wkb = m_writer.polygon_finish(1);
+
+    if (m_expire) {
+        expire_polygon(bbox, *wkb, way.id());
+    }
+
+    return true;
+}
+
 osmium_builder_t::wkb_t
 osmium_builder_t::get_wkb_polygon(osmium::Way const &way)
 {
+    wkb_t wkb;
+    if (get_simple_polygon(way, &wkb)) {
+        return wkb;
+    }
+
     osmium::area::AssemblerConfig area_config;
     area_config.ignore_invalid_locations = true;
     osmium::area::GeomAssembler assembler{area_config};
@@ -76,8 +203,15 @@ osmium_builder_t::get_wkb_polygon(osmium::Way const &way)
     }
 
     auto const wkbs = create_polygons(m_buffer.get<osmium::Area>(0));
+    if (wkbs.empty()) {
+        return wkb_t{};
+    }
+
+    if (m_expire) {
+        expire_polygon(m_outer_bboxes[0], wkbs[0], way.id());
+    }
 
-    return wkbs.empty() ? wkb_t{} : wkbs[0];
+    return wkbs[0];
 }
 
 osmium_builder_t::wkbs_t
@@ -99,6 +233,12 @@ osmium_builder_t::get_wkb_multipolygon(osmium::Relation const &rel,
         ret = create_polygons(area);
         assert(!ret.empty());
 
+        if (m_expire) {
+            for (std::size_t i = 0; i < ret.size(); ++i) {
+                expire_polygon(m_outer_bboxes[i], ret[i], -rel.id());
+            }
+        }
+
         if (build_multigeoms) {
             if (ret.size() > 1 || wrap_multi) {
                 wrap_in_multipolygon(&ret);
@@ -125,6 +265,9 @@ osmium_builder_t::get_wkb_multiline(osmium::memory::Buffer const &ways,
     wkbs_t ret;
 
     for (auto const &line : linestrings) {
+        if (m_expire) {
+            m_expire->from_line(line);
+        }
         m_writer.linestring_start();
         for (auto const &coord : line) {
             m_writer.add_location(coord);
@@ -145,7 +288,8 @@ osmium_builder_t::get_wkb_multiline(osmium::memory::Buffer const &ways,
     return ret;
 }
 
-size_t osmium_builder_t::add_mp_points(osmium::NodeRefList const &nodes)
+size_t osmium_builder_t::add_mp_points(osmium::NodeRefList const &nodes,
+                                       bbox_t *bbox)
 {
     size_t num_points = 0;
     osmium::Location last_location;
@@ -153,7 +297,11 @@ size_t osmium_builder_t::add_mp_points(osmium::NodeRefList const &nodes)
         if (node_ref.location().valid() &&
             last_location != node_ref.location()) {
             last_location = node_ref.location();
-            m_writer.add_location(m_proj->reproject(last_location));
+            auto const coords = m_proj->reproject(last_location);
+            if (bbox) {
+                bbox->extend(coords);
+            }
+            m_writer.add_location(coords);
             ++num_points;
         }
     }
@@ -165,6 +313,7 @@ osmium_builder_t::wkbs_t
 osmium_builder_t::create_polygons(osmium::Area const &area)
 {
     wkbs_t ret;
+    m_outer_bboxes.clear();
 
     try {
         size_t num_rings = 0;
@@ -178,7 +327,9 @@ osmium_builder_t::create_polygons(osmium::Area const &area)
                 }
                 m_writer.polygon_start();
                 m_writer.polygon_ring_start();
-                auto const num_points = add_mp_points(ring);
+                m_outer_bboxes.emplace_back();
+                auto const num_points = add_mp_points(
+                    ring, m_expire ? &m_outer_bboxes.back() : nullptr);
                 m_writer.polygon_ring_finish(num_points);
                 ++num_rings;
             } else if (item.type() == osmium::item_type::inner_ring) {
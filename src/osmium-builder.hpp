@@ -14,12 +14,16 @@
 #include <string>
 #include <vector>
 
+#include <osmium/area/detail/node_ref_segment.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm.hpp>
 
+#include "osmtypes.hpp"
 #include "reprojection.hpp"
 #include "wkb.hpp"
 
+struct expire_tiles;
+
 namespace geom {
 
 class osmium_builder_t
@@ -33,6 +37,15 @@ public:
       m_writer(m_proj->target_srs())
     {}
 
+    reprojection const &projection() const noexcept { return *m_proj; }
+
+    /**
+     * Expire tiles for all geometries created by this builder from now on.
+     * The coordinates are handed to the expiry code while they are written,
+     * so the WKB doesn't have to be parsed again. Set to nullptr to disable.
+     */
+    void set_expire(expire_tiles *expire) noexcept { m_expire = expire; }
+
     wkb_t get_wkb_node(osmium::Location const &loc) const;
     wkbs_t get_wkb_line(osmium::WayNodeList const &nodes, double split_at);
     wkb_t get_wkb_polygon(osmium::Way const &way);
@@ -57,13 +70,51 @@ public:
     void wrap_in_multipolygon(wkb_t *geometry);
 
 private:
+    /// Bounding box of the outer ring of a polygon in target coordinates.
+    struct bbox_t
+    {
+        osmium::geom::Coordinates min{};
+        osmium::geom::Coordinates max{};
+        bool valid = false;
+
+        void extend(osmium::geom::Coordinates c) noexcept;
+    };
+
     wkbs_t create_polygons(osmium::Area const &area);
-    size_t add_mp_points(osmium::NodeRefList const &nodes);
+    size_t add_mp_points(osmium::NodeRefList const &nodes,
+                         bbox_t *bbox = nullptr);
+
+    /**
+     * Expire tiles for a polygon. Usually the bounding box of the outer
+     * ring is enough, only if that is too large the WKB is parsed to
+     * expire the tiles along all rings.
+     */
+    void expire_polygon(bbox_t const &bbox, wkb_t const &wkb, osmid_t osm_id);
+
+    /**
+     * Create polygon from a closed way without going through the area
+     * assembler. This only works if the way forms a simple ring, ie it has
+     * at least three different locations, no location is used twice and
+     * no segments intersect. The result is the same as the assembler would
+     * create: The ring starts at the smallest location and is oriented
+     * counter-clockwise.
+     *
+     * \returns true if the polygon was written to wkb, false if the way
+     *          needs to go through the assembler.
+     */
+    bool get_simple_polygon(osmium::Way const &way, wkb_t *wkb);
 
     std::shared_ptr<reprojection> m_proj;
     // internal buffer for creating areas
     osmium::memory::Buffer m_buffer;
+    // reused for checking simple rings
+    std::vector<osmium::NodeRef> m_ring;
+    std::vector<osmium::Location> m_sorted_locations;
+    std::vector<osmium::area::detail::NodeRefSegment> m_segments;
+    // bounding boxes of polygons from last create_polygons() call
+    std::vector<bbox_t> m_outer_bboxes;
     ewkb::writer_t m_writer;
+    expire_tiles *m_expire = nullptr;
 };
 
 } // namespace geom
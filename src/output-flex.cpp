@@ -12,8 +12,10 @@
 #include "format.hpp"
 #include "geom-transform.hpp"
 #include "logging.hpp"
+#include "lua-helpers.hpp"
 #include "lua-init.hpp"
 #include "lua-utils.hpp"
+#include "metrics.hpp"
 #include "middle.hpp"
 #include "options.hpp"
 #include "osmtypes.hpp"
@@ -36,6 +38,8 @@ extern "C"
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
@@ -48,6 +52,15 @@ extern "C"
 // Mutex used to coordinate access to Lua code
 static std::mutex lua_mutex;
 
+// Time spent in the Lua processing functions (including callbacks into C++)
+static metric_t &lua_time_metric()
+{
+    static metric_t &metric = get_metrics().duration(
+        "osm2pgsql_lua_duration_seconds_total",
+        "Time spent in the Lua processing functions.");
+    return metric;
+}
+
 // Lua can't call functions on C++ objects directly. This macro defines simple
 // C "trampoline" functions which are called from Lua which get the current
 // context (the output_flex_t object) and call the respective function on the
@@ -460,224 +473,318 @@ static void write_json(json_writer_type *writer, lua_State *lua_state,
     }
 }
 
-void output_flex_t::write_column(
-    db_copy_mgr_t<db_deleter_by_type_and_id_t> *copy_mgr,
-    flex_table_column_t const &column)
+using copy_mgr_type = db_copy_mgr_t<db_deleter_by_type_and_id_t>;
+
+static void encode_text(lua_State *lua_state, copy_mgr_type *copy_mgr,
+                        flex_table_column_t const & /*column*/, int ltype)
 {
-    // If there is nothing on the Lua stack, then the Lua function add_row()
-    // was called without a table parameter. In that case this column will
-    // be set to NULL.
-    if (lua_gettop(lua_state()) == 0) {
-        write_null(copy_mgr, column);
-        return;
+    auto const *const str = lua_tolstring(lua_state, -1, nullptr);
+    if (!str) {
+        throw std::runtime_error{"Invalid type '{}' for text column."_format(
+            lua_typename(lua_state, ltype))};
     }
+    copy_mgr->add_column(str);
+}
 
-    lua_getfield(lua_state(), -1, column.name().c_str());
-    int const ltype = lua_type(lua_state(), -1);
-
-    // Certain Lua types can never be added to the database
-    if (ltype == LUA_TFUNCTION || ltype == LUA_TUSERDATA ||
-        ltype == LUA_TTHREAD) {
+static void encode_boolean(lua_State *lua_state, copy_mgr_type *copy_mgr,
+                           flex_table_column_t const &column, int ltype)
+{
+    switch (ltype) {
+    case LUA_TBOOLEAN:
+        copy_mgr->add_column(lua_toboolean(lua_state, -1) != 0);
+        break;
+    case LUA_TNUMBER:
+        copy_mgr->add_column(lua_tonumber(lua_state, -1) != 0);
+        break;
+    case LUA_TSTRING:
+        write_boolean(copy_mgr, column, lua_tolstring(lua_state, -1, nullptr));
+        break;
+    default:
         throw std::runtime_error{
-            "Can not add Lua objects of type function, userdata, or thread."};
+            "Invalid type '{}' for boolean column."_format(
+                lua_typename(lua_state, ltype))};
     }
+}
 
-    // A Lua nil value is always translated to a database NULL
-    if (ltype == LUA_TNIL) {
-        write_null(copy_mgr, column);
-        lua_pop(lua_state(), 1);
-        return;
+static char const *integer_type_name(table_column_type type) noexcept
+{
+    switch (type) {
+    case table_column_type::int2:
+        return "int2";
+    case table_column_type::int4:
+        return "int4";
+    default:
+        break;
     }
+    return "int8";
+}
 
-    if (column.type() == table_column_type::text) {
-        auto const *const str = lua_tolstring(lua_state(), -1, nullptr);
-        if (!str) {
-            throw std::runtime_error{
-                "Invalid type '{}' for text column."_format(
-                    lua_typename(lua_state(), ltype))};
-        }
-        copy_mgr->add_column(str);
-    } else if (column.type() == table_column_type::boolean) {
-        switch (ltype) {
-        case LUA_TBOOLEAN:
-            copy_mgr->add_column(lua_toboolean(lua_state(), -1) != 0);
-            break;
-        case LUA_TNUMBER:
-            copy_mgr->add_column(lua_tonumber(lua_state(), -1) != 0);
-            break;
-        case LUA_TSTRING:
-            write_boolean(copy_mgr, column,
-                          lua_tolstring(lua_state(), -1, nullptr));
-            break;
-        default:
-            throw std::runtime_error{
-                "Invalid type '{}' for boolean column."_format(
-                    lua_typename(lua_state(), ltype))};
-        }
-    } else if (column.type() == table_column_type::int2) {
-        if (ltype == LUA_TNUMBER) {
-            int64_t const value = lua_tointeger(lua_state(), -1);
-            if (value >= std::numeric_limits<int16_t>::min() &&
-                value <= std::numeric_limits<int16_t>::max()) {
-                copy_mgr->add_column(value);
-            } else {
-                write_null(copy_mgr, column);
-            }
-        } else if (ltype == LUA_TSTRING) {
-            write_integer<int16_t>(copy_mgr, column,
-                                   lua_tolstring(lua_state(), -1, nullptr));
-        } else if (ltype == LUA_TBOOLEAN) {
-            copy_mgr->add_column(lua_toboolean(lua_state(), -1));
+template <typename T>
+void encode_integer(lua_State *lua_state, copy_mgr_type *copy_mgr,
+                    flex_table_column_t const &column, int ltype)
+{
+    if (ltype == LUA_TNUMBER) {
+        int64_t const value = lua_tointeger(lua_state, -1);
+        if (value >= std::numeric_limits<T>::min() &&
+            value <= std::numeric_limits<T>::max()) {
+            copy_mgr->add_column(value);
         } else {
-            throw std::runtime_error{
-                "Invalid type '{}' for int2 column."_format(
-                    lua_typename(lua_state(), ltype))};
+            write_null(copy_mgr, column);
         }
-    } else if (column.type() == table_column_type::int4) {
-        if (ltype == LUA_TNUMBER) {
-            int64_t const value = lua_tointeger(lua_state(), -1);
-            if (value >= std::numeric_limits<int32_t>::min() &&
-                value <= std::numeric_limits<int32_t>::max()) {
-                copy_mgr->add_column(value);
-            } else {
-                write_null(copy_mgr, column);
-            }
-        } else if (ltype == LUA_TSTRING) {
-            write_integer<int32_t>(copy_mgr, column,
-                                   lua_tolstring(lua_state(), -1, nullptr));
-        } else if (ltype == LUA_TBOOLEAN) {
-            copy_mgr->add_column(lua_toboolean(lua_state(), -1));
-        } else {
+    } else if (ltype == LUA_TSTRING) {
+        write_integer<T>(copy_mgr, column,
+                         lua_tolstring(lua_state, -1, nullptr));
+    } else if (ltype == LUA_TBOOLEAN) {
+        copy_mgr->add_column(lua_toboolean(lua_state, -1));
+    } else {
+        throw std::runtime_error{"Invalid type '{}' for {} column."_format(
+            lua_typename(lua_state, ltype), integer_type_name(column.type()))};
+    }
+}
+
+static void encode_real(lua_State *lua_state, copy_mgr_type *copy_mgr,
+                        flex_table_column_t const &column, int ltype)
+{
+    if (ltype == LUA_TNUMBER) {
+        copy_mgr->add_column(lua_tonumber(lua_state, -1));
+    } else if (ltype == LUA_TSTRING) {
+        write_double(copy_mgr, column, lua_tolstring(lua_state, -1, nullptr));
+    } else {
+        throw std::runtime_error{"Invalid type '{}' for real column."_format(
+            lua_typename(lua_state, ltype))};
+    }
+}
+
+static void encode_hstore(lua_State *lua_state, copy_mgr_type *copy_mgr,
+                          flex_table_column_t const & /*column*/, int ltype)
+{
+    if (ltype != LUA_TTABLE) {
+        throw std::runtime_error{"Invalid type '{}' for hstore column."_format(
+            lua_typename(lua_state, ltype))};
+    }
+
+    copy_mgr->new_hash();
+
+    lua_pushnil(lua_state);
+    while (lua_next(lua_state, -2) != 0) {
+        char const *const key = lua_tostring(lua_state, -2);
+        char const *const val = lua_tostring(lua_state, -1);
+        if (key == nullptr) {
+            int const ltype_key = lua_type(lua_state, -2);
             throw std::runtime_error{
-                "Invalid type '{}' for int4 column."_format(
-                    lua_typename(lua_state(), ltype))};
+                "NULL key for hstore. Possibly this is due to"
+                " an incorrect data type '{}' as key."_format(
+                    lua_typename(lua_state, ltype_key))};
         }
-    } else if (column.type() == table_column_type::int8) {
-        if (ltype == LUA_TNUMBER) {
-            copy_mgr->add_column(lua_tointeger(lua_state(), -1));
-        } else if (ltype == LUA_TSTRING) {
-            write_integer<int64_t>(copy_mgr, column,
-                                   lua_tolstring(lua_state(), -1, nullptr));
-        } else if (ltype == LUA_TBOOLEAN) {
-            copy_mgr->add_column(lua_toboolean(lua_state(), -1));
-        } else {
+        if (val == nullptr) {
+            int const ltype_value = lua_type(lua_state, -1);
             throw std::runtime_error{
-                "Invalid type '{}' for int8 column."_format(
-                    lua_typename(lua_state(), ltype))};
+                "NULL value for hstore. Possibly this is due to"
+                " an incorrect data type '{}' for key '{}'."_format(
+                    lua_typename(lua_state, ltype_value), key)};
         }
-    } else if (column.type() == table_column_type::real) {
-        if (ltype == LUA_TNUMBER) {
-            copy_mgr->add_column(lua_tonumber(lua_state(), -1));
-        } else if (ltype == LUA_TSTRING) {
-            write_double(copy_mgr, column,
-                         lua_tolstring(lua_state(), -1, nullptr));
-        } else {
-            throw std::runtime_error{
-                "Invalid type '{}' for real column."_format(
-                    lua_typename(lua_state(), ltype))};
+        copy_mgr->add_hash_elem(key, val);
+        lua_pop(lua_state, 1);
+    }
+
+    copy_mgr->finish_hash();
+}
+
+static void encode_json(lua_State *lua_state, copy_mgr_type *copy_mgr,
+                        flex_table_column_t const & /*column*/, int /*ltype*/)
+{
+    rapidjson::StringBuffer stream;
+    json_writer_type writer{stream};
+    table_register_type tables;
+    write_json(&writer, lua_state, &tables);
+    copy_mgr->add_column(stream.GetString());
+}
+
+static void encode_direction(lua_State *lua_state, copy_mgr_type *copy_mgr,
+                             flex_table_column_t const &column, int ltype)
+{
+    switch (ltype) {
+    case LUA_TBOOLEAN:
+        copy_mgr->add_column(lua_toboolean(lua_state, -1));
+        break;
+    case LUA_TNUMBER:
+        copy_mgr->add_column(sgn(lua_tonumber(lua_state, -1)));
+        break;
+    case LUA_TSTRING:
+        write_direction(copy_mgr, column,
+                        lua_tolstring(lua_state, -1, nullptr));
+        break;
+    default:
+        throw std::runtime_error{
+            "Invalid type '{}' for direction column."_format(
+                lua_typename(lua_state, ltype))};
+    }
+}
+
+static column_writer_t::encoder_type
+get_encoder(flex_table_column_t const &column)
+{
+    switch (column.type()) {
+    case table_column_type::text:
+        return encode_text;
+    case table_column_type::boolean:
+        return encode_boolean;
+    case table_column_type::int2:
+        return encode_integer<int16_t>;
+    case table_column_type::int4:
+        return encode_integer<int32_t>;
+    case table_column_type::int8:
+        return encode_integer<int64_t>;
+    case table_column_type::real:
+        return encode_real;
+    case table_column_type::hstore:
+        return encode_hstore;
+    case table_column_type::json:
+    case table_column_type::jsonb:
+        return encode_json;
+    case table_column_type::direction:
+        return encode_direction;
+    default:
+        break;
+    }
+
+    throw std::runtime_error{
+        "Column type {} not implemented."_format(column.type())};
+}
+
+write_plan_t output_flex_t::compile_write_plan(flex_table_t const &table)
+{
+    write_plan_t plan;
+
+    std::size_t n = 0;
+    for (auto const &column : table) {
+        column_writer_t writer{};
+        writer.column_index = n++;
+
+        if (column.create_only()) {
+            continue;
         }
-    } else if (column.type() == table_column_type::hstore) {
-        if (ltype == LUA_TTABLE) {
-            copy_mgr->new_hash();
-
-            lua_pushnil(lua_state());
-            while (lua_next(lua_state(), -2) != 0) {
-                char const *const key = lua_tostring(lua_state(), -2);
-                char const *const val = lua_tostring(lua_state(), -1);
-                if (key == nullptr) {
-                    int const ltype_key = lua_type(lua_state(), -2);
-                    throw std::runtime_error{
-                        "NULL key for hstore. Possibly this is due to"
-                        " an incorrect data type '{}' as key."_format(
-                            lua_typename(lua_state(), ltype_key))};
-                }
-                if (val == nullptr) {
-                    int const ltype_value = lua_type(lua_state(), -1);
-                    throw std::runtime_error{
-                        "NULL value for hstore. Possibly this is due to"
-                        " an incorrect data type '{}' for key '{}'."_format(
-                            lua_typename(lua_state(), ltype_value), key)};
-                }
-                copy_mgr->add_hash_elem(key, val);
-                lua_pop(lua_state(), 1);
-            }
 
-            copy_mgr->finish_hash();
+        if (column.type() == table_column_type::id_type) {
+            writer.source = column_writer_t::source_type::id_type;
+        } else if (column.type() == table_column_type::id_num) {
+            writer.source = column_writer_t::source_type::id_num;
+        } else if (column.is_geometry_column()) {
+            writer.source = column_writer_t::source_type::geometry;
+        } else if (column.type() == table_column_type::area) {
+            writer.source = column_writer_t::source_type::area;
+        } else if (column.type() == table_column_type::row_hash) {
+            writer.source = column_writer_t::source_type::row_hash;
+        } else if (column.type() == table_column_type::partition_key) {
+            writer.source = column_writer_t::source_type::partition_key;
         } else {
-            throw std::runtime_error{
-                "Invalid type '{}' for hstore column."_format(
-                    lua_typename(lua_state(), ltype))};
-        }
-    } else if ((column.type() == table_column_type::json) ||
-               (column.type() == table_column_type::jsonb)) {
-        rapidjson::StringBuffer stream;
-        json_writer_type writer{stream};
-        table_register_type tables;
-        write_json(&writer, lua_state(), &tables);
-        copy_mgr->add_column(stream.GetString());
-    } else if (column.type() == table_column_type::direction) {
-        switch (ltype) {
-        case LUA_TBOOLEAN:
-            copy_mgr->add_column(lua_toboolean(lua_state(), -1));
-            break;
-        case LUA_TNUMBER:
-            copy_mgr->add_column(sgn(lua_tonumber(lua_state(), -1)));
-            break;
-        case LUA_TSTRING:
-            write_direction(copy_mgr, column,
-                            lua_tolstring(lua_state(), -1, nullptr));
-            break;
-        default:
-            throw std::runtime_error{
-                "Invalid type '{}' for direction column."_format(
-                    lua_typename(lua_state(), ltype))};
+            writer.source = column_writer_t::source_type::lua;
+            writer.encoder = get_encoder(column);
+
+            // Keep a reference to the column name as Lua string in the
+            // registry, so that it doesn't have to be created and hashed
+            // for every row.
+            lua_pushstring(lua_state(), column.name().c_str());
+            writer.key_ref = luaL_ref(lua_state(), LUA_REGISTRYINDEX);
         }
-    } else {
+
+        plan.push_back(writer);
+    }
+
+    return plan;
+}
+
+void output_flex_t::write_column(copy_mgr_type *copy_mgr,
+                                 flex_table_column_t const &column,
+                                 column_writer_t const &writer)
+{
+    lua_rawgeti(lua_state(), LUA_REGISTRYINDEX, writer.key_ref);
+    lua_gettable(lua_state(), -2);
+    int const ltype = lua_type(lua_state(), -1);
+
+    // A Lua nil value is always translated to a database NULL
+    if (ltype == LUA_TNIL) {
+        write_null(copy_mgr, column);
+        lua_pop(lua_state(), 1);
+        return;
+    }
+
+    // Certain Lua types can never be added to the database
+    if (ltype == LUA_TFUNCTION || ltype == LUA_TUSERDATA ||
+        ltype == LUA_TTHREAD) {
         throw std::runtime_error{
-            "Column type {} not implemented."_format(column.type())};
+            "Can not add Lua objects of type function, userdata, or thread."};
     }
 
+    writer.encoder(lua_state(), copy_mgr, column, ltype);
+
     lua_pop(lua_state(), 1);
 }
 
 void output_flex_t::write_row(table_connection_t *table_connection,
+                              write_plan_t const &plan,
                               osmium::item_type id_type, osmid_t id,
-                              std::string const &geom, int srid)
+                              std::string const &geom)
 {
     assert(table_connection);
     table_connection->new_line();
     auto *copy_mgr = table_connection->copy_mgr();
+    auto const &table = table_connection->table();
 
-    for (auto const &column : table_connection->table()) {
-        if (column.create_only()) {
-            continue;
-        }
-        if (column.type() == table_column_type::id_type) {
+    // If there is nothing on the Lua stack, then the Lua function add_row()
+    // was called without a table parameter. In that case all columns filled
+    // from Lua will be set to NULL.
+    bool const has_data = lua_gettop(lua_state()) != 0;
+
+    for (auto const &writer : plan) {
+        auto const &column = table.column(writer.column_index);
+        switch (writer.source) {
+        case column_writer_t::source_type::id_type:
             copy_mgr->add_column(type_to_char(id_type));
-        } else if (column.type() == table_column_type::id_num) {
+            break;
+        case column_writer_t::source_type::id_num:
             copy_mgr->add_column(id);
-        } else if (column.is_geometry_column()) {
+            break;
+        case column_writer_t::source_type::geometry:
             assert(!geom.empty());
             copy_mgr->add_hex_geom(geom);
-        } else if (column.type() == table_column_type::area) {
+            break;
+        case column_writer_t::source_type::area:
             if (geom.empty()) {
                 write_null(copy_mgr, column);
             } else {
-                // if srid of the area column is the same as for the geom column
+                // The projection is only set if the srid of the area column
+                // is different from the one of the geom column.
+                auto const *const proj = column.area_projection();
                 double const area =
-                    column.srid() == srid
-                        ? ewkb::parser_t(geom)
-                              .get_area<osmium::geom::IdentityProjection>()
-                        : ewkb::parser_t(geom).get_area<reprojection>(
-                              reprojection::create_projection(srid).get());
+                    proj ? ewkb::parser_t(geom).get_area<reprojection>(proj)
+                         : ewkb::parser_t(geom)
+                               .get_area<osmium::geom::IdentityProjection>();
                 copy_mgr->add_column(area);
             }
-        } else {
-            write_column(copy_mgr, column);
+            break;
+        case column_writer_t::source_type::row_hash:
+            copy_mgr->add_row_hash_column();
+            break;
+        case column_writer_t::source_type::partition_key:
+            copy_mgr->add_column(table.geom_partition(
+                geom, table_connection->get_builder()->projection()));
+            break;
+        case column_writer_t::source_type::lua:
+            if (has_data) {
+                write_column(copy_mgr, column, writer);
+            } else {
+                write_null(copy_mgr, column);
+            }
+            break;
         }
     }
 
     copy_mgr->finish_line();
+
+    if (table_connection->replacing()) {
+        table_connection->add_replacement_row(copy_mgr->row_hash(), geom);
+    }
 }
 
 // Gets all way nodes from the middle the first time this is called.
@@ -703,6 +810,12 @@ int output_flex_t::app_get_bbox()
         throw std::runtime_error{"No parameter(s) needed for get_box()."};
     }
 
+    // In the process_*_batch() functions, get the object from the first
+    // (self) parameter.
+    if (m_batch_index_ref != LUA_NOREF) {
+        select_batch_object(1);
+    }
+
     if (m_context_node) {
         lua_pushnumber(lua_state(), m_context_node->location().lon());
         lua_pushnumber(lua_state(), m_context_node->location().lat());
@@ -809,6 +922,72 @@ flex_table_t &output_flex_t::create_flex_table()
     }
     lua_pop(lua_state(), 1);
 
+    // optional "partition_by" and "partitions" fields
+    lua_getfield(lua_state(), -1, "partition_by");
+    int const partition_by_type = lua_type(lua_state(), -1);
+    if (partition_by_type == LUA_TSTRING) {
+        std::string const partition_by = lua_tostring(lua_state(), -1);
+        if (partition_by == "type") {
+            new_table.set_partitioning(flex_table_t::partition_type::type, 3);
+        } else if (partition_by == "geom") {
+            lua_getfield(lua_state(), -2, "partitions");
+            std::size_t partitions = 16;
+            if (lua_isnumber(lua_state(), -1)) {
+                auto const value = lua_tointeger(lua_state(), -1);
+                if (value < 2 || value > 256) {
+                    throw std::runtime_error{
+                        "The 'partitions' table option must be between 2"
+                        " and 256."};
+                }
+                partitions = static_cast<std::size_t>(value);
+            } else if (!lua_isnil(lua_state(), -1)) {
+                throw std::runtime_error{
+                    "The 'partitions' table option must be a number."};
+            }
+            lua_pop(lua_state(), 1); // partitions
+            new_table.set_partitioning(flex_table_t::partition_type::geom,
+                                       partitions);
+
+            lua_getfield(lua_state(), -2, "partition_extent");
+            if (lua_istable(lua_state(), -1)) {
+                std::array<double, 4> extent{};
+                for (int i = 0; i < 4; ++i) {
+                    lua_rawgeti(lua_state(), -1, i + 1);
+                    if (!lua_isnumber(lua_state(), -1)) {
+                        throw std::runtime_error{
+                            "The 'partition_extent' table option must be a "
+                            "Lua array with four numbers."};
+                    }
+                    extent[static_cast<std::size_t>(i)] =
+                        lua_tonumber(lua_state(), -1);
+                    lua_pop(lua_state(), 1);
+                }
+                osmium::Box const box{extent[0], extent[1], extent[2],
+                                      extent[3]};
+                if (!box.valid() || extent[0] >= extent[2] ||
+                    extent[1] >= extent[3]) {
+                    throw std::runtime_error{
+                        "The 'partition_extent' table option must be a valid"
+                        " bounding box (min lon, min lat, max lon, max lat)."};
+                }
+                new_table.set_partition_extent(box);
+            } else if (!lua_isnil(lua_state(), -1)) {
+                throw std::runtime_error{
+                    "The 'partition_extent' table option must be a Lua array "
+                    "with four numbers."};
+            }
+            lua_pop(lua_state(), 1); // partition_extent
+        } else {
+            throw std::runtime_error{
+                "Unknown value '{}' for 'partition_by' table option"
+                " (use 'type' or 'geom')."_format(partition_by)};
+        }
+    } else if (partition_by_type != LUA_TNIL) {
+        throw std::runtime_error{
+            "Unknown value for 'partition_by' table option: Must be string."};
+    }
+    lua_pop(lua_state(), 1); // partition_by
+
     return new_table;
 }
 
@@ -935,6 +1114,32 @@ int output_flex_t::app_define_table()
     setup_id_columns(&new_table);
     setup_flex_table_columns(&new_table);
 
+    if (new_table.has_row_hash_column() && !new_table.has_id_column()) {
+        throw std::runtime_error{
+            "Table '{}' with row_hash column needs an id column."_format(
+                new_table.name())};
+    }
+
+    if (new_table.partitioning() == flex_table_t::partition_type::type &&
+        !new_table.has_multicolumn_id_index()) {
+        throw std::runtime_error{
+            "Table '{}' partitioned by type needs ids of type 'any'"
+            " with a type_column."_format(new_table.name())};
+    }
+
+    if (new_table.partitioning() == flex_table_t::partition_type::geom) {
+        if (!new_table.has_geom_column()) {
+            throw std::runtime_error{
+                "Table '{}' partitioned by geom needs a geometry column."_format(
+                    new_table.name())};
+        }
+        new_table.add_column("partition_key", "partition_key", "")
+            .set_not_null();
+    }
+
+    new_table.init_area_projections();
+    m_write_plans->push_back(compile_write_plan(new_table));
+
     lua_pushlightuserdata(lua_state(), (void *)(m_tables->size()));
     luaL_getmetatable(lua_state(), osm2pgsql_table_name);
     lua_setmetatable(lua_state(), -2);
@@ -1002,16 +1207,27 @@ int output_flex_t::table_add_row()
     }
 
     // Params are the table object and an optional Lua table with the contents
-    // for the fields.
-    auto const num_params = lua_gettop(lua_state());
-    if (num_params < 1 || num_params > 2) {
+    // for the fields. In the process_*_batch() functions the object from the
+    // batch the row is for is needed as third parameter.
+    auto num_params = lua_gettop(lua_state());
+    if (m_batch_index_ref != LUA_NOREF) {
+        if (num_params != 3) {
+            throw std::runtime_error{
+                "Need three parameters in process_*_batch() functions: The"
+                " osm2pgsql.table, the row data (or nil), and the object."};
+        }
+        select_batch_object(3);
+        num_params = lua_isnil(lua_state(), 2) ? 1 : 2;
+        lua_settop(lua_state(), num_params);
+    } else if (num_params < 1 || num_params > 2) {
         throw std::runtime_error{
             "Need two parameters: The osm2pgsql.table and the row data."};
     }
 
-    auto &table_connection =
-        m_table_connections.at(table_idx_from_param(lua_state()));
+    auto const table_idx = table_idx_from_param(lua_state());
+    auto &table_connection = m_table_connections.at(table_idx);
     auto const &table = table_connection.table();
+    auto const &plan = (*m_write_plans)[table_idx];
 
     // It there is a second parameter, it must be a Lua table.
     if (num_params == 2) {
@@ -1024,19 +1240,19 @@ int output_flex_t::table_add_row()
             throw std::runtime_error{
                 "Trying to add node to table '{}'."_format(table.name())};
         }
-        add_row(&table_connection, *m_context_node);
+        add_row(&table_connection, plan, *m_context_node);
     } else if (m_context_way) {
         if (!table.matches_type(osmium::item_type::way)) {
             throw std::runtime_error{
                 "Trying to add way to table '{}'."_format(table.name())};
         }
-        add_row(&table_connection, *m_context_way);
+        add_row(&table_connection, plan, *m_context_way);
     } else if (m_context_relation) {
         if (!table.matches_type(osmium::item_type::relation)) {
             throw std::runtime_error{
                 "Trying to add relation to table '{}'."_format(table.name())};
         }
-        add_row(&table_connection, *m_context_relation);
+        add_row(&table_connection, plan, *m_context_relation);
     }
 
     return 0;
@@ -1200,7 +1416,7 @@ output_flex_t::run_transform(geom::osmium_builder_t *builder,
 
 template <typename OBJECT>
 void output_flex_t::add_row(table_connection_t *table_connection,
-                            OBJECT const &object)
+                            write_plan_t const &plan, OBJECT const &object)
 {
     assert(table_connection);
     auto const &table = table_connection->table();
@@ -1208,7 +1424,7 @@ void output_flex_t::add_row(table_connection_t *table_connection,
     osmid_t const id = table.map_id(object.type(), object.id());
 
     if (!table.has_geom_column()) {
-        write_row(table_connection, object.type(), id, "", 0);
+        write_row(table_connection, plan, object.type(), id, "");
         return;
     }
 
@@ -1233,9 +1449,11 @@ void output_flex_t::add_row(table_connection_t *table_connection,
     auto const wkbs =
         run_transform(builder, transform, table.geom_column().type(), object);
     for (auto const &wkb : wkbs) {
-        m_expire.from_wkb(wkb, id);
-        write_row(table_connection, object.type(), id, wkb,
-                  table.geom_column().srid());
+        // When replacing rows, expiry is done later if something changed.
+        if (!table_connection->replacing()) {
+            m_expire.from_wkb(wkb, id);
+        }
+        write_row(table_connection, plan, object.type(), id, wkb);
     }
 }
 
@@ -1250,6 +1468,7 @@ void output_flex_t::call_lua_function(prepared_lua_function_t func,
         get_options()->extra_attributes); // the single argument
 
     luaX_set_context(lua_state(), this);
+    metric_timer_t const timer{&lua_time_metric()};
     if (luaX_pcall(lua_state(), 1, func.nresults())) {
         throw std::runtime_error{
             "Failed to execute Lua function 'osm2pgsql.{}':"
@@ -1266,9 +1485,142 @@ void output_flex_t::get_mutex_and_call_lua_function(
     call_lua_function(func, object);
 }
 
+prepared_lua_function_t const &
+output_flex_t::batch_function(osmium::item_type type) const noexcept
+{
+    if (type == osmium::item_type::node) {
+        return m_process_node_batch;
+    }
+    if (type == osmium::item_type::way) {
+        return m_process_way_batch;
+    }
+    return m_process_relation_batch;
+}
+
+void output_flex_t::add_to_batch(osmium::OSMObject const &object)
+{
+    if (m_batch_type != object.type()) {
+        flush_batch();
+        m_batch_type = object.type();
+    }
+
+    m_batch_buffer.add_item(object);
+    m_batch_buffer.commit();
+
+    if (++m_batch_count == max_batch_size) {
+        flush_batch();
+    }
+}
+
+void output_flex_t::flush_batch()
+{
+    if (m_batch_count == 0) {
+        return;
+    }
+
+    auto const &func = batch_function(m_batch_type);
+    assert(func);
+
+    m_batch_objects.clear();
+    for (auto &object : m_batch_buffer.select<osmium::OSMObject>()) {
+        m_batch_objects.push_back(&object);
+    }
+
+    std::lock_guard<std::mutex> guard{lua_mutex};
+
+    m_calling_context = func.context();
+
+    lua_pushvalue(lua_state(), func.index()); // the function to call
+
+    // The single argument is an array of all objects. A second table maps
+    // the objects back to their index in the batch so that add_row() can
+    // find them.
+    auto const size = static_cast<int>(m_batch_objects.size());
+    lua_createtable(lua_state(), size, 0);
+    lua_createtable(lua_state(), 0, size);
+    for (int n = 0; n < size; ++n) {
+        push_osm_object_to_lua_stack(lua_state(), *m_batch_objects[n],
+                                     get_options()->extra_attributes);
+        lua_pushvalue(lua_state(), -1);
+        lua_rawseti(lua_state(), -4, n + 1);
+        lua_pushinteger(lua_state(), n);
+        lua_rawset(lua_state(), -3);
+    }
+    m_batch_index_ref = luaL_ref(lua_state(), LUA_REGISTRYINDEX);
+
+    luaX_set_context(lua_state(), this);
+    {
+        metric_timer_t const timer{&lua_time_metric()};
+        if (luaX_pcall(lua_state(), 1, 0)) {
+            throw std::runtime_error{
+                "Failed to execute Lua function 'osm2pgsql.{}':"
+                " {}."_format(func.name(), lua_tostring(lua_state(), -1))};
+        }
+    }
+
+    luaL_unref(lua_state(), LUA_REGISTRYINDEX, m_batch_index_ref);
+    m_batch_index_ref = LUA_NOREF;
+
+    m_calling_context = calling_context::main;
+    m_context_node = nullptr;
+    m_context_way = nullptr;
+    m_context_relation = nullptr;
+    m_num_way_nodes = std::numeric_limits<std::size_t>::max();
+
+    m_batch_objects.clear();
+    m_batch_buffer.clear();
+    m_batch_count = 0;
+    m_batch_type = osmium::item_type::undefined;
+}
+
+bool output_flex_t::batch_contains(osmium::item_type type, osmid_t id) const
+{
+    if (type != m_batch_type) {
+        return false;
+    }
+
+    for (auto const &object : m_batch_buffer.select<osmium::OSMObject>()) {
+        if (object.id() == id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void output_flex_t::select_batch_object(int index)
+{
+    lua_rawgeti(lua_state(), LUA_REGISTRYINDEX, m_batch_index_ref);
+    lua_pushvalue(lua_state(), index);
+    lua_rawget(lua_state(), -2);
+    if (!lua_isnumber(lua_state(), -1)) {
+        throw std::runtime_error{
+            "The object parameter must be one of the objects in the batch."};
+    }
+    auto const n = static_cast<std::size_t>(lua_tointeger(lua_state(), -1));
+    lua_pop(lua_state(), 2); // index table, index
+    auto *const object = m_batch_objects.at(n);
+
+    m_context_node = nullptr;
+    m_context_relation = nullptr;
+    if (object->type() == osmium::item_type::node) {
+        m_context_node = static_cast<osmium::Node const *>(object);
+    } else if (object->type() == osmium::item_type::way) {
+        auto *const way = static_cast<osmium::Way *>(object);
+        if (way != m_context_way) {
+            m_num_way_nodes = std::numeric_limits<std::size_t>::max();
+        }
+        m_context_way = way;
+        return;
+    } else {
+        m_context_relation = static_cast<osmium::Relation const *>(object);
+    }
+    m_context_way = nullptr;
+}
+
 void output_flex_t::pending_way(osmid_t id)
 {
-    if (!m_process_way) {
+    if (!m_process_way && !m_process_way_batch) {
         return;
     }
 
@@ -1277,13 +1629,18 @@ void output_flex_t::pending_way(osmid_t id)
         return;
     }
 
-    way_delete(id);
+    delete_from_tables(osmium::item_type::way, id);
 
     auto &way = m_buffer.get<osmium::Way>(0);
 
-    m_context_way = &way;
-    get_mutex_and_call_lua_function(m_process_way, way);
-    m_context_way = nullptr;
+    if (m_process_way_batch) {
+        add_to_batch(way);
+    } else {
+        m_context_way = &way;
+        get_mutex_and_call_lua_function(m_process_way, way);
+        m_context_way = nullptr;
+    }
+    finish_replacements();
     m_num_way_nodes = std::numeric_limits<std::size_t>::max();
     m_buffer.clear();
 }
@@ -1368,7 +1725,8 @@ void output_flex_t::select_relation_members(osmid_t id)
 
 void output_flex_t::pending_relation(osmid_t id)
 {
-    if (!m_process_relation && !m_select_relation_members) {
+    if (!m_process_relation && !m_process_relation_batch &&
+        !m_select_relation_members) {
         return;
     }
 
@@ -1380,18 +1738,21 @@ void output_flex_t::pending_relation(osmid_t id)
     select_relation_members(relation);
     delete_from_tables(osmium::item_type::relation, id);
 
-    if (m_process_relation) {
+    if (m_process_relation_batch) {
+        add_to_batch(relation);
+    } else if (m_process_relation) {
         m_context_relation = &relation;
         get_mutex_and_call_lua_function(m_process_relation, relation);
         m_context_relation = nullptr;
     }
+    finish_replacements();
 
     m_rels_buffer.clear();
 }
 
 void output_flex_t::pending_relation_stage1c(osmid_t id)
 {
-    if (!m_process_relation) {
+    if (!m_process_relation && !m_process_relation_batch) {
         return;
     }
 
@@ -1401,9 +1762,17 @@ void output_flex_t::pending_relation_stage1c(osmid_t id)
     auto const &relation = m_rels_buffer.get<osmium::Relation>(0);
 
     m_disable_add_row = true;
-    m_context_relation = &relation;
-    get_mutex_and_call_lua_function(m_process_relation, relation);
-    m_context_relation = nullptr;
+    if (m_process_relation_batch) {
+        // Objects in the batch are processed with add_row() disabled, so
+        // they can't be mixed with other objects.
+        flush_batch();
+        add_to_batch(relation);
+        flush_batch();
+    } else {
+        m_context_relation = &relation;
+        get_mutex_and_call_lua_function(m_process_relation, relation);
+        m_context_relation = nullptr;
+    }
     m_disable_add_row = false;
 
     m_rels_buffer.clear();
@@ -1411,6 +1780,8 @@ void output_flex_t::pending_relation_stage1c(osmid_t id)
 
 void output_flex_t::sync()
 {
+    flush_batch();
+
     for (auto &table : m_table_connections) {
         table.sync();
     }
@@ -1418,15 +1789,28 @@ void output_flex_t::sync()
 
 void output_flex_t::stop()
 {
+    flush_batch();
+
+    bool const updateable = m_options.slim && !m_options.droptemp;
+
     for (auto &table : m_table_connections) {
-        table.task_set(thread_pool().submit([&]() {
-            table.stop(m_options.slim && !m_options.droptemp, m_options.append);
-        }));
+        if (table.table().is_partitioned() && !m_options.append) {
+            // Make sure all data is in the database before the partitions
+            // are processed on their own connections.
+            table.sync();
+            for (std::size_t n = 0; n < table.table().num_partitions(); ++n) {
+                table.partition_task_add(thread_pool().submit([&, n]() {
+                    table.stop_partition(
+                        n, updateable, m_options.database_options.conninfo());
+                }));
+            }
+        }
+        table.task_set(thread_pool().submit(
+            [&]() { table.stop(updateable, m_options.append); }));
     }
 
     if (m_options.expire_tiles_zoom_min > 0) {
-        m_expire.output_and_destroy(m_options.expire_tiles_filename.c_str(),
-                                    m_options.expire_tiles_zoom_min);
+        m_expire.output_and_destroy(m_options);
     }
 }
 
@@ -1439,6 +1823,11 @@ void output_flex_t::wait()
 
 void output_flex_t::node_add(osmium::Node const &node)
 {
+    if (m_process_node_batch) {
+        add_to_batch(node);
+        return;
+    }
+
     if (!m_process_node) {
         return;
     }
@@ -1452,6 +1841,11 @@ void output_flex_t::way_add(osmium::Way *way)
 {
     assert(way);
 
+    if (m_process_way_batch) {
+        add_to_batch(*way);
+        return;
+    }
+
     if (!m_process_way) {
         return;
     }
@@ -1464,12 +1858,17 @@ void output_flex_t::way_add(osmium::Way *way)
 
 void output_flex_t::relation_add(osmium::Relation const &relation)
 {
-    if (!m_process_relation) {
+    if (!m_process_relation && !m_process_relation_batch) {
         return;
     }
 
     select_relation_members(relation);
 
+    if (m_process_relation_batch) {
+        add_to_batch(relation);
+        return;
+    }
+
     m_context_relation = &relation;
     get_mutex_and_call_lua_function(m_process_relation, relation);
     m_context_relation = nullptr;
@@ -1481,6 +1880,22 @@ void output_flex_t::delete_from_table(table_connection_t *table_connection,
     assert(table_connection);
     auto const id = table_connection->table().map_id(type, osm_id);
 
+    // In append mode rows in tables with a row hash column are replaced
+    // only if their content changed, see finish_replacements().
+    if (m_options.append && table_connection->table().has_row_hash_column() &&
+        table_connection->can_replace(id)) {
+        auto result = table_connection->get_row_hashes(type, id);
+
+        if (result.num_tuples() > 0) {
+            table_connection->begin_replace(type, id, std::move(result));
+            return;
+        }
+
+        // Rows of this object might still be in the copy buffer.
+        table_connection->delete_rows_with(type, id);
+        return;
+    }
+
     if (m_expire.enabled() && table_connection->table().has_geom_column()) {
         auto const result = table_connection->get_geom_by_id(type, id);
 
@@ -1496,6 +1911,15 @@ void output_flex_t::delete_from_table(table_connection_t *table_connection,
 
 void output_flex_t::delete_from_tables(osmium::item_type type, osmid_t osm_id)
 {
+    // Rows of objects still waiting in the batch must be added before the
+    // delete. And they must not be mistaken for replacement rows of this
+    // object, see finish_replacements().
+    if (m_batch_count > 0 &&
+        (batch_contains(type, osm_id) ||
+         (m_options.append && has_row_hash_tables()))) {
+        flush_batch();
+    }
+
     for (auto &table : m_table_connections) {
         if (table.table().matches_type(type) && table.table().has_id_column()) {
             delete_from_table(&table, type, osm_id);
@@ -1503,41 +1927,78 @@ void output_flex_t::delete_from_tables(osmium::item_type type, osmid_t osm_id)
     }
 }
 
+bool output_flex_t::has_row_hash_tables() const
+{
+    return std::any_of(m_table_connections.cbegin(),
+                       m_table_connections.cend(),
+                       [](table_connection_t const &table) {
+                           return table.table().has_row_hash_column();
+                       });
+}
+
+void output_flex_t::finish_replacements()
+{
+    bool const replacing =
+        std::any_of(m_table_connections.cbegin(), m_table_connections.cend(),
+                    [](table_connection_t const &table) {
+                        return table.replacing();
+                    });
+    if (!replacing) {
+        return;
+    }
+
+    // The new rows might still be waiting in the batch.
+    flush_batch();
+
+    for (auto &table : m_table_connections) {
+        if (table.replacing()) {
+            table.finish_replace(&m_expire);
+        }
+    }
+}
+
 /* Delete is easy, just remove all traces of this object. We don't need to
  * worry about finding objects that depend on it, since the same diff must
  * contain the change for that also. */
 void output_flex_t::node_delete(osmid_t osm_id)
 {
     delete_from_tables(osmium::item_type::node, osm_id);
+    finish_replacements();
 }
 
 void output_flex_t::way_delete(osmid_t osm_id)
 {
     delete_from_tables(osmium::item_type::way, osm_id);
+    finish_replacements();
 }
 
 void output_flex_t::relation_delete(osmid_t osm_id)
 {
     select_relation_members(osm_id);
     delete_from_tables(osmium::item_type::relation, osm_id);
+    finish_replacements();
 }
 
 void output_flex_t::node_modify(osmium::Node const &node)
 {
-    node_delete(node.id());
+    delete_from_tables(osmium::item_type::node, node.id());
     node_add(node);
+    finish_replacements();
 }
 
 void output_flex_t::way_modify(osmium::Way *way)
 {
-    way_delete(way->id());
+    delete_from_tables(osmium::item_type::way, way->id());
     way_add(way);
+    finish_replacements();
 }
 
 void output_flex_t::relation_modify(osmium::Relation const &rel)
 {
-    relation_delete(rel.id());
+    select_relation_members(rel.id());
+    delete_from_tables(osmium::item_type::relation, rel.id());
     relation_add(rel);
+    finish_replacements();
 }
 
 void output_flex_t::init_clone()
@@ -1563,7 +2024,8 @@ output_flex_t::clone(std::shared_ptr<middle_query_t> const &mid,
     return std::make_shared<output_flex_t>(
         mid, m_thread_pool, *get_options(), copy_thread, true, m_lua_state,
         m_process_node, m_process_way, m_process_relation,
-        m_select_relation_members, m_tables, m_stage2_way_ids);
+        m_select_relation_members, m_process_node_batch, m_process_way_batch,
+        m_process_relation_batch, m_tables, m_write_plans, m_stage2_way_ids);
 }
 
 output_flex_t::output_flex_t(
@@ -1574,17 +2036,26 @@ output_flex_t::output_flex_t(
     prepared_lua_function_t process_way,
     prepared_lua_function_t process_relation,
     prepared_lua_function_t select_relation_members,
+    prepared_lua_function_t process_node_batch,
+    prepared_lua_function_t process_way_batch,
+    prepared_lua_function_t process_relation_batch,
     std::shared_ptr<std::vector<flex_table_t>> tables,
+    std::shared_ptr<std::vector<write_plan_t>> write_plans,
     std::shared_ptr<idset_t> stage2_way_ids)
 : output_t(mid, std::move(thread_pool), o), m_tables(std::move(tables)),
-  m_stage2_way_ids(std::move(stage2_way_ids)), m_copy_thread(copy_thread),
+  m_write_plans(std::move(write_plans)),
+  m_stage2_way_ids(std::move(stage2_way_ids)), m_copy_threads{copy_thread},
   m_lua_state(std::move(lua_state)),
   m_expire(o.expire_tiles_zoom, o.expire_tiles_max_bbox, o.projection),
   m_buffer(32768, osmium::memory::Buffer::auto_grow::yes),
   m_rels_buffer(1024, osmium::memory::Buffer::auto_grow::yes),
   m_process_node(process_node), m_process_way(process_way),
   m_process_relation(process_relation),
-  m_select_relation_members(select_relation_members)
+  m_select_relation_members(select_relation_members),
+  m_process_node_batch(process_node_batch),
+  m_process_way_batch(process_way_batch),
+  m_process_relation_batch(process_relation_batch),
+  m_batch_buffer(32768, osmium::memory::Buffer::auto_grow::yes)
 {
     assert(copy_thread);
 
@@ -1604,9 +2075,24 @@ output_flex_t::output_flex_t(
             "No tables defined in Lua config. Nothing to do!"};
     }
 
+    // Additional copy threads are used for the main output, in import and
+    // in append mode. Clones are used for parallel processing of pending
+    // objects, they have one copy thread each anyway.
+    if (!is_clone) {
+        auto const num_copy_threads =
+            std::min(static_cast<std::size_t>(m_options.num_copy_threads),
+                     m_tables->size());
+        for (std::size_t i = 1; i < num_copy_threads; ++i) {
+            m_copy_threads.push_back(std::make_shared<db_copy_thread_t>(
+                m_options.database_options.conninfo()));
+        }
+    }
+
     assert(m_table_connections.empty());
     for (auto &table : *m_tables) {
-        m_table_connections.emplace_back(&table, m_copy_thread);
+        auto const &copy_thread =
+            m_copy_threads[m_table_connections.size() % m_copy_threads.size()];
+        m_table_connections.emplace_back(&table, copy_thread);
     }
 
     if (is_clone) {
@@ -1658,6 +2144,12 @@ void output_flex_t::init_lua(std::string const &filename)
             lua_tostring(lua_state(), -1))};
     }
 
+    // Replace the most often used helper functions from init.lua by
+    // native implementations.
+    lua_getglobal(lua_state(), "osm2pgsql");
+    add_native_lua_helpers(lua_state());
+    lua_settop(lua_state(), 0);
+
     // Store the "get_bbox" in the "object_metatable".
     lua_getglobal(lua_state(), "object_metatable");
     lua_getfield(lua_state(), -1, "__index");
@@ -1693,6 +2185,21 @@ void output_flex_t::init_lua(std::string const &filename)
     m_select_relation_members = prepared_lua_function_t{
         lua_state(), calling_context::select_relation_members,
         "select_relation_members", 1};
+    m_process_node_batch = prepared_lua_function_t{
+        lua_state(), calling_context::process_node, "process_node_batch"};
+    m_process_way_batch = prepared_lua_function_t{
+        lua_state(), calling_context::process_way, "process_way_batch"};
+    m_process_relation_batch =
+        prepared_lua_function_t{lua_state(), calling_context::process_relation,
+                                "process_relation_batch"};
+
+    if ((m_process_node && m_process_node_batch) ||
+        (m_process_way && m_process_way_batch) ||
+        (m_process_relation && m_process_relation_batch)) {
+        throw std::runtime_error{
+            "Only one of the functions process_OBJECT() and"
+            " process_OBJECT_batch() can be defined for each object type."};
+    }
 
     lua_remove(lua_state(), 1); // global "osm2pgsql"
 }
@@ -1755,6 +2262,7 @@ void output_flex_t::reprocess_marked()
         auto &way = m_buffer.get<osmium::Way>(0);
         way_modify(&way);
     }
+    flush_batch();
 
     // We don't need these any more so can free the memory.
     m_stage2_way_ids->clear();
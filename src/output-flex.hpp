@@ -21,6 +21,7 @@
 
 extern "C"
 {
+#include <lauxlib.h>
 #include <lua.h>
 }
 
@@ -95,6 +96,47 @@ private:
     calling_context m_calling_context = calling_context::main;
 };
 
+/**
+ * Describes how the data for one column of a flex table is written to the
+ * database. The write plan of a table contains one of these for each column
+ * filled by osm2pgsql. It is compiled once when the table is defined so that
+ * writing a row doesn't have to look at the column names and types again.
+ */
+struct column_writer_t
+{
+    enum class source_type : uint8_t
+    {
+        id_type, ///< Type of the OSM object
+        id_num, ///< Id of the OSM object
+        geometry, ///< Geometry created by the geometry transformation
+        area, ///< Area of the geometry
+        row_hash, ///< Hash of the content of the row
+        partition_key, ///< Partition the geometry belongs in
+        lua ///< Value from the Lua table given to add_row()
+    };
+
+    using encoder_type =
+        void (*)(lua_State *lua_state,
+                 db_copy_mgr_t<db_deleter_by_type_and_id_t> *copy_mgr,
+                 flex_table_column_t const &column, int ltype);
+
+    /// Index of the column in the flex table.
+    std::size_t column_index;
+
+    /// Encoder used for converting the Lua value (only for source lua).
+    encoder_type encoder;
+
+    /**
+     * Reference into the Lua registry where the column name is stored as
+     * Lua string (only for source lua).
+     */
+    int key_ref;
+
+    source_type source;
+};
+
+using write_plan_t = std::vector<column_writer_t>;
+
 class output_flex_t : public output_t
 {
 
@@ -108,8 +150,13 @@ public:
         prepared_lua_function_t process_way = {},
         prepared_lua_function_t process_relation = {},
         prepared_lua_function_t select_relation_members = {},
+        prepared_lua_function_t process_node_batch = {},
+        prepared_lua_function_t process_way_batch = {},
+        prepared_lua_function_t process_relation_batch = {},
         std::shared_ptr<std::vector<flex_table_t>> tables =
             std::make_shared<std::vector<flex_table_t>>(),
+        std::shared_ptr<std::vector<write_plan_t>> write_plans =
+            std::make_shared<std::vector<write_plan_t>>(),
         std::shared_ptr<idset_t> stage2_way_ids = std::make_shared<idset_t>());
 
     output_flex_t(output_flex_t const &) = delete;
@@ -179,6 +226,31 @@ private:
     void get_mutex_and_call_lua_function(prepared_lua_function_t func,
                                          osmium::OSMObject const &object);
 
+    /// The process_*_batch() Lua function for objects of this type.
+    prepared_lua_function_t const &
+    batch_function(osmium::item_type type) const noexcept;
+
+    /**
+     * Add a copy of the object to the batch for the process_*_batch() Lua
+     * function. The batch is handed to Lua when it is full or when an
+     * object of a different type is added.
+     */
+    void add_to_batch(osmium::OSMObject const &object);
+
+    /**
+     * Call the process_*_batch() Lua function with all objects in the batch
+     * as an array parameter.
+     */
+    void flush_batch();
+
+    bool batch_contains(osmium::item_type type, osmid_t id) const;
+
+    /**
+     * Make the object of the current batch at the specified position on the
+     * Lua stack the context object for add_row() and get_bbox().
+     */
+    void select_batch_object(int index);
+
     void init_lua(std::string const &filename);
 
     flex_table_t &create_flex_table();
@@ -187,11 +259,14 @@ private:
 
     flex_table_t const &get_table_from_param();
 
+    write_plan_t compile_write_plan(flex_table_t const &table);
+
     void write_column(db_copy_mgr_t<db_deleter_by_type_and_id_t> *copy_mgr,
-                      flex_table_column_t const &column);
+                      flex_table_column_t const &column,
+                      column_writer_t const &writer);
     void write_row(table_connection_t *table_connection,
-                   osmium::item_type id_type, osmid_t id,
-                   std::string const &geom, int srid);
+                   write_plan_t const &plan, osmium::item_type id_type,
+                   osmid_t id, std::string const &geom);
 
     geom::osmium_builder_t::wkbs_t
     run_transform(geom::osmium_builder_t *builder,
@@ -208,24 +283,37 @@ private:
         table_column_type target_geom_type, osmium::Relation const &relation);
 
     template <typename OBJECT>
-    void add_row(table_connection_t *table_connection, OBJECT const &object);
+    void add_row(table_connection_t *table_connection,
+                 write_plan_t const &plan, OBJECT const &object);
 
     void delete_from_table(table_connection_t *table_connection,
                            osmium::item_type type, osmid_t osm_id);
     void delete_from_tables(osmium::item_type type, osmid_t osm_id);
+    bool has_row_hash_tables() const;
+    void finish_replacements();
 
     std::size_t get_way_nodes();
 
     lua_State *lua_state() noexcept { return m_lua_state.get(); }
 
     std::shared_ptr<std::vector<flex_table_t>> m_tables;
+
+    // The write plans for all tables (in the same order as m_tables). This
+    // is shared between all clones of the output.
+    std::shared_ptr<std::vector<write_plan_t>> m_write_plans;
+
     std::vector<table_connection_t> m_table_connections;
 
     // This is shared between all clones of the output and must only be
     // accessed while protected using the lua_mutex.
     std::shared_ptr<idset_t> m_stage2_way_ids;
 
-    std::shared_ptr<db_copy_thread_t> m_copy_thread;
+    /**
+     * The copy threads used by this output. Tables are assigned to the copy
+     * threads round-robin, each table always uses the same thread. Clones
+     * only have a single copy thread.
+     */
+    std::vector<std::shared_ptr<db_copy_thread_t>> m_copy_threads;
 
     // This is shared between all clones of the output and must only be
     // accessed while protected using the lua_mutex.
@@ -251,6 +339,31 @@ private:
     prepared_lua_function_t m_process_way;
     prepared_lua_function_t m_process_relation;
     prepared_lua_function_t m_select_relation_members;
+    prepared_lua_function_t m_process_node_batch;
+    prepared_lua_function_t m_process_way_batch;
+    prepared_lua_function_t m_process_relation_batch;
+
+    /// The maximum number of objects handed to a process_*_batch() function.
+    static constexpr std::size_t const max_batch_size = 1000;
+
+    /// Objects waiting to be handed to a process_*_batch() Lua function.
+    osmium::memory::Buffer m_batch_buffer;
+
+    /// The number of objects in m_batch_buffer.
+    std::size_t m_batch_count = 0;
+
+    /// The type of all objects in m_batch_buffer.
+    osmium::item_type m_batch_type = osmium::item_type::undefined;
+
+    /// The objects of the batch currently processed in Lua.
+    std::vector<osmium::OSMObject *> m_batch_objects;
+
+    /**
+     * Reference into the Lua registry to a Lua table mapping the objects
+     * handed to the process_*_batch() function to their index in
+     * m_batch_objects. LUA_NOREF when no batch is processed.
+     */
+    int m_batch_index_ref = LUA_NOREF;
 
     calling_context m_calling_context = calling_context::main;
 
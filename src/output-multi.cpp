@@ -0,0 +1,208 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "db-copy.hpp"
+#include "output-multi.hpp"
+
+#include <cassert>
+#include <utility>
+
+output_multi_t::output_multi_t(std::shared_ptr<middle_query_t> const &mid,
+                               std::shared_ptr<thread_pool_t> thread_pool,
+                               options_t const &options,
+                               std::vector<std::shared_ptr<output_t>> outputs)
+: output_t(mid, std::move(thread_pool), options), m_outputs(std::move(outputs))
+{
+    assert(!m_outputs.empty());
+
+    // The middle must keep everything needed by any of the outputs.
+    for (auto const &output : m_outputs) {
+        auto const &req = output->get_requirements();
+        m_output_requirements.full_nodes |= req.full_nodes;
+        m_output_requirements.full_ways |= req.full_ways;
+        m_output_requirements.full_relations |= req.full_relations;
+        m_output_requirements.way_tags_in_relations |=
+            req.way_tags_in_relations;
+    }
+}
+
+output_multi_t::~output_multi_t() = default;
+
+std::shared_ptr<output_t>
+output_multi_t::clone(std::shared_ptr<middle_query_t> const &mid,
+                      std::shared_ptr<db_copy_thread_t> const &copy_thread) const
+{
+    std::vector<std::shared_ptr<output_t>> clones;
+    clones.reserve(m_outputs.size());
+
+    for (auto const &output : m_outputs) {
+        // The copy thread we got is connected to the main database, outputs
+        // writing to other databases need their own.
+        auto const conninfo =
+            output->get_options()->database_options.conninfo();
+        if (conninfo == m_options.database_options.conninfo()) {
+            clones.push_back(output->clone(mid, copy_thread));
+        } else {
+            clones.push_back(output->clone(
+                mid, std::make_shared<db_copy_thread_t>(conninfo)));
+        }
+    }
+
+    return std::make_shared<output_multi_t>(mid, m_thread_pool, m_options,
+                                            std::move(clones));
+}
+
+void output_multi_t::start()
+{
+    for (auto &output : m_outputs) {
+        output->start();
+    }
+}
+
+void output_multi_t::stop()
+{
+    for (auto &output : m_outputs) {
+        output->stop();
+    }
+}
+
+void output_multi_t::sync()
+{
+    for (auto &output : m_outputs) {
+        output->sync();
+    }
+}
+
+void output_multi_t::wait()
+{
+    for (auto &output : m_outputs) {
+        output->wait();
+    }
+}
+
+osmium::index::IdSetSmall<osmid_t> const &output_multi_t::get_marked_way_ids()
+{
+    m_marked_way_ids.clear();
+    for (auto &output : m_outputs) {
+        for (auto const id : output->get_marked_way_ids()) {
+            m_marked_way_ids.set(id);
+        }
+    }
+    m_marked_way_ids.sort_unique();
+
+    return m_marked_way_ids;
+}
+
+void output_multi_t::reprocess_marked()
+{
+    for (auto &output : m_outputs) {
+        output->reprocess_marked();
+    }
+}
+
+void output_multi_t::pending_way(osmid_t id)
+{
+    for (auto &output : m_outputs) {
+        output->pending_way(id);
+    }
+}
+
+void output_multi_t::pending_relation(osmid_t id)
+{
+    for (auto &output : m_outputs) {
+        output->pending_relation(id);
+    }
+}
+
+void output_multi_t::pending_relation_stage1c(osmid_t id)
+{
+    for (auto &output : m_outputs) {
+        output->pending_relation_stage1c(id);
+    }
+}
+
+void output_multi_t::select_relation_members(osmid_t id)
+{
+    for (auto &output : m_outputs) {
+        output->select_relation_members(id);
+    }
+}
+
+void output_multi_t::node_add(osmium::Node const &node)
+{
+    for (auto &output : m_outputs) {
+        output->node_add(node);
+    }
+}
+
+void output_multi_t::way_add(osmium::Way *way)
+{
+    for (auto &output : m_outputs) {
+        output->way_add(way);
+    }
+}
+
+void output_multi_t::relation_add(osmium::Relation const &rel)
+{
+    for (auto &output : m_outputs) {
+        output->relation_add(rel);
+    }
+}
+
+void output_multi_t::node_modify(osmium::Node const &node)
+{
+    for (auto &output : m_outputs) {
+        output->node_modify(node);
+    }
+}
+
+void output_multi_t::way_modify(osmium::Way *way)
+{
+    for (auto &output : m_outputs) {
+        output->way_modify(way);
+    }
+}
+
+void output_multi_t::relation_modify(osmium::Relation const &rel)
+{
+    for (auto &output : m_outputs) {
+        output->relation_modify(rel);
+    }
+}
+
+void output_multi_t::node_delete(osmid_t id)
+{
+    for (auto &output : m_outputs) {
+        output->node_delete(id);
+    }
+}
+
+void output_multi_t::way_delete(osmid_t id)
+{
+    for (auto &output : m_outputs) {
+        output->way_delete(id);
+    }
+}
+
+void output_multi_t::relation_delete(osmid_t id)
+{
+    for (auto &output : m_outputs) {
+        output->relation_delete(id);
+    }
+}
+
+void output_multi_t::merge_expire_trees(output_t *other)
+{
+    auto *const multi = dynamic_cast<output_multi_t *>(other);
+    assert(multi && multi->m_outputs.size() == m_outputs.size());
+
+    for (std::size_t i = 0; i < m_outputs.size(); ++i) {
+        m_outputs[i]->merge_expire_trees(multi->m_outputs[i].get());
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef OSM2PGSQL_OUTPUT_MULTI_HPP
+#define OSM2PGSQL_OUTPUT_MULTI_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains the class output_multi_t.
+ */
+
+#include "output.hpp"
+
+#include <memory>
+#include <vector>
+
+/**
+ * An output forwarding everything to several other outputs. This is used
+ * to fill several databases (set up with --extra-output) from a single
+ * pass over the input and a single middle. Each of the outputs has its own
+ * options (output type, style, database) and its own copy threads.
+ */
+class output_multi_t : public output_t
+{
+public:
+    output_multi_t(std::shared_ptr<middle_query_t> const &mid,
+                   std::shared_ptr<thread_pool_t> thread_pool,
+                   options_t const &options,
+                   std::vector<std::shared_ptr<output_t>> outputs);
+
+    ~output_multi_t() override;
+
+    std::shared_ptr<output_t>
+    clone(std::shared_ptr<middle_query_t> const &mid,
+          std::shared_ptr<db_copy_thread_t> const &copy_thread) const override;
+
+    void start() override;
+    void stop() override;
+    void sync() override;
+    void wait() override;
+
+    osmium::index::IdSetSmall<osmid_t> const &get_marked_way_ids() override;
+    void reprocess_marked() override;
+
+    void pending_way(osmid_t id) override;
+    void pending_relation(osmid_t id) override;
+    void pending_relation_stage1c(osmid_t id) override;
+
+    void select_relation_members(osmid_t id) override;
+
+    void node_add(osmium::Node const &node) override;
+    void way_add(osmium::Way *way) override;
+    void relation_add(osmium::Relation const &rel) override;
+
+    void node_modify(osmium::Node const &node) override;
+    void way_modify(osmium::Way *way) override;
+    void relation_modify(osmium::Relation const &rel) override;
+
+    void node_delete(osmid_t id) override;
+    void way_delete(osmid_t id) override;
+    void relation_delete(osmid_t id) override;
+
+    void merge_expire_trees(output_t *other) override;
+
+private:
+    std::vector<std::shared_ptr<output_t>> m_outputs;
+
+    /// Union of the ways marked by all outputs.
+    osmium::index::IdSetSmall<osmid_t> m_marked_way_ids;
+};
+
+#endif // OSM2PGSQL_OUTPUT_MULTI_HPP
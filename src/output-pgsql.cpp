@@ -49,7 +49,6 @@ void output_pgsql_t::pgsql_out_way(osmium::Way const &way, taglist_t *tags,
     if (polygon && way.is_closed()) {
         auto wkb = m_builder.get_wkb_polygon(way);
         if (!wkb.empty()) {
-            m_expire.from_wkb(wkb, way.id());
             if (m_enable_way_area) {
                 auto const area =
                     m_options.reproject_area
@@ -66,7 +65,6 @@ void output_pgsql_t::pgsql_out_way(osmium::Way const &way, taglist_t *tags,
         double const split_at =
             m_options.projection->target_latlon() ? 1 : 100 * 1000;
         for (auto const &wkb : m_builder.get_wkb_line(way.nodes(), split_at)) {
-            m_expire.from_wkb(wkb, way.id());
             m_tables[t_line]->write_row(way.id(), *tags, wkb);
             if (roads) {
                 m_tables[t_roads]->write_row(way.id(), *tags, wkb);
@@ -128,8 +126,7 @@ void output_pgsql_t::stop()
     }
 
     if (m_options.expire_tiles_zoom_min > 0) {
-        m_expire.output_and_destroy(m_options.expire_tiles_filename.c_str(),
-                                    m_options.expire_tiles_zoom_min);
+        m_expire.output_and_destroy(m_options);
     }
 }
 
@@ -148,7 +145,6 @@ void output_pgsql_t::node_add(osmium::Node const &node)
     }
 
     auto wkb = m_builder.get_wkb_node(node.location());
-    m_expire.from_wkb(wkb, node.id());
     m_tables[t_point]->write_row(node.id(), outtags, wkb);
 }
 
@@ -245,7 +241,6 @@ void output_pgsql_t::pgsql_process_relation(osmium::Relation const &rel)
             m_options.projection->target_latlon() ? 1 : 100 * 1000;
         auto wkbs = m_builder.get_wkb_multiline(m_buffer, split_at);
         for (auto const &wkb : wkbs) {
-            m_expire.from_wkb(wkb, -rel.id());
             m_tables[t_line]->write_row(-rel.id(), outtags, wkb);
             if (roads) {
                 m_tables[t_roads]->write_row(-rel.id(), outtags, wkb);
@@ -259,7 +254,6 @@ void output_pgsql_t::pgsql_process_relation(osmium::Relation const &rel)
                                                    m_options.enable_multi);
 
         for (auto const &wkb : wkbs) {
-            m_expire.from_wkb(wkb, -rel.id());
             if (m_enable_way_area) {
                 auto const area =
                     m_options.reproject_area
@@ -399,12 +393,24 @@ output_pgsql_t::output_pgsql_t(
     log_debug("Using projection SRS {} ({})", o.projection->target_srs(),
               o.projection->target_desc());
 
+    // Tiles are expired by the geometry builder while it creates the
+    // geometries.
+    if (m_expire.enabled()) {
+        m_builder.set_expire(&m_expire);
+    }
+
     export_list exlist;
 
     m_enable_way_area = read_style_file(m_options.style, &exlist);
 
     m_tagtransform = tagtransform_t::make_tagtransform(&m_options, exlist);
 
+    // The Lua tag transform gets the tags of member ways when processing
+    // relations.
+    if (!m_options.tag_transform_script.empty()) {
+        m_output_requirements.way_tags_in_relations = true;
+    }
+
     //for each table
     for (size_t i = 0; i < t_MAX; ++i) {
 
@@ -455,6 +461,10 @@ output_pgsql_t::output_pgsql_t(
   m_buffer(1024, osmium::memory::Buffer::auto_grow::yes),
   m_rels_buffer(1024, osmium::memory::Buffer::auto_grow::yes)
 {
+    if (m_expire.enabled()) {
+        m_builder.set_expire(&m_expire);
+    }
+
     for (size_t i = 0; i < t_MAX; ++i) {
         //copy constructor will just connect to the already there table
         m_tables[i] =
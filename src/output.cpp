@@ -11,7 +11,9 @@
 
 #include "db-copy.hpp"
 #include "format.hpp"
+#include "logging.hpp"
 #include "output-gazetteer.hpp"
+#include "output-multi.hpp"
 #include "output-null.hpp"
 #include "output-pgsql.hpp"
 #include "output.hpp"
@@ -26,12 +28,51 @@
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
+
+/**
+ * Create an output_multi_t forwarding to the main output and all outputs
+ * configured with --extra-output.
+ */
+static std::shared_ptr<output_t>
+create_multi_output(std::shared_ptr<middle_query_t> const &mid,
+                    std::shared_ptr<thread_pool_t> thread_pool,
+                    options_t const &options)
+{
+    options_t main_options{options};
+    main_options.extra_outputs.clear();
+
+    std::vector<std::shared_ptr<output_t>> outputs;
+    outputs.push_back(output_t::create_output(mid, thread_pool, main_options));
+
+    for (auto const &extra : options.extra_outputs) {
+        options_t extra_options{main_options};
+        extra_options.output_backend = extra.output_backend;
+        extra_options.style = extra.style.empty() ? DEFAULT_STYLE : extra.style;
+        extra_options.database_options.db = extra.db;
+
+        // Only the main output writes the tile expiry list.
+        extra_options.expire_tiles_zoom = 0;
+
+        log_info("Using extra {} output with style '{}'.",
+                 extra_options.output_backend, extra_options.style);
+        outputs.push_back(
+            output_t::create_output(mid, thread_pool, extra_options));
+    }
+
+    return std::make_shared<output_multi_t>(mid, std::move(thread_pool),
+                                            options, std::move(outputs));
+}
 
 std::shared_ptr<output_t>
 output_t::create_output(std::shared_ptr<middle_query_t> const &mid,
                         std::shared_ptr<thread_pool_t> thread_pool,
                         options_t const &options)
 {
+    if (!options.extra_outputs.empty()) {
+        return create_multi_output(mid, std::move(thread_pool), options);
+    }
+
     auto copy_thread =
         std::make_shared<db_copy_thread_t>(options.database_options.conninfo());
 
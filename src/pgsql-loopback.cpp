@@ -0,0 +1,711 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "pgsql-loopback.hpp"
+
+#include "format.hpp"
+#include "logging.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <regex>
+#include <utility>
+
+namespace {
+
+/// FNV-1a hash of a single COPY row (without the newline).
+uint64_t hash_row(char const *begin, char const *end) noexcept
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; begin != end; ++begin) {
+        hash ^= static_cast<unsigned char>(*begin);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool starts_with_ci(std::string const &str, char const *prefix) noexcept
+{
+    auto const len = std::strlen(prefix);
+    if (str.size() < len) {
+        return false;
+    }
+    for (std::size_t i = 0; i < len; ++i) {
+        if (std::toupper(static_cast<unsigned char>(str[i])) !=
+            std::toupper(static_cast<unsigned char>(prefix[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool equal_ci(std::string const &str, char const *other) noexcept
+{
+    return str.size() == std::strlen(other) && starts_with_ci(str, other);
+}
+
+std::string trim(std::string const &str)
+{
+    auto const begin = str.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return {};
+    }
+    auto const end = str.find_last_not_of(" \t\r\n");
+    return str.substr(begin, end - begin + 1);
+}
+
+/// Remove double quotes from (possibly schema-qualified) name.
+std::string normalize_name(std::string const &name)
+{
+    std::string result;
+    std::copy_if(name.begin(), name.end(), std::back_inserter(result),
+                 [](char c) { return c != '"'; });
+    return result;
+}
+
+/**
+ * Split string at the separator, but not inside parentheses or quoted
+ * strings. The parts are trimmed.
+ */
+std::vector<std::string> split_top_level(std::string const &str, char sep)
+{
+    std::vector<std::string> parts;
+    int depth = 0;
+    char quote = '\0';
+    std::size_t start = 0;
+
+    for (std::size_t i = 0; i < str.size(); ++i) {
+        char const c = str[i];
+        if (quote != '\0') {
+            if (c == quote) {
+                quote = '\0';
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')') {
+            --depth;
+        } else if (c == sep && depth == 0) {
+            parts.push_back(trim(str.substr(start, i - start)));
+            start = i + 1;
+        }
+    }
+    parts.push_back(trim(str.substr(start)));
+
+    return parts;
+}
+
+/**
+ * Split SQL string into statements. Semicolons in quoted strings and in
+ * dollar-quoted function bodies are ignored.
+ */
+std::vector<std::string> split_statements(char const *sql)
+{
+    std::vector<std::string> statements;
+    std::string current;
+    char quote = '\0';
+    bool in_dollar_quote = false;
+
+    for (char const *p = sql; *p != '\0'; ++p) {
+        if (in_dollar_quote) {
+            if (p[0] == '$' && p[1] == '$') {
+                in_dollar_quote = false;
+                current += *p++;
+            }
+        } else if (quote != '\0') {
+            if (*p == quote) {
+                quote = '\0';
+            }
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (p[0] == '$' && p[1] == '$') {
+            in_dollar_quote = true;
+            current += *p++;
+        } else if (*p == ';') {
+            auto statement = trim(current);
+            if (!statement.empty()) {
+                statements.push_back(std::move(statement));
+            }
+            current.clear();
+            continue;
+        }
+        current += *p;
+    }
+
+    auto statement = trim(current);
+    if (!statement.empty()) {
+        statements.push_back(std::move(statement));
+    }
+
+    return statements;
+}
+
+/// Parse a single id or an array literal with ids.
+std::vector<osmid_t> parse_ids(char const *str)
+{
+    std::vector<osmid_t> ids;
+
+    if (*str == '{') {
+        ++str;
+    }
+
+    while (*str != '\0' && *str != '}') {
+        char *end = nullptr;
+        ids.push_back(std::strtoll(str, &end, 10));
+        if (end == str) {
+            break;
+        }
+        str = end;
+        if (*str == ',') {
+            ++str;
+        }
+    }
+
+    return ids;
+}
+
+/**
+ * Unescape a field in COPY text format. Returns false if the field is
+ * the NULL value.
+ */
+bool unescape_copy_field(char const *begin, char const *end,
+                         std::string *result)
+{
+    if (end - begin == 2 && begin[0] == '\\' && begin[1] == 'N') {
+        return false;
+    }
+
+    result->clear();
+    for (char const *p = begin; p != end; ++p) {
+        if (*p != '\\' || p + 1 == end) {
+            *result += *p;
+            continue;
+        }
+        ++p;
+        switch (*p) {
+        case 'b':
+            *result += '\b';
+            break;
+        case 'f':
+            *result += '\f';
+            break;
+        case 'n':
+            *result += '\n';
+            break;
+        case 'r':
+            *result += '\r';
+            break;
+        case 't':
+            *result += '\t';
+            break;
+        case 'v':
+            *result += '\v';
+            break;
+        default:
+            *result += *p;
+            break;
+        }
+    }
+
+    return true;
+}
+
+/// Split a line in COPY text format into its (still escaped) fields.
+std::vector<std::pair<char const *, char const *>>
+split_copy_line(std::string const &line)
+{
+    std::vector<std::pair<char const *, char const *>> fields;
+
+    char const *begin = line.data();
+    char const *const end = line.data() + line.size();
+    for (char const *p = begin; p != end; ++p) {
+        if (*p == '\t') {
+            fields.emplace_back(begin, p);
+            begin = p + 1;
+        }
+    }
+    fields.emplace_back(begin, end);
+
+    return fields;
+}
+
+/// Convert a value in text format into binary format for the given type.
+std::string to_binary(std::string const &value, std::string const &type)
+{
+    if (type == "int8") {
+        auto num = static_cast<uint64_t>(std::strtoll(value.c_str(), nullptr, 10));
+        std::string result(8, '\0');
+        for (std::size_t i = 8; i > 0; --i) {
+            result[i - 1] = static_cast<char>(num & 0xffU);
+            num >>= 8U;
+        }
+        return result;
+    }
+
+    if (type == "bytea" && starts_with_ci(value, "\\x")) {
+        std::string result;
+        result.reserve((value.size() - 2) / 2);
+        for (std::size_t i = 2; i + 1 < value.size(); i += 2) {
+            result += static_cast<char>(
+                std::stoi(value.substr(i, 2), nullptr, 16));
+        }
+        return result;
+    }
+
+    return value;
+}
+
+PGresult *make_result(ExecStatusType status)
+{
+    return PQmakeEmptyPGresult(nullptr, status);
+}
+
+/// Make result with a single column containing the specified values.
+PGresult *make_result(std::vector<char const *> const &values)
+{
+    PGresult *const result = make_result(PGRES_TUPLES_OK);
+
+    PGresAttDesc attr{};
+    attr.name = const_cast<char *>("value");
+    PQsetResultAttrs(result, 1, &attr);
+
+    int row = 0;
+    for (auto const *value : values) {
+        PQsetvalue(result, row++, 0, const_cast<char *>(value),
+                   static_cast<int>(std::strlen(value)));
+    }
+
+    return result;
+}
+
+} // anonymous namespace
+
+loopback_db_t::table_t &loopback_db_t::get_table(std::string const &name)
+{
+    return m_tables[name];
+}
+
+void loopback_db_t::create_table(std::string const &sql)
+{
+    // Skip "CREATE [UNLOGGED] TABLE [IF NOT EXISTS]"
+    std::size_t pos = 0;
+    auto const next_token = [&]() {
+        auto const begin = sql.find_first_not_of(" \t\r\n", pos);
+        if (begin == std::string::npos) {
+            pos = sql.size();
+            return std::string{};
+        }
+        auto end = begin;
+        bool quoted = false;
+        while (end < sql.size() &&
+               (quoted || (!std::isspace(sql[end]) && sql[end] != '('))) {
+            if (sql[end] == '"') {
+                quoted = !quoted;
+            }
+            ++end;
+        }
+        pos = end;
+        return sql.substr(begin, end - begin);
+    };
+
+    std::string token;
+    do {
+        token = next_token();
+    } while (!token.empty() && !equal_ci(token, "TABLE"));
+
+    auto name = next_token();
+    if (equal_ci(name, "IF")) {
+        next_token(); // NOT
+        next_token(); // EXISTS
+        name = next_token();
+    }
+    if (name.empty()) {
+        return;
+    }
+
+    table_t table;
+
+    // Only plain column lists are understood, anything else ("AS SELECT",
+    // "PARTITION OF", ...) leaves the columns unknown.
+    auto const open = sql.find_first_not_of(" \t\r\n", pos);
+    if (open != std::string::npos && sql[open] == '(') {
+        int depth = 0;
+        auto close = open;
+        for (; close < sql.size(); ++close) {
+            if (sql[close] == '(') {
+                ++depth;
+            } else if (sql[close] == ')' && --depth == 0) {
+                break;
+            }
+        }
+
+        for (auto const &def :
+             split_top_level(sql.substr(open + 1, close - open - 1), ',')) {
+            auto const space = def.find_first_of(" \t\r\n");
+            if (space == std::string::npos) {
+                continue;
+            }
+            auto const column = normalize_name(def.substr(0, space));
+            if (equal_ci(column, "PRIMARY") || equal_ci(column, "CONSTRAINT") ||
+                equal_ci(column, "UNIQUE") || equal_ci(column, "CHECK")) {
+                continue;
+            }
+            auto type = trim(def.substr(space));
+            type = type.substr(0, type.find_first_of(" \t\r\n"));
+            std::transform(type.begin(), type.end(), type.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+            table.columns.push_back(column);
+            table.types.push_back(type);
+        }
+    }
+
+    table.has_id = !table.columns.empty() && table.columns[0] == "id" &&
+                   table.types[0] == "int8";
+
+    // Statistics are kept when a table is re-created, so that they cover
+    // all data sent to the table.
+    std::lock_guard<std::mutex> const guard{m_mutex};
+    auto &existing = get_table(normalize_name(name));
+    existing.columns = std::move(table.columns);
+    existing.types = std::move(table.types);
+    existing.rows.clear();
+    existing.has_id = table.has_id;
+}
+
+void loopback_db_t::drop_table(std::string const &name)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto const it = m_tables.find(name);
+    if (it == m_tables.end()) {
+        return;
+    }
+
+    it->second.columns.clear();
+    it->second.types.clear();
+    it->second.rows.clear();
+    it->second.has_id = false;
+}
+
+void loopback_db_t::delete_rows(std::string const &name,
+                                std::vector<osmid_t> const &ids)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto const it = m_tables.find(name);
+    if (it == m_tables.end()) {
+        return;
+    }
+
+    for (auto const id : ids) {
+        it->second.rows.erase(id);
+    }
+}
+
+void loopback_db_t::copy_data(std::string const &name,
+                              std::vector<std::string> const &columns,
+                              char const *data, std::size_t size)
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto &table = get_table(name);
+
+    // Map from table column to column in the COPY data if the COPY
+    // command has a column list different from the table columns.
+    std::vector<int> column_map;
+    if (table.has_id && !columns.empty() && columns != table.columns) {
+        for (auto const &column : table.columns) {
+            auto const it = std::find(columns.begin(), columns.end(), column);
+            column_map.push_back(it == columns.end()
+                                     ? -1
+                                     : static_cast<int>(it - columns.begin()));
+        }
+    }
+
+    char const *start = data;
+    char const *const data_end = data + size;
+    while (start < data_end) {
+        char const *const end = std::find(start, data_end, '\n');
+
+        // Rows from several connections arrive interleaved in any order,
+        // so the row hashes are combined with an order-independent sum.
+        ++table.lines;
+        table.bytes += static_cast<std::size_t>(end - start) + 1;
+        table.checksum += hash_row(start, end);
+
+        if (table.has_id) {
+            std::string line{start, end};
+            if (!column_map.empty()) {
+                auto const fields = split_copy_line(line);
+                std::string mapped;
+                for (auto const index : column_map) {
+                    if (index < 0 ||
+                        static_cast<std::size_t>(index) >= fields.size()) {
+                        mapped += "\\N";
+                    } else {
+                        auto const &field =
+                            fields[static_cast<std::size_t>(index)];
+                        mapped.append(field.first, field.second);
+                    }
+                    mapped += '\t';
+                }
+                mapped.resize(mapped.size() - 1);
+                line = std::move(mapped);
+            }
+            osmid_t const id = std::strtoll(line.c_str(), nullptr, 10);
+            table.rows[id] = std::move(line);
+        }
+
+        start = end + 1;
+    }
+}
+
+PGresult *loopback_db_t::lookup(std::string const &name,
+                                std::vector<std::string> const &columns,
+                                std::vector<osmid_t> const &ids,
+                                int result_format) const
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto const it = m_tables.find(name);
+    if (it == m_tables.end() || !it->second.has_id) {
+        return nullptr;
+    }
+    auto const &table = it->second;
+
+    std::vector<std::size_t> indexes;
+    std::vector<PGresAttDesc> attrs(columns.size());
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+        auto const col =
+            std::find(table.columns.begin(), table.columns.end(), columns[i]);
+        if (col == table.columns.end()) {
+            return nullptr;
+        }
+        indexes.push_back(
+            static_cast<std::size_t>(col - table.columns.begin()));
+        attrs[i].name = const_cast<char *>(columns[i].c_str());
+        attrs[i].format = result_format;
+    }
+
+    PGresult *const result = make_result(PGRES_TUPLES_OK);
+    PQsetResultAttrs(result, static_cast<int>(attrs.size()), attrs.data());
+
+    int row = 0;
+    std::string value;
+    for (auto const id : ids) {
+        auto const r = table.rows.find(id);
+        if (r == table.rows.end()) {
+            continue;
+        }
+        auto const fields = split_copy_line(r->second);
+        for (std::size_t i = 0; i < indexes.size(); ++i) {
+            auto const index = indexes[i];
+            if (index >= fields.size() ||
+                !unescape_copy_field(fields[index].first,
+                                     fields[index].second, &value)) {
+                PQsetvalue(result, row, static_cast<int>(i), nullptr, -1);
+                continue;
+            }
+            if (result_format == 1) {
+                value = to_binary(value, table.types[index]);
+            }
+            PQsetvalue(result, row, static_cast<int>(i), &value[0],
+                       static_cast<int>(value.size()));
+        }
+        ++row;
+    }
+
+    return result;
+}
+
+uint64_t loopback_db_t::checksum(std::string const &name) const
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    auto const it = m_tables.find(name);
+    return it == m_tables.end() ? 0 : it->second.checksum;
+}
+
+void loopback_db_t::log_stats() const
+{
+    std::lock_guard<std::mutex> const guard{m_mutex};
+
+    for (auto const &table : m_tables) {
+        if (table.second.lines == 0) {
+            continue;
+        }
+        log_info("Loopback table '{}': {} rows, {} bytes, checksum {:016x}",
+                 table.first, table.second.lines, table.second.bytes,
+                 table.second.checksum);
+    }
+}
+
+loopback_db_t &get_loopback_db() noexcept
+{
+    static loopback_db_t db;
+    return db;
+}
+
+PGresult *loopback_conn_t::query(ExecStatusType expect, char const *sql)
+{
+    PGresult *result = nullptr;
+
+    for (auto const &statement : split_statements(sql)) {
+        if (result) {
+            PQclear(result);
+        }
+        result = execute(expect, statement);
+    }
+
+    return result ? result : make_result(expect);
+}
+
+PGresult *loopback_conn_t::execute(ExecStatusType expect,
+                                   std::string const &sql)
+{
+    if (starts_with_ci(sql, "COPY ")) {
+        auto const end = sql.find_first_of(" (", 5);
+        m_copy_table = normalize_name(sql.substr(5, end - 5));
+        m_copy_columns.clear();
+        auto const open = sql.find('(', 5);
+        if (open != std::string::npos) {
+            auto const close = sql.find(')', open);
+            for (auto const &column :
+                 split_top_level(sql.substr(open + 1, close - open - 1), ',')) {
+                m_copy_columns.push_back(normalize_name(column));
+            }
+        }
+        m_partial_line.clear();
+        return make_result(PGRES_COPY_IN);
+    }
+
+    if (starts_with_ci(sql, "PREPARE ")) {
+        prepare(sql);
+    } else if (starts_with_ci(sql, "CREATE ")) {
+        get_loopback_db().create_table(sql);
+    } else if (starts_with_ci(sql, "DROP TABLE ")) {
+        auto names = sql.substr(11);
+        if (starts_with_ci(names, "IF EXISTS ")) {
+            names = names.substr(10);
+        }
+        for (auto name : split_top_level(names, ',')) {
+            name = name.substr(0, name.find_first_of(" \t\r\n"));
+            get_loopback_db().drop_table(normalize_name(name));
+        }
+    } else if (starts_with_ci(sql, "DELETE FROM ")) {
+        // Only "DELETE FROM table WHERE id IN (...)" is understood.
+        auto const where = sql.find(" WHERE id IN (");
+        if (where != std::string::npos) {
+            auto const name = trim(sql.substr(12, where - 12));
+            get_loopback_db().delete_rows(
+                normalize_name(name), parse_ids(sql.c_str() + where + 14));
+        }
+    } else if (sql.find("FROM pg_extension WHERE extname='postgis'") !=
+               std::string::npos) {
+        return make_result({"3", "1"});
+    } else if (starts_with_ci(sql, "SELECT current_catalog")) {
+        return make_result({"loopback"});
+    }
+
+    return make_result(expect);
+}
+
+void loopback_conn_t::prepare(std::string const &sql)
+{
+    static std::regex const prepare_re{
+        "PREPARE\\s+(\\w+)\\s*\\([^)]*\\)\\s+AS\\s+SELECT\\s+(.+?)\\s+"
+        "FROM\\s+(\\S+)\\s+WHERE\\s+id\\s*=\\s*"
+        "(\\$1|ANY\\s*\\(\\s*\\$1::int8\\[\\]\\s*\\))\\s*",
+        std::regex::ECMAScript | std::regex::icase};
+
+    std::string flat{sql};
+    std::replace(flat.begin(), flat.end(), '\n', ' ');
+
+    std::smatch match;
+    if (!std::regex_match(flat, match, prepare_re)) {
+        // Remember the name, so that executing the statement works.
+        static std::regex const name_re{"PREPARE\\s+(\\w+).*",
+                                        std::regex::ECMAScript |
+                                            std::regex::icase};
+        if (std::regex_match(flat, match, name_re)) {
+            m_statements[match[1]] = statement_t{};
+        }
+        return;
+    }
+
+    statement_t statement;
+    statement.table = normalize_name(match[3]);
+    for (auto const &column : split_top_level(match[2], ',')) {
+        statement.columns.push_back(normalize_name(column));
+    }
+    statement.supported = true;
+
+    m_statements[match[1]] = std::move(statement);
+}
+
+PGresult *loopback_conn_t::exec_prepared(char const *stmt, int num_params,
+                                         char const *const *param_values,
+                                         int result_format) const
+{
+    auto const it = m_statements.find(stmt);
+    if (it == m_statements.end()) {
+        PGresult *const result = make_result(PGRES_FATAL_ERROR);
+        return result;
+    }
+
+    auto const &statement = it->second;
+    if (statement.supported && num_params == 1 && param_values[0]) {
+        PGresult *const result = get_loopback_db().lookup(
+            statement.table, statement.columns, parse_ids(param_values[0]),
+            result_format);
+        if (result) {
+            return result;
+        }
+    }
+
+    return make_result(PGRES_TUPLES_OK);
+}
+
+void loopback_conn_t::copy_data(std::string const &data)
+{
+    // Only complete lines are handed to the database.
+    auto const last = data.rfind('\n');
+    if (last == std::string::npos) {
+        m_partial_line += data;
+        return;
+    }
+
+    if (m_partial_line.empty()) {
+        get_loopback_db().copy_data(m_copy_table, m_copy_columns, data.data(),
+                                    last);
+    } else {
+        m_partial_line.append(data, 0, last);
+        get_loopback_db().copy_data(m_copy_table, m_copy_columns,
+                                    m_partial_line.data(),
+                                    m_partial_line.size());
+        m_partial_line.clear();
+    }
+    m_partial_line.append(data, last + 1, std::string::npos);
+}
+
+void loopback_conn_t::end_copy()
+{
+    if (!m_partial_line.empty()) {
+        get_loopback_db().copy_data(m_copy_table, m_copy_columns,
+                                    m_partial_line.data(),
+                                    m_partial_line.size());
+        m_partial_line.clear();
+    }
+    m_copy_table.clear();
+    m_copy_columns.clear();
+}
@@ -0,0 +1,161 @@
+#ifndef OSM2PGSQL_PGSQL_LOOPBACK_HPP
+#define OSM2PGSQL_PGSQL_LOOPBACK_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+/**
+ * \file
+ *
+ * This file is part of osm2pgsql (https://github.com/openstreetmap/osm2pgsql).
+ *
+ * Contains the classes for the in-process stand-in for the database used
+ * with the --loopback-database option.
+ */
+
+#include "osmtypes.hpp"
+
+#include <libpq-fe.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// The conninfo string used to connect to the loopback database.
+constexpr char const *const loopback_conninfo = "osm2pgsql-loopback";
+
+/**
+ * In-process stand-in for the database. It is used to measure how much CPU
+ * time osm2pgsql itself needs without a database in the loop.
+ *
+ * Data sent with COPY is counted and checksummed row by row, the checksum
+ * doesn't depend on the order of the rows. Rows of tables with an
+ * "id" column of type int8 as first column (the middle tables) are kept in
+ * memory, so that the simple lookups by id the middle does can be answered.
+ * All other SQL commands are accepted and ignored.
+ *
+ * There is one instance of this class shared by all connections, use
+ * get_loopback_db() to access it. All functions are thread-safe.
+ */
+class loopback_db_t
+{
+public:
+    /// Register a table from a CREATE TABLE command.
+    void create_table(std::string const &sql);
+
+    /// Forget about the columns and rows of a table, statistics are kept.
+    void drop_table(std::string const &name);
+
+    /// Remove rows with the specified ids from a table.
+    void delete_rows(std::string const &name, std::vector<osmid_t> const &ids);
+
+    /**
+     * Add COPY data for a table. The data must only contain complete lines.
+     * The columns are the ones in the COPY command, empty if there was no
+     * column list.
+     */
+    void copy_data(std::string const &name,
+                   std::vector<std::string> const &columns, char const *data,
+                   std::size_t size);
+
+    /**
+     * Build result for a query for the specified columns of the rows with
+     * the specified ids. Returns nullptr if the table or one of the columns
+     * is unknown.
+     */
+    PGresult *lookup(std::string const &name,
+                     std::vector<std::string> const &columns,
+                     std::vector<osmid_t> const &ids, int result_format) const;
+
+    /// Checksum of all rows sent with COPY to a table so far.
+    uint64_t checksum(std::string const &name) const;
+
+    /// Log number of rows, bytes, and checksum of the data for all tables.
+    void log_stats() const;
+
+private:
+    struct table_t
+    {
+        std::vector<std::string> columns;
+        std::vector<std::string> types;
+
+        /// Rows (as COPY lines) by id. Only used for tables with id column.
+        std::unordered_map<osmid_t, std::string> rows;
+
+        bool has_id = false;
+
+        std::size_t lines = 0;
+        std::size_t bytes = 0;
+        /// Sum of the hashes of all rows.
+        uint64_t checksum = 0;
+    };
+
+    table_t &get_table(std::string const &name);
+
+    std::map<std::string, table_t> m_tables;
+
+    mutable std::mutex m_mutex;
+
+}; // class loopback_db_t
+
+loopback_db_t &get_loopback_db() noexcept;
+
+/**
+ * One connection to the loopback database. This is what pg_conn_t uses
+ * instead of a libpq connection in loopback mode. Prepared statements and
+ * COPY state are kept per connection like in a real database.
+ *
+ * Functions return newly created PGresult objects owned by the caller.
+ */
+class loopback_conn_t
+{
+public:
+    PGresult *query(ExecStatusType expect, char const *sql);
+
+    PGresult *exec_prepared(char const *stmt, int num_params,
+                            char const *const *param_values,
+                            int result_format) const;
+
+    void copy_data(std::string const &data);
+
+    void end_copy();
+
+private:
+    /**
+     * A prepared statement of the form "SELECT columns FROM table WHERE
+     * id = $1" or "... WHERE id = ANY($1::int8[])". Statements that look
+     * different are not supported and return empty results.
+     */
+    struct statement_t
+    {
+        std::string table;
+        std::vector<std::string> columns;
+        bool supported = false;
+    };
+
+    PGresult *execute(ExecStatusType expect, std::string const &sql);
+
+    void prepare(std::string const &sql);
+
+    std::unordered_map<std::string, statement_t> m_statements;
+
+    /// Table and columns of the current COPY.
+    std::string m_copy_table;
+    std::vector<std::string> m_copy_columns;
+
+    /// Incomplete line from the last call to copy_data().
+    std::string m_partial_line;
+
+}; // class loopback_conn_t
+
+#endif // OSM2PGSQL_PGSQL_LOOPBACK_HPP
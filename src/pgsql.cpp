@@ -10,6 +10,8 @@
 /* Helper functions for the postgresql connections */
 #include "format.hpp"
 #include "logging.hpp"
+#include "metrics.hpp"
+#include "pgsql-loopback.hpp"
 #include "pgsql.hpp"
 #include "util.hpp"
 
@@ -19,9 +21,47 @@
 #include <string>
 #include <utility>
 
+namespace {
+
+/// Metrics for the communication with the database.
+struct sql_metrics_t
+{
+    metric_t &query_count = get_metrics().counter(
+        "osm2pgsql_sql_statements_total", "Number of SQL statements run.",
+        "kind=\"query\"");
+    metric_t &query_time = get_metrics().duration(
+        "osm2pgsql_sql_duration_seconds_total",
+        "Time spent waiting for the database.", "kind=\"query\"");
+    metric_t &prepared_count = get_metrics().counter(
+        "osm2pgsql_sql_statements_total", "Number of SQL statements run.",
+        "kind=\"prepared\"");
+    metric_t &prepared_time = get_metrics().duration(
+        "osm2pgsql_sql_duration_seconds_total",
+        "Time spent waiting for the database.", "kind=\"prepared\"");
+    metric_t &copy_time = get_metrics().duration(
+        "osm2pgsql_sql_duration_seconds_total",
+        "Time spent waiting for the database.", "kind=\"copy\"");
+    metric_t &copy_bytes =
+        get_metrics().counter("osm2pgsql_copy_bytes_total",
+                              "Bytes of COPY data sent to the database.");
+};
+
+sql_metrics_t &sql_metrics()
+{
+    static sql_metrics_t metrics;
+    return metrics;
+}
+
+} // anonymous namespace
+
 pg_conn_t::pg_conn_t(std::string const &conninfo)
-: m_conn(PQconnectdb(conninfo.c_str()))
 {
+    if (conninfo == loopback_conninfo) {
+        m_loopback = std::make_unique<loopback_conn_t>();
+        return;
+    }
+
+    m_conn.reset(PQconnectdb(conninfo.c_str()));
     if (!m_conn) {
         throw std::runtime_error{"Connecting to database failed."};
     }
@@ -31,8 +71,24 @@ pg_conn_t::pg_conn_t(std::string const &conninfo)
     }
 }
 
+pg_conn_t::pg_conn_t(pg_conn_t &&) noexcept = default;
+
+pg_conn_t &pg_conn_t::operator=(pg_conn_t &&) noexcept = default;
+
+pg_conn_t::~pg_conn_t() noexcept = default;
+
+void pg_conn_t::close() noexcept
+{
+    m_conn.reset();
+    m_loopback.reset();
+}
+
 char const *pg_conn_t::error_msg() const noexcept
 {
+    if (m_loopback) {
+        return "Not supported by loopback database";
+    }
+
     assert(m_conn);
 
     return PQerrorMessage(m_conn.get());
@@ -40,10 +96,16 @@ char const *pg_conn_t::error_msg() const noexcept
 
 pg_result_t pg_conn_t::query(ExecStatusType expect, char const *sql) const
 {
-    assert(m_conn);
+    assert(m_conn || m_loopback);
 
     log_sql("{}", sql);
-    pg_result_t res{PQexec(m_conn.get(), sql)};
+
+    auto &metrics = sql_metrics();
+    metrics.query_count.add();
+    metric_timer_t const timer{&metrics.query_time};
+
+    pg_result_t res{m_loopback ? m_loopback->query(expect, sql)
+                               : PQexec(m_conn.get(), sql)};
     if (PQresultStatus(res.get()) != expect) {
         throw std::runtime_error{"Database error: {}"_format(error_msg())};
     }
@@ -84,9 +146,18 @@ void pg_conn_t::exec(std::string const &sql) const
 void pg_conn_t::copy_data(std::string const &sql,
                           std::string const &context) const
 {
-    assert(m_conn);
-
     log_sql_data("Copy data to '{}':\n{}", context, sql);
+
+    auto &metrics = sql_metrics();
+    metrics.copy_bytes.add(sql.size());
+    metric_timer_t const timer{&metrics.copy_time};
+
+    if (m_loopback) {
+        m_loopback->copy_data(sql);
+        return;
+    }
+
+    assert(m_conn);
     int const r = PQputCopyData(m_conn.get(), sql.c_str(), (int)sql.size());
 
     if (r == 1) {
@@ -114,6 +185,13 @@ void pg_conn_t::copy_data(std::string const &sql,
 
 void pg_conn_t::end_copy(std::string const &context) const
 {
+    metric_timer_t const timer{&sql_metrics().copy_time};
+
+    if (m_loopback) {
+        m_loopback->end_copy();
+        return;
+    }
+
     assert(m_conn);
 
     if (PQputCopyEnd(m_conn.get(), nullptr) != 1) {
@@ -147,16 +225,26 @@ static std::string concat_params(int num_params,
 
 pg_result_t
 pg_conn_t::exec_prepared_internal(char const *stmt, int num_params,
-                                  char const *const *param_values) const
+                                  char const *const *param_values,
+                                  int result_format) const
 {
-    assert(m_conn);
+    assert(m_conn || m_loopback);
 
     if (get_logger().log_sql()) {
         log_sql("EXECUTE {}({})", stmt,
                 concat_params(num_params, param_values));
     }
-    pg_result_t res{PQexecPrepared(m_conn.get(), stmt, num_params, param_values,
-                                   nullptr, nullptr, 0)};
+
+    auto &metrics = sql_metrics();
+    metrics.prepared_count.add();
+    metric_timer_t const timer{&metrics.prepared_time};
+
+    pg_result_t res{
+        m_loopback ? m_loopback->exec_prepared(stmt, num_params, param_values,
+                                               result_format)
+                   : PQexecPrepared(m_conn.get(), stmt, num_params,
+                                    param_values, nullptr, nullptr,
+                                    result_format)};
     if (PQresultStatus(res.get()) != PGRES_TUPLES_OK) {
         log_error("SQL command failed: EXECUTE {}({})", stmt,
                   concat_params(num_params, param_values));
@@ -190,6 +278,20 @@ pg_result_t pg_conn_t::exec_prepared(char const *stmt, osmid_t id) const
     return exec_prepared(stmt, buffer.c_str());
 }
 
+pg_result_t pg_conn_t::exec_prepared_binary(char const *stmt,
+                                            std::string const &param) const
+{
+    char const *const value = param.c_str();
+    return exec_prepared_internal(stmt, 1, &value, 1);
+}
+
+pg_result_t pg_conn_t::exec_prepared_binary(char const *stmt, osmid_t id) const
+{
+    util::integer_to_buffer buffer{id};
+    char const *const value = buffer.c_str();
+    return exec_prepared_internal(stmt, 1, &value, 1);
+}
+
 std::string tablespace_clause(std::string const &name)
 {
     std::string sql;
@@ -27,6 +27,8 @@
 #include <memory>
 #include <string>
 
+class loopback_conn_t;
+
 /**
  * PostgreSQL query result.
  *
@@ -111,12 +113,23 @@ private:
  *
  * The connection is automatically closed when the object is destroyed or
  * you can close it explicitly by calling close().
+ *
+ * If the conninfo is the loopback_conninfo, no connection to a database is
+ * made, everything is handled by the in-process loopback database instead.
  */
 class pg_conn_t
 {
 public:
     explicit pg_conn_t(std::string const &conninfo);
 
+    pg_conn_t(pg_conn_t const &) = delete;
+    pg_conn_t &operator=(pg_conn_t const &) = delete;
+
+    pg_conn_t(pg_conn_t &&) noexcept;
+    pg_conn_t &operator=(pg_conn_t &&) noexcept;
+
+    ~pg_conn_t() noexcept;
+
     /// Execute a prepared statement with one parameter.
     pg_result_t exec_prepared(char const *stmt, char const *param) const;
 
@@ -129,6 +142,19 @@ public:
     /// Execute a prepared statement with one integer parameter.
     pg_result_t exec_prepared(char const *stmt, osmid_t id) const;
 
+    /**
+     * Execute a prepared statement with one string parameter. The result
+     * is returned in binary format.
+     */
+    pg_result_t exec_prepared_binary(char const *stmt,
+                                     std::string const &param) const;
+
+    /**
+     * Execute a prepared statement with one integer parameter. The result
+     * is returned in binary format.
+     */
+    pg_result_t exec_prepared_binary(char const *stmt, osmid_t id) const;
+
     pg_result_t query(ExecStatusType expect, char const *sql) const;
 
     pg_result_t query(ExecStatusType expect, std::string const &sql) const;
@@ -146,11 +172,12 @@ public:
     char const *error_msg() const noexcept;
 
     /// Close database connection.
-    void close() noexcept { m_conn.reset(); }
+    void close() noexcept;
 
 private:
     pg_result_t exec_prepared_internal(char const *stmt, int num_params,
-                                       char const *const *param_values) const;
+                                       char const *const *param_values,
+                                       int result_format = 0) const;
 
     struct pg_conn_deleter_t
     {
@@ -158,6 +185,9 @@ private:
     };
 
     std::unique_ptr<PGconn, pg_conn_deleter_t> m_conn;
+
+    /// Connection to the loopback database (only in loopback mode).
+    std::unique_ptr<loopback_conn_t> m_loopback;
 };
 
 /**
@@ -23,6 +23,8 @@
 #include "taginfo.hpp"
 #include "util.hpp"
 
+constexpr std::size_t const table_t::no_tag;
+
 table_t::table_t(std::string const &name, std::string const &type,
                  columns_t const &columns, hstores_t const &hstore_columns,
                  int const srid, bool const append, hstore_column hstore_mode,
@@ -41,6 +43,7 @@ table_t::table_t(std::string const &name, std::string const &type,
             "No columns provided for table {}."_format(name)};
     }
 
+    init_column_index();
     generate_copy_column_list();
 }
 
@@ -52,6 +55,8 @@ table_t::table_t(table_t const &other,
   m_hstore_columns(other.m_hstore_columns), m_table_space(other.m_table_space),
   m_copy(copy_thread)
 {
+    init_column_index();
+
     // if the other table has already started, then we want to execute
     // the same stuff to get into the same state. but if it hasn't, then
     // this would be premature.
@@ -61,6 +66,17 @@ table_t::table_t(table_t const &other,
     }
 }
 
+void table_t::init_column_index()
+{
+    m_column_index.reserve(m_columns.size());
+    for (std::size_t i = 0; i < m_columns.size(); ++i) {
+        m_column_index.emplace(m_columns[i].name, i);
+    }
+
+    m_column_tags.resize(m_columns.size());
+    m_hstore_column_tags.resize(m_hstore_columns.size());
+}
+
 void table_t::teardown() { m_sql_conn.reset(); }
 
 void table_t::sync() { m_copy.sync(); }
@@ -283,22 +299,17 @@ void table_t::write_row(osmid_t id, taglist_t const &tags,
     //add the osm id
     m_copy.add_column(id);
 
-    // used to remember which columns have been written out already.
-    std::vector<bool> used;
-
-    if (m_hstore_mode != hstore_column::none) {
-        used.assign(tags.size(), false);
-    }
+    route_tags(tags);
 
     //get the regular columns' values
-    write_columns(tags, m_hstore_mode == hstore_column::norm ? &used : nullptr);
+    write_columns(tags);
 
     //get the hstore columns' values
     write_hstore_columns(tags);
 
     //get the key value pairs for the tags column
     if (m_hstore_mode != hstore_column::none) {
-        write_tags_column(tags, used);
+        write_tags_column(tags);
     }
 
     //add the geometry - encoding it to hex along the way
@@ -308,18 +319,44 @@ void table_t::write_row(osmid_t id, taglist_t const &tags,
     m_copy.finish_line();
 }
 
-void table_t::write_columns(taglist_t const &tags, std::vector<bool> *used)
+/**
+ * Find out in one pass over the tags which tag goes into which column. If
+ * there are several tags with the same key, the first one is used for the
+ * column.
+ */
+void table_t::route_tags(taglist_t const &tags)
 {
-    for (auto const &column : m_columns) {
-        std::size_t const idx = tags.indexof(column.name);
-        if (idx != std::numeric_limits<std::size_t>::max()) {
-            escape_type(tags[idx].value, column.type);
-
-            // Remember we already used this one so we can't use
-            // again later in the hstore column.
-            if (used) {
-                (*used)[idx] = true;
+    std::fill(m_column_tags.begin(), m_column_tags.end(), no_tag);
+    for (auto &tag_list : m_hstore_column_tags) {
+        tag_list.clear();
+    }
+    m_tag_used.assign(tags.size(), false);
+
+    for (std::size_t i = 0; i < tags.size(); ++i) {
+        auto const &key = tags[i].key;
+
+        auto const it = m_column_index.find(key);
+        if (it != m_column_index.end() && m_column_tags[it->second] == no_tag) {
+            m_column_tags[it->second] = i;
+            m_tag_used[i] = true;
+        }
+
+        //check if the tag's key starts with the name of a hstore column
+        for (std::size_t j = 0; j < m_hstore_columns.size(); ++j) {
+            auto const &hcolumn = m_hstore_columns[j];
+            if (key.compare(0, hcolumn.size(), hcolumn) == 0) {
+                m_hstore_column_tags[j].push_back(i);
             }
+        }
+    }
+}
+
+void table_t::write_columns(taglist_t const &tags)
+{
+    for (std::size_t i = 0; i < m_columns.size(); ++i) {
+        std::size_t const idx = m_column_tags[i];
+        if (idx != no_tag) {
+            escape_type(tags[idx].value, m_columns[i].type);
         } else {
             m_copy.add_null_column();
         }
@@ -327,14 +364,16 @@ void table_t::write_columns(taglist_t const &tags, std::vector<bool> *used)
 }
 
 /// Write all tags to hstore. Exclude tags written to other columns and z_order.
-void table_t::write_tags_column(taglist_t const &tags,
-                                std::vector<bool> const &used)
+void table_t::write_tags_column(taglist_t const &tags)
 {
+    // Tags used in other columns are only excluded in "norm" mode.
+    bool const exclude_used = m_hstore_mode == hstore_column::norm;
+
     m_copy.new_hash();
 
     for (std::size_t i = 0; i < tags.size(); ++i) {
         tag_t const &tag = tags[i];
-        if (!used[i] && (tag.key != "z_order")) {
+        if (!(exclude_used && m_tag_used[i]) && (tag.key != "z_order")) {
             m_copy.add_hash_elem(tag.key, tag.value);
         }
     }
@@ -345,30 +384,23 @@ void table_t::write_tags_column(taglist_t const &tags,
 /* write an hstore column to the database */
 void table_t::write_hstore_columns(taglist_t const &tags)
 {
-    for (auto const &hcolumn : m_hstore_columns) {
-        bool added = false;
-
-        for (auto const &tag : tags) {
-            //check if the tag's key starts with the name of the hstore column
-            if (tag.key.compare(0, hcolumn.size(), hcolumn) == 0) {
-                char const *const shortkey = &tag.key[hcolumn.size()];
-
-                //and pack the shortkey with its value into the hstore
-                //hstore ASCII representation looks like "key"=>"value"
-                if (!added) {
-                    added = true;
-                    m_copy.new_hash();
-                }
-
-                m_copy.add_hash_elem(shortkey, tag.value.c_str());
-            }
+    for (std::size_t j = 0; j < m_hstore_columns.size(); ++j) {
+        auto const &tag_list = m_hstore_column_tags[j];
+        if (tag_list.empty()) {
+            m_copy.add_null_column();
+            continue;
         }
 
-        if (added) {
-            m_copy.finish_hash();
-        } else {
-            m_copy.add_null_column();
+        auto const prefix_length = m_hstore_columns[j].size();
+
+        //pack the shortkey with its value into the hstore
+        //hstore ASCII representation looks like "key"=>"value"
+        m_copy.new_hash();
+        for (auto const idx : tag_list) {
+            auto const &tag = tags[idx];
+            m_copy.add_hash_elem(&tag.key[prefix_length], tag.value.c_str());
         }
+        m_copy.finish_hash();
     }
 }
 
@@ -17,8 +17,10 @@
 #include "thread-pool.hpp"
 
 #include <cstddef>
+#include <limits>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -60,9 +62,11 @@ protected:
     void prepare();
     void teardown();
 
-    void write_columns(taglist_t const &tags, std::vector<bool> *used);
-    void write_tags_column(taglist_t const &tags,
-                           std::vector<bool> const &used);
+    void init_column_index();
+    void route_tags(taglist_t const &tags);
+
+    void write_columns(taglist_t const &tags);
+    void write_tags_column(taglist_t const &tags);
     void write_hstore_columns(taglist_t const &tags);
 
     void escape_type(std::string const &value, ColumnType flags);
@@ -80,6 +84,27 @@ protected:
     hstores_t m_hstore_columns;
     std::string m_table_space;
 
+    /// Maps tag keys to the index of the column in m_columns.
+    std::unordered_map<std::string, std::size_t> m_column_index;
+
+    static constexpr std::size_t const no_tag =
+        std::numeric_limits<std::size_t>::max();
+
+    /**
+     * The following vectors are filled by route_tags() for the row
+     * currently being written. They are kept as members to avoid
+     * allocations for every row.
+     */
+
+    /// Index of the tag for each column in m_columns (or no_tag).
+    std::vector<std::size_t> m_column_tags;
+
+    /// Indexes of the tags for each hstore column in m_hstore_columns.
+    std::vector<std::vector<std::size_t>> m_hstore_column_tags;
+
+    /// Tags already written to one of the normal columns.
+    std::vector<bool> m_tag_used;
+
     db_copy_mgr_t<db_deleter_by_id_t> m_copy;
 };
 
@@ -0,0 +1,127 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "format.hpp"
+#include "metrics.hpp"
+#include "tagtransform-cached.hpp"
+
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+metric_t &lookups_metric(char const *result)
+{
+    return get_metrics().counter(
+        "osm2pgsql_tag_transform_cache_lookups_total",
+        "Number of lookups in the tag transform cache.",
+        "result=\"{}\""_format(result));
+}
+
+} // anonymous namespace
+
+cached_tagtransform_t::cached_tagtransform_t(
+    std::unique_ptr<tagtransform_t> tagtransform, std::size_t max_entries,
+    bool extra_attributes)
+: m_tagtransform(std::move(tagtransform)), m_max_entries(max_entries),
+  m_extra_attributes(extra_attributes), m_hits(&lookups_metric("hit")),
+  m_misses(&lookups_metric("miss"))
+{}
+
+std::unique_ptr<tagtransform_t> cached_tagtransform_t::clone() const
+{
+    return std::make_unique<cached_tagtransform_t>(
+        m_tagtransform->clone(), m_max_entries, m_extra_attributes);
+}
+
+void cached_tagtransform_t::build_key(osmium::OSMObject const &o,
+                                      bool with_polygon, bool with_roads)
+{
+    m_sorted_tags.clear();
+    for (auto const &tag : o.tags()) {
+        m_sorted_tags.push_back(&tag);
+    }
+    std::sort(m_sorted_tags.begin(), m_sorted_tags.end(),
+              [](osmium::Tag const *a, osmium::Tag const *b) {
+                  return std::strcmp(a->key(), b->key()) < 0;
+              });
+
+    // The results for polygon and roads are only available if they were
+    // asked for, so that is part of the key.
+    m_key.clear();
+    m_key += osmium::item_type_to_char(o.type());
+    m_key += with_polygon ? 'p' : '-';
+    m_key += with_roads ? 'r' : '-';
+
+    // Keys and values can't contain a \0 character, so this is unique.
+    for (auto const *tag : m_sorted_tags) {
+        m_key.append(tag->key(), std::strlen(tag->key()) + 1);
+        m_key.append(tag->value(), std::strlen(tag->value()) + 1);
+    }
+}
+
+bool cached_tagtransform_t::filter_tags(osmium::OSMObject const &o,
+                                        bool *polygon, bool *roads,
+                                        taglist_t &out_tags)
+{
+    if (m_extra_attributes && o.version() > 0) {
+        return m_tagtransform->filter_tags(o, polygon, roads, out_tags);
+    }
+
+    build_key(o, polygon != nullptr, roads != nullptr);
+
+    auto const it = m_cache.find(m_key);
+    if (it != m_cache.end()) {
+        m_hits->add();
+        auto const &result = it->second;
+        for (auto const &tag : result.tags) {
+            out_tags.add_tag(tag.key.c_str(), tag.value.c_str());
+        }
+        if (polygon) {
+            *polygon = result.polygon;
+        }
+        if (roads) {
+            *roads = result.roads;
+        }
+        return result.filter;
+    }
+
+    m_misses->add();
+
+    result_t result;
+    bool const filter =
+        m_tagtransform->filter_tags(o, polygon, roads, result.tags);
+    result.filter = filter;
+    result.polygon = polygon ? *polygon : false;
+    result.roads = roads ? *roads : false;
+
+    for (auto const &tag : result.tags) {
+        out_tags.add_tag(tag.key.c_str(), tag.value.c_str());
+    }
+
+    if (m_cache.size() < m_max_entries) {
+        m_cache.emplace(m_key, std::move(result));
+    }
+
+    return filter;
+}
+
+bool cached_tagtransform_t::filter_rel_member_tags(
+    taglist_t const &rel_tags, osmium::memory::Buffer const &members,
+    rolelist_t const &member_roles, bool *make_boundary, bool *make_polygon,
+    bool *roads, taglist_t &out_tags)
+{
+    return m_tagtransform->filter_rel_member_tags(rel_tags, members,
+                                                  member_roles, make_boundary,
+                                                  make_polygon, roads, out_tags);
+}
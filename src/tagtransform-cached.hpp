@@ -0,0 +1,85 @@
+#ifndef OSM2PGSQL_TAGTRANSFORM_CACHED_HPP
+#define OSM2PGSQL_TAGTRANSFORM_CACHED_HPP
+
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include "tagtransform.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class metric_t;
+
+/**
+ * Tag transform which caches the results of another tag transform. Many
+ * objects have exactly the same tags, for those the wrapped tag transform
+ * is only called once. This requires that the results only depend on the
+ * type and tags of an object, so it can not be used with Lua tag transform
+ * scripts keeping state between calls.
+ *
+ * Results are cached by the sorted list of tags. The cache holds at most
+ * max_entries tag sets. Once it is full, no new entries are added, so the
+ * tag sets seen first (which are usually the most common ones) stay in the
+ * cache.
+ *
+ * Objects with attributes (if extra_attributes is set) are never cached,
+ * because the attributes are different for each object.
+ */
+class cached_tagtransform_t : public tagtransform_t
+{
+public:
+    cached_tagtransform_t(std::unique_ptr<tagtransform_t> tagtransform,
+                          std::size_t max_entries, bool extra_attributes);
+
+    std::unique_ptr<tagtransform_t> clone() const override;
+
+    bool filter_tags(osmium::OSMObject const &o, bool *polygon, bool *roads,
+                     taglist_t &out_tags) override;
+
+    bool filter_rel_member_tags(taglist_t const &rel_tags,
+                                osmium::memory::Buffer const &members,
+                                rolelist_t const &member_roles,
+                                bool *make_boundary, bool *make_polygon,
+                                bool *roads, taglist_t &out_tags) override;
+
+    std::size_t size() const noexcept { return m_cache.size(); }
+
+private:
+    struct result_t
+    {
+        taglist_t tags;
+        bool filter;
+        bool polygon;
+        bool roads;
+    };
+
+    /// Build the cache key for an object in m_key.
+    void build_key(osmium::OSMObject const &o, bool with_polygon,
+                   bool with_roads);
+
+    std::unique_ptr<tagtransform_t> m_tagtransform;
+    std::unordered_map<std::string, result_t> m_cache;
+
+    std::size_t m_max_entries;
+    bool m_extra_attributes;
+
+    /// Buffers reused for building keys.
+    std::string m_key;
+    std::vector<osmium::Tag const *> m_sorted_tags;
+
+    metric_t *m_hits;
+    metric_t *m_misses;
+
+}; // class cached_tagtransform_t
+
+#endif // OSM2PGSQL_TAGTRANSFORM_CACHED_HPP
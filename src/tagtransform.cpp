@@ -11,6 +11,7 @@
 #include "logging.hpp"
 #include "options.hpp"
 #include "tagtransform-c.hpp"
+#include "tagtransform-cached.hpp"
 #include "tagtransform.hpp"
 
 #ifdef HAVE_LUA
@@ -20,9 +21,8 @@
 #include <stdexcept>
 #include <utility>
 
-std::unique_ptr<tagtransform_t>
-tagtransform_t::make_tagtransform(options_t const *options,
-                                  export_list const &exlist)
+static std::unique_ptr<tagtransform_t>
+make_uncached_tagtransform(options_t const *options, export_list const &exlist)
 {
     if (!options->tag_transform_script.empty()) {
 #ifdef HAVE_LUA
@@ -40,4 +40,21 @@ tagtransform_t::make_tagtransform(options_t const *options,
     return std::make_unique<c_tagtransform_t>(options, exlist);
 }
 
+std::unique_ptr<tagtransform_t>
+tagtransform_t::make_tagtransform(options_t const *options,
+                                  export_list const &exlist)
+{
+    auto tagtransform = make_uncached_tagtransform(options, exlist);
+
+    if (options->tag_transform_cache == 0) {
+        return tagtransform;
+    }
+
+    log_debug("Caching tag transform results for up to {} tag sets",
+              options->tag_transform_cache);
+    return std::make_unique<cached_tagtransform_t>(
+        std::move(tagtransform), options->tag_transform_cache,
+        options->extra_attributes);
+}
+
 tagtransform_t::~tagtransform_t() = default;
@@ -318,7 +318,7 @@ public:
     }
 
     template <typename PROJ>
-    double get_area(PROJ *proj = nullptr)
+    double get_area(PROJ const *proj = nullptr)
     {
         double total = 0;
 
@@ -342,7 +342,7 @@ public:
 
 private:
     template <typename PROJ>
-    double get_polygon_area(PROJ *proj)
+    double get_polygon_area(PROJ const *proj)
     {
         auto const num_rings = read_length();
         assert(num_rings > 0);
@@ -357,7 +357,7 @@ private:
     }
 
     template <typename PROJ>
-    double get_ring_area(PROJ *proj)
+    double get_ring_area(PROJ const *proj)
     {
         // Algorithm borrowed from
         // http://stackoverflow.com/questions/451426/how-do-i-calculate-the-area-of-a-2d-polygon
@@ -377,7 +377,7 @@ private:
         return std::abs(total) * 0.5;
     }
 
-    double get_ring_area(osmium::geom::IdentityProjection *)
+    double get_ring_area(osmium::geom::IdentityProjection const *)
     {
         // Algorithm borrowed from
         // http://stackoverflow.com/questions/451426/how-do-i-calculate-the-area-of-a-2d-polygon
@@ -0,0 +1,36 @@
+
+local points = osm2pgsql.define_node_table('osm2pgsql_test_points', {
+    { column = 'tags',  type = 'hstore' },
+    { column = 'min_x', type = 'real' },
+    { column = 'min_y', type = 'real' },
+    { column = 'geom',  type = 'point' },
+})
+
+local highways = osm2pgsql.define_way_table('osm2pgsql_test_highways', {
+    { column = 'tags',  type = 'hstore' },
+    { column = 'geom',  type = 'linestring' },
+})
+
+function osm2pgsql.process_node_batch(objects)
+    for _, object in ipairs(objects) do
+        local row = {
+            tags = object.tags,
+        }
+
+        row.min_x, row.min_y = object:get_bbox()
+
+        points:add_row(row, object)
+    end
+end
+
+function osm2pgsql.process_way_batch(objects)
+    for _, object in ipairs(objects) do
+        if object.tags.highway then
+            highways:add_row({
+                tags = object.tags,
+                geom = { create = 'line' }
+            }, object)
+        end
+    end
+end
+
@@ -0,0 +1,31 @@
+
+local by_type = osm2pgsql.define_table({
+    name = 'osm2pgsql_test_by_type',
+    ids = { type = 'any', type_column = 'osm_type', id_column = 'osm_id' },
+    partition_by = 'type',
+    columns = {
+        { column = 'tags', type = 'hstore' },
+    }
+})
+
+local by_geom = osm2pgsql.define_node_table('osm2pgsql_test_by_geom', {
+    { column = 'tags', type = 'hstore' },
+    { column = 'geom', type = 'point' },
+}, { partition_by = 'geom', partitions = 4 })
+
+local by_extent = osm2pgsql.define_node_table('osm2pgsql_test_by_extent', {
+    { column = 'tags', type = 'hstore' },
+    { column = 'geom', type = 'point' },
+}, { partition_by = 'geom', partitions = 4,
+     partition_extent = { 0.0, 0.0, 20.0, 20.0 } })
+
+function osm2pgsql.process_node(object)
+    by_type:add_row({ tags = object.tags })
+    by_geom:add_row({ tags = object.tags })
+    by_extent:add_row({ tags = object.tags })
+end
+
+function osm2pgsql.process_way(object)
+    by_type:add_row({ tags = object.tags })
+end
+
@@ -0,0 +1,15 @@
+
+local points = osm2pgsql.define_node_table('osm2pgsql_test_point', {
+    { column = 'tags', type = 'hstore' },
+    { column = 'geom', type = 'point' },
+    { column = 'hash', type = 'row_hash' },
+})
+
+function osm2pgsql.process_node(object)
+    if object.tags.amenity then
+        points:add_row({
+            tags = object.tags
+        })
+    end
+end
+
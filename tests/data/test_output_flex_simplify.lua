@@ -0,0 +1,45 @@
+
+local tables = {}
+
+tables.line = osm2pgsql.define_way_table('osm2pgsql_test_line', {
+    { column = 'tags', type = 'hstore' },
+    { column = 'geom', type = 'linestring' },
+})
+
+tables.line_simple = osm2pgsql.define_way_table('osm2pgsql_test_line_simple', {
+    { column = 'tags', type = 'hstore' },
+    { column = 'geom', type = 'linestring' },
+})
+
+tables.area = osm2pgsql.define_way_table('osm2pgsql_test_area', {
+    { column = 'tags', type = 'hstore' },
+    { column = 'geom', type = 'geometry' },
+})
+
+tables.area_simple = osm2pgsql.define_way_table('osm2pgsql_test_area_simple', {
+    { column = 'tags', type = 'hstore' },
+    { column = 'geom', type = 'geometry' },
+})
+
+function osm2pgsql.process_way(object)
+    if object.is_closed then
+        tables.area:add_row({
+            tags = object.tags,
+            geom = { create = 'area' }
+        })
+        tables.area_simple:add_row({
+            tags = object.tags,
+            geom = { create = 'area', simplify = 100 }
+        })
+    else
+        tables.line:add_row({
+            tags = object.tags,
+            geom = { create = 'line' }
+        })
+        tables.line_simple:add_row({
+            tags = object.tags,
+            geom = { create = 'line', simplify = 100 }
+        })
+    end
+end
+
@@ -0,0 +1,44 @@
+
+local tables = {}
+
+tables.pois = osm2pgsql.define_node_table('osm2pgsql_test_pois', {
+    { column = 'amenity', type = 'text' },
+    { column = 'name', type = 'text' },
+    { column = 'geom', type = 'point' },
+})
+
+tables.highways = osm2pgsql.define_way_table('osm2pgsql_test_highways', {
+    { column = 'highway', type = 'text' },
+    { column = 'name', type = 'text' },
+    { column = 'geom', type = 'linestring' },
+})
+
+tables.buildings = osm2pgsql.define_area_table('osm2pgsql_test_buildings', {
+    { column = 'building', type = 'text' },
+    { column = 'geom', type = 'geometry' },
+})
+
+function osm2pgsql.process_node(object)
+    if object.tags.amenity then
+        tables.pois:add_row({
+            amenity = object.tags.amenity,
+            name = object.tags.name
+        })
+    end
+end
+
+function osm2pgsql.process_way(object)
+    if object.tags.highway then
+        tables.highways:add_row({
+            highway = object.tags.highway,
+            name = object.tags.name
+        })
+    end
+    if object.is_closed and object.tags.building then
+        tables.buildings:add_row({
+            building = object.tags.building,
+            geom = { create = 'area' }
+        })
+    end
+end
+
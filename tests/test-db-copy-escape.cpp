@@ -0,0 +1,79 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "db-copy-escape.hpp"
+
+#include <string>
+
+static std::string escape_column(std::string const &str)
+{
+    std::string buffer;
+    copy_escape_column(&buffer, str.data(), str.size());
+    return buffer;
+}
+
+static std::string escape_quoted(std::string const &str)
+{
+    std::string buffer;
+    copy_escape_quoted(&buffer, str.data(), str.size());
+    return buffer;
+}
+
+TEST_CASE("escape empty string", "[NoDB]")
+{
+    REQUIRE(escape_column("").empty());
+    REQUIRE(escape_quoted("").empty());
+}
+
+TEST_CASE("escape strings without special characters", "[NoDB]")
+{
+    std::string const str{"foo"};
+    REQUIRE(escape_column(str) == str);
+    REQUIRE(escape_quoted(str) == str);
+
+    std::string const long_str{"a longer string with more than 32 characters"};
+    REQUIRE(escape_column(long_str) == long_str);
+    REQUIRE(escape_quoted(long_str) == long_str);
+}
+
+TEST_CASE("escape column value", "[NoDB]")
+{
+    REQUIRE(escape_column("a\tb") == "a\\tb");
+    REQUIRE(escape_column("\n\r") == "\\n\\r");
+    REQUIRE(escape_column("back\\slash") == "back\\\\slash");
+    REQUIRE(escape_column("\"quote\"") == "\\\"quote\\\"");
+}
+
+TEST_CASE("escape quoted value", "[NoDB]")
+{
+    REQUIRE(escape_quoted("a\tb") == "a\\tb");
+    REQUIRE(escape_quoted("\n\r") == "\\n\\r");
+    REQUIRE(escape_quoted("back\\slash") == "back\\\\\\\\slash");
+    REQUIRE(escape_quoted("\"quote\"") == "\\\\\"quote\\\\\"");
+}
+
+TEST_CASE("escape special characters at all positions", "[NoDB]")
+{
+    // Make sure special characters are found at any position inside and
+    // across the blocks checked at the same time.
+    for (std::size_t len = 1; len < 40; ++len) {
+        for (std::size_t pos = 0; pos < len; ++pos) {
+            std::string str(len, 'x');
+            str[pos] = '\t';
+
+            std::string expected(len - 1, 'x');
+            expected.insert(pos, "\\t");
+
+            REQUIRE(escape_column(str) == expected);
+            REQUIRE(escape_quoted(str) == expected);
+        }
+    }
+}
@@ -196,4 +196,38 @@ TEST_CASE("copy_mgr_t")
             CHECK(res == v.second);
         }
     }
+
+    SECTION("Insert row hash")
+    {
+        auto t = setup_table("hash int8, t text");
+
+        mgr.new_line(t);
+        mgr.add_column(1);
+        mgr.add_row_hash_column();
+        mgr.add_column("foo");
+        mgr.finish_line();
+        auto const hash = mgr.row_hash();
+        mgr.sync();
+
+        CHECK(hash > 0);
+        check_row({"1", fmt::to_string(hash), "foo"});
+    }
+
+    SECTION("Roll back rows not yet sent")
+    {
+        auto t = setup_table("t text");
+
+        add_row(mgr, t, 1, "foo");
+
+        mgr.new_line(t);
+        auto const mark = mgr.mark();
+        mgr.delete_object(1);
+        mgr.new_line(t);
+        mgr.add_columns(1, "bar");
+        mgr.finish_line();
+        REQUIRE(mgr.rollback(mark));
+        mgr.sync();
+
+        check_row({"1", "foo"});
+    }
 }
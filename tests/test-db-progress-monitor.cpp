@@ -0,0 +1,35 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "db-progress-monitor.hpp"
+
+using seconds = std::chrono::duration<double>;
+
+TEST_CASE("estimate remaining time from progress", "[NoDB]")
+{
+    // 100 units in 10 seconds, 800 units to go
+    REQUIRE(estimate_remaining_seconds(100, 200, 1000, seconds{10}) ==
+            Approx(80.0));
+
+    // done
+    REQUIRE(estimate_remaining_seconds(0, 1000, 1000, seconds{10}) ==
+            Approx(0.0));
+}
+
+TEST_CASE("no estimate without progress", "[NoDB]")
+{
+    REQUIRE(estimate_remaining_seconds(200, 200, 1000, seconds{10}) < 0.0);
+    REQUIRE(estimate_remaining_seconds(0, 100, 1000, seconds{0}) < 0.0);
+
+    // Counters reset (new phase) or inconsistent numbers
+    REQUIRE(estimate_remaining_seconds(500, 100, 1000, seconds{10}) < 0.0);
+    REQUIRE(estimate_remaining_seconds(0, 2000, 1000, seconds{10}) < 0.0);
+}
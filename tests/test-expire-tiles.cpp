@@ -9,10 +9,15 @@
 
 #include <catch.hpp>
 
+#include <cstdio>
 #include <set>
 
+#include "common-buffer.hpp"
+#include "common-cleanup.hpp"
 #include "expire-tiles.hpp"
+#include "osmium-builder.hpp"
 #include "reprojection.hpp"
+#include "wkb.hpp"
 
 static constexpr double EARTH_CIRCUMFERENCE = 40075016.68;
 static std::shared_ptr<reprojection>
@@ -382,3 +387,168 @@ TEST_CASE("merge with complete flag", "[NoDB]")
 
     CHECK(set == set0);
 }
+
+TEST_CASE("expire with metatiles", "[NoDB]")
+{
+    expire_tiles et(18, 20000, defproj);
+
+    tile_output_set input;
+    input.output_dirty_tile(8, 8, 18);
+    input.output_dirty_tile(15, 15, 18);
+    input.output_dirty_tile(16, 8, 18);
+    input.expire_centroids(et);
+
+    tile_output_set set;
+    et.output_and_destroy(set, 17, 8, false);
+
+    tile_output_set expected;
+    expected.output_dirty_tile(8, 8, 18);
+    expected.output_dirty_tile(16, 8, 18);
+    expected.output_dirty_tile(0, 0, 17);
+    expected.output_dirty_tile(8, 0, 17);
+
+    CHECK(set == expected);
+}
+
+TEST_CASE("expire collapsing completely expired subtrees", "[NoDB]")
+{
+    expire_tiles et(18, 20000, defproj);
+
+    tile_output_set input;
+    // All four tiles below 17/5/5
+    input.output_dirty_tile(10, 10, 18);
+    input.output_dirty_tile(11, 10, 18);
+    input.output_dirty_tile(10, 11, 18);
+    input.output_dirty_tile(11, 11, 18);
+    // All sixteen tiles below 16/5/5
+    for (uint32_t x = 20; x < 24; ++x) {
+        for (uint32_t y = 20; y < 24; ++y) {
+            input.output_dirty_tile(x, y, 18);
+        }
+    }
+    // A single tile
+    input.output_dirty_tile(100, 100, 18);
+    input.expire_centroids(et);
+
+    tile_output_set set;
+    et.output_and_destroy(set, 16, 1, true);
+
+    tile_output_set expected;
+    expected.output_dirty_tile(5, 5, 17);
+    expected.output_dirty_tile(5, 5, 16);
+    expected.output_dirty_tile(100, 100, 18);
+
+    CHECK(set == expected);
+}
+
+TEST_CASE("binary expire output", "[NoDB]")
+{
+    std::string const filename{"test_expire_tiles.bin"};
+    testing::cleanup::file_t const cleanup{filename};
+
+    std::vector<tile_output_binary_t::run_t> runs;
+    {
+        tile_output_binary_t writer{filename.c_str(), 2};
+        writer.output_dirty_tile(4, 2, 3);
+        writer.output_dirty_tile(0, 2, 3);
+        writer.output_dirty_tile(2, 2, 3);
+        writer.output_dirty_tile(0, 0, 3);
+        writer.output_dirty_tile(0, 0, 2);
+        runs = writer.get_runs();
+    }
+
+    REQUIRE(runs.size() == 3);
+    CHECK(runs[0].zoom == 2);
+    CHECK(runs[0].count == 1);
+    CHECK(runs[1].zoom == 3);
+    CHECK(runs[1].y == 0);
+    CHECK(runs[1].count == 1);
+    CHECK(runs[2].zoom == 3);
+    CHECK(runs[2].x == 0);
+    CHECK(runs[2].y == 2);
+    CHECK(runs[2].count == 3);
+
+    FILE *file = std::fopen(filename.c_str(), "rb");
+    REQUIRE(file);
+
+    char magic[8];
+    uint32_t header[2];
+    REQUIRE(std::fread(magic, sizeof(magic), 1, file) == 1);
+    REQUIRE(std::fread(header, sizeof(header), 1, file) == 1);
+    CHECK(std::string(magic, sizeof(magic)) == "O2PEXP01");
+    CHECK(header[0] == 2);
+    CHECK(header[1] == 3);
+
+    uint32_t data[12];
+    CHECK(std::fread(data, sizeof(data), 1, file) == 1);
+    CHECK(data[8] == 3);  // zoom
+    CHECK(data[11] == 3); // count
+    CHECK(std::fgetc(file) == EOF);
+
+    std::fclose(file);
+}
+
+TEST_CASE("expire point and line from coordinates like from wkb", "[NoDB]")
+{
+    uint32_t const zoom = 18;
+    expire_tiles et_coords(zoom, 20000, defproj);
+    expire_tiles et_wkb(zoom, 20000, defproj);
+
+    osmium::geom::Coordinates const point{1000.0, -2000.0};
+    geom::linestring_t const line{osmium::geom::Coordinates{-500.0, 100.0},
+                                  osmium::geom::Coordinates{700.0, 300.0},
+                                  osmium::geom::Coordinates{900.0, -800.0}};
+
+    et_coords.from_point(point);
+    et_coords.from_line(line);
+
+    ewkb::writer_t writer{PROJ_SPHERE_MERC};
+    et_wkb.from_wkb(writer.make_point(point), 1);
+    writer.linestring_start();
+    for (auto const &coord : line) {
+        writer.add_location(coord);
+    }
+    et_wkb.from_wkb(writer.linestring_finish(line.size()), 1);
+
+    tile_output_set set_coords;
+    et_coords.output_and_destroy(set_coords, zoom);
+    tile_output_set set_wkb;
+    et_wkb.output_and_destroy(set_wkb, zoom);
+
+    CHECK(set_coords.tiles.size() > 1);
+    CHECK(set_coords == set_wkb);
+}
+
+TEST_CASE("geometry builder expires tiles of created geometries", "[NoDB]")
+{
+    uint32_t const zoom = 16;
+    // Small maximum bbox size so that the large polygon is expired along
+    // its perimeter.
+    expire_tiles et_builder(zoom, 5000, defproj);
+    expire_tiles et_wkb(zoom, 5000, defproj);
+
+    geom::osmium_builder_t builder{defproj};
+    builder.set_expire(&et_builder);
+
+    test_buffer_t buffer;
+    auto const &small = buffer.add_way(
+        "w1 Nn1x0.01y0.01,n2x0.02y0.01,n3x0.02y0.02,n1x0.01y0.01");
+    auto const &large =
+        buffer.add_way("w2 Nn1x0.1y0.1,n2x0.2y0.1,n3x0.2y0.2,n1x0.1y0.1");
+    auto const &node = buffer.add_node("n4 x0.3 y0.3");
+
+    et_wkb.from_wkb(builder.get_wkb_polygon(small), 1);
+    et_wkb.from_wkb(builder.get_wkb_polygon(large), 2);
+    for (auto const &wkb : builder.get_wkb_line(small.nodes(), 0.0)) {
+        et_wkb.from_wkb(wkb, 1);
+    }
+    et_wkb.from_wkb(builder.get_wkb_node(node.location()), 4);
+
+    tile_output_set set_builder;
+    et_builder.output_and_destroy(set_builder, zoom);
+    tile_output_set set_wkb;
+    et_wkb.output_and_destroy(set_wkb, zoom);
+
+    CHECK(set_builder.tiles.size() > 1);
+    CHECK(set_builder == set_wkb);
+}
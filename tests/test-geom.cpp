@@ -12,9 +12,16 @@
 #include "common-buffer.hpp"
 
 #include "geom.hpp"
+#include "osmium-builder.hpp"
 #include "reprojection.hpp"
+#include "wkb.hpp"
+
+#include <osmium/area/geom_assembler.hpp>
 
 #include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 using Coordinates = osmium::geom::Coordinates;
 
@@ -440,3 +447,232 @@ TEST_CASE("make_multiline from P shape with closed way", "[NoDB]")
     REQUIRE(lines[1] == expected[1]);
 }
 
+TEST_CASE("simplify linestring", "[NoDB]")
+{
+    geom::linestring_t const line{Coordinates{0, 0}, Coordinates{1, 0.1},
+                                  Coordinates{2, -0.1}, Coordinates{3, 5},
+                                  Coordinates{4, 6}, Coordinates{5, 7.05},
+                                  Coordinates{6, 8}};
+
+    // Nothing is removed with a tolerance of 0.
+    REQUIRE(geom::simplify(line, 0.0) == line);
+
+    geom::linestring_t const expected{Coordinates{0, 0}, Coordinates{2, -0.1},
+                                      Coordinates{3, 5}, Coordinates{6, 8}};
+    REQUIRE(geom::simplify(line, 0.5) == expected);
+
+    geom::linestring_t const expected_straight{Coordinates{0, 0},
+                                               Coordinates{6, 8}};
+    REQUIRE(geom::simplify(line, 100.0) == expected_straight);
+}
+
+TEST_CASE("simplify closed linestring", "[NoDB]")
+{
+    geom::linestring_t const ring{Coordinates{0, 0}, Coordinates{10, 0},
+                                  Coordinates{10, 0.1}, Coordinates{10, 10},
+                                  Coordinates{0, 10}, Coordinates{0, 0}};
+
+    geom::linestring_t const expected{Coordinates{0, 0}, Coordinates{10, 0},
+                                      Coordinates{10, 10}, Coordinates{0, 10},
+                                      Coordinates{0, 0}};
+    REQUIRE(geom::simplify(ring, 1.0) == expected);
+}
+
+static std::string
+make_polygon_wkb(std::vector<geom::linestring_t> const &rings)
+{
+    ewkb::writer_t writer{3857};
+    writer.polygon_start();
+    for (auto const &ring : rings) {
+        writer.polygon_ring_start();
+        for (auto const &coord : ring) {
+            writer.add_location(coord);
+        }
+        writer.polygon_ring_finish(ring.size());
+    }
+    return writer.polygon_finish(rings.size());
+}
+
+TEST_CASE("simplify wkb linestring", "[NoDB]")
+{
+    ewkb::writer_t writer{3857};
+    writer.linestring_start();
+    writer.add_location(Coordinates{0, 0});
+    writer.add_location(Coordinates{1, 0.1});
+    writer.add_location(Coordinates{2, 0});
+    auto const wkb = writer.linestring_finish(3);
+
+    REQUIRE(geom::simplify_wkb(wkb, 0.01) == wkb);
+
+    auto const simplified = geom::simplify_wkb(wkb, 1.0);
+    ewkb::parser_t parser{simplified};
+    REQUIRE(parser.read_header() == ewkb::wkb_line);
+    REQUIRE(parser.read_length() == 2);
+    REQUIRE(parser.read_point() == Coordinates{0, 0});
+    REQUIRE(parser.read_point() == Coordinates{2, 0});
+
+    // The SRID is kept.
+    REQUIRE(simplified.substr(0, 9) == wkb.substr(0, 9));
+}
+
+TEST_CASE("simplify wkb polygon removes small inner rings", "[NoDB]")
+{
+    geom::linestring_t const outer{Coordinates{0, 0}, Coordinates{100, 0},
+                                   Coordinates{100, 100}, Coordinates{0, 100},
+                                   Coordinates{0, 0}};
+    geom::linestring_t const small{Coordinates{10, 10}, Coordinates{11, 10},
+                                   Coordinates{11, 11}, Coordinates{10, 10}};
+    geom::linestring_t const large{Coordinates{20, 20}, Coordinates{60, 20},
+                                   Coordinates{60, 60}, Coordinates{20, 20}};
+    auto const wkb = make_polygon_wkb({outer, small, large});
+
+    auto const simplified = geom::simplify_wkb(wkb, 2.0);
+    ewkb::parser_t parser{simplified};
+    REQUIRE(parser.read_header() == ewkb::wkb_polygon);
+    REQUIRE(parser.read_length() == 2);
+    REQUIRE(parser.read_length() == 5);
+    parser.skip_points(5);
+    REQUIRE(parser.read_length() == 4);
+}
+
+TEST_CASE("simplify wkb polygon collapsing completely", "[NoDB]")
+{
+    geom::linestring_t const outer{Coordinates{0, 0}, Coordinates{1, 0},
+                                   Coordinates{1, 1}, Coordinates{0, 1},
+                                   Coordinates{0, 0}};
+    auto const wkb = make_polygon_wkb({outer});
+
+    REQUIRE(geom::simplify_wkb(wkb, 10.0).empty());
+}
+
+TEST_CASE("simplify wkb multipolygon", "[NoDB]")
+{
+    geom::linestring_t const large{Coordinates{0, 0}, Coordinates{100, 0},
+                                   Coordinates{100, 100}, Coordinates{0, 100},
+                                   Coordinates{0, 0}};
+    geom::linestring_t const small{Coordinates{200, 0}, Coordinates{201, 0},
+                                   Coordinates{201, 1}, Coordinates{200, 0}};
+
+    ewkb::writer_t writer{3857};
+    writer.multipolygon_start();
+    writer.add_sub_geometry(make_polygon_wkb({large}));
+    writer.add_sub_geometry(make_polygon_wkb({small}));
+    auto const wkb = writer.multipolygon_finish(2);
+
+    auto const simplified = geom::simplify_wkb(wkb, 2.0);
+    ewkb::parser_t parser{simplified};
+    REQUIRE(parser.read_header() == ewkb::wkb_multi_polygon);
+    REQUIRE(parser.read_length() == 1);
+    REQUIRE(parser.read_header() == ewkb::wkb_polygon);
+    REQUIRE(parser.read_length() == 1);
+    REQUIRE(parser.read_length() == 5);
+}
+
+namespace {
+
+std::vector<Coordinates> read_polygon_ring(std::string const &wkb)
+{
+    std::vector<Coordinates> points;
+    ewkb::parser_t parser{wkb};
+    REQUIRE(parser.read_header() == ewkb::wkb_polygon);
+    REQUIRE(parser.read_length() == 1);
+    auto const num_points = parser.read_length();
+    for (std::size_t i = 0; i < num_points; ++i) {
+        points.push_back(parser.read_point());
+    }
+    return points;
+}
+
+} // anonymous namespace
+
+TEST_CASE("polygon from simple closed way", "[NoDB]")
+{
+    geom::osmium_builder_t builder{
+        reprojection::create_projection(PROJ_LATLONG)};
+
+    test_buffer_t buffer;
+    // clockwise, not starting at the smallest location, duplicate node
+    auto const &way = buffer.add_way(
+        "w1 Nn1x2y2,n2x2y1,n3x2y1,n4x1y1,n5x1y2,n1x2y2");
+
+    auto const points = read_polygon_ring(builder.get_wkb_polygon(way));
+    REQUIRE(points.size() == 5);
+    REQUIRE(points[0] == Coordinates{1, 1});
+    REQUIRE(points[1] == Coordinates{2, 1});
+    REQUIRE(points[2] == Coordinates{2, 2});
+    REQUIRE(points[3] == Coordinates{1, 2});
+    REQUIRE(points[4] == Coordinates{1, 1});
+}
+
+TEST_CASE("no polygon from self-intersecting or unclosed way", "[NoDB]")
+{
+    geom::osmium_builder_t builder{
+        reprojection::create_projection(PROJ_LATLONG)};
+
+    test_buffer_t buffer;
+    auto const &bowtie =
+        buffer.add_way("w1 Nn1x1y1,n2x2y2,n3x2y1,n4x1y2,n1x1y1");
+    auto const &unclosed = buffer.add_way("w2 Nn1x1y1,n2x2y1,n3x2y2");
+    auto const &line = buffer.add_way("w3 Nn1x1y1,n2x2y1,n1x1y1");
+
+    REQUIRE(builder.get_wkb_polygon(bowtie).empty());
+    REQUIRE(builder.get_wkb_polygon(unclosed).empty());
+    REQUIRE(builder.get_wkb_polygon(line).empty());
+}
+
+TEST_CASE("polygon from closed way is the same as from area assembler",
+          "[NoDB]")
+{
+    geom::osmium_builder_t builder{
+        reprojection::create_projection(PROJ_LATLONG)};
+
+    osmium::area::AssemblerConfig area_config;
+    area_config.ignore_invalid_locations = true;
+
+    // Deterministic pseudo-random rings on a small grid, so that many of
+    // them are self-intersecting or touching.
+    uint32_t seed = 42;
+    auto const random = [&seed](uint32_t n) {
+        seed = seed * 1103515245U + 12345U;
+        return (seed >> 16U) % n;
+    };
+
+    for (int i = 0; i < 5000; ++i) {
+        std::string nodes;
+        auto const num_nodes = 3 + random(5);
+        for (uint32_t n = 1; n <= num_nodes; ++n) {
+            nodes += "n{}x{}y{},"_format(n, random(5), random(5));
+        }
+        auto const first = nodes.substr(0, nodes.find(','));
+
+        test_buffer_t buffer;
+        auto const &way = buffer.add_way("w1 N" + nodes + first);
+
+        osmium::memory::Buffer area_buffer{
+            1024, osmium::memory::Buffer::auto_grow::yes};
+        osmium::area::GeomAssembler assembler{area_config};
+        bool const ok = assembler(way, area_buffer);
+        auto const wkb = builder.get_wkb_polygon(way);
+
+        if (!ok) {
+            REQUIRE(wkb.empty());
+            continue;
+        }
+
+        auto const &area = area_buffer.get<osmium::Area>(0);
+        auto const num_rings = area.num_rings();
+        if (num_rings.first != 1 || num_rings.second != 0) {
+            continue;
+        }
+
+        auto const points = read_polygon_ring(wkb);
+        auto const &ring = *area.cbegin<osmium::OuterRing>();
+        REQUIRE(points.size() == ring.size());
+        std::size_t n = 0;
+        for (auto const &node_ref : ring) {
+            REQUIRE(points[n] == Coordinates{node_ref.location().lon(),
+                                             node_ref.location().lat()});
+            ++n;
+        }
+    }
+}
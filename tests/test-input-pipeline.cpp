@@ -0,0 +1,77 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-buffer.hpp"
+
+#include "input-pipeline.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+TEST_CASE("all objects go through both stages in order", "[NoDB]")
+{
+    test_buffer_t buffer;
+    std::vector<osmid_t> middle_ids;
+    std::vector<osmid_t> output_ids;
+    std::size_t visible_in_output = 0;
+
+    input_pipeline_t pipeline{
+        [&](osmium::OSMObject &object) {
+            middle_ids.push_back(object.id());
+            object.set_visible(false);
+        },
+        [&](osmium::OSMObject &object) {
+            // Changes from the middle stage are visible in the output stage
+            if (object.visible()) {
+                ++visible_in_output;
+            }
+            output_ids.push_back(object.id());
+        }};
+
+    std::vector<osmid_t> ids;
+    for (osmid_t id = 1; id <= 100000; ++id) {
+        pipeline.add(buffer.add_node("n{}"_format(id)));
+        ids.push_back(id);
+    }
+    pipeline.flush();
+
+    REQUIRE(middle_ids == ids);
+    REQUIRE(output_ids == ids);
+    REQUIRE(visible_in_output == 0);
+
+    // The pipeline can be used again after a flush.
+    pipeline.add(buffer.add_way("w1 Nn1,n2"));
+    pipeline.flush();
+
+    REQUIRE(middle_ids.size() == ids.size() + 1);
+    REQUIRE(output_ids.size() == ids.size() + 1);
+}
+
+TEST_CASE("exception in a stage is reported by flush", "[NoDB]")
+{
+    test_buffer_t buffer;
+    std::size_t output_count = 0;
+
+    input_pipeline_t pipeline{
+        [&](osmium::OSMObject &object) {
+            if (object.id() == 3) {
+                throw std::runtime_error{"fail"};
+            }
+        },
+        [&](osmium::OSMObject &) { ++output_count; }};
+
+    for (osmid_t id = 1; id <= 10; ++id) {
+        pipeline.add(buffer.add_node("n{}"_format(id)));
+    }
+
+    REQUIRE_THROWS_WITH(pipeline.flush(), "fail");
+    REQUIRE(output_count == 0);
+}
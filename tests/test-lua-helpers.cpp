@@ -0,0 +1,286 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "lua-helpers.hpp"
+#include "lua-init.hpp"
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+#include <memory>
+#include <string>
+
+namespace {
+
+// Compares the native helper functions with the Lua implementations from
+// init.lua (stored in "lua_impl") on fixed and pseudo-random inputs.
+char const *const differential_test = R"(
+local native = osm2pgsql
+local names = { 'has_prefix', 'has_suffix', 'trim', 'split_unit',
+                'split_string', 'make_check_values_func',
+                'make_clean_tags_func' }
+for _, name in ipairs(names) do
+    assert(native[name] ~= lua_impl[name], name .. ' is not native')
+end
+
+local function same(a, b)
+    if type(a) ~= type(b) then
+        return false
+    end
+    if type(a) == 'number' and math.type and math.type(a) ~= math.type(b) then
+        return false
+    end
+    if type(a) ~= 'table' then
+        return a == b or (a ~= a and b ~= b)
+    end
+    for k, v in pairs(a) do
+        if not same(v, b[k]) then
+            return false
+        end
+    end
+    for k, _ in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+local function compare(name, ...)
+    local rn = table.pack and table.pack(native[name](...))
+                           or { n = select('#', native[name](...)),
+                                native[name](...) }
+    local rl = table.pack and table.pack(lua_impl[name](...))
+                           or { n = select('#', lua_impl[name](...)),
+                                lua_impl[name](...) }
+    if rn.n ~= rl.n or not same(rn, rl) then
+        error(string.format('%s differs for %q', name, tostring((...))))
+    end
+end
+
+-- Deterministic pseudo-random numbers, independent of the Lua version.
+local seed = 42
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return seed % n + 1
+end
+
+local chars = { 'a', 'b', 'Z', ':', '_', ' ', '\t', '\n', '1', '0', '.',
+                '-', '*', ';', ',', 'm', '\0' }
+local function random_string(max_len)
+    local parts = {}
+    for i = 1, random(max_len + 1) - 1 do
+        parts[i] = chars[random(#chars)]
+    end
+    return table.concat(parts)
+end
+
+local fixed = { '', ' ', 'a', 'addr:city', '  foo bar  ', '\t\n\v\f\r',
+                'x\0 ', '20', '20 m', '20m', '-3.5km', '1.2.3 m', '.',
+                '-', '12  m', '12 m2', '5 ft', 'a;b; c ;;d', ';', 'abc' }
+
+local strings = {}
+for _, s in ipairs(fixed) do
+    strings[#strings + 1] = s
+end
+for _ = 1, 2000 do
+    strings[#strings + 1] = random_string(10)
+end
+
+for i, s in ipairs(strings) do
+    local other = strings[(i * 7) % #strings + 1]:sub(1, random(4) - 1)
+    compare('has_prefix', s, other)
+    compare('has_prefix', s, s)
+    compare('has_suffix', s, other)
+    compare('has_suffix', s, s)
+    compare('trim', s)
+    compare('split_unit', s)
+    compare('split_unit', s, 'm')
+    compare('split_string', s)
+    compare('split_string', s, ',')
+    compare('split_string', s, ' ;')
+    compare('split_string', s, 'a^')
+end
+
+compare('has_prefix', nil, 'a')
+compare('has_suffix', nil, 'a')
+compare('trim', nil)
+compare('split_unit', nil)
+compare('split_string', nil)
+compare('split_string', 'a-b-c', '-')
+compare('split_string', 'a%b%c', '%%')
+compare('split_string', 'a1b2c', '%d')
+compare('split_string', '1a2', 2)
+
+-- make_check_values_func()
+local values = { 'a', 'b', 'addr:city', 3, false }
+for _, default in ipairs({ 'x', false }) do
+    local fn = native.make_check_values_func(values, default)
+    local fl = lua_impl.make_check_values_func(values, default)
+    for _, s in ipairs({ 'a', 'b', 'c', 3, '3', false, true }) do
+        assert(same(fn(s), fl(s)))
+    end
+    assert(same(fn(), fl()))
+end
+do
+    local fn = native.make_check_values_func(values)
+    local fl = lua_impl.make_check_values_func(values)
+    for _, s in ipairs(strings) do
+        assert(same(fn(s), fl(s)))
+    end
+    assert(fn('a') == 'a' and fn('c') == nil and fn(3) == 3)
+end
+
+-- make_clean_tags_func()
+local function copy(tags)
+    local result = {}
+    for k, v in pairs(tags) do
+        result[k] = v
+    end
+    return result
+end
+
+local key_chars = { 'a', 'b', ':', '*' }
+local function random_key()
+    local parts = {}
+    for i = 1, random(5) - 1 do
+        parts[i] = key_chars[random(#key_chars)]
+    end
+    return table.concat(parts)
+end
+
+for _ = 1, 300 do
+    local keys = {}
+    for i = 1, random(6) - 1 do
+        keys[i] = random_key()
+    end
+    local fn = native.make_clean_tags_func(keys)
+    local fl = lua_impl.make_clean_tags_func(keys)
+    for _ = 1, 20 do
+        local tags = {}
+        for _ = 1, random(6) - 1 do
+            tags[random_key():gsub('%*', '')] = 'v'
+        end
+        local tn = copy(tags)
+        local tl = copy(tags)
+        assert(fn(tn) == fl(tl))
+        assert(same(tn, tl))
+    end
+end
+
+do
+    local fn = native.make_clean_tags_func({ 'note', 'source:*', '*:fixme',
+                                             '*' })
+    local tags = { note = 'x', name = 'y' }
+    assert(fn(tags) == true)
+    assert(next(tags) == nil)
+
+    fn = native.make_clean_tags_func({ 'note', 'tiger:*', '*:source' })
+    tags = { note = 'x', ['tiger:cfcc'] = 'a', ['name:source'] = 'b',
+             name = 'c' }
+    assert(fn(tags) == false)
+    assert(same(tags, { name = 'c' }))
+    assert(fn({ note = 'x' }) == true)
+
+    -- Unusual tag tables are handled by the Lua implementation.
+    fn = native.make_clean_tags_func({ 'note' })
+    tags = { note = 'x', [1] = 'y' }
+    assert(fn(tags) == false)
+    assert(same(tags, { [1] = 'y' }))
+    local ok = pcall(native.make_clean_tags_func({ 'a*' }), { [1] = 'y' })
+    assert(not ok)
+end
+)";
+
+class lua_state_t
+{
+public:
+    lua_state_t() : m_state(luaL_newstate(), lua_close)
+    {
+        luaL_openlibs(get());
+        lua_newtable(get());
+        lua_setglobal(get(), "osm2pgsql");
+        REQUIRE_FALSE(luaL_dostring(get(), lua_init()));
+    }
+
+    lua_State *get() const noexcept { return m_state.get(); }
+
+    std::string run(char const *code) const
+    {
+        if (luaL_dostring(get(), code)) {
+            return lua_tostring(get(), -1);
+        }
+        return "";
+    }
+
+private:
+    std::unique_ptr<lua_State, void (*)(lua_State *)> m_state;
+};
+
+} // anonymous namespace
+
+TEST_CASE("string_trie_t matches prefixes", "[NoDB]")
+{
+    string_trie_t trie;
+    REQUIRE(trie.empty());
+
+    std::string const str{"addr:city"};
+    REQUIRE_FALSE(trie.matches_prefix_of(str.cbegin(), str.cend()));
+
+    std::string const prefix1{"addr:"};
+    std::string const prefix2{"name:"};
+    trie.add(prefix1.cbegin(), prefix1.cend());
+    trie.add(prefix2.cbegin(), prefix2.cend());
+    REQUIRE_FALSE(trie.empty());
+
+    REQUIRE(trie.matches_prefix_of(str.cbegin(), str.cend()));
+    REQUIRE(trie.matches_prefix_of(prefix1.cbegin(), prefix1.cend()));
+    REQUIRE_FALSE(trie.matches_prefix_of(str.cbegin(), str.cbegin() + 4));
+
+    std::string const other{"name"};
+    REQUIRE_FALSE(trie.matches_prefix_of(other.cbegin(), other.cend()));
+
+    // The empty string is a prefix of everything.
+    std::string const empty;
+    trie.add(empty.cbegin(), empty.cend());
+    REQUIRE(trie.matches_prefix_of(other.cbegin(), other.cend()));
+}
+
+TEST_CASE("string_trie_t matches suffixes", "[NoDB]")
+{
+    string_trie_t trie;
+    std::string const suffix{":source"};
+    trie.add(suffix.crbegin(), suffix.crend());
+
+    std::string const str1{"name:source"};
+    std::string const str2{"source"};
+    REQUIRE(trie.matches_prefix_of(str1.crbegin(), str1.crend()));
+    REQUIRE_FALSE(trie.matches_prefix_of(str2.crbegin(), str2.crend()));
+}
+
+TEST_CASE("Native Lua helpers behave like the Lua implementations", "[NoDB]")
+{
+    lua_state_t const lua;
+
+    REQUIRE(lua.run("lua_impl = {}"
+                    "for k, v in pairs(osm2pgsql) do lua_impl[k] = v end") ==
+            "");
+
+    lua_getglobal(lua.get(), "osm2pgsql");
+    add_native_lua_helpers(lua.get());
+    lua_settop(lua.get(), 0);
+
+    REQUIRE(lua.run(differential_test) == "");
+}
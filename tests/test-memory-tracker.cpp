@@ -0,0 +1,76 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "db-copy.hpp"
+#include "memory-tracker.hpp"
+
+TEST_CASE("tracked memory is reported to the account", "[NoDB]")
+{
+    auto &account = get_memory_tracker().account("test");
+    REQUIRE(account.current() == 0);
+
+    {
+        tracked_memory_t mem1{"test"};
+        tracked_memory_t mem2{"test"};
+
+        mem1.update(1000);
+        mem2.update(500);
+        REQUIRE(account.current() == 1500);
+
+        mem1.update(200);
+        REQUIRE(account.current() == 700);
+        REQUIRE(account.peak() == 1500);
+    }
+
+    // Memory is given back when the tracked_memory_t goes away.
+    REQUIRE(account.current() == 0);
+    REQUIRE(account.peak() == 1500);
+}
+
+TEST_CASE("memory check fails if limit is exceeded", "[NoDB]")
+{
+    auto &tracker = get_memory_tracker();
+
+    tracked_memory_t mem{"test-limit"};
+    mem.update(2000UL * 1024UL * 1024UL);
+
+    REQUIRE_NOTHROW(tracker.check()); // no limit set
+
+    tracker.set_limit(1000UL * 1024UL * 1024UL);
+    REQUIRE_THROWS_WITH(tracker.check(),
+                        Catch::Matchers::Contains("test-limit: 2000MB"));
+    tracker.set_limit(0);
+}
+
+TEST_CASE("resident memory of the process is available", "[NoDB]")
+{
+#ifdef __linux__
+    REQUIRE(process_resident_memory() > 0);
+#else
+    REQUIRE_NOTHROW(process_resident_memory());
+#endif
+}
+
+TEST_CASE("copy buffers are reduced with memory limit", "[NoDB]")
+{
+    auto &tracker = get_memory_tracker();
+    std::size_t const mbyte = 1024UL * 1024UL;
+
+    REQUIRE(db_cmd_copy_t::buffer_size() == db_cmd_copy_t::Max_buf_size);
+
+    tracker.set_limit(256 * mbyte);
+    REQUIRE(db_cmd_copy_t::buffer_size() == mbyte);
+
+    tracker.set_limit(1000 * 1000 * mbyte);
+    REQUIRE(db_cmd_copy_t::buffer_size() == db_cmd_copy_t::Max_buf_size);
+
+    tracker.set_limit(0);
+}
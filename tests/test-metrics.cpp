@@ -0,0 +1,82 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "memory-tracker.hpp"
+#include "metrics.hpp"
+
+#include <string>
+
+TEST_CASE("counters and gauges", "[NoDB]")
+{
+    auto &metrics = get_metrics();
+
+    auto &counter = metrics.counter("test_things_total", "Things counted.",
+                                    "kind=\"a\"");
+    counter.add();
+    counter.add(2);
+    REQUIRE(counter.raw_value() == 3);
+
+    // Getting the same metric again returns the existing one.
+    REQUIRE(&metrics.counter("test_things_total", "Things counted.",
+                             "kind=\"a\"") == &counter);
+
+    metrics.counter("test_things_total", "Things counted.", "kind=\"b\"")
+        .add(5);
+
+    auto &gauge = metrics.gauge("test_level", "A level.");
+    gauge.set(42);
+    gauge.set(17);
+
+    metrics.set_phase("testing");
+
+    auto const text = metrics.format();
+    REQUIRE(text.find("osm2pgsql_phase{phase=\"testing\"} 1\n") !=
+            std::string::npos);
+    REQUIRE(text.find("# HELP test_things_total Things counted.\n"
+                      "# TYPE test_things_total counter\n"
+                      "test_things_total{kind=\"a\"} 3\n"
+                      "test_things_total{kind=\"b\"} 5\n") !=
+            std::string::npos);
+    REQUIRE(text.find("# TYPE test_level gauge\ntest_level 17\n") !=
+            std::string::npos);
+
+    metrics.remove(&gauge);
+    REQUIRE(metrics.format().find("test_level 17") == std::string::npos);
+}
+
+TEST_CASE("durations are reported in seconds", "[NoDB]")
+{
+    auto &duration =
+        get_metrics().duration("test_duration_seconds_total", "Time taken.");
+    duration.add(1500000000);
+    REQUIRE(duration.value() == Approx(1.5));
+
+    {
+        metric_timer_t const timer{&duration};
+    }
+    REQUIRE(duration.raw_value() >= 1500000000);
+}
+
+TEST_CASE("memory use is reported", "[NoDB]")
+{
+    tracked_memory_t memory{"metrics test"};
+    memory.update(1234);
+
+    REQUIRE(get_metrics().format().find(
+                "osm2pgsql_memory_bytes{subsystem=\"metrics test\"} 1234\n") !=
+            std::string::npos);
+
+#ifdef __linux__
+    REQUIRE(get_metrics().format().find(
+                "\nosm2pgsql_process_resident_memory_bytes ") !=
+            std::string::npos);
+#endif
+}
@@ -0,0 +1,112 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-buffer.hpp"
+
+#include "middle-encoding.hpp"
+
+#include <protozero/exception.hpp>
+
+#include <cstring>
+
+TEST_CASE("encode and decode way node list", "[NoDB]")
+{
+    test_buffer_t buffer;
+    auto const &way = buffer.add_way("w1 Nn10,n12,n11,n1000000000000,n3");
+
+    std::string data;
+    add_delta_encoded_way_node_list(&data, way.nodes());
+    REQUIRE(data.size() < 5 * sizeof(osmid_t));
+
+    osmium::memory::Buffer out{1024, osmium::memory::Buffer::auto_grow::yes};
+    {
+        osmium::builder::WayBuilder builder{out};
+        builder.set_id(1);
+        auto const *end = decode_delta_encoded_way_node_list(
+            data.data(), data.data() + data.size(), &builder);
+        REQUIRE(end == data.data() + data.size());
+    }
+    out.commit();
+
+    auto const &decoded = out.get<osmium::Way>(0);
+    REQUIRE(decoded.nodes().size() == 5);
+    REQUIRE(decoded.nodes()[0].ref() == 10);
+    REQUIRE(decoded.nodes()[2].ref() == 11);
+    REQUIRE(decoded.nodes()[3].ref() == 1000000000000);
+    REQUIRE(decoded.nodes()[4].ref() == 3);
+
+    auto const *const begin = data.data();
+    auto const *const end = data.data() + data.size();
+    REQUIRE(delta_encoded_way_node_list_contains(begin, end, 12));
+    REQUIRE(delta_encoded_way_node_list_contains(begin, end, 3));
+    REQUIRE_FALSE(delta_encoded_way_node_list_contains(begin, end, 13));
+}
+
+TEST_CASE("encode and decode relation members and tags", "[NoDB]")
+{
+    test_buffer_t buffer;
+    auto const &relation = buffer.add_relation(
+        "r1 Ttype=route,name=Foo%20%Bar,empty= Mn5@stop,w20@,r3@sub%2c%way");
+
+    std::string members;
+    add_encoded_member_list(&members, relation.members());
+
+    std::string tags;
+    add_encoded_tag_list(&tags, relation.tags());
+    add_encoded_tag(&tags, "osm_user", "someone");
+
+    osmium::memory::Buffer out{1024, osmium::memory::Buffer::auto_grow::yes};
+    {
+        osmium::builder::RelationBuilder builder{out};
+        builder.set_id(1);
+        decode_member_list(members.data(), members.data() + members.size(),
+                           &builder);
+        decode_tag_list(tags.data(), tags.data() + tags.size(), &builder);
+    }
+    out.commit();
+
+    auto const &decoded = out.get<osmium::Relation>(0);
+
+    REQUIRE(decoded.members().size() == 3);
+    auto it = decoded.members().begin();
+    REQUIRE(it->type() == osmium::item_type::node);
+    REQUIRE(it->ref() == 5);
+    REQUIRE(std::strcmp(it->role(), "stop") == 0);
+    ++it;
+    REQUIRE(it->type() == osmium::item_type::way);
+    REQUIRE(it->ref() == 20);
+    REQUIRE(std::strcmp(it->role(), "") == 0);
+    ++it;
+    REQUIRE(it->type() == osmium::item_type::relation);
+    REQUIRE(it->ref() == 3);
+    REQUIRE(std::strcmp(it->role(), "sub,way") == 0);
+
+    REQUIRE(decoded.tags().size() == 4);
+    REQUIRE(std::strcmp(decoded.tags()["name"], "Foo Bar") == 0);
+    REQUIRE(std::strcmp(decoded.tags()["empty"], "") == 0);
+    REQUIRE(std::strcmp(decoded.tags()["osm_user"], "someone") == 0);
+}
+
+TEST_CASE("decoding truncated data fails", "[NoDB]")
+{
+    test_buffer_t buffer;
+    auto const &way = buffer.add_way("w1 Thighway=primary");
+
+    std::string tags;
+    add_encoded_tag_list(&tags, way.tags());
+    tags.resize(tags.size() - 1);
+
+    osmium::memory::Buffer out{1024, osmium::memory::Buffer::auto_grow::yes};
+    osmium::builder::WayBuilder builder{out};
+    REQUIRE_THROWS_AS(
+        decode_tag_list(tags.data(), tags.data() + tags.size(), &builder),
+        protozero::end_of_buffer_exception);
+}
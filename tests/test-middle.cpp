@@ -73,6 +73,16 @@ struct options_slim_with_schema
     }
 };
 
+struct options_slim_compact
+{
+    static options_t options(testing::pg::tempdb_t const &tmpdb)
+    {
+        options_t o = testing::opt_t().slim(tmpdb);
+        o.middle_compact = true;
+        return o;
+    }
+};
+
 struct options_flat_node_cache
 {
     static options_t options(testing::pg::tempdb_t const &tmpdb)
@@ -91,7 +101,8 @@ struct options_ram_optimized
 
 TEMPLATE_TEST_CASE("middle import", "", options_slim_default,
                    options_slim_with_lc_prefix, options_slim_with_uc_prefix,
-                   options_slim_with_schema, options_ram_optimized)
+                   options_slim_with_schema, options_slim_compact,
+                   options_ram_optimized)
 {
     options_t const options = TestType::options(db);
     testing::cleanup::file_t flatnode_cleaner{options.flat_node_file};
@@ -417,6 +428,50 @@ TEMPLATE_TEST_CASE("middle: add, delete and update node", "",
  * Check that the way is in the mid with the right attributes and tags.
  * Does not check node locations.
  */
+TEST_CASE("middle: update cache file is not used after run without it")
+{
+    auto thread_pool = std::make_shared<thread_pool_t>(1U);
+
+    options_t options = options_slim_default::options(db);
+
+    std::string const cache_file{"test_middle_update_cache.bin"};
+    testing::cleanup::file_t const cache_file_cleaner{cache_file};
+
+    test_buffer_t buffer;
+    auto const &node10 = buffer.add_node("n10 v1 x1.0 y0.0");
+    auto const &node10a = buffer.add_node("n10 v2 x2.0 y0.0");
+    auto const &node10b = buffer.add_node("n10 v3 x3.0 y0.0");
+
+    auto const run = [&](options_t const &opts, osmium::Node const &node) {
+        auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &opts);
+        mid->start();
+        mid->node(node);
+        mid->after_nodes();
+        mid->after_ways();
+        mid->after_relations();
+        mid->stop();
+        mid->wait();
+    };
+
+    run(options, node10);
+
+    options.append = true;
+    options_t options_cache = options;
+    options_cache.update_cache = 1;
+    options_cache.update_cache_file = cache_file;
+
+    // Update with update cache file, it contains the location of node 10.
+    run(options_cache, node10a);
+
+    // Update without update cache moves the node again.
+    run(options, node10b);
+
+    // Update with update cache file must not use the stale location.
+    auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &options_cache);
+    mid->start();
+    check_node(mid, node10b);
+}
+
 static void check_way(std::shared_ptr<middle_pgsql_t> const &mid,
                       osmium::Way const &orig_way)
 {
@@ -468,7 +523,8 @@ static bool no_way(std::shared_ptr<middle_pgsql_t> const &mid, osmid_t id)
 }
 
 TEMPLATE_TEST_CASE("middle: add, delete and update way", "",
-                   options_slim_default, options_flat_node_cache)
+                   options_slim_default, options_slim_compact,
+                   options_flat_node_cache)
 {
     auto thread_pool = std::make_shared<thread_pool_t>(1U);
 
@@ -615,7 +671,7 @@ TEMPLATE_TEST_CASE("middle: add, delete and update way", "",
 }
 
 TEMPLATE_TEST_CASE("middle: add way with attributes", "", options_slim_default,
-                   options_flat_node_cache)
+                   options_slim_compact, options_flat_node_cache)
 {
     auto thread_pool = std::make_shared<thread_pool_t>(1U);
 
@@ -701,7 +757,8 @@ static bool no_relation(std::shared_ptr<middle_pgsql_t> const &mid, osmid_t id)
 }
 
 TEMPLATE_TEST_CASE("middle: add, delete and update relation", "",
-                   options_slim_default, options_flat_node_cache)
+                   options_slim_default, options_slim_compact,
+                   options_flat_node_cache)
 {
     auto thread_pool = std::make_shared<thread_pool_t>(1U);
 
@@ -844,7 +901,8 @@ TEMPLATE_TEST_CASE("middle: add, delete and update relation", "",
 }
 
 TEMPLATE_TEST_CASE("middle: add relation with attributes", "",
-                   options_slim_default, options_flat_node_cache)
+                   options_slim_default, options_slim_compact,
+                   options_flat_node_cache)
 {
     auto thread_pool = std::make_shared<thread_pool_t>(1U);
 
@@ -895,8 +953,112 @@ TEMPLATE_TEST_CASE("middle: add relation with attributes", "",
     }
 }
 
+TEMPLATE_TEST_CASE("middle: count relation members", "",
+                   options_slim_default, options_slim_with_schema,
+                   options_slim_compact)
+{
+    auto thread_pool = std::make_shared<thread_pool_t>(1U);
+
+    options_t options = TestType::options(db);
+
+    test_buffer_t buffer;
+    auto const &relation30 =
+        buffer.add_relation("r30 Mw10@outer,w11@inner,n5@label "
+                            "Ttype=multipolygon");
+    auto const &relation31 = buffer.add_relation("r31 Mr30@");
+    auto const &relation32 = buffer.add_relation("r32 Ttype=site");
+
+    {
+        auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &options);
+        mid->start();
+
+        mid->relation(relation30);
+        mid->relation(relation31);
+        mid->relation(relation32);
+        mid->after_relations();
+    }
+
+    options.append = true;
+
+    auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &options);
+    mid->start();
+
+    // Relation 42 doesn't exist, it is counted as having no members.
+    auto const counts = mid->get_relation_member_counts({31, 42, 30, 32});
+    REQUIRE(counts == std::vector<std::size_t>{1, 0, 3, 0});
+
+    REQUIRE(mid->get_relation_member_counts({}).empty());
+}
+
+TEMPLATE_TEST_CASE("middle: migrate from array to compact format", "",
+                   options_slim_default, options_slim_with_schema)
+{
+    auto thread_pool = std::make_shared<thread_pool_t>(1U);
+
+    options_t options = TestType::options(db);
+
+    test_buffer_t buffer;
+    auto const &way20 =
+        buffer.add_way("w20 Nn10,n11 Thighway=residential,name=High_Street");
+    auto const &way21 = buffer.add_way("w21 Nn11,n12");
+    auto const &relation30 = buffer.add_relation(
+        "r30 Mw20@outer,w21@inner Ttype=multipolygon,name=Penguin_Park");
+    auto const &relation31 = buffer.add_relation("r31 Mn10@,r30@sub");
+
+    auto conn = db.connect();
+    if (!options.middle_dbschema.empty()) {
+        conn.exec("CREATE SCHEMA IF NOT EXISTS osm;");
+    }
+
+    // Create middle tables in the array format.
+    {
+        auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &options);
+        mid->start();
+
+        mid->way(way20);
+        mid->way(way21);
+        mid->after_ways();
+        mid->relation(relation30);
+        mid->relation(relation31);
+        mid->after_relations();
+    }
+
+    std::string const schema = options.middle_dbschema.empty()
+                                   ? "public"
+                                   : options.middle_dbschema;
+    std::string const nodes_type =
+        "SELECT format_type(atttypid, NULL) FROM pg_attribute"
+        " WHERE attrelid = '{}.planet_osm_ways'::regclass"
+        "   AND attname = 'nodes'"_format(schema);
+    REQUIRE(conn.result_as_string(nodes_type) == "bigint[]");
+
+    options.append = true;
+    options.middle_compact = true;
+
+    // Migrate, twice to check that the compact format is detected after
+    // the migration.
+    for (int i = 0; i < 2; ++i) {
+        auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &options);
+        mid->start();
+
+        check_way(mid, way20);
+        check_way(mid, way21);
+        check_relation(mid, relation30);
+        check_relation(mid, relation31);
+
+        auto ways = mid->get_ways_by_node(11);
+        std::sort(ways.begin(), ways.end());
+        REQUIRE(ways == idlist_t{20, 21});
+        REQUIRE(mid->get_rels_by_way(21) == idlist_t{30});
+
+        REQUIRE(conn.result_as_string(nodes_type) == "bytea");
+        REQUIRE(0 == conn.get_count("pg_catalog.pg_class",
+                                    "relname LIKE 'planet_osm_migrate%'"));
+    }
+}
+
 TEMPLATE_TEST_CASE("middle: change nodes in way", "", options_slim_default,
-                   options_flat_node_cache)
+                   options_slim_compact, options_flat_node_cache)
 {
     auto thread_pool = std::make_shared<thread_pool_t>(1U);
 
@@ -1033,7 +1195,7 @@ TEMPLATE_TEST_CASE("middle: change nodes in way", "", options_slim_default,
 }
 
 TEMPLATE_TEST_CASE("middle: change nodes in relation", "", options_slim_default,
-                   options_flat_node_cache)
+                   options_slim_compact, options_flat_node_cache)
 {
     auto thread_pool = std::make_shared<thread_pool_t>(1U);
 
@@ -1117,3 +1279,67 @@ TEMPLATE_TEST_CASE("middle: change nodes in relation", "", options_slim_default,
         check_relation(mid, rel31);
     }
 }
+
+TEMPLATE_TEST_CASE("middle: detect changes relevant for parents", "",
+                   options_slim_default, options_slim_compact,
+                   options_flat_node_cache)
+{
+    auto thread_pool = std::make_shared<thread_pool_t>(1U);
+
+    options_t options = TestType::options(db);
+
+    testing::cleanup::file_t flatnode_cleaner{options.flat_node_file};
+
+    test_buffer_t buffer;
+    auto const &node10 = buffer.add_node("n10 x1.0 y0.0");
+    auto const &node11 = buffer.add_node("n11 x1.1 y0.0");
+    auto const &node10t = buffer.add_node("n10 v2 Tamenity=cafe x1.0 y0.0");
+    auto const &node10a = buffer.add_node("n10 v2 x2.0 y0.0");
+    auto const &node12 = buffer.add_node("n12 x1.2 y0.0");
+
+    auto const &way20 = buffer.add_way("w20 Nn10,n11");
+    auto const &way20t = buffer.add_way("w20 v2 Thighway=road Nn10,n11");
+    auto const &way20a = buffer.add_way("w20 v2 Nn11,n10");
+    auto const &way20b = buffer.add_way("w20 v2 Nn10,n11,n12");
+    auto const &way21 = buffer.add_way("w21 Nn11,n12");
+
+    {
+        auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &options);
+        mid->start();
+
+        mid->node(node10);
+        mid->node(node11);
+        mid->after_nodes();
+        mid->way(way20);
+        mid->after_ways();
+        mid->after_relations();
+    }
+
+    // From now on use append mode to not destroy the data we just added.
+    options.append = true;
+
+    auto mid = std::make_shared<middle_pgsql_t>(thread_pool, &options);
+    mid->start();
+
+    SECTION("Node with changed tags only")
+    {
+        REQUIRE_FALSE(mid->node_location_changed(node10t));
+    }
+
+    SECTION("Moved node") { REQUIRE(mid->node_location_changed(node10a)); }
+
+    SECTION("New node") { REQUIRE(mid->node_location_changed(node12)); }
+
+    SECTION("Way with changed tags only")
+    {
+        REQUIRE_FALSE(mid->way_nodes_changed(way20t));
+    }
+
+    SECTION("Way with changed node list")
+    {
+        REQUIRE(mid->way_nodes_changed(way20a));
+        REQUIRE(mid->way_nodes_changed(way20b));
+    }
+
+    SECTION("New way") { REQUIRE(mid->way_nodes_changed(way21)); }
+}
@@ -0,0 +1,132 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-cleanup.hpp"
+
+#include "node-location-cache.hpp"
+
+#include <fstream>
+
+TEST_CASE("node location cache basics", "[NoDB]")
+{
+    node_location_cache_t cache{1024 * 1024};
+    REQUIRE(cache.size() == 0);
+
+    // ids can be added in any order
+    cache.set(5, {5.6, 7.8});
+    cache.set(3, {1.2, 3.4});
+    REQUIRE(cache.size() == 2);
+
+    REQUIRE(cache.get(1) == osmium::Location{});
+    REQUIRE(cache.get(3) == osmium::Location{1.2, 3.4});
+    REQUIRE(cache.get(5) == osmium::Location{5.6, 7.8});
+
+    cache.set(3, {9.1, 2.3});
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.get(3) == osmium::Location{9.1, 2.3});
+
+    cache.remove(5);
+    REQUIRE(cache.size() == 1);
+    REQUIRE(cache.get(5) == osmium::Location{});
+
+    cache.set(3, osmium::Location{});
+    REQUIRE(cache.size() == 0);
+}
+
+TEST_CASE("node location cache with size 0 stores nothing", "[NoDB]")
+{
+    node_location_cache_t cache{0};
+    cache.set(1, {1.0, 1.0});
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.get(1) == osmium::Location{});
+}
+
+TEST_CASE("node location cache evicts entries not used recently", "[NoDB]")
+{
+    node_location_cache_t cache{10 * 1024};
+    auto const capacity = static_cast<osmid_t>(cache.capacity());
+    REQUIRE(capacity > 2);
+
+    for (osmid_t id = 1; id <= capacity; ++id) {
+        cache.set(id, {1.0, static_cast<double>(id) / 1000});
+    }
+    REQUIRE(cache.size() == cache.capacity());
+
+    // Adding one more evicts one entry
+    cache.set(capacity + 1, {2.0, 2.0});
+    REQUIRE(cache.size() == cache.capacity());
+    REQUIRE(cache.get(capacity + 1) == osmium::Location{2.0, 2.0});
+
+    // Use node 3, then add more nodes than the cache can hold minus one.
+    REQUIRE(cache.get(3).valid());
+    for (osmid_t id = capacity + 2; id < 2 * capacity; ++id) {
+        cache.set(id, {3.0, 3.0});
+        if (id % 4 == 0) {
+            // keep using node 3
+            REQUIRE(cache.get(3).valid());
+        }
+    }
+
+    REQUIRE(cache.size() == cache.capacity());
+    REQUIRE(cache.get(3) == osmium::Location{1.0, 0.003});
+}
+
+TEST_CASE("node location cache can be saved and loaded", "[NoDB]")
+{
+    std::string const filename{"test_node_location_cache.bin"};
+    testing::cleanup::file_t const cleanup{filename};
+
+    testing::cleanup::file_t const cleanup_tmp{filename + ".tmp"};
+
+    {
+        node_location_cache_t cache{1024 * 1024};
+        REQUIRE_FALSE(cache.load(filename, 42));
+        cache.set(17, {1.5, 2.5});
+        cache.set(-3, {-1.5, -2.5});
+        cache.save(filename, 42);
+    }
+
+    // no temporary file left behind
+    REQUIRE_FALSE(std::ifstream{filename + ".tmp"}.good());
+
+    node_location_cache_t cache{1024 * 1024};
+    REQUIRE(cache.load(filename, 42));
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.get(17) == osmium::Location{1.5, 2.5});
+    REQUIRE(cache.get(-3) == osmium::Location{-1.5, -2.5});
+}
+
+TEST_CASE("node location cache file for other state is not loaded",
+          "[NoDB]")
+{
+    std::string const filename{"test_node_location_cache_state.bin"};
+    testing::cleanup::file_t const cleanup{filename};
+
+    {
+        node_location_cache_t cache{1024 * 1024};
+        cache.set(17, {1.5, 2.5});
+        cache.save(filename, 42);
+    }
+
+    node_location_cache_t cache{1024 * 1024};
+    REQUIRE_FALSE(cache.load(filename, 43));
+    REQUIRE(cache.size() == 0);
+    REQUIRE_FALSE(cache.get(17).valid());
+
+    // saving again replaces the existing file
+    cache.set(18, {3.5, 4.5});
+    cache.save(filename, 43);
+
+    node_location_cache_t cache2{1024 * 1024};
+    REQUIRE(cache2.load(filename, 43));
+    REQUIRE(cache2.size() == 1);
+    REQUIRE(cache2.get(18) == osmium::Location{3.5, 4.5});
+}
@@ -48,6 +48,9 @@ TEST_CASE("Incompatible arguments", "[NoDB]")
     bad_opt({"-j", "-k"}, "You can not specify both");
 
     bad_opt({"-a"}, "--append can only be used with slim mode");
+
+    bad_opt({"-a", "--slim", "--loopback-database"},
+            "--append can not be used with --loopback-database");
 }
 
 TEST_CASE("Middle selection", "[NoDB]")
@@ -59,6 +62,12 @@ TEST_CASE("Middle selection", "[NoDB]")
     REQUIRE_FALSE(options.slim);
 }
 
+TEST_CASE("Input pipeline can be disabled", "[NoDB]")
+{
+    REQUIRE(opt({}).input_pipeline);
+    REQUIRE_FALSE(opt({"--disable-input-pipeline"}).input_pipeline);
+}
+
 TEST_CASE("Lua styles", "[NoDB]")
 {
 #ifdef HAVE_LUA
@@ -122,3 +131,54 @@ TEST_CASE("Parsing tile expiry zoom levels fails", "[NoDB]")
             "Bad argument for option --expire-tiles. Minimum zoom level "
             "must be larger than 0.");
 }
+
+TEST_CASE("Parsing number of copy threads", "[NoDB]")
+{
+    auto options = opt({});
+    CHECK(options.num_copy_threads == 1);
+
+    options = opt({"--copy-threads", "4"});
+    CHECK(options.num_copy_threads == 4);
+
+    // Out of range values are clamped to valid values.
+    options = opt({"--copy-threads", "0"});
+    CHECK(options.num_copy_threads == 1);
+
+    options = opt({"--copy-threads", "100"});
+    CHECK(options.num_copy_threads == 32);
+}
+
+TEST_CASE("Parsing memory limit", "[NoDB]")
+{
+    auto options = opt({});
+    CHECK(options.memory_limit == 0);
+
+    // Caches are reduced to fit into the limit.
+    options = opt({"--slim", "--cache", "2000", "--memory-limit", "1000"});
+    CHECK(options.memory_limit == 1000);
+    CHECK(options.cache == 500);
+
+    bad_opt({"--memory-limit", "100"}, "Memory limit must be at least 256MB.");
+}
+
+TEST_CASE("Parsing extra outputs", "[NoDB]")
+{
+    options_t const options =
+        opt({"--extra-output", "flex,style.lua,host=db port=5433 dbname=gis",
+             "--extra-output", "pgsql,,other"});
+
+    REQUIRE(options.extra_outputs.size() == 2);
+    CHECK(options.extra_outputs[0].output_backend == "flex");
+    CHECK(options.extra_outputs[0].style == "style.lua");
+    CHECK(options.extra_outputs[0].db == "host=db port=5433 dbname=gis");
+    CHECK(options.extra_outputs[1].output_backend == "pgsql");
+    CHECK(options.extra_outputs[1].style.empty());
+    CHECK(options.extra_outputs[1].db == "other");
+
+    bad_opt({"--extra-output", "pgsql,default.style"},
+            "Argument for --extra-output must be of the form");
+    bad_opt({"--extra-output", ",default.style,gis"},
+            "Output and database must be set for --extra-output.");
+    bad_opt({"--extra-output", "flex,,gis"},
+            "You need to set a style file for the extra flex output.");
+}
@@ -0,0 +1,336 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "dependency-manager.hpp"
+#include "middle.hpp"
+#include "options.hpp"
+#include "osmdata.hpp"
+#include "output.hpp"
+
+#include "common-buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct test_middle_query_t : public middle_query_t
+{
+    size_t nodes_get_list(osmium::WayNodeList * /*nodes*/) const override
+    {
+        return 0;
+    }
+
+    bool way_get(osmid_t /*id*/,
+                 osmium::memory::Buffer * /*buffer*/) const override
+    {
+        return false;
+    }
+
+    size_t rel_members_get(osmium::Relation const & /*rel*/,
+                           osmium::memory::Buffer * /*buffer*/,
+                           osmium::osm_entity_bits::type /*types*/) const override
+    {
+        return 0;
+    }
+
+    bool relation_get(osmid_t /*id*/,
+                      osmium::memory::Buffer * /*buffer*/) const override
+    {
+        return false;
+    }
+};
+
+/**
+ * Middle which only knows the member counts of some relations. Without any
+ * member counts it behaves like a middle that can't count members. It
+ * records the ids of the nodes and ways stored in it and the threads they
+ * were stored from.
+ */
+class test_middle_t : public middle_t
+{
+public:
+    explicit test_middle_t(std::map<osmid_t, std::size_t> member_counts)
+    : middle_t(nullptr), m_member_counts(std::move(member_counts))
+    {}
+
+    void start() override {}
+    void stop() override {}
+    void node(osmium::Node const &node) override { record(node.id()); }
+    void way(osmium::Way const &way) override { record(way.id()); }
+    void relation(osmium::Relation const & /*relation*/) override {}
+
+    idlist_t const &stored_ids() const noexcept { return m_stored_ids; }
+
+    std::vector<std::thread::id> const &stored_from() const noexcept
+    {
+        return m_stored_from;
+    }
+
+    std::vector<std::size_t>
+    get_relation_member_counts(idlist_t const &ids) override
+    {
+        std::vector<std::size_t> counts;
+        if (m_member_counts.empty()) {
+            return counts;
+        }
+
+        for (auto const id : ids) {
+            auto const it = m_member_counts.find(id);
+            counts.push_back(it == m_member_counts.end() ? 0 : it->second);
+        }
+        return counts;
+    }
+
+    std::shared_ptr<middle_query_t> get_query_instance() override
+    {
+        return std::make_shared<test_middle_query_t>();
+    }
+
+private:
+    void record(osmid_t id)
+    {
+        std::lock_guard<std::mutex> const guard{m_mutex};
+        m_stored_ids.push_back(id);
+        m_stored_from.push_back(std::this_thread::get_id());
+    }
+
+    std::map<osmid_t, std::size_t> m_member_counts;
+
+    std::mutex m_mutex;
+    idlist_t m_stored_ids;
+    std::vector<std::thread::id> m_stored_from;
+};
+
+/// Dependency manager returning fixed lists of pending ids once.
+class test_dependency_manager_t : public dependency_manager_t
+{
+public:
+    test_dependency_manager_t(idlist_t ways, idlist_t relations)
+    : m_ways(std::move(ways)), m_relations(std::move(relations))
+    {}
+
+    bool has_pending() const noexcept override
+    {
+        return !m_ways.empty() || !m_relations.empty();
+    }
+
+    idlist_t get_pending_way_ids() override { return std::move(m_ways); }
+
+    idlist_t get_pending_relation_ids() override
+    {
+        return std::move(m_relations);
+    }
+
+private:
+    idlist_t m_ways;
+    idlist_t m_relations;
+};
+
+/// State shared between a test output and all its clones.
+struct output_state_t
+{
+    std::mutex mutex;
+    idlist_t processed_objects;
+    idlist_t processed_relations;
+    osmid_t failing_way = 0;
+    std::atomic<int> in_progress{0};
+};
+
+/// Output recording pending objects processed in any of its clones.
+class test_output_t : public output_t
+{
+public:
+    test_output_t(std::shared_ptr<middle_query_t> const &mid,
+                  options_t const &options,
+                  std::shared_ptr<output_state_t> state)
+    : output_t(mid, nullptr, options), m_state(std::move(state))
+    {}
+
+    std::shared_ptr<output_t>
+    clone(std::shared_ptr<middle_query_t> const &mid,
+          std::shared_ptr<db_copy_thread_t> const & /*copy_thread*/)
+        const override
+    {
+        return std::make_shared<test_output_t>(mid, m_options, m_state);
+    }
+
+    void start() override {}
+    void stop() override {}
+    void sync() override {}
+
+    void pending_way(osmid_t id) override
+    {
+        ++m_state->in_progress;
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+        --m_state->in_progress;
+        if (id == m_state->failing_way) {
+            throw std::runtime_error{"error in pending way"};
+        }
+    }
+
+    void pending_relation(osmid_t id) override
+    {
+        std::lock_guard<std::mutex> const guard{m_state->mutex};
+        m_state->processed_relations.push_back(id);
+    }
+
+    void node_add(osmium::Node const & /*node*/) override {}
+    void way_add(osmium::Way * /*way*/) override {}
+    void relation_add(osmium::Relation const & /*rel*/) override {}
+    void node_modify(osmium::Node const &node) override
+    {
+        std::lock_guard<std::mutex> const guard{m_state->mutex};
+        m_state->processed_objects.push_back(node.id());
+    }
+
+    void way_modify(osmium::Way *way) override
+    {
+        std::lock_guard<std::mutex> const guard{m_state->mutex};
+        m_state->processed_objects.push_back(way->id());
+    }
+    void relation_modify(osmium::Relation const & /*rel*/) override {}
+    void node_delete(osmid_t /*id*/) override {}
+    void way_delete(osmid_t /*id*/) override {}
+    void relation_delete(osmid_t /*id*/) override {}
+
+private:
+    std::shared_ptr<output_state_t> m_state;
+};
+
+options_t append_options(unsigned int num_procs)
+{
+    options_t options;
+    options.append = true;
+    options.slim = true;
+    options.num_procs = num_procs;
+    options.database_options.loopback = true;
+    return options;
+}
+
+} // anonymous namespace
+
+TEST_CASE("error in one clone while processing pending ways", "[NoDB]")
+{
+    auto const options = append_options(4);
+
+    idlist_t ways;
+    for (osmid_t id = 1; id <= 2000; ++id) {
+        ways.push_back(id);
+    }
+
+    auto state = std::make_shared<output_state_t>();
+    state->failing_way = 500;
+
+    auto mid = std::make_shared<test_middle_t>(std::map<osmid_t, std::size_t>{});
+    auto output = std::make_shared<test_output_t>(mid->get_query_instance(),
+                                                  options, state);
+    osmdata_t osmdata{std::make_unique<test_dependency_manager_t>(
+                          std::move(ways), idlist_t{}),
+                      mid, output, options};
+
+    REQUIRE_THROWS_WITH(osmdata.stop(), "error in pending way");
+
+    // All other workers have stopped before the error was reported.
+    REQUIRE(state->in_progress == 0);
+}
+
+static idlist_t process_pending_relations(
+    std::map<osmid_t, std::size_t> member_counts, idlist_t relations)
+{
+    auto const options = append_options(1);
+    auto state = std::make_shared<output_state_t>();
+
+    auto mid = std::make_shared<test_middle_t>(std::move(member_counts));
+    auto output = std::make_shared<test_output_t>(mid->get_query_instance(),
+                                                  options, state);
+    osmdata_t osmdata{std::make_unique<test_dependency_manager_t>(
+                          idlist_t{}, std::move(relations)),
+                      mid, output, options};
+    osmdata.stop();
+
+    return state->processed_relations;
+}
+
+TEST_CASE("heavy relations are processed first", "[NoDB]")
+{
+    // relation 11 is unknown to the middle
+    auto const processed =
+        process_pending_relations({{1, 3},
+                                   {3, 1000},
+                                   {5, 20},
+                                   {7, 50000},
+                                   {9, 999},
+                                   {13, 4000}},
+                                  {1, 3, 5, 7, 9, 11, 13});
+
+    REQUIRE(processed == idlist_t{7, 13, 3, 1, 5, 9, 11});
+}
+
+TEST_CASE("relations keep their order without member counts", "[NoDB]")
+{
+    auto const processed = process_pending_relations({}, {5, 3, 7, 1});
+
+    REQUIRE(processed == idlist_t{5, 3, 7, 1});
+}
+
+TEST_CASE("nodes and ways with and without input pipeline", "[NoDB]")
+{
+    bool const input_pipeline = GENERATE(true, false);
+
+    auto options = append_options(4);
+    options.input_pipeline = input_pipeline;
+
+    auto state = std::make_shared<output_state_t>();
+    auto mid = std::make_shared<test_middle_t>(std::map<osmid_t, std::size_t>{});
+    auto output = std::make_shared<test_output_t>(mid->get_query_instance(),
+                                                  options, state);
+    osmdata_t osmdata{std::make_unique<test_dependency_manager_t>(idlist_t{},
+                                                                  idlist_t{}),
+                      mid, output, options};
+
+    idlist_t expected;
+    test_buffer_t buffer;
+    for (osmid_t id = 1; id <= 1000; ++id) {
+        osmdata.node(buffer.add_node("n{} x1 y2"_format(id)));
+        expected.push_back(id);
+    }
+    osmdata.after_nodes();
+    for (osmid_t id = 1; id <= 100; ++id) {
+        osmdata.way(buffer.add_way(id, {id, id + 1}));
+        expected.push_back(id);
+    }
+    osmdata.after_ways();
+    osmdata.after_relations();
+    osmdata.stop();
+
+    // All objects are stored and processed in input order either way.
+    REQUIRE(mid->stored_ids() == expected);
+    REQUIRE(state->processed_objects == expected);
+
+    // Without the pipeline the middle is filled from the input thread.
+    auto const &threads = mid->stored_from();
+    auto const in_input_thread = static_cast<std::size_t>(
+        std::count(threads.begin(), threads.end(), std::this_thread::get_id()));
+    if (input_pipeline) {
+        REQUIRE(in_input_thread == 0);
+    } else {
+        REQUIRE(in_input_thread == threads.size());
+    }
+}
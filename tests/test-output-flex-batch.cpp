@@ -0,0 +1,66 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-import.hpp"
+#include "common-options.hpp"
+
+static testing::db::import_t db;
+
+static char const *const conf_file = "test_output_flex_batch.lua";
+
+TEST_CASE("process nodes and ways in batches")
+{
+    options_t const options = testing::opt_t().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options,
+                                  "n10 v1 dV Ta=b x10.0 y10.0\n"
+                                  "n11 v1 dV Ta=b x10.0 y10.2\n"
+                                  "n12 v1 dV Ta=b x10.2 y10.2\n"
+                                  "w20 v1 dV Thighway=primary Nn10,n11,n12\n"
+                                  "w21 v1 dV Tbuilding=yes Nn10,n11,n12\n"
+                                  "w22 v1 dV Thighway=track Nn11,n12\n"));
+
+    auto conn = db.db().connect();
+
+    CHECK(3 == conn.get_count("osm2pgsql_test_points"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_points",
+                              "abs(min_x - 10.2) < 0.01 AND "
+                              "abs(min_y - 10.2) < 0.01"));
+
+    CHECK(2 == conn.get_count("osm2pgsql_test_highways"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_highways",
+                              "tags->'highway' = 'track'"));
+}
+
+TEST_CASE("updates with batches")
+{
+    options_t options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options,
+                                  "n10 v1 dV Ta=b x10.0 y10.0\n"
+                                  "n11 v1 dV Ta=b x10.0 y10.2\n"
+                                  "w20 v1 dV Thighway=primary Nn10,n11\n"));
+
+    auto conn = db.db().connect();
+
+    CHECK(1 == conn.get_count("osm2pgsql_test_highways"));
+
+    options.append = true;
+
+    REQUIRE_NOTHROW(db.run_import(options, "n11 v2 dV Ta=b x10.1 y10.2\n"
+                                           "w21 v1 dV Thighway=primary "
+                                           "Nn10,n11\n"));
+
+    CHECK(2 == conn.get_count("osm2pgsql_test_points"));
+    CHECK(2 == conn.get_count("osm2pgsql_test_highways"));
+    CHECK(2 == conn.get_count("osm2pgsql_test_highways",
+                              "ST_NumPoints(geom) = 2"));
+}
@@ -0,0 +1,96 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-import.hpp"
+#include "common-options.hpp"
+
+static testing::db::import_t db;
+
+static char const *const conf_file = "test_output_flex_partition.lua";
+
+TEST_CASE("rows are written into the right partitions")
+{
+    options_t const options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options,
+                                  "n10 v1 dV Ta=b x10.0 y10.0\n"
+                                  "n11 v1 dV Ta=b x-120.0 y40.0\n"
+                                  "n12 v1 dV Ta=b x140.0 y-30.0\n"
+                                  "w20 v1 dV Thighway=primary Nn10,n11\n"));
+
+    auto conn = db.db().connect();
+
+    CHECK(4 == conn.get_count("osm2pgsql_test_by_type"));
+    CHECK(3 == conn.get_count("osm2pgsql_test_by_type_p0"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_type_p1"));
+    CHECK(0 == conn.get_count("osm2pgsql_test_by_type_p2"));
+
+    // The Hilbert curve through the world goes from the south-west quarter
+    // through the north-west and north-east quarters to the south-east.
+    CHECK(3 == conn.get_count("osm2pgsql_test_by_geom"));
+    CHECK(0 == conn.get_count("osm2pgsql_test_by_geom_p0"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_geom_p1", "node_id = 11"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_geom_p2", "node_id = 10"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_geom_p3", "node_id = 12"));
+    CHECK(0 == conn.get_count("osm2pgsql_test_by_geom",
+                              "partition_key < 0 OR partition_key > 3"));
+}
+
+TEST_CASE("partition extent is split into partitions")
+{
+    options_t const options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options,
+                                  "n10 v1 dV Ta=b x5.0 y5.0\n"
+                                  "n11 v1 dV Ta=b x5.0 y15.0\n"
+                                  "n12 v1 dV Ta=b x15.0 y15.0\n"
+                                  "n13 v1 dV Ta=b x15.0 y5.0\n"
+                                  "n14 v1 dV Ta=b x-60.0 y-30.0\n"
+                                  "n15 v1 dV Ta=b x140.0 y-30.0\n"));
+
+    auto conn = db.db().connect();
+
+    CHECK(6 == conn.get_count("osm2pgsql_test_by_extent"));
+
+    // Inside the extent the quarters go into different partitions.
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_extent_p0", "node_id = 10"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_extent_p1", "node_id = 11"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_extent_p2", "node_id = 12"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_extent_p3", "node_id = 13"));
+
+    // Outside the extent geometries go into the partitions at its edges.
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_extent_p0", "node_id = 14"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_extent_p3", "node_id = 15"));
+
+    // In the whole world all of them are in the north-east quarter.
+    CHECK(4 == conn.get_count("osm2pgsql_test_by_geom_p2"));
+}
+
+TEST_CASE("updates on partitioned tables")
+{
+    options_t options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options, "n10 v1 dV Ta=b x10.0 y10.0\n"
+                                           "n11 v1 dV Ta=b x10.0 y10.2\n"));
+
+    auto conn = db.db().connect();
+
+    CHECK(2 == conn.get_count("osm2pgsql_test_by_geom"));
+
+    options.append = true;
+
+    REQUIRE_NOTHROW(db.run_import(options, "n10 v2 dD\n"
+                                           "n11 v2 dV Ta=c x-10.0 y-10.2\n"));
+
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_type_p0"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_geom"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_by_geom", "tags->'a' = 'c'"));
+}
@@ -0,0 +1,94 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-buffer.hpp"
+#include "common-import.hpp"
+#include "common-options.hpp"
+
+static testing::db::import_t db;
+
+static char const *const conf_file = "test_output_flex_row_hash.lua";
+
+TEST_CASE("row hashes are updated when rows change")
+{
+    options_t options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options,
+                                  "n10 v1 dV Tamenity=cafe x10.0 y10.0\n"
+                                  "n11 v1 dV Tamenity=pub x10.0 y10.1\n"));
+
+    auto conn = db.db().connect();
+    REQUIRE(2 == conn.get_count("osm2pgsql_test_point"));
+
+    std::string const query_hash =
+        "SELECT hash FROM osm2pgsql_test_point WHERE node_id = ";
+    auto const hash10 = conn.result_as_string(query_hash + "10");
+    auto const hash11 = conn.result_as_string(query_hash + "11");
+
+    options.append = true;
+    REQUIRE_NOTHROW(
+        db.run_import(options, "n10 v2 dV Tamenity=cafe,note=x x10.0 y10.0\n"
+                               "n11 v2 dV Tamenity=pub x10.0 y10.1\n"));
+
+    CHECK(2 == conn.get_count("osm2pgsql_test_point"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_point",
+                              "node_id = 10 AND tags->'note' = 'x'"));
+    CHECK(hash10 != conn.result_as_string(query_hash + "10"));
+    CHECK(hash11 == conn.result_as_string(query_hash + "11"));
+}
+
+TEST_CASE("changing an object again after changing another one")
+{
+    options_t options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options,
+                                  "n10 v1 dV Tamenity=cafe x10.0 y10.0\n"
+                                  "n11 v1 dV Tamenity=pub x10.0 y10.1\n"));
+
+    auto conn = db.db().connect();
+    REQUIRE(2 == conn.get_count("osm2pgsql_test_point"));
+
+    // Feed the changes for objects A, B, A directly into the processing
+    // chain (input files would be sorted). The second change of A sets the
+    // row back to what is still in the database, but the first change of A
+    // has already been added to the COPY data.
+    options.append = true;
+    options.database_options = db.db().db_options();
+
+    auto thread_pool = std::make_shared<thread_pool_t>(1U);
+    auto middle = create_middle(thread_pool, options);
+    middle->start();
+
+    auto output = output_t::create_output(middle->get_query_instance(),
+                                          thread_pool, options);
+    middle->set_requirements(output->get_requirements());
+
+    osmdata_t osmdata{std::make_unique<full_dependency_manager_t>(middle),
+                      middle, output, options};
+    osmdata.start();
+
+    test_buffer_t buffer;
+    osmdata.node(
+        buffer.add_node("n10 v2 dV Tamenity=restaurant x10.0 y10.0"));
+    osmdata.node(buffer.add_node("n11 v2 dV Tamenity=bar x10.0 y10.1"));
+    osmdata.node(buffer.add_node("n10 v3 dV Tamenity=cafe x10.0 y10.0"));
+
+    osmdata.after_nodes();
+    osmdata.after_ways();
+    osmdata.after_relations();
+    osmdata.stop();
+
+    CHECK(2 == conn.get_count("osm2pgsql_test_point"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_point",
+                              "node_id = 10 AND tags->'amenity' = 'cafe'"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_point",
+                              "node_id = 11 AND tags->'amenity' = 'bar'"));
+}
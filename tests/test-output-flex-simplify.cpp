@@ -0,0 +1,93 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-import.hpp"
+#include "common-options.hpp"
+
+static testing::db::import_t db;
+
+static char const *const conf_file = "test_output_flex_simplify.lua";
+
+// The middle node of the line and the extra node on the southern edge of
+// the polygon are only about 11m off, less than the tolerance of 100m.
+static char const *const data = "n10 v1 dV x10.0 y10.0\n"
+                                "n11 v1 dV x10.05 y10.0001\n"
+                                "n12 v1 dV x10.1 y10.0\n"
+                                "n13 v1 dV x10.0 y11.0\n"
+                                "n14 v1 dV x10.05 y11.0001\n"
+                                "n15 v1 dV x10.1 y11.0\n"
+                                "n16 v1 dV x10.1 y11.1\n"
+                                "n17 v1 dV x10.0 y11.1\n"
+                                "n20 v1 dV x20.0 y20.0\n"
+                                "n21 v1 dV x20.0001 y20.0\n"
+                                "n22 v1 dV x20.0001 y20.0001\n"
+                                "n23 v1 dV x20.0 y20.0001\n"
+                                "w30 v1 dV Ta=line Nn10,n11,n12\n"
+                                "w31 v1 dV Ta=area Nn13,n14,n15,n16,n17,n13\n"
+                                "w32 v1 dV Ta=tiny Nn20,n21,n22,n23,n20\n";
+
+TEST_CASE("simplify lines")
+{
+    options_t const options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options, data));
+
+    auto conn = db.db().connect();
+
+    CHECK(1 == conn.get_count("osm2pgsql_test_line", "ST_NPoints(geom) = 3"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_line_simple",
+                              "ST_NPoints(geom) = 2"));
+
+    // The simplified line keeps the end points.
+    CHECK(1 == conn.get_count("osm2pgsql_test_line_simple",
+                              "ST_Equals(ST_StartPoint(geom), (SELECT "
+                              "ST_StartPoint(geom) FROM osm2pgsql_test_line))"
+                              " AND ST_Equals(ST_EndPoint(geom), (SELECT "
+                              "ST_EndPoint(geom) FROM osm2pgsql_test_line))"));
+}
+
+TEST_CASE("simplify polygons")
+{
+    options_t const options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options, data));
+
+    auto conn = db.db().connect();
+
+    CHECK(2 == conn.get_count("osm2pgsql_test_area"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_area",
+                              "way_id = 31 AND ST_NPoints(geom) = 6"));
+
+    // The tiny polygon collapses and is not added to the simplified table.
+    CHECK(1 == conn.get_count("osm2pgsql_test_area_simple"));
+    CHECK(1 == conn.get_count("osm2pgsql_test_area_simple",
+                              "way_id = 31 AND ST_NPoints(geom) = 5"));
+}
+
+TEST_CASE("simplified geometries are updated")
+{
+    options_t options = testing::opt_t().slim().flex(conf_file);
+
+    REQUIRE_NOTHROW(db.run_import(options, data));
+
+    auto conn = db.db().connect();
+
+    CHECK(1 == conn.get_count("osm2pgsql_test_line_simple",
+                              "ST_NPoints(geom) = 2"));
+
+    options.append = true;
+
+    // Move the middle node of the line far enough to be kept.
+    REQUIRE_NOTHROW(db.run_import(options, "n11 v2 dV x10.05 y10.01\n"));
+
+    CHECK(1 == conn.get_count("osm2pgsql_test_line_simple",
+                              "ST_NPoints(geom) = 3"));
+}
@@ -34,8 +34,18 @@ struct options_slim_expire
     }
 };
 
+struct options_slim_copy_threads
+{
+    static options_t options()
+    {
+        options_t o = options_slim_default::options();
+        o.num_copy_threads = 2;
+        return o;
+    }
+};
+
 TEMPLATE_TEST_CASE("updating a node", "", options_slim_default,
-                   options_slim_expire)
+                   options_slim_expire, options_slim_copy_threads)
 {
     options_t options = TestType::options();
 
@@ -76,7 +86,7 @@ TEMPLATE_TEST_CASE("updating a node", "", options_slim_default,
 }
 
 TEMPLATE_TEST_CASE("updating a way", "", options_slim_default,
-                   options_slim_expire)
+                   options_slim_expire, options_slim_copy_threads)
 {
     options_t options = TestType::options();
 
@@ -165,7 +175,7 @@ TEMPLATE_TEST_CASE("updating a way", "", options_slim_default,
 }
 
 TEMPLATE_TEST_CASE("ways as linestrings and polygons", "", options_slim_default,
-                   options_slim_expire)
+                   options_slim_expire, options_slim_copy_threads)
 {
     options_t options = TestType::options();
 
@@ -273,7 +283,7 @@ TEMPLATE_TEST_CASE("ways as linestrings and polygons", "", options_slim_default,
 }
 
 TEMPLATE_TEST_CASE("multipolygons", "", options_slim_default,
-                   options_slim_expire)
+                   options_slim_expire, options_slim_copy_threads)
 {
     options_t options = TestType::options();
 
@@ -0,0 +1,127 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "common-import.hpp"
+#include "common-options.hpp"
+
+// The main database gets the middle and the pgsql output, the extra
+// database only the tables of the flex output.
+static testing::db::import_t db;
+static testing::pg::tempdb_t extra_db;
+
+static char const *const conf_file = "test_output_multi.lua";
+
+static options_t multi_options()
+{
+    options_t options = testing::opt_t().slim();
+
+    extra_output_t extra;
+    extra.output_backend = "flex";
+    extra.style = TESTDATA_DIR;
+    extra.style += conf_file;
+    extra.db = extra_db.db_options().db;
+    options.extra_outputs.push_back(extra);
+
+    return options;
+}
+
+static char const *const data =
+    "n10 v1 dV Tamenity=cafe,name=Foo x10.0 y10.0\n"
+    "n11 v1 dV Tshop=bakery x10.1 y10.1\n"
+    "n12 v1 dV x10.0 y10.2\n"
+    "n13 v1 dV x10.1 y10.2\n"
+    "n14 v1 dV x10.2 y10.2\n"
+    "n15 v1 dV x10.0 y10.3\n"
+    "n16 v1 dV x10.1 y10.3\n"
+    "n17 v1 dV x10.1 y10.4\n"
+    "w20 v1 dV Thighway=primary,name=Main Nn12,n13\n"
+    "w21 v1 dV Thighway=residential Nn13,n14\n"
+    "w22 v1 dV Tbuilding=yes Nn15,n16,n17,n15\n";
+
+static int table_count(testing::pg::conn_t const &conn, char const *table)
+{
+    return conn.result_as_int(
+        "SELECT count(*) FROM pg_tables WHERE tablename = '{}'"_format(table));
+}
+
+TEST_CASE("extra output fills its own database")
+{
+    REQUIRE_NOTHROW(db.run_import(multi_options(), data));
+
+    auto conn = db.db().connect();
+    auto extra_conn = extra_db.connect();
+
+    // Main database: middle and pgsql output tables
+    CHECK(1 == table_count(conn, "planet_osm_nodes"));
+    CHECK(0 == table_count(conn, "osm2pgsql_test_pois"));
+
+    CHECK(2 == conn.get_count("planet_osm_point"));
+    CHECK(1 == conn.get_count("planet_osm_point",
+                              "osm_id = 10 AND amenity = 'cafe'"));
+    CHECK(1 == conn.get_count("planet_osm_point",
+                              "osm_id = 11 AND shop = 'bakery'"));
+
+    CHECK(2 == conn.get_count("planet_osm_line"));
+    CHECK(1 == conn.get_count("planet_osm_roads"));
+    CHECK(1 == conn.get_count("planet_osm_roads",
+                              "osm_id = 20 AND highway = 'primary'"));
+
+    CHECK(1 == conn.get_count("planet_osm_polygon"));
+    CHECK(1 == conn.get_count("planet_osm_polygon",
+                              "osm_id = 22 AND building = 'yes'"));
+
+    // Extra database: flex output tables only
+    CHECK(0 == table_count(extra_conn, "planet_osm_nodes"));
+    CHECK(0 == table_count(extra_conn, "planet_osm_point"));
+
+    CHECK(1 == extra_conn.get_count("osm2pgsql_test_pois"));
+    CHECK(1 == extra_conn.get_count("osm2pgsql_test_pois",
+                                    "node_id = 10 AND amenity = 'cafe' "
+                                    "AND name = 'Foo'"));
+
+    CHECK(2 == extra_conn.get_count("osm2pgsql_test_highways"));
+    CHECK(1 == extra_conn.get_count("osm2pgsql_test_highways",
+                                    "way_id = 20 AND highway = 'primary' "
+                                    "AND name = 'Main'"));
+    CHECK(1 == extra_conn.get_count("osm2pgsql_test_highways",
+                                    "way_id = 21 AND highway = 'residential'"));
+
+    CHECK(1 == extra_conn.get_count("osm2pgsql_test_buildings"));
+    CHECK(1 == extra_conn.get_count("osm2pgsql_test_buildings",
+                                    "area_id = 22 AND building = 'yes'"));
+}
+
+TEST_CASE("extra output is updated in append mode")
+{
+    options_t options = multi_options();
+
+    REQUIRE_NOTHROW(db.run_import(options, data));
+
+    options.append = true;
+
+    REQUIRE_NOTHROW(db.run_import(options,
+                                  "n10 v2 dD\n"
+                                  "w20 v2 dV Thighway=secondary Nn12,n13\n"));
+
+    auto conn = db.db().connect();
+    auto extra_conn = extra_db.connect();
+
+    CHECK(1 == conn.get_count("planet_osm_point"));
+    CHECK(0 == conn.get_count("planet_osm_roads"));
+    CHECK(1 == conn.get_count("planet_osm_line",
+                              "osm_id = 20 AND highway = 'secondary'"));
+
+    CHECK(0 == extra_conn.get_count("osm2pgsql_test_pois"));
+    CHECK(2 == extra_conn.get_count("osm2pgsql_test_highways"));
+    CHECK(1 == extra_conn.get_count("osm2pgsql_test_highways",
+                                    "way_id = 20 AND highway = 'secondary' "
+                                    "AND name IS NULL"));
+}
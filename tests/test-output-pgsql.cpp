@@ -9,11 +9,27 @@
 
 #include <catch.hpp>
 
+#include "common-cleanup.hpp"
 #include "common-import.hpp"
 #include "common-options.hpp"
 
+#include <cstdio>
+#include <fstream>
+#include <string>
+
 static testing::db::import_t db;
 
+static std::size_t count_lines(std::string const &filename)
+{
+    std::ifstream file{filename};
+    std::string line;
+    std::size_t count = 0;
+    while (std::getline(file, line)) {
+        ++count;
+    }
+    return count;
+}
+
 static void require_tables(testing::pg::conn_t const &conn)
 {
     conn.require_has_table("osm2pgsql_test_point");
@@ -124,6 +140,92 @@ TEST_CASE("route relation slim flatnode")
     REQUIRE(0 == conn.get_count("osm2pgsql_test_polygon"));
 }
 
+TEST_CASE("route relation tags go into columns of the route line")
+{
+    options_t options = testing::opt_t().slim();
+    options.hstore_mode = hstore_column::norm;
+
+    REQUIRE_NOTHROW(db.run_import(
+        options, "n1 v1 dV x-122.5 y49\n"
+                 "n2 v1 dV x-122.51 y49\n"
+                 "w1 v1 dV Thighway=primary,name=Main Nn1,n2\n"
+                 "r1 v1 dV Ttype=route,route=bicycle,name=Velo,network=lcn,"
+                 "ref=7 Mw1@\n"));
+
+    auto conn = db.db().connect();
+    require_tables(conn);
+
+    REQUIRE(2 == conn.get_count("osm2pgsql_test_line"));
+
+    // The member way keeps its own tags.
+    CHECK(1 == conn.get_count("osm2pgsql_test_line",
+                              "osm_id = 1 AND highway = 'primary' AND "
+                              "name = 'Main' AND route IS NULL"));
+
+    // The route line gets the tags of the relation and the geometry of the
+    // member way.
+    CHECK(1 == conn.get_count("osm2pgsql_test_line",
+                              "osm_id = -1 AND route = 'bicycle' AND "
+                              "name = 'Velo' AND ref = '7' AND "
+                              "highway IS NULL"));
+    CHECK(1 == conn.get_count(
+                   "osm2pgsql_test_line r, osm2pgsql_test_line w",
+                   "r.osm_id = -1 AND w.osm_id = 1 AND "
+                   "ST_Equals(r.way, w.way)"));
+
+    // Tags written to columns are not in the tags column, tags generated
+    // for routes are.
+    CHECK(1 == conn.get_count("osm2pgsql_test_line",
+                              "osm_id = -1 AND tags->'route_name' = 'Velo' "
+                              "AND tags->'lcn' = 'yes' AND "
+                              "tags->'lcn_ref' = '7' AND "
+                              "tags->'network' = 'lcn' AND "
+                              "NOT tags ? 'name' AND NOT tags ? 'route' AND "
+                              "NOT tags ? 'type'"));
+}
+
+TEST_CASE("tag-only node change doesn't reprocess or expire parent ways")
+{
+    std::string const expire_file{"test_output_pgsql_expire.txt"};
+    testing::cleanup::file_t const cleanup{expire_file};
+
+    options_t options = testing::opt_t().slim();
+    options.expire_tiles_zoom = 12;
+    options.expire_tiles_zoom_min = 12;
+    options.expire_tiles_filename = expire_file;
+
+    REQUIRE_NOTHROW(
+        db.run_import(options, "n10 v1 dV x10.0 y10.0\n"
+                               "n11 v1 dV x10.1 y10.0\n"
+                               "w20 v1 dV Thighway=primary Nn10,n11\n"));
+    std::remove(expire_file.c_str());
+
+    auto conn = db.db().connect();
+
+    // The row is only replaced (with a new xmin) if the way is reprocessed.
+    auto const way_xmin = [&]() {
+        return conn.result_as_string(
+            "SELECT xmin FROM osm2pgsql_test_line WHERE osm_id = 20");
+    };
+    auto const xmin_before = way_xmin();
+
+    options.append = true;
+
+    REQUIRE_NOTHROW(db.run_import(options, "n10 v2 dV Tfoo=bar x10.0 y10.0\n"));
+
+    CHECK(way_xmin() == xmin_before);
+    CHECK(count_lines(expire_file) == 0);
+
+    REQUIRE_NOTHROW(
+        db.run_import(options, "n10 v3 dV Tfoo=bar x10.0 y10.05\n"));
+
+    CHECK(way_xmin() != xmin_before);
+    CHECK(count_lines(expire_file) > 0);
+    CHECK(1 == conn.get_count("osm2pgsql_test_line",
+                              "osm_id = 20 AND ST_Y(ST_Transform("
+                              "ST_StartPoint(way), 4326)) > 10.04"));
+}
+
 TEST_CASE("liechtenstein slim bz2 parsing regression")
 {
     REQUIRE_NOTHROW(db.run_file(testing::opt_t().slim(),
@@ -0,0 +1,112 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "pgsql-loopback.hpp"
+#include "pgsql.hpp"
+
+TEST_CASE("loopback database answers lookups by id", "[NoDB]")
+{
+    pg_conn_t conn{loopback_conninfo};
+
+    conn.exec("CREATE UNLOGGED TABLE \"lb_ways\" (id int8 PRIMARY KEY"
+              ", nodes int8[] NOT NULL, tags text[])");
+    conn.exec("PREPARE get_way(int8) AS SELECT nodes, tags FROM lb_ways "
+              "WHERE id = $1");
+    conn.exec("PREPARE get_ways(int8[]) AS SELECT id, nodes FROM lb_ways "
+              "WHERE id = ANY($1::int8[])");
+
+    conn.query(PGRES_COPY_IN, "COPY lb_ways (id, tags, nodes) FROM STDIN");
+    conn.copy_data("1\t{highway,primary}\t{10,11}\n2\t\\N\t{12,", "lb_ways");
+    conn.copy_data("13}\n3\t{a,b}\t{14,15}\n", "lb_ways");
+    conn.end_copy("lb_ways");
+
+    SECTION("single id")
+    {
+        auto const res = conn.exec_prepared("get_way", 2);
+        REQUIRE(res.num_tuples() == 1);
+        REQUIRE(res.get_value_as_string(0, 0) == "{12,13}");
+        REQUIRE(res.is_null(0, 1));
+    }
+
+    SECTION("list of ids")
+    {
+        auto const res = conn.exec_prepared("get_ways", "{3,4,1}");
+        REQUIRE(res.num_tuples() == 2);
+        REQUIRE(res.get_value_as_string(0, 0) == "3");
+        REQUIRE(res.get_value_as_string(0, 1) == "{14,15}");
+        REQUIRE(res.get_value_as_string(1, 0) == "1");
+    }
+
+    SECTION("deleted rows are gone")
+    {
+        conn.exec("DELETE FROM lb_ways WHERE id IN (1,3)");
+        auto const res = conn.exec_prepared("get_ways", "{1,2,3}");
+        REQUIRE(res.num_tuples() == 1);
+        REQUIRE(res.get_value_as_string(0, 0) == "2");
+    }
+
+    SECTION("unknown prepared statement fails")
+    {
+        REQUIRE_THROWS(conn.exec_prepared("does_not_exist", 1));
+    }
+
+    conn.exec("DROP TABLE IF EXISTS lb_ways");
+}
+
+TEST_CASE("loopback database accepts other tables and statements", "[NoDB]")
+{
+    pg_conn_t conn{loopback_conninfo};
+
+    conn.exec("CREATE TABLE lb_points (osm_id int8, way geometry(POINT,3857))");
+    conn.query(PGRES_COPY_IN, "COPY lb_points FROM STDIN");
+    conn.copy_data("1\tSRID=3857;POINT(1 2)\n", "lb_points");
+    conn.end_copy("lb_points");
+
+    conn.exec("PREPARE mark(int8) AS SELECT id FROM lb_points "
+              "WHERE nodes && ARRAY[$1]");
+    REQUIRE(conn.exec_prepared("mark", 1).num_tuples() == 0);
+
+    REQUIRE_NOTHROW(conn.exec("ANALYZE lb_points"));
+    REQUIRE(conn.query(PGRES_TUPLES_OK, "SELECT current_catalog")
+                .get_value_as_string(0, 0) == "loopback");
+
+    conn.exec("DROP TABLE lb_points");
+}
+
+TEST_CASE("loopback checksum doesn't depend on row order or chunks", "[NoDB]")
+{
+    pg_conn_t conn{loopback_conninfo};
+
+    conn.exec("CREATE TABLE lb_sum1 (osm_id int8, name text)");
+    conn.exec("CREATE TABLE lb_sum2 (osm_id int8, name text)");
+
+    conn.query(PGRES_COPY_IN, "COPY lb_sum1 FROM STDIN");
+    conn.copy_data("1\tfoo\n2\tbar\n3\tbaz\n", "lb_sum1");
+    conn.end_copy("lb_sum1");
+
+    conn.query(PGRES_COPY_IN, "COPY lb_sum2 FROM STDIN");
+    conn.copy_data("3\tb", "lb_sum2");
+    conn.copy_data("az\n1\tfoo\n2", "lb_sum2");
+    conn.copy_data("\tbar", "lb_sum2");
+    conn.end_copy("lb_sum2");
+
+    auto const &db = get_loopback_db();
+    REQUIRE(db.checksum("lb_sum1") != 0);
+    REQUIRE(db.checksum("lb_sum1") == db.checksum("lb_sum2"));
+
+    conn.query(PGRES_COPY_IN, "COPY lb_sum2 FROM STDIN");
+    conn.copy_data("4\tqux\n", "lb_sum2");
+    conn.end_copy("lb_sum2");
+    REQUIRE(db.checksum("lb_sum1") != db.checksum("lb_sum2"));
+
+    conn.exec("DROP TABLE lb_sum1");
+    conn.exec("DROP TABLE lb_sum2");
+}
@@ -0,0 +1,200 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This file is part of osm2pgsql (https://osm2pgsql.org/).
+ *
+ * Copyright (C) 2006-2021 by the osm2pgsql developer community.
+ * For a full list of authors see the git log.
+ */
+
+#include <catch.hpp>
+
+#include "tagtransform-cached.hpp"
+
+#include "common-buffer.hpp"
+
+#include <memory>
+#include <string>
+
+namespace {
+
+/// Tag transform keeping tags starting with 'k' and counting its calls.
+class counting_tagtransform_t : public tagtransform_t
+{
+public:
+    explicit counting_tagtransform_t(int *calls) : m_calls(calls) {}
+
+    std::unique_ptr<tagtransform_t> clone() const override
+    {
+        return std::make_unique<counting_tagtransform_t>(m_calls);
+    }
+
+    bool filter_tags(osmium::OSMObject const &o, bool *polygon, bool *roads,
+                     taglist_t &out_tags) override
+    {
+        ++*m_calls;
+        for (auto const &tag : o.tags()) {
+            if (tag.key()[0] == 'k') {
+                out_tags.add_tag(tag.key(), tag.value());
+            }
+        }
+        if (polygon) {
+            *polygon = o.tags().has_key("area");
+        }
+        if (roads) {
+            *roads = o.tags().has_key("highway");
+        }
+        return out_tags.empty();
+    }
+
+    bool filter_rel_member_tags(taglist_t const &, osmium::memory::Buffer const &,
+                                rolelist_t const &, bool *, bool *, bool *,
+                                taglist_t &) override
+    {
+        return true;
+    }
+
+private:
+    int *m_calls;
+};
+
+struct result_t
+{
+    bool filter = false;
+    bool polygon = false;
+    bool roads = false;
+    taglist_t tags;
+};
+
+result_t filter_way(tagtransform_t *tt, osmium::Way const &way)
+{
+    result_t r;
+    r.filter = tt->filter_tags(way, &r.polygon, &r.roads, r.tags);
+    return r;
+}
+
+} // anonymous namespace
+
+TEST_CASE("Cached tag transform only calls wrapped transform once per tag set",
+          "[NoDB]")
+{
+    int calls = 0;
+    cached_tagtransform_t tt{std::make_unique<counting_tagtransform_t>(&calls),
+                             100, false};
+
+    test_buffer_t buffer;
+    auto const &way1 = buffer.add_way("w1 Tkey=a,highway=road,area=yes");
+    auto const &way2 = buffer.add_way("w2 Tarea=yes,key=a,highway=road");
+    auto const &way3 = buffer.add_way("w3 Tkey=b,highway=road");
+    auto const &way4 = buffer.add_way("w4 Tfoo=bar");
+
+    auto const r1 = filter_way(&tt, way1);
+    REQUIRE(calls == 1);
+    REQUIRE_FALSE(r1.filter);
+    REQUIRE(r1.polygon);
+    REQUIRE(r1.roads);
+    REQUIRE(r1.tags.size() == 1);
+    REQUIRE(*r1.tags.get("key") == "a");
+
+    // Same tags in different order
+    auto const r2 = filter_way(&tt, way2);
+    REQUIRE(calls == 1);
+    REQUIRE(r2.filter == r1.filter);
+    REQUIRE(r2.polygon == r1.polygon);
+    REQUIRE(r2.roads == r1.roads);
+    REQUIRE(*r2.tags.get("key") == "a");
+
+    auto const r3 = filter_way(&tt, way3);
+    REQUIRE(calls == 2);
+    REQUIRE_FALSE(r3.polygon);
+    REQUIRE(*r3.tags.get("key") == "b");
+
+    auto const r4 = filter_way(&tt, way4);
+    REQUIRE(calls == 3);
+    REQUIRE(r4.filter);
+    REQUIRE(r4.tags.empty());
+
+    filter_way(&tt, way4);
+    REQUIRE(calls == 3);
+    REQUIRE(tt.size() == 3);
+}
+
+TEST_CASE("Cached tag transform distinguishes object types", "[NoDB]")
+{
+    int calls = 0;
+    cached_tagtransform_t tt{std::make_unique<counting_tagtransform_t>(&calls),
+                             100, false};
+
+    test_buffer_t buffer;
+    auto const &node = buffer.add_node("n1 Tkey=a");
+    auto const &way = buffer.add_way("w1 Tkey=a");
+
+    taglist_t tags;
+    tt.filter_tags(node, nullptr, nullptr, tags);
+    tt.filter_tags(way, nullptr, nullptr, tags);
+    REQUIRE(calls == 2);
+
+    // The flags are only known if they were asked for.
+    filter_way(&tt, way);
+    REQUIRE(calls == 3);
+    filter_way(&tt, way);
+    REQUIRE(calls == 3);
+}
+
+TEST_CASE("Cached tag transform does not grow beyond maximum size", "[NoDB]")
+{
+    int calls = 0;
+    cached_tagtransform_t tt{std::make_unique<counting_tagtransform_t>(&calls),
+                             2, false};
+
+    test_buffer_t buffer;
+    auto const &way1 = buffer.add_way("w1 Tkey=1");
+    auto const &way2 = buffer.add_way("w2 Tkey=2");
+    auto const &way3 = buffer.add_way("w3 Tkey=3");
+
+    filter_way(&tt, way1);
+    filter_way(&tt, way2);
+    auto const r3 = filter_way(&tt, way3);
+    REQUIRE(*r3.tags.get("key") == "3");
+    REQUIRE(tt.size() == 2);
+    REQUIRE(calls == 3);
+
+    filter_way(&tt, way1);
+    REQUIRE(calls == 3);
+    filter_way(&tt, way3);
+    REQUIRE(calls == 4);
+}
+
+TEST_CASE("Cached tag transform does not cache objects with attributes",
+          "[NoDB]")
+{
+    int calls = 0;
+    cached_tagtransform_t tt{std::make_unique<counting_tagtransform_t>(&calls),
+                             100, true};
+
+    test_buffer_t buffer;
+    auto const &way1 = buffer.add_way("w1 v1 Tkey=a");
+    auto const &way2 = buffer.add_way("w2 v1 Tkey=a");
+
+    filter_way(&tt, way1);
+    filter_way(&tt, way2);
+    REQUIRE(calls == 2);
+    REQUIRE(tt.size() == 0);
+}
+
+TEST_CASE("Clones of cached tag transform have their own cache", "[NoDB]")
+{
+    int calls = 0;
+    cached_tagtransform_t tt{std::make_unique<counting_tagtransform_t>(&calls),
+                             100, false};
+
+    test_buffer_t buffer;
+    auto const &way = buffer.add_way("w1 Tkey=a");
+
+    filter_way(&tt, way);
+    auto clone = tt.clone();
+    filter_way(clone.get(), way);
+    REQUIRE(calls == 2);
+    filter_way(clone.get(), way);
+    REQUIRE(calls == 2);
+}